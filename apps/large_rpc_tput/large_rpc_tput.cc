@@ -56,9 +56,10 @@ void req_handler(erpc::ReqHandle *req_handle, void *_context) {
   const erpc::MsgBuffer *req_msgbuf = req_handle->get_req_msgbuf();
   uint8_t resp_byte = req_msgbuf->buf[0];
 
-  // Use dynamic response
+  // Use a pooled dynamic response. eRPC returns it to the pool after sending.
   erpc::MsgBuffer &resp_msgbuf = req_handle->dyn_resp_msgbuf;
-  resp_msgbuf = c->rpc->alloc_msg_buffer_or_die(FLAGS_resp_size);
+  resp_msgbuf = c->rpc->alloc_msg_buffer_from_pool(kAppReqType);
+  erpc::rt_assert(resp_msgbuf.buf != nullptr);
 
   // Touch the response
   if (kAppServerMemsetResp) {
@@ -133,6 +134,10 @@ void thread_func(size_t thread_id, app_stats_t *app_stats, erpc::Nexus *nexus) {
 
   c.rpc = &rpc;
 
+  int ret = rpc.create_msg_buffer_pool(kAppReqType, FLAGS_resp_size,
+                                       kAppRespPoolSize);
+  erpc::rt_assert(ret == 0, "Failed to create response pool");
+
   // Create the session. Some threads may not create any sessions, and therefore
   // not run the event loop required for other threads to connect them. This
   // is OK because all threads will run the event loop below.
@@ -11,6 +11,7 @@
 static constexpr size_t kAppReqType = 1;
 static constexpr uint8_t kAppDataByte = 3;  // Data transferred in req & resp
 static constexpr size_t kAppMaxConcurrency = 32;  // Outstanding reqs per thread
+static constexpr size_t kAppRespPoolSize = 64;  // Pooled dynamic responses
 
 // Globals
 volatile sig_atomic_t ctrl_c_pressed = 0;
@@ -36,6 +36,12 @@ static constexpr bool kTesting = false;
 static constexpr bool kTesting = ERPC_TESTING;
 #endif
 
+/// True iff sessions can encrypt and authenticate payloads with AES-GCM
+#ifndef ERPC_CRYPTO
+#define ERPC_CRYPTO false
+#endif
+static constexpr bool kCrypto = ERPC_CRYPTO;
+
 // General constants
 
 /// Array size to hold registered request handler functions
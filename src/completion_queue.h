@@ -0,0 +1,66 @@
+/**
+ * @file completion_queue.h
+ * @brief A user-owned ring of request completions, as an alternative to
+ * continuation callbacks
+ */
+#pragma once
+
+#include "common.h"
+#include "msg_buffer.h"
+#include "util/spsc_queue.h"
+
+namespace erpc {
+
+/// One completed request, as harvested from a CompletionQueue
+struct completion_t {
+  void *tag;               ///< The tag passed to enqueue_request()
+  MsgBuffer *resp_msgbuf;  ///< The response. Zero data size marks an error.
+
+  completion_t() {}
+  completion_t(void *tag, MsgBuffer *resp_msgbuf)
+      : tag(tag), resp_msgbuf(resp_msgbuf) {}
+};
+
+/**
+ * @brief A completion ring that the application passes to
+ * Rpc::enqueue_request() instead of a continuation. eRPC's dispatch thread
+ * produces completions, and any one application thread consumes them in
+ * batches with poll_completions().
+ *
+ * A completion returns ownership of the request and response MsgBuffers to the
+ * application, exactly like a continuation invocation. The same CompletionQueue
+ * can be shared by requests on many sessions, but only with one Rpc.
+ *
+ * If the ring is full, eRPC holds completions internally and retries in later
+ * event loop iterations, so completions are never lost. Completions on a
+ * queue are not ordered by request issue order.
+ */
+class CompletionQueue {
+ public:
+  /// Create a queue that holds at least \p capacity completions
+  explicit CompletionQueue(size_t capacity) : ring(capacity) {}
+
+  /**
+   * @brief Harvest up to \p max completions into \p out. This must be called
+   * by at most one thread at a time.
+   *
+   * @return The number of completions harvested
+   */
+  inline size_t poll_completions(completion_t *out, size_t max) {
+    return ring.pop_burst(out, max);
+  }
+
+  /// Return the approximate number of completions ready for harvesting
+  inline size_t size() const { return ring.size(); }
+
+  /// Return the maximum number of completions the ring can hold
+  inline size_t capacity() const { return ring.capacity(); }
+
+  /// Add a completion. Only eRPC's dispatch thread may call this.
+  inline bool push(const completion_t &c) { return ring.push(c); }
+
+ private:
+  SpscQueue<completion_t> ring;
+};
+
+}  // namespace erpc
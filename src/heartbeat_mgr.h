@@ -1,12 +1,13 @@
 #pragma once
 
-#include <queue>
-#include <sstream>
+#include <algorithm>
+#include <string_view>
 #include <unordered_map>
 #include "common.h"
 #include "rpc_constants.h"
 #include "sm_types.h"
 #include "util/autorun_helpers.h"
+#include "util/logger.h"
 #include "util/timer.h"
 #include "util/udp_client.h"
 
@@ -17,42 +18,72 @@ namespace erpc {
  *
  * This class has two main tasks: First, it sends heartbeat messages to remote
  * processes at fixed intervals. Second, it checks for timeouts, also at fixed
- * intervals. These tasks are scheduled using a time-based priority queue.
+ * intervals. These tasks are scheduled using a hashed timing wheel.
  *
  * For efficiency, if a process has multiple sessions to a remote process,
- * only one instance of the remote URI is tracked.
+ * only one instance of the remote URI is tracked. Remote URIs are interned
+ * into dense peer IDs when they are added, and each peer's heartbeat packet
+ * and address are prepared once, so the per-heartbeat work does not depend on
+ * URI strings. The ID of a peer whose last reference is removed is recycled.
+ * Heartbeats that are due together are sent with one sendmmsg().
+ *
+ * Datapath packets are liveness evidence too. Each Rpc records the time at
+ * which it last received a datapath packet from each peer in an RX timestamp
+ * array from add_rx_source(), and the heartbeat manager takes the latest of
+ * these when it checks a peer. Explicit heartbeats are sent only to peers
+ * that have been idle for a send interval. eRPC answers every datapath packet
+ * (with a response, credit return, or request-for-response), so a peer that
+ * we receive from also receives from us.
  *
  * This heartbeat manager is designed to keep the CPU use of eRPC's management
- * thread close to zero in the steady state. An earlier version of eRPC's
- * timeout detection used a reliable UDP library called ENet, which had
- * non-negligible CPU use.
+ * thread close to zero in the steady state, even with thousands of peers. An
+ * earlier version of eRPC's timeout detection used a reliable UDP library
+ * called ENet, which had non-negligible CPU use.
  */
 class HeartbeatMgr {
  private:
-  static constexpr bool kVerbose = true;
-  enum class EventType : bool {
-    kSend,  // Send a heartbeat to the remote URI
-    kCheck  // Check that we have received a heartbeat from the remote URI
+  static constexpr size_t kWheelSlots = 32;   ///< Timing wheel size
+  static constexpr size_t kSlotsPerSend = 4;  ///< Slots per send interval
+  static_assert(is_power_of_two(kWheelSlots), "");
+
+  enum class EventType : uint8_t {
+    kSend,  // Send a heartbeat to the remote peer
+    kCheck  // Check that we have received a heartbeat from the remote peer
   };
 
-  /// Heartbeat info in the priority queue
-  class Event {
-   public:
+  /// A timing wheel entry. Entries whose generation is older than their peer's
+  /// were scheduled before the peer failed, and are ignored.
+  struct wheel_ent_t {
+    uint32_t peer_id;
+    uint32_t gen;
     EventType type;
-    std::string rem_uri;  // The remote process for receiving/sending heartbeats
-    uint64_t tsc;         // The time at which this event is triggered
 
-    Event(EventType type, const std::string &rem_uri, uint64_t tsc)
-        : type(type), rem_uri(rem_uri), tsc(tsc) {}
+    wheel_ent_t(uint32_t peer_id, uint32_t gen, EventType type)
+        : peer_id(peer_id), gen(gen), type(type) {}
   };
 
-  struct EventComparator {
-    bool operator()(const Event &p1, const Event &p2) {
-      return p1.tsc > p2.tsc;
-    }
+  /// A remote process that is referenced, or a free peer ID
+  struct peer_t {
+    std::string uri;         ///< The remote URI
+    std::string hostname;    ///< The remote hostname, extracted from the URI
+    uint16_t sm_udp_port;    ///< The remote management UDP port
+    const addrinfo *addr;    ///< The resolved remote address
+    SmPkt hb;                ///< The prebuilt heartbeat to this peer
+    size_t last_hb_rx;       ///< Time at which we last heard from the peer
+    uint32_t gen = 0;        ///< Incremented when the peer fails
+    bool tracked = false;    ///< True iff this peer is in the tracking set
+    size_t num_refs = 0;     ///< Number of add_remote() calls not removed
+    size_t last_send_round;  ///< The do_one() call that last sent to the peer
   };
 
  public:
+  /// Maximum number of peers referenced at a time
+  static constexpr size_t kMaxPeers = kMaxHeartbeatPeers;
+
+  /// The peer ID of unknown peers. This is also the index of a spare entry in
+  /// RX timestamp arrays, so that recording RX needn't check for it.
+  static constexpr uint32_t kInvalidPeerId = kMaxPeers;
+
   HeartbeatMgr(std::string hostname, uint16_t sm_udp_port, double freq_ghz,
                size_t machine_failure_timeout_ms)
       : hostname(hostname),
@@ -61,40 +92,127 @@ class HeartbeatMgr {
         creation_tsc(rdtsc()),
         failure_timeout_tsc(ms_to_cycles(machine_failure_timeout_ms, freq_ghz)),
         hb_send_delta_tsc(failure_timeout_tsc / 10),
-        hb_check_delta_tsc(failure_timeout_tsc / 2) {}
+        hb_check_delta_tsc(failure_timeout_tsc / 2),
+        wheel_slot_tsc(hb_send_delta_tsc / kSlotsPerSend),
+        wheel_next_tsc(creation_tsc + wheel_slot_tsc) {
+    rt_assert(hb_check_delta_tsc / wheel_slot_tsc < kWheelSlots,
+              "Heartbeat check interval exceeds the timing wheel");
+  }
+
+  ~HeartbeatMgr() {
+    for (volatile size_t *rx_tsc_arr : rx_sources) delete[] rx_tsc_arr;
+  }
 
-  /// Add a remote URI to the tracking set
-  void unlocked_add_remote(const std::string &remote_uri) {
+  /**
+   * @brief Add a reference to a remote URI, and add it to the tracking set if
+   * it's not tracked
+   *
+   * @return The remote's peer ID, which is the same if the URI is added again
+   * before all its references are removed, or kInvalidPeerId if there are too
+   * many peers. The caller must not use the remote without heartbeats.
+   */
+  uint32_t unlocked_add_remote(const std::string &remote_uri) {
     std::lock_guard<std::mutex> lock(heartbeat_mutex);
-    if (kVerbose) {
-      printf("heartbeat_mgr (%.0f us): Starting tracking URI %s\n",
-             us_since_creation(rdtsc()), remote_uri.c_str());
-    }
 
-    size_t cur_tsc = rdtsc();
+    std::string rem_hostname;
+    uint16_t rem_sm_udp_port;
+    split_uri(remote_uri, rem_hostname, rem_sm_udp_port);
+
+    uint32_t peer_id = lookup_peer(rem_hostname.c_str(), rem_sm_udp_port);
+    if (peer_id == kInvalidPeerId) {
+      if (!free_peer_ids.empty()) {
+        peer_id = free_peer_ids.back();
+        free_peer_ids.pop_back();
+      } else if (peers.size() < kMaxPeers) {
+        peer_id = static_cast<uint32_t>(peers.size());
+        peers.emplace_back();
+      } else {
+        ERPC_WARN("heartbeat_mgr: Too many peers. Not tracking URI %s.\n",
+                  remote_uri.c_str());
+        return kInvalidPeerId;
+      }
 
-    map_last_hb_rx.emplace(remote_uri, cur_tsc);
-    schedule_hb_send(remote_uri);
-    schedule_hb_check(remote_uri);
+      peer_t &peer = peers[peer_id];
+      peer.uri = remote_uri;
+      peer.hostname = rem_hostname;
+      peer.sm_udp_port = rem_sm_udp_port;
+      peer.addr = hb_udp_client.resolve(rem_hostname, rem_sm_udp_port);
+      peer.hb = make_heartbeat(hostname, sm_udp_port, remote_uri);
+      peer.last_send_round = SIZE_MAX;
+      peer_index.emplace(peer_key(rem_hostname.c_str(), rem_sm_udp_port),
+                         peer_id);
+    }
+
+    peer_t &peer = peers[peer_id];
+    peer.num_refs++;
+    if (peer.tracked) return peer_id;
+
+    ERPC_INFO("heartbeat_mgr (%.0f us): Starting tracking URI %s\n",
+              us_since_creation(rdtsc()), remote_uri.c_str());
+    peer.tracked = true;
+    peer.last_hb_rx = rdtsc();
+    schedule(peer_id, EventType::kSend, hb_send_delta_tsc);
+    schedule(peer_id, EventType::kCheck, hb_check_delta_tsc);
+    return peer_id;
   }
 
-  /// Receive a heartbeat
-  void unlocked_receive_hb(const SmPkt &sm_pkt) {
+  /// Drop a reference to a peer. A peer with no references left is not
+  /// tracked, and its ID is recycled.
+  void unlocked_remove_remote(uint32_t peer_id) {
     std::lock_guard<std::mutex> lock(heartbeat_mutex);
-
-    if (map_last_hb_rx.count(sm_pkt.client.uri()) == 0) {
-      if (kVerbose) {
-        printf("heartbeat_mgr (%.0f us): Ignoring heartbeat from URI %s\n",
-               us_since_creation(rdtsc()), sm_pkt.client.uri().c_str());
+    peer_t &peer = peers.at(peer_id);
+    assert(peer.num_refs > 0);
+    peer.num_refs--;
+    if (peer.num_refs > 0) return;
+
+    peer.tracked = false;
+    peer.gen++;  // Cancel the peer's pending events
+
+    // No session records RX at this ID now, so its next owner starts afresh
+    auto range = peer_index.equal_range(
+        peer_key(peer.hostname.c_str(), peer.sm_udp_port));
+    for (auto it = range.first; it != range.second; it++) {
+      if (it->second == peer_id) {
+        peer_index.erase(it);
+        break;
       }
-      return;
     }
+    for (volatile size_t *rx_tsc_arr : rx_sources) rx_tsc_arr[peer_id] = 0;
+    free_peer_ids.push_back(peer_id);
+  }
 
-    if (kVerbose) {
-      printf("heartbeat_mgr (%.0f us): Receiving heartbeat from URI %s\n",
-             us_since_creation(rdtsc()), sm_pkt.client.uri().c_str());
+  /**
+   * @brief Create an RX timestamp array for an Rpc. The Rpc writes the time
+   * at which it receives a datapath packet from a peer at the peer's ID. The
+   * array has kMaxPeers + 1 entries.
+   */
+  volatile size_t *unlocked_add_rx_source() {
+    std::lock_guard<std::mutex> lock(heartbeat_mutex);
+    volatile size_t *rx_tsc_arr = new size_t[kMaxPeers + 1]();
+    rx_sources.push_back(rx_tsc_arr);
+    return rx_tsc_arr;
+  }
+
+  /// Delete an RX timestamp array, keeping its liveness evidence
+  void unlocked_remove_rx_source(volatile size_t *rx_tsc_arr) {
+    std::lock_guard<std::mutex> lock(heartbeat_mutex);
+    for (size_t i = 0; i < peers.size(); i++) {
+      peers[i].last_hb_rx =
+          std::max(peers[i].last_hb_rx, static_cast<size_t>(rx_tsc_arr[i]));
     }
-    map_last_hb_rx.emplace(sm_pkt.client.uri(), rdtsc());
+    rx_sources.erase(
+        std::find(rx_sources.begin(), rx_sources.end(), rx_tsc_arr));
+    delete[] rx_tsc_arr;
+  }
+
+  /// Receive a heartbeat
+  void unlocked_receive_hb(const SmPkt &sm_pkt) {
+    std::lock_guard<std::mutex> lock(heartbeat_mutex);
+
+    uint32_t peer_id =
+        lookup_peer(sm_pkt.client.hostname, sm_pkt.client.sm_udp_port);
+    if (peer_id == kInvalidPeerId || !peers[peer_id].tracked) return;
+    peers[peer_id].last_hb_rx = rdtsc();
   }
 
   /**
@@ -103,68 +221,93 @@ class HeartbeatMgr {
    * @param failed_uris The list of failed remote URIs to fill-in
    */
   void do_one(std::vector<std::string> &failed_uris) {
-    while (true) {
-      if (hb_event_pqueue.empty()) break;
-
-      const auto next_ev = hb_event_pqueue.top();  // Copy-out
+    std::lock_guard<std::mutex> lock(heartbeat_mutex);
+    const size_t cur_tsc = rdtsc();
+    send_round++;
+
+    // Process every slot that is due. When catching up after a long pause,
+    // each peer gets at most one heartbeat.
+    while (wheel_next_tsc <= cur_tsc) {
+      std::vector<wheel_ent_t> &slot = wheel[wheel_slot];
+
+      // Events scheduled below land in other slots, so slot is stable
+      for (const wheel_ent_t &ent : slot) {
+        peer_t &peer = peers[ent.peer_id];
+        if (ent.gen != peer.gen) continue;  // The peer failed since
+
+        switch (ent.type) {
+          case EventType::kSend: {
+            // Skip the heartbeat if datapath packets flowed recently
+            const size_t rx_tsc = datapath_rx_tsc(ent.peer_id);
+            if (rx_tsc <= cur_tsc && cur_tsc - rx_tsc < hb_send_delta_tsc) {
+              stats.hbs_suppressed++;
+            } else if (peer.last_send_round != send_round) {
+              peer.last_send_round = send_round;
+              send_addrs.push_back(peer.addr);
+              send_pkts.push_back(peer.hb);
+            }
+            schedule(ent.peer_id, EventType::kSend, hb_send_delta_tsc);
+            break;
+          }
 
-      // Stop processing the event queue when the top event is in the future
-      if (in_future(next_ev.tsc)) {
-        if (kVerbose) {
-          printf("heartbeat_mgr (%.0f us): Event %s is in the future\n",
-                 us_since_creation(rdtsc()), ev_to_string(next_ev).c_str());
+          case EventType::kCheck: {
+            // Other cores' timestamps may be slightly ahead of cur_tsc
+            const size_t last_rx =
+                std::max(peer.last_hb_rx, datapath_rx_tsc(ent.peer_id));
+            if (cur_tsc > last_rx && cur_tsc - last_rx > failure_timeout_tsc) {
+              ERPC_INFO("heartbeat_mgr (%.0f us): Remote URI %s failed\n",
+                        us_since_creation(cur_tsc), peer.uri.c_str());
+              failed_uris.push_back(peer.uri);
+              peer.tracked = false;
+              peer.gen++;  // Cancel the peer's pending events
+            } else {
+              schedule(ent.peer_id, EventType::kCheck, hb_check_delta_tsc);
+            }
+            break;
+          }
         }
-        break;
       }
 
-      if (map_last_hb_rx.count(next_ev.rem_uri) == 0) {
-        if (kVerbose) {
-          printf(
-              "heartbeat_mgr (%.0f us): Remote URI for event %s is not "
-              "in tracking set. Ignoring.\n",
-              us_since_creation(rdtsc()), ev_to_string(next_ev).c_str());
-        }
-        break;
-      }
+      slot.clear();
+      wheel_slot = (wheel_slot + 1) % kWheelSlots;
+      wheel_next_tsc += wheel_slot_tsc;
+    }
 
-      if (kVerbose) {
-        printf("heartbeat_mgr (%.0f us): Handling event %s\n",
-               us_since_creation(rdtsc()), ev_to_string(next_ev).c_str());
-      }
+    if (!send_pkts.empty()) {
+      hb_udp_client.send_batch(send_addrs.data(), send_pkts.data(),
+                               send_pkts.size());
+      stats.hbs_sent += send_pkts.size();
+      send_addrs.clear();
+      send_pkts.clear();
+    }
+  }
 
-      hb_event_pqueue.pop();  // Consume the event
+  /// Return the heartbeat send interval in cycles. A remote that hears from us
+  /// more often than this skips its heartbeats to us.
+  size_t get_hb_send_delta_tsc() const { return hb_send_delta_tsc; }
 
-      switch (next_ev.type) {
-        case EventType::kSend: {
-          SmPkt heartbeat =
-              make_heartbeat(hostname, sm_udp_port, next_ev.rem_uri);
-          hb_udp_client.send(heartbeat.server.hostname,
-                             heartbeat.server.sm_udp_port, heartbeat);
+  /// Return the period of the heartbeat timing wheel in nanoseconds. do_one()
+  /// should be called about this often.
+  size_t get_wheel_slot_ns() const {
+    return static_cast<size_t>(wheel_slot_tsc / freq_ghz);
+  }
 
-          schedule_hb_send(next_ev.rem_uri);
-          break;
-        }
+  /// Return the number of heartbeats sent
+  size_t get_stat_hbs_sent() const { return stats.hbs_sent; }
 
-        case EventType::kCheck: {
-          size_t last_ping_rx = map_last_hb_rx[next_ev.rem_uri];
-          if (rdtsc() - last_ping_rx > failure_timeout_tsc) {
-            failed_uris.push_back(next_ev.rem_uri);
+  /// Return the number of heartbeats skipped because of datapath traffic
+  size_t get_stat_hbs_suppressed() const { return stats.hbs_suppressed; }
 
-            if (kVerbose) {
-              printf("heartbeat_mgr (%.0f us): Remote URI %s failed\n",
-                     us_since_creation(rdtsc()), next_ev.rem_uri.c_str());
-            }
-            map_last_hb_rx.erase(map_last_hb_rx.find(next_ev.rem_uri));
-          } else {
-            schedule_hb_check(next_ev.rem_uri.c_str());
-          }
-          break;
-        }
-      }
+ private:
+  /// Return the latest datapath RX timestamp of a peer over all Rpcs
+  size_t datapath_rx_tsc(uint32_t peer_id) const {
+    size_t ret = 0;
+    for (volatile size_t *rx_tsc_arr : rx_sources) {
+      ret = std::max(ret, static_cast<size_t>(rx_tsc_arr[peer_id]));
     }
+    return ret;
   }
 
- private:
   // Create a heartbeat packet send by the local URI to the remote URI.
   //
   // A heartbeat packet is a session management packet where most fields are
@@ -192,40 +335,39 @@ class HeartbeatMgr {
     return sm_hb;
   }
 
-  /// Return the microseconds between tsc and this manager's creation time
-  double us_since_creation(size_t tsc) const {
-    return to_usec(tsc - creation_tsc, freq_ghz);
+  /// Return the peer index key for a remote process
+  static size_t peer_key(const char *rem_hostname, uint16_t rem_sm_udp_port) {
+    return std::hash<std::string_view>()(std::string_view(rem_hostname)) ^
+           (static_cast<size_t>(rem_sm_udp_port) << 48);
   }
 
-  /// Return a string representation of a ping event. This is outside the
-  /// Event class because we need creation_tsc.
-  std::string ev_to_string(const Event &e) const {
-    std::ostringstream ret;
-    ret << "[Type: " << (e.type == EventType::kSend ? "send" : "check")
-        << ", URI " << e.rem_uri << ", time "
-        << static_cast<size_t>(us_since_creation(e.tsc)) << " us]";
-    return ret.str();
+  /// Return the ID of a referenced remote process, or kInvalidPeerId. This
+  /// does not allocate.
+  uint32_t lookup_peer(const char *rem_hostname, uint16_t rem_sm_udp_port) {
+    auto range =
+        peer_index.equal_range(peer_key(rem_hostname, rem_sm_udp_port));
+    for (auto it = range.first; it != range.second; it++) {
+      const peer_t &peer = peers[it->second];
+      if (peer.sm_udp_port == rem_sm_udp_port &&
+          peer.hostname == rem_hostname) {
+        return it->second;
+      }
+    }
+    return kInvalidPeerId;
   }
 
-  /// Return true iff a timestamp is in the future
-  static bool in_future(size_t tsc) { return tsc > rdtsc(); }
-
-  void schedule_hb_send(const std::string &rem_uri) {
-    Event e(EventType::kSend, rem_uri, rdtsc() + hb_send_delta_tsc);
-    if (kVerbose) {
-      printf("heartbeat_mgr (%.0f us): Scheduling event %s\n",
-             us_since_creation(rdtsc()), ev_to_string(e).c_str());
-    }
-    hb_event_pqueue.push(e);
+  /// Schedule an event for a peer at least \p delta_tsc cycles after the
+  /// current wheel slot
+  void schedule(uint32_t peer_id, EventType type, size_t delta_tsc) {
+    const size_t num_slots = std::max(1ul, delta_tsc / wheel_slot_tsc);
+    assert(num_slots < kWheelSlots);
+    wheel[(wheel_slot + num_slots) % kWheelSlots].emplace_back(
+        peer_id, peers[peer_id].gen, type);
   }
 
-  void schedule_hb_check(const std::string &rem_uri) {
-    Event e(EventType::kCheck, rem_uri, rdtsc() + hb_check_delta_tsc);
-    if (kVerbose) {
-      printf("heartbeat_mgr (%.0f us): Scheduling event %s\n",
-             us_since_creation(rdtsc()), ev_to_string(e).c_str());
-    }
-    hb_event_pqueue.push(e);
+  /// Return the microseconds between tsc and this manager's creation time
+  double us_since_creation(size_t tsc) const {
+    return to_usec(tsc - creation_tsc, freq_ghz);
   }
 
   const std::string hostname;  /// This process's local hostname
@@ -243,20 +385,36 @@ class HeartbeatMgr {
   /// is around half of the failure timeout #nyquist.
   const size_t hb_check_delta_tsc;
 
-  std::priority_queue<Event, std::vector<Event>, EventComparator>
-      hb_event_pqueue;
+  /// The timing wheel. A slot spans a fraction of the send interval, and the
+  /// wheel spans more than the check interval, so events never wrap around.
+  const size_t wheel_slot_tsc;
+  std::vector<wheel_ent_t> wheel[kWheelSlots];
+  size_t wheel_slot = 0;  ///< The next slot to process
+  size_t wheel_next_tsc;  ///< Time at which wheel_slot is due
+  size_t send_round = 0;  ///< Number of do_one() calls
 
-  // This map servers two purposes:
-  //
-  // 1. Its value for a remote URI is the timestamp when we last received a
-  //    heartbeat from the remote URI.
-  // 2. The set of remote URIs in the map is our remote tracking set. Since we
-  //    cannot delete efficiently from the event priority queue, events for
-  //    remote URIs not in this map are ignored when they are dequeued.
-  std::unordered_map<std::string, uint64_t> map_last_hb_rx;
+  /// All peers, indexed by peer ID. Failed peers keep their IDs until their
+  /// last reference is removed.
+  std::vector<peer_t> peers;
+  std::vector<uint32_t> free_peer_ids;  ///< IDs of peers with no references
+
+  /// Map from a hash of a peer's hostname and UDP port to its peer ID
+  std::unordered_multimap<size_t, uint32_t> peer_index;
+
+  /// The RX timestamp arrays of all Rpcs
+  std::vector<volatile size_t *> rx_sources;
+
+  struct {
+    size_t hbs_sent = 0;        ///< Heartbeats sent
+    size_t hbs_suppressed = 0;  ///< Heartbeats skipped for datapath traffic
+  } stats;
+
+  // Heartbeats due in this do_one() call, reused across calls
+  std::vector<const addrinfo *> send_addrs;
+  std::vector<SmPkt> send_pkts;
 
   UDPClient<SmPkt> hb_udp_client;
 
   std::mutex heartbeat_mutex;  // Protects this heartbeat manager
 };
-}
+}  // namespace erpc
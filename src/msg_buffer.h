@@ -16,7 +16,8 @@ class Rpc;
 /**
  * @brief Applications store request and response messages in hugepage-backed
  * buffers called message buffers. These buffers are registered with the NIC,
- * allowing fast zero-copy transmission.
+ * allowing fast zero-copy transmission. Response and received-request
+ * MsgBuffers may instead be placed in trusted memory (see MemPlacement).
  *
  * A message buffer is allocated using Rpc::alloc_msg_buffer. Only its maximum
  * size is specified during allocation. Later, users can resize the message
@@ -6,9 +6,13 @@
 #include "heartbeat_mgr.h"
 #include "session.h"
 #include "sm_types.h"
+#include "transport.h"
+#include "util/aes_gcm.h"
 #include "util/logger.h"
 #include "util/mt_queue.h"
+#include "util/spsc_queue.h"
 #include "util/tls_registry.h"
+#include "util/tsc_publisher.h"
 
 namespace erpc {
 
@@ -16,6 +20,8 @@ namespace erpc {
 template <typename T>
 class Rpc;
 
+class HugeArena;
+
 /**
  * @brief A per-process library object used for initializing eRPC
  */
@@ -51,6 +57,72 @@ class Nexus {
   int register_req_func(uint8_t req_type, erpc_req_func_t req_func,
                         ReqFuncType req_func_type = ReqFuncType::kForeground);
 
+  /**
+   * @brief Make Rpcs on the same physical port allocate message buffers from
+   * one shared hugepage arena, registered once with the device, instead of
+   * from per-Rpc hugepages. Each Rpc caches arena memory in small per-thread
+   * magazines. This must be done before any Rpc registers with the Nexus, and
+   * it has no effect for transports that cannot share memory registrations.
+   *
+   * @return 0 on success, negative errno on failure.
+   */
+  int enable_shared_huge_arena();
+
+  /**
+   * @brief Back Rpcs' private hugepage regions with named files in the
+   * hugetlbfs mount \p hugetlbfs_dir, so that their memory survives a process
+   * restart. An Rpc with the same management UDP port and Rpc ID in a later
+   * process maps the existing memory instead of faulting in fresh zeroed
+   * hugepages. Memory registrations are redone. This must be done before any
+   * Rpc registers with the Nexus.
+   *
+   * @return 0 on success, negative errno on failure.
+   */
+  int enable_persistent_hugepages(std::string hugetlbfs_dir);
+
+  /**
+   * @brief Carry session management packets over the Rpcs' datapath transport
+   * instead of kernel UDP sockets where possible. The first handshake between
+   * two Rpcs still uses UDP, and teaches each side the other's routing info.
+   * Later connect and disconnect packets between them, and heartbeats for
+   * their sessions, use the datapath. Remote processes that don't enable this
+   * keep using UDP. Each session reserves kDpSmCredits RX ring entries for
+   * these packets. This must be done before any Rpc registers with the Nexus.
+   *
+   * @return 0 on success, negative errno on failure.
+   */
+  int enable_datapath_sm();
+
+  /**
+   * @brief Set the pre-shared AES-128 master key for encrypted sessions. The
+   * client and server processes of an encrypted session must set the same
+   * key. Each session's key is derived from it and from random nonces chosen
+   * by both ends at connect time. This must be done before any Rpc registers
+   * with the Nexus.
+   *
+   * @return 0 on success, negative errno on failure, e.g., -ENOTSUP if eRPC
+   * was compiled without crypto support.
+   */
+  int set_aead_key(const uint8_t *key, size_t key_len);
+
+  /**
+   * @brief Return the AEAD context for a session with the client's connect
+   * token \p uniq_token and the server's nonce \p srv_nonce, or nullptr if no
+   * AEAD key is set. The caller owns it.
+   */
+  AesGcm *new_session_aead(conn_req_uniq_token_t uniq_token,
+                           uint64_t srv_nonce) const;
+
+  /**
+   * @brief Fill in the tag of \p sm_pkt, a successful connect response for a
+   * protected session. The tag covers the response's token, server nonce, and
+   * server endpoint, under a key derived like the session key.
+   */
+  void sign_connect_resp(SmPkt *sm_pkt) const;
+
+  /// Return true iff \p sm_pkt carries a valid tag from sign_connect_resp()
+  bool verify_connect_resp(const SmPkt &sm_pkt) const;
+
  private:
   enum class BgWorkItemType : bool { kReq, kResp };
 
@@ -101,9 +173,9 @@ class Nexus {
     /// Background thread request queues, installed by the Nexus
     MtQueue<BgWorkItem> *bg_req_queue_arr[kMaxBgThreads] = {nullptr};
 
-    /// The Rpc thread's session management RX queue, installed by the Rpc.
-    /// Work items from the SM thread for this Rpc are queued here.
-    MtQueue<SmWorkItem> sm_rx_queue;
+    /// The Rpc thread's session management RX ring. The SM thread produces
+    /// packets for this Rpc, and the Rpc thread consumes them.
+    SpscQueue<SmPkt> sm_rx_queue{kSmRxQueueSize};
   };
 
   /// Check if a hook with for rpc_id exists in this Nexus. The caller must not
@@ -116,6 +188,18 @@ class Nexus {
   /// Unregister a previously registered session management hook
   void unregister_hook(Hook *hook);
 
+  /**
+   * @brief Get a reference to the shared hugepage arena for \p phy_port,
+   * creating it with the given registration functions if needed
+   */
+  HugeArena *acquire_huge_arena(uint8_t phy_port,
+                                Transport::reg_mr_func_t reg_mr_func,
+                                Transport::dereg_mr_func_t dereg_mr_func);
+
+  /// Drop a reference to the shared hugepage arena for \p phy_port. The arena
+  /// is deleted, deregistering its memory, with its last reference.
+  void release_huge_arena(uint8_t phy_port);
+
   /// Background thread context
   class BgThreadCtx {
    public:
@@ -155,6 +239,10 @@ class Nexus {
   /// The session management thread
   static void sm_thread_func(SmThreadCtx ctx);
 
+  /// Publishes the TSC if kPublishedTsc is set. This is constructed first
+  /// and destroyed last, so it outlives all other users of rdtsc().
+  TscPublisher tsc_publisher;
+
   /// Read-mostly members exposed to Rpc threads
   const double freq_ghz;        ///< TSC frequncy
   const std::string hostname;   ///< The local host
@@ -175,6 +263,25 @@ class Nexus {
   Hook *reg_hooks_arr[kMaxRpcId + 1] = {nullptr};
   std::mutex reg_hooks_lock;  ///< Lock for concurrent access to the hooks array
 
+  /// Shared hugepage arenas. An arena lives while any Rpc on its port does,
+  /// because its memory is registered with the port's shared device context.
+  bool shared_huge_arena_enabled = false;
+  struct {
+    HugeArena *arena = nullptr;
+    size_t refcount = 0;
+  } huge_arenas[kMaxPhyPorts];
+  std::mutex huge_arenas_lock;  ///< Lock for the shared hugepage arenas
+
+  /// The hugetlbfs directory for persistent hugepage regions, or empty
+  std::string persistent_huge_dir;
+
+  /// Rpcs carry session management packets over the datapath when possible
+  bool datapath_sm_enabled = false;
+
+  /// The master key for encrypted sessions, valid if aead_key_set is true
+  uint8_t aead_key[AesGcm::kKeySize];
+  bool aead_key_set = false;
+
   HeartbeatMgr heartbeat_mgr;  ///< The heartbeat manager
   volatile bool kill_switch;   ///< Used to turn off SM and background threads
 
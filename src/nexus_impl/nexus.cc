@@ -1,10 +1,13 @@
 #include "nexus.h"
+#include <linux/magic.h>
+#include <sys/vfs.h>
 #include <algorithm>
 #include "common.h"
 #include "rpc.h"
 #include "transport_impl/eth_common.h"
 #include "util/autorun_helpers.h"
 #include "util/barrier.h"
+#include "util/huge_arena.h"
 #include "util/numautils.h"
 
 namespace erpc {
@@ -158,4 +161,182 @@ int Nexus::register_req_func(uint8_t req_type, erpc_req_func_t req_func,
   arr_req_func = ReqFunc(req_func, req_func_type);
   return 0;
 }
+
+int Nexus::enable_shared_huge_arena() {
+  // Rpcs that already exist use private hugepages
+  if (!req_func_registration_allowed) {
+    ERPC_WARN("eRPC Nexus: Enable the shared arena before creating Rpcs.\n");
+    return -EPERM;
+  }
+
+  shared_huge_arena_enabled = true;
+  return 0;
+}
+
+int Nexus::enable_persistent_hugepages(std::string hugetlbfs_dir) {
+  if (!req_func_registration_allowed) {
+    ERPC_WARN("eRPC Nexus: Enable persistent hugepages before Rpcs.\n");
+    return -EPERM;
+  }
+
+  // Files elsewhere would be backed by 4 KB pages, or not shared across
+  // processes
+  struct statfs fs_stat;
+  if (statfs(hugetlbfs_dir.c_str(), &fs_stat) != 0 ||
+      static_cast<unsigned long>(fs_stat.f_type) != HUGETLBFS_MAGIC ||
+      static_cast<size_t>(fs_stat.f_bsize) != kHugepageSize) {
+    ERPC_WARN("eRPC Nexus: %s is not a hugetlbfs mount with %zu MB pages.\n",
+              hugetlbfs_dir.c_str(), kHugepageSize / MB(1));
+    return -EINVAL;
+  }
+
+  persistent_huge_dir = hugetlbfs_dir;
+  return 0;
+}
+
+int Nexus::enable_datapath_sm() {
+  // Existing Rpcs have already advertised their endpoints without it
+  if (!req_func_registration_allowed) {
+    ERPC_WARN("eRPC Nexus: Enable datapath SM before creating Rpcs.\n");
+    return -EPERM;
+  }
+
+  datapath_sm_enabled = true;
+  return 0;
+}
+
+int Nexus::set_aead_key(const uint8_t *key, size_t key_len) {
+  if (!kCrypto) {
+    ERPC_WARN("eRPC Nexus: AEAD key set, but compiled without crypto.\n");
+    return -ENOTSUP;
+  }
+
+  if (key_len != AesGcm::kKeySize) {
+    ERPC_WARN("eRPC Nexus: Invalid AEAD key length %zu.\n", key_len);
+    return -EINVAL;
+  }
+
+  // Existing Rpcs may have already connected sessions
+  if (!req_func_registration_allowed) {
+    ERPC_WARN("eRPC Nexus: Set the AEAD key before creating Rpcs.\n");
+    return -EPERM;
+  }
+
+  memcpy(aead_key, key, AesGcm::kKeySize);
+  aead_key_set = true;
+  return 0;
+}
+
+// A protected session's keys are derived in two steps: the master key and the
+// client's token give an intermediate key, which together with the server's
+// nonce gives the session key and the connect response key. A replayed connect
+// request therefore yields fresh keys, so GCM nonces are never reused across
+// sessions and old data packets don't authenticate in new sessions.
+static constexpr uint32_t kSessionKeyLabel = 1;
+static constexpr uint32_t kConnectRespKeyLabel = 2;
+
+/// Derive the key with \p label of the protected session with \p uniq_token
+/// and \p srv_nonce
+static void derive_session_key(const uint8_t *master_key,
+                               conn_req_uniq_token_t uniq_token,
+                               uint64_t srv_nonce, uint32_t label,
+                               uint8_t *out) {
+  uint8_t token_key[AesGcm::kKeySize];
+  AesGcm::derive_key(master_key, uniq_token, 0, token_key);
+  AesGcm::derive_key(token_key, srv_nonce, label, out);
+}
+
+/// Fill in the key and the authenticated data of connect response \p sm_pkt
+static void connect_resp_auth(const uint8_t *master_key, const SmPkt &sm_pkt,
+                              uint8_t *resp_key, std::vector<uint8_t> &data) {
+  derive_session_key(master_key, sm_pkt.uniq_token, sm_pkt.srv_nonce,
+                     kConnectRespKeyLabel, resp_key);
+
+  // Cover fields one by one, since the packet's padding isn't reliably
+  // copied. Duplicate responses from the server share all these fields, so
+  // the key is never used with the same nonce for different data.
+  auto append = [&data](const void *field, size_t size) {
+    auto *bytes = static_cast<const uint8_t *>(field);
+    data.insert(data.end(), bytes, bytes + size);
+  };
+
+  const SessionEndpoint &srv = sm_pkt.server;
+  append(&sm_pkt.pkt_type, sizeof(sm_pkt.pkt_type));
+  append(&sm_pkt.err_type, sizeof(sm_pkt.err_type));
+  append(&sm_pkt.uniq_token, sizeof(sm_pkt.uniq_token));
+  append(&sm_pkt.srv_nonce, sizeof(sm_pkt.srv_nonce));
+  append(&srv.transport_type, sizeof(srv.transport_type));
+  append(srv.hostname, sizeof(srv.hostname));
+  append(&srv.sm_udp_port, sizeof(srv.sm_udp_port));
+  append(&srv.rpc_id, sizeof(srv.rpc_id));
+  append(&srv.session_num, sizeof(srv.session_num));
+  append(&srv.routing_info, sizeof(srv.routing_info));
+  append(&srv.datapath_sm, sizeof(srv.datapath_sm));
+  append(&srv.crypto, sizeof(srv.crypto));
+}
+
+/// The connect response key is used once, so its nonce is fixed
+static constexpr uint8_t kConnectRespNonce[AesGcm::kNonceSize] = {0};
+static_assert(kSmPktTagSize == AesGcm::kTagSize, "");
+
+AesGcm *Nexus::new_session_aead(conn_req_uniq_token_t uniq_token,
+                                uint64_t srv_nonce) const {
+  if (!aead_key_set) return nullptr;
+
+  uint8_t session_key[AesGcm::kKeySize];
+  derive_session_key(aead_key, uniq_token, srv_nonce, kSessionKeyLabel,
+                     session_key);
+  return new AesGcm(session_key);
+}
+
+void Nexus::sign_connect_resp(SmPkt *sm_pkt) const {
+  assert(aead_key_set && sm_pkt->pkt_type == SmPktType::kConnectResp);
+  uint8_t resp_key[AesGcm::kKeySize];
+  std::vector<uint8_t> data;
+  connect_resp_auth(aead_key, *sm_pkt, resp_key, data);
+  AesGcm(resp_key).mac(data.data(), data.size(), kConnectRespNonce,
+                       sm_pkt->auth_tag);
+}
+
+bool Nexus::verify_connect_resp(const SmPkt &sm_pkt) const {
+  if (!aead_key_set || sm_pkt.pkt_type != SmPktType::kConnectResp) {
+    return false;
+  }
+
+  uint8_t resp_key[AesGcm::kKeySize];
+  std::vector<uint8_t> data;
+  connect_resp_auth(aead_key, sm_pkt, resp_key, data);
+  return AesGcm(resp_key).verify(data.data(), data.size(), kConnectRespNonce,
+                                 sm_pkt.auth_tag);
+}
+
+HugeArena *Nexus::acquire_huge_arena(uint8_t phy_port,
+                                     Transport::reg_mr_func_t reg_mr_func,
+                                     Transport::dereg_mr_func_t dereg_mr_func) {
+  assert(phy_port < kMaxPhyPorts);
+  std::lock_guard<std::mutex> lock(huge_arenas_lock);
+
+  auto &huge_arena = huge_arenas[phy_port];
+  if (huge_arena.refcount == 0) {
+    ERPC_INFO("eRPC Nexus: Creating shared hugepage arena for port %u.\n",
+              phy_port);
+    huge_arena.arena = new HugeArena(numa_node, reg_mr_func, dereg_mr_func);
+  }
+
+  huge_arena.refcount++;
+  return huge_arena.arena;
+}
+
+void Nexus::release_huge_arena(uint8_t phy_port) {
+  assert(phy_port < kMaxPhyPorts);
+  std::lock_guard<std::mutex> lock(huge_arenas_lock);
+
+  auto &huge_arena = huge_arenas[phy_port];
+  assert(huge_arena.refcount > 0);
+  huge_arena.refcount--;
+  if (huge_arena.refcount == 0) {
+    delete huge_arena.arena;
+    huge_arena.arena = nullptr;
+  }
+}
 }  // namespace erpc
@@ -1,4 +1,8 @@
 #include "nexus.h"
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <map>
+#include <vector>
 #include "util/udp_client.h"
 #include "util/udp_server.h"
 
@@ -8,59 +12,159 @@ namespace erpc {
 static constexpr size_t kSmThreadRxBlockMs = 20;
 static constexpr size_t kUDPBufferSz = MB(4);
 
+/// Maximum number of datagrams received with one recvmmsg() call
+static constexpr size_t kSmRxBurst = 16;
+
 void Nexus::sm_thread_func(SmThreadCtx ctx) {
   UDPServer<SmPkt> udp_server(ctx.sm_udp_port, kSmThreadRxBlockMs,
                               kUDPBufferSz);
   UDPClient<SmPkt> udp_client;
 
-  // This is not a busy loop because of recv_blocking()
+  // Wait for management packets and heartbeat wheel ticks in one epoll set
+  const int epoll_fd = epoll_create1(0);
+  const int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  rt_assert(epoll_fd >= 0 && timer_fd >= 0, "eRPC Nexus: SM thread fds");
+
+  const size_t tick_ns = ctx.heartbeat_mgr->get_wheel_slot_ns();
+  struct itimerspec tick;
+  tick.it_interval.tv_sec = static_cast<time_t>(tick_ns / 1000000000);
+  tick.it_interval.tv_nsec = static_cast<long>(tick_ns % 1000000000);
+  tick.it_value = tick.it_interval;
+  rt_assert(timerfd_settime(timer_fd, 0, &tick, nullptr) == 0,
+            "eRPC Nexus: Failed to arm heartbeat timer");
+
+  for (int fd : {udp_server.get_fd(), timer_fd}) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    rt_assert(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0,
+              "eRPC Nexus: Failed to add fd to SM epoll set");
+  }
+
+  std::vector<SmPkt> rx_pkts(kSmRxBurst * kMaxSmPktBatch);
+  size_t rx_sizes[kSmRxBurst];
+  std::vector<std::string> failed_uris;
+
+  // Packets for Rpcs whose SM RX ring was full, in order, and their count
+  std::vector<SmPkt> backlog[kMaxRpcId + 1];
+  size_t backlog_size = 0;
+
+  // Error responses to send after the current RX burst, per remote Nexus
+  std::map<std::pair<std::string, uint16_t>, std::vector<SmPkt>> err_resps;
+
+  // Queue a packet for its target Rpc. Caller must hold the hooks lock.
+  auto deliver = [&](uint8_t rpc_id, const SmPkt &sm_pkt) {
+    Hook *hook = const_cast<Hook *>(ctx.reg_hooks_arr[rpc_id]);
+    if (!backlog[rpc_id].empty() || !hook->sm_rx_queue.push(sm_pkt)) {
+      backlog[rpc_id].push_back(sm_pkt);
+      backlog_size++;
+    }
+  };
+
   while (*ctx.kill_switch == false) {
-    SmPkt sm_pkt;
-    ssize_t ret = udp_server.recv_blocking(sm_pkt);
+    struct epoll_event events[2];
+    const int num_events = epoll_wait(
+        epoll_fd, events, 2, backlog_size > 0 ? 1 : kSmThreadRxBlockMs);
 
-    if (ret >= 0) {
-      rt_assert(static_cast<size_t>(ret) == sizeof(sm_pkt),
-                "eRPC Nexus: Invalid SM packet RX size.");
+    for (int e = 0; e < num_events; e++) {
+      if (events[e].data.fd == timer_fd) {
+        uint64_t num_ticks;
+        if (read(timer_fd, &num_ticks, sizeof(num_ticks)) < 0) continue;
 
-      ERPC_INFO("eRPC Nexus: Received SM packet %s\n",
-                sm_pkt.to_string().c_str());
+        // Send heartbeats to idle peers, and check for failed peers
+        ctx.heartbeat_mgr->do_one(failed_uris);
+        for (const std::string &uri : failed_uris) {
+          ERPC_WARN("eRPC Nexus: Remote process %s failed.\n", uri.c_str());
+        }
+        failed_uris.clear();
+        continue;
+      }
 
-      uint8_t target_rpc_id =
-          sm_pkt.is_req() ? sm_pkt.server.rpc_id : sm_pkt.client.rpc_id;
+      // Drain the socket in bursts of datagrams
+      while (true) {
+        const size_t num_dgrams = udp_server.recv_burst(
+            rx_pkts.data(), kMaxSmPktBatch, kSmRxBurst, rx_sizes);
+        if (num_dgrams == 0) break;
 
-      // Lock the Nexus to prevent Rpc registration while we lookup the hook
-      ctx.reg_hooks_lock->lock();
-      Hook *target_hook = const_cast<Hook *>(ctx.reg_hooks_arr[target_rpc_id]);
-
-      if (target_hook != nullptr) {
-        target_hook->sm_rx_queue.unlocked_push(
-            SmWorkItem(target_rpc_id, sm_pkt));
-      } else {
-        // We don't have an Rpc object for the target Rpc. Send an error
-        // response iff it's a request packet.
-        if (sm_pkt.is_req()) {
-          ERPC_INFO(
-              "eRPC Nexus: Received session management request for invalid "
-              "Rpc %u from %s. Sending response.\n",
-              target_rpc_id, sm_pkt.client.name().c_str());
-
-          const SmPkt resp_sm_pkt =
-              sm_construct_resp(sm_pkt, SmErrType::kInvalidRemoteRpcId);
-
-          udp_client.send(resp_sm_pkt.client.hostname,
-                          resp_sm_pkt.client.sm_udp_port, resp_sm_pkt);
-        } else {
-          ERPC_INFO(
-              "eRPC Nexus: Received session management response for invalid "
-              "Rpc %u from %s. Dropping.\n",
-              target_rpc_id, sm_pkt.client.name().c_str());
+        // Lock the Nexus to prevent Rpc registration while we lookup hooks
+        ctx.reg_hooks_lock->lock();
+        for (size_t d = 0; d < num_dgrams; d++) {
+          rt_assert(rx_sizes[d] > 0 && rx_sizes[d] % sizeof(SmPkt) == 0,
+                    "eRPC Nexus: Invalid SM packet RX size.");
+          const SmPkt *dgram = &rx_pkts[d * kMaxSmPktBatch];
+
+          for (size_t i = 0; i < rx_sizes[d] / sizeof(SmPkt); i++) {
+            const SmPkt &sm_pkt = dgram[i];
+            if (sm_pkt.pkt_type == SmPktType::kPingReq) {
+              ctx.heartbeat_mgr->unlocked_receive_hb(sm_pkt);
+              continue;
+            }
+
+            ERPC_INFO("eRPC Nexus: Received SM packet %s\n",
+                      sm_pkt.to_string().c_str());
+
+            uint8_t target_rpc_id =
+                sm_pkt.is_req() ? sm_pkt.server.rpc_id : sm_pkt.client.rpc_id;
+
+            if (ctx.reg_hooks_arr[target_rpc_id] != nullptr) {
+              deliver(target_rpc_id, sm_pkt);
+            } else if (sm_pkt.is_req()) {
+              // We don't have an Rpc object for the target Rpc. Send an error
+              // response iff it's a request packet.
+              ERPC_INFO(
+                  "eRPC Nexus: Received session management request for "
+                  "invalid Rpc %u from %s. Sending response.\n",
+                  target_rpc_id, sm_pkt.client.name().c_str());
+              err_resps[std::make_pair(std::string(sm_pkt.client.hostname),
+                                       sm_pkt.client.sm_udp_port)]
+                  .push_back(sm_construct_resp(
+                      sm_pkt, SmErrType::kInvalidRemoteRpcId));
+            } else {
+              ERPC_INFO(
+                  "eRPC Nexus: Received session management response for "
+                  "invalid Rpc %u from %s. Dropping.\n",
+                  target_rpc_id, sm_pkt.client.name().c_str());
+            }
+          }
         }
+        ctx.reg_hooks_lock->unlock();
+
+        if (num_dgrams < kSmRxBurst) break;
       }
+    }
 
+    // Retry backlogged packets. Packets for Rpcs that are gone are dropped.
+    if (backlog_size > 0) {
+      ctx.reg_hooks_lock->lock();
+      for (size_t rpc_id = 0; rpc_id <= kMaxRpcId; rpc_id++) {
+        std::vector<SmPkt> &pkts = backlog[rpc_id];
+        if (pkts.empty()) continue;
+
+        Hook *hook = const_cast<Hook *>(ctx.reg_hooks_arr[rpc_id]);
+        size_t num_done = 0;
+        while (num_done < pkts.size() &&
+               (hook == nullptr || hook->sm_rx_queue.push(pkts[num_done]))) {
+          num_done++;
+        }
+        pkts.erase(pkts.begin(), pkts.begin() + static_cast<ssize_t>(num_done));
+        backlog_size -= num_done;
+      }
       ctx.reg_hooks_lock->unlock();
     }
+
+    // Coalesce error responses per remote Nexus
+    for (auto &kv : err_resps) {
+      const std::vector<SmPkt> &resps = kv.second;
+      for (size_t i = 0; i < resps.size(); i += kMaxSmPktBatch) {
+        udp_client.send(kv.first.first, kv.first.second, &resps[i],
+                        std::min(kMaxSmPktBatch, resps.size() - i));
+      }
+    }
+    err_resps.clear();
   }
 
+  close(timer_fd);
+  close(epoll_fd);
   ERPC_INFO("eRPC Nexus: Session management thread exiting.\n");
   return;
 }
@@ -31,6 +31,16 @@ static constexpr size_t kPktHdrMagic = 11;  ///< Magic number for packet headers
 static_assert(kPktHdrMagicBits == 4, "");  // Just to keep track
 static_assert(kPktHdrMagic < (1ull << kPktHdrMagicBits), "");
 
+/// Byte offsets in the 16-byte eRPC header (i.e., at pkthdr_t::ehdrptr()).
+/// The batched RX path uses these to classify packets with SIMD byte compares
+/// instead of bitfield accesses. util_tests/misc_test checks them.
+static constexpr size_t kEhdrSize = 16;
+static constexpr size_t kEhdrPktTypeByte = 8;  ///< pkt_type is in bits 0--1
+static constexpr size_t kEhdrMagicByte = 15;   ///< magic is in bits 4--7
+
+/// Size of the AES-GCM tag that follows the eRPC header in crypto builds
+static constexpr size_t kAeadTagSize = kCrypto ? 16 : 0;
+
 /// These packet types are stored as bitfields in the packet header, so don't
 /// use an enum class here to avoid casting all over the place.
 enum PktType : uint64_t {
@@ -64,6 +74,11 @@ struct pkthdr_t {
   uint64_t req_num : kReqNumBits;
   uint64_t magic : kPktHdrMagicBits;  ///< Magic from alloc_msg_buffer()
 
+#if ERPC_CRYPTO
+  /// Tag over the payload and eRPC header, for sessions with AEAD enabled
+  uint8_t aead_tag[kAeadTagSize];
+#endif
+
   /// Fill in packet header fields
   void format(uint64_t _req_type, uint64_t _msg_size,
               uint64_t _dest_session_num, uint64_t _pkt_type, uint64_t _pkt_num,
@@ -123,6 +138,14 @@ struct pkthdr_t {
     return reinterpret_cast<const uint8_t *>(this) + kHeadroom;
   }
 
+  /// Return a pointer to the AES-GCM tag, valid only if kCrypto is true
+  inline uint8_t *get_aead_tag() { return ehdrptr() + kEhdrSize; }
+
+  /// Return the eRPC fields of the header that AES-GCM authenticates, i.e.,
+  /// the eRPC header excluding the last two bytes of the transport headroom.
+  /// The headroom is filled by the transport after sealing.
+  inline const uint8_t *get_aead_aad() const { return ehdrptr() + 2; }
+
   inline bool check_magic() const { return magic == kPktHdrMagic; }
 
   inline bool is_req() const { return pkt_type == kPktTypeReq; }
@@ -133,4 +156,6 @@ struct pkthdr_t {
 } __attribute__((packed));
 
 static_assert(sizeof(pkthdr_t) % sizeof(size_t) == 0, "");
+static_assert(sizeof(pkthdr_t) - kHeadroom == kEhdrSize + kAeadTagSize, "");
+static constexpr size_t kAeadAadSize = kEhdrSize - 2;  ///< See get_aead_aad()
 }  // namespace erpc
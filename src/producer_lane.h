@@ -0,0 +1,85 @@
+/**
+ * @file producer_lane.h
+ * @brief A lock-free request submission lane for one application thread
+ */
+#pragma once
+
+#include <atomic>
+
+#include "common.h"
+#include "completion_queue.h"
+#include "session.h"
+#include "util/spsc_queue.h"
+
+namespace erpc {
+
+// Forward declaration for friendship
+template <typename T>
+class Rpc;
+
+/**
+ * @brief A lock-free lane through which one application thread submits
+ * requests to an Rpc it does not own. Lanes are created with
+ * Rpc::create_producer_lane() and owned by the Rpc.
+ *
+ * The producer thread need not be the Rpc's creator or an eRPC background
+ * thread. Submitting a request only writes to the lane's SPSC ring and rings
+ * the Rpc's doorbell; the Rpc's event loop drains all lanes when the doorbell
+ * is set. Completions are delivered either by invoking a continuation in the
+ * Rpc's dispatch thread, or to a CompletionQueue that the producer polls.
+ * The producer may allocate and free its MsgBuffers through the Rpc.
+ */
+class ProducerLane {
+  friend class Rpc<CTransport>;
+
+ public:
+  /**
+   * @brief Submit a request whose continuation runs in the Rpc's dispatch
+   * thread. The arguments are the same as Rpc::enqueue_request().
+   *
+   * @return True on success, false if the lane is full
+   */
+  inline bool enqueue_request(int session_num, uint8_t req_type,
+                              MsgBuffer *req_msgbuf, MsgBuffer *resp_msgbuf,
+                              erpc_cont_func_t cont_func, void *tag) {
+    return submit(enq_req_args_t(session_num, req_type, req_msgbuf,
+                                 resp_msgbuf, cont_func, tag, kInvalidBgETid));
+  }
+
+  /**
+   * @brief Submit a request whose completion is delivered to \p comp_queue.
+   * The arguments are the same as Rpc::enqueue_request().
+   *
+   * @return True on success, false if the lane is full
+   */
+  inline bool enqueue_request(int session_num, uint8_t req_type,
+                              MsgBuffer *req_msgbuf, MsgBuffer *resp_msgbuf,
+                              CompletionQueue *comp_queue, void *tag) {
+    assert(comp_queue != nullptr);
+    return submit(enq_req_args_t(session_num, req_type, req_msgbuf,
+                                 resp_msgbuf, nullptr, tag, kInvalidBgETid,
+                                 comp_queue));
+  }
+
+  /// Return the maximum number of requests that can be queued in this lane
+  inline size_t capacity() const { return ring.capacity(); }
+
+ private:
+  ProducerLane(size_t capacity, std::atomic<bool> *doorbell)
+      : ring(capacity), doorbell(doorbell) {}
+
+  inline bool submit(const enq_req_args_t &args) {
+    if (unlikely(!ring.push(args))) return false;
+
+    // Ring unconditionally with an RMW. This keeps every producer's ring in
+    // the release sequence that the event loop's exchange acquires from, so
+    // the event loop sees this request whenever it sees the doorbell set.
+    doorbell->exchange(true, std::memory_order_release);
+    return true;
+  }
+
+  SpscQueue<enq_req_args_t> ring;  ///< Requests from the producer thread
+  std::atomic<bool> *doorbell;     ///< The owning Rpc's lane doorbell
+};
+
+}  // namespace erpc
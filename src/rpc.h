@@ -3,9 +3,11 @@
 #include <set>
 #include "cc/timing_wheel.h"
 #include "common.h"
+#include "completion_queue.h"
 #include "msg_buffer.h"
 #include "nexus.h"
 #include "pkthdr.h"
+#include "producer_lane.h"
 #include "rpc_types.h"
 #include "session.h"
 #include "transport.h"
@@ -77,6 +79,14 @@ class Rpc {
   /// Timeout for a session management request in milliseconds
   static constexpr size_t kSMTimeoutMs = kTesting ? 10 : 100;
 
+  /// Maximum number of packets classified together by the batched RX path.
+  /// This is the number of byte lanes in one SSE register.
+  static constexpr size_t kRxClassifyBatch = 16;
+
+  /// Distance, in dispatch order, at which the batched RX path prefetches a
+  /// packet's Session and SSlot
+  static constexpr size_t kRxPrefetchDistance = 2;
+
  public:
   /// Max request or response *data* size, i.e., excluding packet headers
   static constexpr size_t kMaxMsgSize =
@@ -126,20 +136,42 @@ class Rpc {
    * hugepage reservation failure is catastrophic. An exception is *not* thrown
    * if allocation fails simply because we ran out of memory.
    *
+   * @param placement MemPlacement::kUntrusted (the default) allocates from
+   * NIC-registered hugepages. MemPlacement::kTrusted allocates from the heap,
+   * which is enclave memory when eRPC runs in an enclave. Trusted MsgBuffers
+   * cannot be transmitted, so applications can use them only as response
+   * MsgBuffers. eRPC also places received requests in them after
+   * set_req_msgbuf_placement(MemPlacement::kTrusted).
+   *
    * \note The returned MsgBuffer's \p buf is surrounded by packet headers for
    * internal use by eRPC. This function does not fill in packet headers,
    * although it sets the magic field in the zeroth header.
    */
-  inline MsgBuffer alloc_msg_buffer(size_t max_data_size) {
+  inline MsgBuffer alloc_msg_buffer(
+      size_t max_data_size,
+      MemPlacement placement = MemPlacement::kUntrusted) {
     assert(max_data_size > 0);  // Doesn't work for max_data_size = 0
 
     // This function avoids division for small data sizes
     size_t max_num_pkts = data_size_to_num_pkts(max_data_size);
-
-    lock_cond(&huge_alloc_lock);
-    Buffer buffer =
-        huge_alloc->alloc(max_data_size + (max_num_pkts * sizeof(pkthdr_t)));
-    unlock_cond(&huge_alloc_lock);
+    size_t alloc_size = max_data_size + (max_num_pkts * sizeof(pkthdr_t));
+
+    Buffer buffer;
+    if (likely(placement == MemPlacement::kUntrusted)) {
+      lock_cond(&huge_alloc_lock);
+      buffer = huge_alloc->alloc(alloc_size);
+      unlock_cond(&huge_alloc_lock);
+    } else {
+      alloc_size = round_up<64>(alloc_size);
+      buffer = Buffer(static_cast<uint8_t *>(aligned_alloc(64, alloc_size)),
+                      alloc_size, 0);
+      buffer.trusted = true;
+      if (buffer.buf != nullptr) {
+        lock_cond(&huge_alloc_lock);
+        enclave_stats.trusted_alloc_tot += alloc_size;
+        unlock_cond(&huge_alloc_lock);
+      }
+    }
 
     if (unlikely(buffer.buf == nullptr)) {
       MsgBuffer msg_buffer;
@@ -176,7 +208,79 @@ class Rpc {
   /// background threads (TS).
   inline void free_msg_buffer(MsgBuffer msg_buffer) {
     lock_cond(&huge_alloc_lock);
-    huge_alloc->free_buf(msg_buffer.buffer);
+    if (likely(!msg_buffer.buffer.trusted)) {
+      huge_alloc->free_buf(msg_buffer.buffer);
+    } else {
+      enclave_stats.trusted_alloc_tot -= msg_buffer.buffer.class_size;
+      free(msg_buffer.buffer.buf);
+    }
+    unlock_cond(&huge_alloc_lock);
+  }
+
+  /**
+   * @brief Create a pool of MsgBuffers for request type \p req_type, each
+   * with space for \p max_data_size bytes. Safe to call from background
+   * threads (TS).
+   *
+   * Pooled MsgBuffers are allocated and freed without the hugepage allocator,
+   * and the constant fields of their packet headers are initialized once for
+   * \p req_type, so enqueue_response() doesn't rewrite them. A dynamic
+   * response allocated with alloc_msg_buffer_from_pool() is returned to its
+   * request type's pool automatically when eRPC buries it.
+   *
+   * @param num_bufs The number of MsgBuffers to preallocate. The pool holds at
+   * most this many free MsgBuffers.
+   *
+   * @return 0 on success, negative errno on failure
+   */
+  int create_msg_buffer_pool(uint8_t req_type, size_t max_data_size,
+                             size_t num_bufs);
+
+  /**
+   * @brief Allocate a MsgBuffer from \p req_type's pool, sized to the pool's
+   * maximum data size. If the pool is empty, this falls back to
+   * alloc_msg_buffer(). Safe to call from background threads (TS).
+   *
+   * @return The MsgBuffer. It is invalid if we ran out of hugepage memory.
+   */
+  inline MsgBuffer alloc_msg_buffer_from_pool(uint8_t req_type) {
+    msgbuf_pool_t &pool = msgbuf_pools[req_type];
+    assert(pool.max_data_size > 0);  // The pool must exist
+
+    lock_cond(&huge_alloc_lock);
+    if (likely(!pool.free_vec.empty())) {
+      MsgBuffer msg_buffer = pool.free_vec.back();
+      pool.free_vec.pop_back();
+      unlock_cond(&huge_alloc_lock);
+      return msg_buffer;
+    }
+    unlock_cond(&huge_alloc_lock);
+
+    MsgBuffer msg_buffer = alloc_msg_buffer(pool.max_data_size);
+    if (msg_buffer.buf != nullptr) stamp_pooled_msgbuf(&msg_buffer, req_type);
+    return msg_buffer;
+  }
+
+  /**
+   * @brief Return a MsgBuffer to \p req_type's pool. MsgBuffers that were not
+   * allocated from \p req_type's pool, or that don't fit this pool, are freed
+   * with free_msg_buffer(). Safe to call from background threads (TS).
+   */
+  inline void free_msg_buffer_to_pool(uint8_t req_type, MsgBuffer msg_buffer) {
+    msgbuf_pool_t &pool = msgbuf_pools[req_type];
+
+    lock_cond(&huge_alloc_lock);
+    if (likely(msg_buffer.buffer.pooled &&
+               msg_buffer.get_pkthdr_0()->req_type == req_type &&
+               msg_buffer.max_data_size == pool.max_data_size &&
+               pool.free_vec.size() < pool.capacity)) {
+      msg_buffer.resize(msg_buffer.max_data_size, msg_buffer.max_num_pkts);
+      pool.free_vec.push_back(msg_buffer);
+    } else {
+      unlock_cond(&huge_alloc_lock);
+      free_msg_buffer(msg_buffer);
+      return;
+    }
     unlock_cond(&huge_alloc_lock);
   }
 
@@ -199,7 +303,47 @@ class Rpc {
    * @param rem_rpc_id The ID of the remote Rpc object
    */
   int create_session(std::string remote_uri, uint8_t rem_rpc_id) {
-    return create_session_st(remote_uri, rem_rpc_id);
+    return create_session_st(remote_uri, rem_rpc_id, SessionCrypto::kNone);
+  }
+
+  /**
+   * @brief Create a session like create_session(), whose request and response
+   * payloads are encrypted and authenticated with AES-GCM. Both Nexuses must
+   * have the same key from Nexus::set_aead_key(). The connect fails with
+   * SmErrType::kAeadUnavailable if the server has no key, and connect
+   * responses signed with another key are ignored. Each session gets a fresh
+   * key from random nonces of both ends, so packets of other sessions don't
+   * authenticate. Data, credit return, and request-for-response packets that
+   * fail authentication are dropped.
+   *
+   * Request MsgBuffers hold ciphertext while their request is in flight. The
+   * plaintext is restored before the continuation is invoked.
+   *
+   * @return The local session number, or negative errno. -ENOTSUP if this
+   * Nexus has no AEAD key.
+   */
+  int create_encrypted_session(std::string remote_uri, uint8_t rem_rpc_id) {
+    return create_session_st(remote_uri, rem_rpc_id, SessionCrypto::kAead);
+  }
+
+  /**
+   * @brief Create a session like create_encrypted_session(), whose payloads
+   * are authenticated with AES-GMAC but sent in cleartext. This detects
+   * tampering for much less CPU than encryption, and request MsgBuffers are
+   * left unmodified.
+   *
+   * Replayed packets are rejected like retransmissions: the MAC binds each
+   * packet to its request number, and each session slot accepts only request
+   * numbers past the last one it received, i.e., a sliding window of
+   * kSessionReqWindow requests. Replays of the current request's packets at
+   * most trigger resends of its credit returns or response.
+   *
+   * @return The local session number, or negative errno. -ENOTSUP if this
+   * Nexus has no AEAD key.
+   */
+  int create_authenticated_session(std::string remote_uri,
+                                   uint8_t rem_rpc_id) {
+    return create_session_st(remote_uri, rem_rpc_id, SessionCrypto::kMac);
   }
 
   /**
@@ -217,6 +361,43 @@ class Rpc {
     return destroy_session_st(session_num);
   }
 
+  /**
+   * @brief Create sessions to many remote Rpcs, like calling create_session()
+   * for each of them. Connect requests to Rpcs of the same remote Nexus are
+   * sent in batches of up to kMaxSmPktBatch per datagram, and the remote Rpcs
+   * resolve routing info and respond once per batch. The connect callbacks of
+   * a batch are invoked together in one event loop iteration.
+   *
+   * @param remotes (remote URI, remote Rpc ID) pairs, as in create_session()
+   *
+   * @param session_nums Filled with the create_session() return value for each
+   * remote, i.e., a local session number or a negative errno
+   *
+   * @return The number of sessions whose handshake was initiated, or negative
+   * errno if the caller is not the creator thread
+   */
+  int create_sessions(
+      const std::vector<std::pair<std::string, uint8_t>> &remotes,
+      std::vector<int> *session_nums);
+
+  /**
+   * @brief Let client sessions share a pool of \p num_credits packet credits
+   * instead of reserving kSessionCredits RX ring entries each. This allows
+   * many more client sessions than get_max_num_sessions(), as long as few of
+   * them are active at a time.
+   *
+   * A client session still sends at most kSessionCredits packets at a time,
+   * but each packet also takes a credit from the shared pool, which the
+   * response or credit return gives back. Requests on sessions that find the
+   * pool empty wait in the credit stall queue. Server sessions still reserve
+   * ring entries because their remote clients control their credits.
+   *
+   * This must be called before creating sessions.
+   *
+   * @return 0 on success, negative errno on failure
+   */
+  int enable_shared_credits(size_t num_credits);
+
   /**
    * @brief Enqueue a request for transmission. This always succeeds. eRPC owns
    * \p msg_buffer until it invokes the continuation callback. This function is
@@ -245,9 +426,34 @@ class Rpc {
    * continuation runs in the foreground. This argument is meant only for
    * internal use by eRPC (i.e., user calls must ignore it).
    */
-  void enqueue_request(int session_num, uint8_t req_type, MsgBuffer *req_msgbuf,
-                       MsgBuffer *resp_msgbuf, erpc_cont_func_t cont_func,
-                       void *tag, size_t cont_etid = kInvalidBgETid);
+  inline void enqueue_request(int session_num, uint8_t req_type,
+                              MsgBuffer *req_msgbuf, MsgBuffer *resp_msgbuf,
+                              erpc_cont_func_t cont_func, void *tag,
+                              size_t cont_etid = kInvalidBgETid) {
+    enqueue_request_args(enq_req_args_t(session_num, req_type, req_msgbuf,
+                                        resp_msgbuf, cont_func, tag,
+                                        cont_etid));
+  }
+
+  /**
+   * @brief Enqueue a request whose completion is delivered to a user-owned
+   * completion ring instead of a continuation callback. The application
+   * harvests completions in batches with CompletionQueue::poll_completions(),
+   * from any one thread. This function is safe to call from background
+   * threads (TS).
+   *
+   * The arguments are the same as the continuation-based enqueue_request(),
+   * except that \p comp_queue replaces the continuation. \p comp_queue must
+   * outlive all requests enqueued with it.
+   */
+  inline void enqueue_request(int session_num, uint8_t req_type,
+                              MsgBuffer *req_msgbuf, MsgBuffer *resp_msgbuf,
+                              CompletionQueue *comp_queue, void *tag) {
+    assert(comp_queue != nullptr);
+    enqueue_request_args(enq_req_args_t(session_num, req_type, req_msgbuf,
+                                        resp_msgbuf, nullptr, tag,
+                                        kInvalidBgETid, comp_queue));
+  }
 
   /**
    * @brief Enqueue a response for transmission at the server. See ReqHandle
@@ -272,6 +478,55 @@ class Rpc {
    */
   void enqueue_response(ReqHandle *req_handle, MsgBuffer *resp_msgbuf);
 
+  /**
+   * @brief Enqueue a burst of requests, e.g., a client's full request window.
+   * This is equivalent to calling enqueue_request() for each element of
+   * \p args_arr in order, but the dispatch-thread check, session lookup, and
+   * TX batching are amortized across the burst. This function is safe to call
+   * from background threads (TS), in which case the burst is handed to the
+   * dispatch thread under one queue lock acquisition.
+   *
+   * Each element is either continuation-based (non-null cont_func, null
+   * comp_queue) or completion-queue-based (null cont_func, non-null
+   * comp_queue). The cont_etid field is for internal use; set it to
+   * \p kInvalidBgETid.
+   *
+   * @param args_arr The requests to enqueue
+   * @param num The number of requests in \p args_arr
+   */
+  void enqueue_requests(const enq_req_args_t *args_arr, size_t num);
+
+  /**
+   * @brief Enqueue a burst of responses. This is equivalent to calling
+   * enqueue_response() for each element of \p args_arr in order, with the
+   * same amortization and thread-safety as enqueue_requests().
+   *
+   * @param args_arr The responses to enqueue
+   * @param num The number of responses in \p args_arr
+   */
+  void enqueue_responses(const enq_resp_args_t *args_arr, size_t num);
+
+  /**
+   * @brief Create a lock-free request submission lane for one application
+   * thread. This lets threads that are neither the Rpc's creator nor eRPC
+   * background threads issue requests through this Rpc, without creating
+   * one Rpc per thread. This must be called from the Rpc's creator thread,
+   * before the lane is handed to its producer thread.
+   *
+   * Producer threads build their request MsgBuffers, so once a lane exists,
+   * the Rpc locks its hugepage allocator even if the Nexus has no background
+   * threads. This makes alloc_msg_buffer() and free_msg_buffer() safe to call
+   * from producer threads.
+   *
+   * Each lane must be used by at most one producer thread at a time. The Rpc
+   * owns the lane and frees it on destruction.
+   *
+   * @param capacity The minimum number of requests the lane can queue
+   *
+   * @return The lane, or nullptr if kMaxProducerLanes lanes already exist
+   */
+  ProducerLane *create_producer_lane(size_t capacity);
+
   /// Run the event loop for some milliseconds
   inline void run_event_loop(size_t timeout_ms) {
     run_event_loop_timeout_st(timeout_ms);
@@ -280,6 +535,43 @@ class Rpc {
   /// Run the event loop once
   inline void run_event_loop_once() { run_event_loop_do_one_st(); }
 
+  /**
+   * @brief Enable or disable the interrupt-driven low-load mode of
+   * run_event_loop(). In this mode, if no packets have been received for
+   * \p idle_us microseconds and no work is pending, run_event_loop() arms the
+   * transport's RX interrupts and sleeps until a packet arrives. It goes back
+   * to polling immediately after waking up.
+   *
+   * Sleeps are bounded by kRxIntrMaxSleepUs, and by the packet loss scan
+   * interval while requests are outstanding, so session management,
+   * background-thread, and producer-lane work is delayed by at most that much.
+   *
+   * @param idle_us The idle period in microseconds. Zero disables the mode.
+   *
+   * @return 0 on success, negative errno if the transport cannot generate RX
+   * events
+   */
+  int set_rx_intr_idle_us(size_t idle_us);
+
+  /**
+   * @brief Return a file descriptor for integrating this Rpc into an
+   * application's own epoll loop, or -1 if the transport cannot generate RX
+   * events. The file descriptor is readable after arm_event_fd() once a packet
+   * has arrived.
+   */
+  int get_event_fd();
+
+  /**
+   * @brief Prepare to block on get_event_fd() in an application's own event
+   * loop. This arms RX interrupts, and then polls once to catch packets that
+   * arrived before arming.
+   *
+   * @return True if the caller may block on get_event_fd(). False if this Rpc
+   * has pending work, in which case the caller must run the event loop again
+   * instead of blocking.
+   */
+  bool arm_event_fd();
+
   /// Identical to alloc_msg_buffer(), but throws an exception on failure
   inline MsgBuffer alloc_msg_buffer_or_die(size_t max_data_size) {
     MsgBuffer m = alloc_msg_buffer(max_data_size);
@@ -320,6 +612,73 @@ class Rpc {
     return ret;
   }
 
+  /**
+   * @brief Return the hugepage memory saved by not keeping a preallocated
+   * response MsgBuffer in every server session slot (see kLazyPreRespMsgbuf)
+   */
+  inline size_t get_stat_pre_resp_bytes_saved() const {
+    return (pre_resp_stats.num_server_sslots -
+            pre_resp_stats.num_materialized) *
+           pre_resp_msgbuf_size;
+  }
+
+  /// Return the number of preallocated response MsgBuffers released from
+  /// idle server sessions
+  inline size_t get_stat_pre_resp_released() const {
+    return pre_resp_stats.num_released;
+  }
+
+  /// Return the total amount of memory allocated to trusted MsgBuffers
+  inline size_t get_stat_trusted_alloc_tot() {
+    lock_cond(&huge_alloc_lock);
+    size_t ret = enclave_stats.trusted_alloc_tot;
+    unlock_cond(&huge_alloc_lock);
+    return ret;
+  }
+
+  /// Return the number of received data bytes that eRPC copied from untrusted
+  /// RX rings into trusted MsgBuffers
+  inline size_t get_stat_enclave_rx_copy_bytes() const {
+    return enclave_stats.rx_copy_bytes;
+  }
+
+  /**
+   * @brief Set where eRPC allocates MsgBuffers for received requests. With
+   * MemPlacement::kTrusted, multi-packet and (unless kZeroCopyRX) single-packet
+   * requests are reassembled in trusted memory. Call this before creating
+   * sessions.
+   */
+  inline void set_req_msgbuf_placement(MemPlacement placement) {
+    req_msgbuf_placement = placement;
+  }
+
+  /**
+   * @brief Bound this Rpc's hugepage memory. The event loop lazily releases
+   * fully free hugepage regions while reserved memory stays at or above
+   * \p low_watermark, and allocations fail instead of reserving memory above
+   * \p high_watermark.
+   */
+  inline void set_hugepage_watermarks(size_t low_watermark,
+                                      size_t high_watermark) {
+    lock_cond(&huge_alloc_lock);
+    huge_alloc->set_watermarks(low_watermark, high_watermark);
+    unlock_cond(&huge_alloc_lock);
+  }
+
+  /**
+   * @brief Reserve and pin a fixed budget of \p size bytes of hugepages for
+   * message buffers. After this, the datapath never reserves hugepages, and
+   * alloc_msg_buffer() fails when the budget is exhausted.
+   *
+   * @return True if the reservation succeeds
+   */
+  inline bool reserve_pinned_hugepages(size_t size) {
+    lock_cond(&huge_alloc_lock);
+    bool ret = huge_alloc->reserve_pinned(size);
+    unlock_cond(&huge_alloc_lock);
+    return ret;
+  }
+
   /// Return the Timely instance for a connected session. Expert use only.
   Timely *get_timely(int session_num) {
     Session *session = session_vec[static_cast<size_t>(session_num)];
@@ -358,9 +717,12 @@ class Rpc {
     return session_vec[static_cast<size_t>(session_num)]->get_remote_hostname();
   }
 
-  /// Return the maximum number of sessions supported
-  static inline constexpr size_t get_max_num_sessions() {
-    return Transport::kNumRxRingEntries / kSessionCredits;
+  /// Return the maximum number of sessions supported, unless client sessions
+  /// use shared credits. Datapath SM lowers this because every session also
+  /// reserves kDpSmCredits ring entries.
+  inline size_t get_max_num_sessions() const {
+    return Transport::kNumRxRingEntries /
+           session_ring_entries(Session::Role::kServer);
   }
 
   /// Return the data size in bytes that can be sent in one request or response
@@ -413,7 +775,8 @@ class Rpc {
   void fault_inject_set_pkt_drop_prob_st(double pkt_drop_prob);
 
  private:
-  int create_session_st(std::string remote_uri, uint8_t rem_rpc_id);
+  int create_session_st(std::string remote_uri, uint8_t rem_rpc_id,
+                        SessionCrypto crypto);
   int destroy_session_st(int session_num);
   size_t num_active_sessions_st();
 
@@ -421,18 +784,90 @@ class Rpc {
   // Session management helper functions
   //
 
-  /// Process all session management packets in the hook's RX list
+  /// Process all session management packets in the hook's RX list, and those
+  /// received over the datapath
   void handle_sm_rx_st();
 
+  /// Process one session management packet from the hook's RX ring
+  void handle_sm_pkt_st(const SmPkt &sm_pkt);
+
   /// Free a session's resources and mark it as null in the session vector.
   /// Only the MsgBuffers allocated by the Rpc layer are freed. The user is
   /// responsible for freeing user-allocated MsgBuffers.
   void bury_session_st(Session *);
 
-  /// Send an SM packet. The packet's destination (i.e., client or server) is
-  /// determined using the packet's type.
+  /**
+   * @brief Account for a new server session's sslots, and allocate their
+   * preallocated response MsgBuffers unless they are allocated lazily
+   *
+   * @return True on success. On failure, nothing is allocated.
+   */
+  bool init_server_sslots_st(Session *);
+
+  /// Release the preallocated response MsgBuffers of server sessions that
+  /// have been idle for kSessionIdleMs, except those that hold a response the
+  /// client hasn't acknowledged
+  void release_idle_server_sslots_st();
+
+  /// A remote Rpc that accepts SM packets over the datapath
+  struct dp_sm_route_t {
+    Transport::RoutingInfo routing_info;  ///< Resolved routing info
+    size_t num_sessions = 0;  ///< Sessions with the remote Rpc
+    size_t credits = 0;       ///< Credits left in the current epoch
+    size_t epoch_tsc = 0;     ///< Packet loss epoch of the credits
+  };
+
+  /// Send an SM packet over the datapath if we know the destination Rpc's
+  /// routing info, and over UDP otherwise
+  void sm_pkt_tx_st(const SmPkt &);
+
+  /// Send an SM packet over UDP. The packet's destination (i.e., client or
+  /// server) is determined using the packet's type. Inside an SM TX batch, the
+  /// packet is queued until the batch ends.
   void sm_pkt_udp_tx_st(const SmPkt &);
 
+  /// Enqueue an SM packet for tx_burst to the bootstrap session of the Rpc
+  /// with resolved routing info \p routing_info
+  void sm_pkt_dp_tx_st(const SmPkt &, Transport::RoutingInfo *routing_info);
+
+  /// Take a datapath SM credit for \p route. Return false if the route has
+  /// used up its credits in this packet loss epoch.
+  bool take_dp_sm_credit_st(dp_sm_route_t *route);
+
+  /// Process an SM packet received over the datapath. Pings are handled here,
+  /// and other packets are queued for handle_sm_rx_st().
+  void process_sm_pkt_dp_st(const pkthdr_t *);
+
+  /// Remember the resolved routing info of remote endpoint \p remote for a
+  /// new session, if it accepts SM packets over the datapath
+  void learn_dp_sm_route_st(const SessionEndpoint &remote,
+                            const Transport::RoutingInfo &routing_info);
+
+  /// Drop a session's reference to the route to \p remote. The route is
+  /// forgotten with the last session, since the remote Rpc stops reserving RX
+  /// ring entries for us.
+  void forget_dp_sm_route_st(const SessionEndpoint &remote);
+
+  /// Send a datapath ping for each remote process that we have a connected
+  /// session with, so that it can skip UDP heartbeats to us
+  void send_dp_sm_pings_st();
+
+  /// Start batching SM packets to each remote Nexus. Batches may nest.
+  inline void begin_sm_tx_batch_st() { sm_tx_batch.depth++; }
+
+  /// End an SM TX batch. Ending the outermost batch sends the queued packets
+  /// in as few datagrams as possible.
+  void end_sm_tx_batch_st();
+
+  /**
+   * @brief Resolve remote routing info, reusing an earlier resolution of the
+   * same routing info in this SM TX batch. Connect requests from one remote
+   * Rpc, and responses from one remote Rpc, carry the same routing info.
+   *
+   * @return True iff resolution succeeds
+   */
+  bool resolve_remote_routing_info_st(Transport::RoutingInfo *);
+
   /// Send a session management request for a client session. This includes
   /// saving retransmission information for the request. The SM request type is
   /// computed using the session state
@@ -455,6 +890,18 @@ class Rpc {
   /// session state must be set to reset-in-progress.
   bool handle_reset_server_st(Session *session);
 
+  /// Mark \p msg_buffer as pooled, and initialize the constant fields of all
+  /// its packet headers for \p req_type's pool. The datapath fills in the
+  /// remaining fields on every use.
+  static void stamp_pooled_msgbuf(MsgBuffer *msg_buffer, uint8_t req_type) {
+    msg_buffer->buffer.pooled = true;
+    for (size_t i = 0; i < msg_buffer->max_num_pkts; i++) {
+      pkthdr_t *pkthdr = msg_buffer->get_pkthdr_n(i);
+      pkthdr->req_type = req_type;
+      pkthdr->magic = kPktHdrMagic;
+    }
+  }
+
   //
   // Methods to bury server-side request and response MsgBuffers. Client-side
   // request and response MsgBuffers are owned by user apps, so eRPC doesn't
@@ -476,13 +923,46 @@ class Rpc {
     // This high-specificity checks prevents freeing a null tx_msgbuf.
     if (sslot->tx_msgbuf == &sslot->dyn_resp_msgbuf) {
       MsgBuffer *tx_msgbuf = sslot->tx_msgbuf;
-      free_msg_buffer(*tx_msgbuf);
+      if (tx_msgbuf->buffer.pooled) {
+        free_msg_buffer_to_pool(sslot->server_info.resp_req_type, *tx_msgbuf);
+      } else {
+        free_msg_buffer(*tx_msgbuf);
+      }
       // Need not nullify tx_msgbuf->buffer.buf: we'll just nullify tx_msgbuf
     }
 
     sslot->tx_msgbuf = nullptr;
   }
 
+  /**
+   * @brief Allocate a server sslot's preallocated response MsgBuffer
+   *
+   * @return True on success. On failure, the sslot is unchanged.
+   */
+  inline bool alloc_pre_resp_msgbuf_st(SSlot *sslot) {
+    assert(in_dispatch());
+    assert(sslot->pre_resp_msgbuf.buf == nullptr);
+
+    MsgBuffer msgbuf = alloc_msg_buffer(pre_resp_msgbuf_size);
+    if (unlikely(msgbuf.buf == nullptr)) return false;
+
+    sslot->pre_resp_msgbuf = msgbuf;
+    pre_resp_stats.num_materialized++;
+    return true;
+  }
+
+  /// Free a server sslot's preallocated response MsgBuffer, if it has one
+  inline void free_pre_resp_msgbuf_st(SSlot *sslot) {
+    assert(in_dispatch());
+    MsgBuffer &msgbuf = sslot->pre_resp_msgbuf;
+    if (msgbuf.buf == nullptr) return;
+
+    free_msg_buffer(msgbuf);
+    msgbuf.buf = nullptr;
+    msgbuf.buffer.buf = nullptr;
+    pre_resp_stats.num_materialized--;
+  }
+
   /**
    * @brief Bury a server sslot's request MsgBuffer. This is done in
    * enqueue_response(), so only in the foreground thread.
@@ -504,20 +984,31 @@ class Rpc {
   // Handle available ring entries
   //
 
+  /// Return the number of ring entries that a session with \p role reserves.
+  /// Client sessions reserve no packet credits if they use the shared credit
+  /// pool. With datapath SM, all sessions also reserve kDpSmCredits.
+  size_t session_ring_entries(Session::Role role) const {
+    const size_t dp_sm_entries = dp_sm.enabled ? kDpSmCredits : 0;
+    if (role == Session::Role::kClient && shared_credits_enabled) {
+      return dp_sm_entries;
+    }
+    return kSessionCredits + dp_sm_entries;
+  }
+
   /// Return true iff there are sufficient ring entries available for a session
-  bool have_ring_entries() const {
-    return ring_entries_available >= kSessionCredits;
+  bool have_ring_entries(Session::Role role) const {
+    return ring_entries_available >= session_ring_entries(role);
   }
 
   /// Allocate ring entries for one session
-  void alloc_ring_entries() {
-    assert(have_ring_entries());
-    ring_entries_available -= kSessionCredits;
+  void alloc_ring_entries(Session::Role role) {
+    assert(have_ring_entries(role));
+    ring_entries_available -= session_ring_entries(role);
   }
 
   /// Free ring entries allocated for one session
-  void free_ring_entries() {
-    ring_entries_available += kSessionCredits;
+  void free_ring_entries(Session::Role role) {
+    ring_entries_available += session_ring_entries(role);
     assert(ring_entries_available <= Transport::kNumRxRingEntries);
   }
 
@@ -623,6 +1114,28 @@ class Rpc {
   /// Actually run one iteration of the event loop
   void run_event_loop_do_one_st();
 
+  /// Return true iff the event loop has no work that needs polling, so the
+  /// dispatch thread may sleep until the next RX event
+  bool can_sleep_st() const;
+
+  /// Sleep until an RX event arrives or \p max_sleep_us elapses. This
+  /// requires the interrupt-driven mode's epoll fd to be initialized.
+  void sleep_until_rx_st(size_t max_sleep_us);
+
+  /// Create the epoll fd for the interrupt-driven low-load mode if needed.
+  /// Return false iff the transport cannot generate RX events.
+  bool init_rx_intr_st();
+
+  /// Implementation of both enqueue_request() API functions. When called from
+  /// a background thread, this queues \p args for the dispatch thread.
+  void enqueue_request_args(const enq_req_args_t &args);
+
+  /// Enqueue a request from the dispatch thread on a connected session
+  void enqueue_request_st(Session *session, const enq_req_args_t &args);
+
+  /// Enqueue a response from the dispatch thread
+  void enqueue_response_st(SSlot *sslot, MsgBuffer *resp_msgbuf);
+
   /// Enqueue client packets for a sslot that has at least one credit and
   /// request packets to send. Packets may be added to the timing wheel or the
   /// TX burst; credits are used in both cases.
@@ -646,6 +1159,32 @@ class Rpc {
    */
   void process_resp_one_st(SSlot *, const pkthdr_t *, size_t rx_tsc);
 
+  /**
+   * @brief Encrypt the payload of each packet of \p msgbuf in place, or only
+   * MAC it for SessionCrypto::kMac sessions, and fill in the packets' AEAD
+   * tags. The packet headers must be formatted. Sealing an encrypted
+   * MsgBuffer again restores its plaintext.
+   */
+  void aead_seal_msgbuf_st(Session *session, MsgBuffer *msgbuf);
+
+  /// Fill in the AEAD tag of a formatted credit return or request-for-response
+  /// packet header, which authenticates the header
+  void aead_seal_ctrl_st(Session *session, pkthdr_t *pkthdr);
+
+  /**
+   * @brief Authenticate and decrypt the payload of a received data packet,
+   * which is packet \p pkt_idx of its message. Control packets, which have no
+   * payload, are authenticated with \p pkt_idx = 0.
+   *
+   * @param dst_msgbuf If non-null, the plaintext is written at the packet's
+   * offset in this MsgBuffer instead of in place in the RX ring. This replaces
+   * copy_data_to_msgbuf(), so that encrypted payloads are touched only once.
+   *
+   * @return True iff the packet is authentic. Other packets must be dropped.
+   */
+  bool aead_open_st(Session *session, const pkthdr_t *pkthdr, size_t pkt_idx,
+                    MsgBuffer *dst_msgbuf);
+
   /**
    * @brief Enqueue an explicit credit return
    *
@@ -732,11 +1271,17 @@ class Rpc {
     if (tx_batch_i == TTr::kPostlist) do_tx_burst_st();
   }
 
+  /// Return the TSC for datapath timing. With kEvLoopTsc, this is the TSC
+  /// sampled at the start of this event loop iteration.
+  inline size_t dpath_tsc() const {
+    return kEvLoopTsc ? ev_loop_tsc : dpath_rdtsc();
+  }
+
   /// Enqueue a request packet to the timing wheel
   inline void enqueue_wheel_req_st(SSlot *sslot, size_t pkt_num) {
     const size_t pkt_idx = pkt_num;
     size_t pktsz = sslot->tx_msgbuf->get_pkt_size<TTr::kMaxDataPerPkt>(pkt_idx);
-    size_t ref_tsc = dpath_rdtsc();
+    size_t ref_tsc = dpath_tsc();
     size_t desired_tx_tsc = sslot->session->cc_getupdate_tx_tsc(ref_tsc, pktsz);
 
     ERPC_CC("Rpc %u: lsn/req/pkt %u/%zu/%zu, REQ wheeled for %.3f us.\n",
@@ -753,7 +1298,7 @@ class Rpc {
     const size_t pkt_idx = resp_ntoi(pkt_num, sslot->tx_msgbuf->num_pkts);
     const MsgBuffer *resp_msgbuf = sslot->client_info.resp_msgbuf;
     size_t pktsz = resp_msgbuf->get_pkt_size<TTr::kMaxDataPerPkt>(pkt_idx);
-    size_t ref_tsc = dpath_rdtsc();
+    size_t ref_tsc = dpath_tsc();
     size_t desired_tx_tsc = sslot->session->cc_getupdate_tx_tsc(ref_tsc, pktsz);
 
     ERPC_CC("Rpc %u: lsn/req/pkt %u/%zu/%zu, RFR wheeled for %.3f us.\n",
@@ -776,11 +1321,11 @@ class Rpc {
 
     if (kCcRTT) {
       size_t batch_tsc = 0;
-      if (kCcOptBatchTsc) batch_tsc = dpath_rdtsc();
+      if (kCcOptBatchTsc) batch_tsc = dpath_tsc();
 
       for (size_t i = 0; i < tx_batch_i; i++) {
         if (tx_burst_arr[i].tx_ts != nullptr) {
-          *tx_burst_arr[i].tx_ts = kCcOptBatchTsc ? batch_tsc : dpath_rdtsc();
+          *tx_burst_arr[i].tx_ts = kCcOptBatchTsc ? batch_tsc : dpath_tsc();
         }
       }
     }
@@ -789,19 +1334,38 @@ class Rpc {
     tx_batch_i = 0;
   }
 
+  /// Return the number of packets that a client session may send now
+  inline size_t avail_credits(const Session *session) const {
+    return std::min(session->client_info.credits, shared_credits);
+  }
+
+  /// Use a credit of this session to send a packet
+  inline void consume_credit(Session *session) {
+    assert(avail_credits(session) > 0);
+    session->client_info.credits--;
+    shared_credits--;
+  }
+
   /// Return a credit to this session
-  static inline void bump_credits(Session *session) {
+  inline void bump_credits(Session *session) {
     assert(session->is_client());
     assert(session->client_info.credits < kSessionCredits);
     session->client_info.credits++;
+    shared_credits++;
   }
 
   /// Copy the data from a packet to a MsgBuffer at a packet index
-  static inline void copy_data_to_msgbuf(MsgBuffer *msgbuf, size_t pkt_idx,
-                                         const pkthdr_t *pkthdr) {
+  inline void copy_data_to_msgbuf(MsgBuffer *msgbuf, size_t pkt_idx,
+                                  const pkthdr_t *pkthdr) {
     size_t offset = pkt_idx * TTr::kMaxDataPerPkt;
     size_t to_copy = std::min(TTr::kMaxDataPerPkt, pkthdr->msg_size - offset);
     memcpy(&msgbuf->buf[offset], pkthdr + 1, to_copy);  // From end of pkthdr
+    count_enclave_copy(msgbuf, to_copy);
+  }
+
+  /// Account for \p bytes of received data copied into \p msgbuf
+  inline void count_enclave_copy(const MsgBuffer *msgbuf, size_t bytes) {
+    if (msgbuf->buffer.trusted) enclave_stats.rx_copy_bytes += bytes;
   }
 
   /**
@@ -815,6 +1379,26 @@ class Rpc {
    */
   void process_comps_st();
 
+  /**
+   * @brief Classify the next \p num_pkts packets in the RX ring and process
+   * them, grouped by packet type.
+   *
+   * The magic check and packet type extraction for all packets use SIMD byte
+   * compares. Groups are processed in the order explicit credit return,
+   * response, request, RFR, and packets keep their RX order within a group.
+   * This preserves per-sslot semantics: client sslots receive only CRs and
+   * responses, and a CR for a request always precedes its response. Server
+   * sslots receive only requests and RFRs, and RFRs for a request follow its
+   * last request packet.
+   *
+   * @param num_pkts The number of packets, at most kRxClassifyBatch
+   */
+  void process_comps_batch_st(size_t num_pkts);
+
+  /// Validate the destination session of one received packet with a correct
+  /// magic number, and dispatch it to its packet-type handler
+  void process_pkt_st(pkthdr_t *pkthdr);
+
   /**
    * @brief Submit a request work item to a random background thread
    *
@@ -835,6 +1419,15 @@ class Rpc {
    */
   void submit_bg_resp_st(erpc_cont_func_t cont_func, void *tag, size_t bg_etid);
 
+  /// Deliver a request completion to \p comp_queue, or hold it in the
+  /// overflow list if the ring is full
+  inline void deliver_completion_st(CompletionQueue *comp_queue, void *tag,
+                                    MsgBuffer *resp_msgbuf) {
+    assert(in_dispatch());
+    if (likely(comp_queue->push(completion_t(tag, resp_msgbuf)))) return;
+    comp_queue_overflow.emplace_back(comp_queue, completion_t(tag, resp_msgbuf));
+  }
+
   //
   // Queue handlers
   //
@@ -851,6 +1444,12 @@ class Rpc {
   /// Process the responses enqueued by background threads
   void process_bg_queues_enqueue_response_st();
 
+  /// Retry delivering completions held back by full completion rings
+  void process_comp_queue_overflow_st();
+
+  /// Process the requests submitted through producer lanes
+  void process_producer_lanes_st();
+
   /**
    * @brief Check if the caller can inject faults
    * @throw runtime_error if the caller cannot inject faults
@@ -930,10 +1529,11 @@ class Rpc {
 
   // Derived
   const size_t creation_tsc;    ///< Timestamp of creation of this Rpc endpoint
-  const bool multi_threaded;    ///< True iff there are background threads
+  bool multi_threaded;  ///< True iff there are bg threads or producer lanes
   const double freq_ghz;        ///< RDTSC frequency, derived from Nexus
   const size_t rpc_rto_cycles;  ///< RPC RTO in cycles
   const size_t rpc_pkt_loss_scan_cycles;  ///< Packet loss scan frequency
+  const size_t session_idle_cycles;       ///< kSessionIdleMs in cycles
 
   /// A copy of the request/response handlers from the Nexus. We could use
   /// a pointer instead, but an array is faster.
@@ -956,6 +1556,12 @@ class Rpc {
   /// Current number of ring buffers available to use for sessions
   size_t ring_entries_available = TTr::kNumRxRingEntries;
 
+  /// Credits available in the pool shared by client sessions. Without
+  /// enable_shared_credits(), this is effectively unlimited so that only
+  /// per-session credits matter.
+  size_t shared_credits = SIZE_MAX / 2;
+  bool shared_credits_enabled = false;
+
   Transport::tx_burst_item_t tx_burst_arr[TTr::kPostlist];  ///< Tx batch info
   size_t tx_batch_i = 0;  ///< The batch index for TX burst array
 
@@ -969,11 +1575,35 @@ class Rpc {
 
   std::vector<SSlot *> stallq;  ///< Request sslots stalled for credits
 
+  /// Completions that could not be delivered because their ring was full
+  std::vector<std::pair<CompletionQueue *, completion_t>> comp_queue_overflow;
+
   size_t ev_loop_tsc;  ///< TSC taken at each iteration of the ev loop
 
   // Packet loss
   size_t pkt_loss_scan_tsc;  ///< Timestamp of the previous scan for lost pkts
 
+  /// Timestamp of the previous scan for idle server sessions
+  size_t idle_session_scan_tsc;
+
+  /// Datapath RX timestamps per heartbeat peer ID, read by the Nexus's
+  /// heartbeat manager as liveness evidence
+  volatile size_t *hb_rx_tsc;
+
+  struct {
+    size_t num_server_sslots = 0;  ///< Slots in all server sessions
+    size_t num_materialized = 0;   ///< Slots with a pre_resp_msgbuf
+    size_t num_released = 0;       ///< pre_resp_msgbufs released when idle
+  } pre_resp_stats;
+
+  struct {
+    size_t rx_copy_bytes = 0;      ///< RX bytes copied into trusted memory
+    size_t trusted_alloc_tot = 0;  ///< Guarded by huge_alloc_lock
+  } enclave_stats;
+
+  /// Placement of MsgBuffers for received requests
+  MemPlacement req_msgbuf_placement = MemPlacement::kUntrusted;
+
   /// The doubly-linked list of active RPCs. An RPC slot is added to this list
   /// when the request is enqueued. The slot is deleted from this list when its
   /// continuation is invoked or queued to a background thread.
@@ -986,6 +1616,15 @@ class Rpc {
   // Allocator
   HugeAlloc *huge_alloc = nullptr;  ///< This thread's hugepage allocator
   std::mutex huge_alloc_lock;       ///< A lock to guard the huge allocator
+  HugeArena *huge_arena = nullptr;  ///< The Nexus's shared arena, if enabled
+
+  /// A pool of ready MsgBuffers for one request type
+  struct msgbuf_pool_t {
+    size_t max_data_size = 0;  ///< Zero iff the pool doesn't exist
+    size_t capacity = 0;       ///< Max free MsgBuffers held by the pool
+    std::vector<MsgBuffer> free_vec;
+  };
+  msgbuf_pool_t msgbuf_pools[kReqTypeArraySize];  ///< Guarded by huge_alloc_lock
 
   MsgBuffer ctrl_msgbufs[2 * TTr::kUnsigBatch];  ///< Buffers for RFR/CR
   size_t ctrl_msgbuf_head = 0;
@@ -1003,6 +1642,13 @@ class Rpc {
     MtQueue<enq_resp_args_t> _enqueue_response;
   } bg_queues;
 
+  /// Lock-free request submission lanes for application threads
+  struct {
+    std::atomic<bool> doorbell{false};  ///< Rung by producers on submission
+    std::atomic<size_t> num_lanes{0};   ///< Number of lanes in lane_arr
+    std::array<ProducerLane *, kMaxProducerLanes> lane_arr;
+  } producer_lanes;
+
   // Misc
   SlowRand slow_rand;  ///< A slow random generator for "real" randomness
   UDPClient<SmPkt> udp_client;  ///< UDP endpoint used to send SM packets
@@ -1018,6 +1664,33 @@ class Rpc {
   /// Sessions for which a session management request is outstanding
   std::set<uint16_t> sm_pending_reqs;
 
+  /// Session management packets batched per remote Nexus
+  struct {
+    size_t depth = 0;  ///< Nesting depth of batches. Zero means no batching.
+
+    /// Queued packets, keyed by the remote Nexus's (hostname, UDP port)
+    std::map<std::pair<std::string, uint16_t>, std::vector<SmPkt>> pkts;
+
+    /// Routing info resolved in this batch, keyed by the unresolved bytes
+    std::map<std::string, Transport::RoutingInfo> resolved_rinfo;
+  } sm_tx_batch;
+
+  /// Session management over the datapath
+  struct {
+    bool enabled = false;  ///< A copy of the Nexus's setting
+
+    /// TX buffers, used round-robin. Allocated only if datapath SM is enabled.
+    MsgBuffer msgbufs[2 * TTr::kUnsigBatch];
+    size_t msgbuf_head = 0;
+
+    /// Routes to remote Rpcs, keyed by the remote Nexus's URI and the Rpc ID.
+    /// Map nodes are stable, so tx_burst items can point to the routing info.
+    std::map<std::pair<std::string, uint8_t>, dp_sm_route_t> routes;
+
+    std::vector<SmPkt> rx_queue;  ///< Received packets not handled yet
+    size_t ping_tsc = 0;          ///< Timestamp of the last round of pings
+  } dp_sm;
+
   /// All the faults that can be injected into eRPC for testing
   struct {
     bool fail_resolve_rinfo = false;  ///< Fail routing info resolution
@@ -1037,6 +1710,14 @@ class Rpc {
   /// ERPC_TRACE and other macros.
   FILE *trace_file;
 
+  /// State for the interrupt-driven low-load mode
+  struct {
+    size_t idle_cycles = 0;  ///< Idle period before sleeping. 0 = disabled.
+    size_t last_rx_tsc = 0;  ///< ev_loop_tsc of the last non-empty RX burst
+    int epoll_fd = -1;       ///< Watches the transport's RX event fd
+    size_t num_sleeps = 0;   ///< Number of times the dispatch thread slept
+  } rx_intr;
+
   /// Datapath stats that can be disabled at compile-time
   struct {
     size_t ev_loop_calls = 0;
@@ -44,6 +44,13 @@ static constexpr size_t kMaxNumaNodes = 8;
  */
 static constexpr size_t kMaxBgThreads = 8;
 
+/**
+ * @relates Rpc
+ * @brief Maximum number of producer lanes (application threads that submit
+ * requests through ProducerLane) per Rpc
+ */
+static constexpr size_t kMaxProducerLanes = 64;
+
 /**
  * @relates Rpc
  * @brief Maximum number of datapath device ports
@@ -59,6 +66,12 @@ static constexpr size_t kMaxPhyPorts = 16;
  */
 static constexpr size_t kMachineFailureTimeoutMs = 500;
 
+/**
+ * @relates Rpc
+ * @brief Maximum number of remote processes tracked by the heartbeat manager
+ */
+static constexpr size_t kMaxHeartbeatPeers = 4096;
+
 /**
  * @brief Return the datapath UDP port used for an Rpc object in a process
  *
@@ -2,6 +2,7 @@
  * @file rpc.cc
  * @brief Simple Rpc-related methods.
  */
+#include <unistd.h>
 #include <algorithm>
 #include <iostream>
 #include <stdexcept>
@@ -24,6 +25,7 @@ Rpc<TTr>::Rpc(Nexus *nexus, void *context, uint8_t rpc_id,
       freq_ghz(nexus->freq_ghz),
       rpc_rto_cycles(us_to_cycles(kRpcRTOUs, freq_ghz)),
       rpc_pkt_loss_scan_cycles(rpc_rto_cycles / 10),
+      session_idle_cycles(ms_to_cycles(kSessionIdleMs, freq_ghz)),
       req_func_arr(nexus->req_func_arr) {
   rt_assert(!getuid(), "You need to be root to use eRPC");
   rt_assert(rpc_id != kInvalidRpcId, "Invalid Rpc ID");
@@ -55,6 +57,22 @@ Rpc<TTr>::Rpc(Nexus *nexus, void *context, uint8_t rpc_id,
   huge_alloc = new HugeAlloc(kInitialHugeAllocSize, numa_node,
                              transport->reg_mr_func, transport->dereg_mr_func);
 
+  // Name persistent regions by the Rpc's identity, which a restarted process
+  // reuses
+  if (!nexus->persistent_huge_dir.empty()) {
+    huge_alloc->set_persistent(nexus->persistent_huge_dir + "/erpc_" +
+                               std::to_string(nexus->sm_udp_port) + "_" +
+                               std::to_string(rpc_id) + "_");
+  }
+
+  // Message buffers come from the Nexus's shared arena if it's enabled. This
+  // requires the transport to share memory registrations across Rpcs.
+  if (nexus->shared_huge_arena_enabled && TTr::kSharedMemReg) {
+    huge_arena = nexus->acquire_huge_arena(phy_port, transport->reg_mr_func,
+                                           transport->dereg_mr_func);
+    huge_alloc->set_arena(huge_arena);
+  }
+
   // Complete transport initialization using the hugepage allocator
   transport->init_hugepage_structures(huge_alloc, rx_ring);
 
@@ -78,9 +96,24 @@ Rpc<TTr>::Rpc(Nexus *nexus, void *context, uint8_t rpc_id,
     }
   }
 
+  // Create msgbufs for session management packets carried over the datapath
+  dp_sm.enabled = nexus->datapath_sm_enabled;
+  if (dp_sm.enabled) {
+    for (MsgBuffer &dp_sm_msgbuf : dp_sm.msgbufs) {
+      dp_sm_msgbuf = alloc_msg_buffer(sizeof(SmPkt));
+      if (dp_sm_msgbuf.buf == nullptr) {
+        delete huge_alloc;
+        throw std::runtime_error(
+            std::string("Failed to allocate datapath SM msgbufs. ") +
+            HugeAlloc::alloc_fail_help_str);
+      }
+    }
+  }
+
   // Register the hook with the Nexus. This installs SM and bg command queues.
   nexus_hook.rpc_id = rpc_id;
   nexus->register_hook(&nexus_hook);
+  hb_rx_tsc = nexus->heartbeat_mgr.unlocked_add_rx_source();
 
   ERPC_INFO("Rpc %u created. eRPC TID = %zu.\n", rpc_id, creator_etid);
 
@@ -91,29 +124,82 @@ Rpc<TTr>::Rpc(Nexus *nexus, void *context, uint8_t rpc_id,
 
   // Steps that should be done as late as possible
   pkt_loss_scan_tsc = rdtsc();  // Assign epoch timestamp as late as possible
+  idle_session_scan_tsc = pkt_loss_scan_tsc;
   if (kCcPacing) wheel->catchup();  // Wheel could be lagging, so catch up
 }
 
+template <class TTr>
+int Rpc<TTr>::create_msg_buffer_pool(uint8_t req_type, size_t max_data_size,
+                                     size_t num_bufs) {
+  if (max_data_size == 0 || req_type == kInvalidReqType) return -EINVAL;
+
+  lock_cond(&huge_alloc_lock);
+  msgbuf_pool_t &pool = msgbuf_pools[req_type];
+  if (pool.max_data_size > 0) {
+    unlock_cond(&huge_alloc_lock);
+    return -EEXIST;
+  }
+
+  const size_t max_num_pkts = data_size_to_num_pkts(max_data_size);
+  pool.free_vec.reserve(num_bufs);
+  for (size_t i = 0; i < num_bufs; i++) {
+    Buffer buffer =
+        huge_alloc->alloc(max_data_size + (max_num_pkts * sizeof(pkthdr_t)));
+    if (buffer.buf == nullptr) {
+      for (MsgBuffer &m : pool.free_vec) huge_alloc->free_buf(m.buffer);
+      pool.free_vec.clear();
+      unlock_cond(&huge_alloc_lock);
+      return -ENOMEM;
+    }
+
+    MsgBuffer msg_buffer(buffer, max_data_size, max_num_pkts);
+    stamp_pooled_msgbuf(&msg_buffer, req_type);
+    pool.free_vec.push_back(msg_buffer);
+  }
+
+  pool.max_data_size = max_data_size;
+  pool.capacity = num_bufs;
+  unlock_cond(&huge_alloc_lock);
+  return 0;
+}
+
 template <class TTr>
 Rpc<TTr>::~Rpc() {
   assert(in_dispatch());
 
   // XXX: Check if all sessions are disconnected
   for (Session *session : session_vec) {
-    if (session != nullptr) delete session;
+    if (session == nullptr) continue;
+    if (session->hb_peer_id != HeartbeatMgr::kInvalidPeerId) {
+      nexus->heartbeat_mgr.unlocked_remove_remote(session->hb_peer_id);
+    }
+    delete session;
   }
 
   ERPC_INFO("Destroying Rpc %u.\n", rpc_id);
 
+  for (size_t i = 0; i < producer_lanes.num_lanes; i++) {
+    delete producer_lanes.lane_arr[i];
+  }
+
+  for (msgbuf_pool_t &pool : msgbuf_pools) {
+    for (MsgBuffer &msg_buffer : pool.free_vec) free_msg_buffer(msg_buffer);
+  }
+
   // First delete the hugepage allocator. This deregisters and deletes the
-  // SHM regions. Deregistration is done using \p transport's deregistration
-  // function, so \p transport is deleted later.
+  // SHM regions, and returns cached Buffers to the shared arena.
+  // Deregistration is done using \p transport's deregistration function, so
+  // \p transport is deleted later. The shared arena is deleted with the last
+  // Rpc on this port, before that Rpc's transport releases the port's PD.
   delete huge_alloc;
+  if (huge_arena != nullptr) nexus->release_huge_arena(phy_port);
 
   // Allow \p transport to clean up non-hugepage structures
   delete transport;
 
+  if (rx_intr.epoll_fd != -1) close(rx_intr.epoll_fd);
   nexus->unregister_hook(&nexus_hook);
+  nexus->heartbeat_mgr.unlocked_remove_rx_source(hb_rx_tsc);
 
   if (ERPC_LOG_LEVEL >= ERPC_LOG_LEVEL_REORDER) fclose(trace_file);
 }
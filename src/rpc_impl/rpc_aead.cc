@@ -0,0 +1,116 @@
+#include "rpc.h"
+
+namespace erpc {
+
+// Each data packet of a protected session is sealed separately, so packets
+// can be opened in any order. The nonce packs the request number, packet
+// number, and packet type, which are never reused for different data within a
+// session, and the message size and request type. Retransmissions resend the
+// same ciphertext and tags.
+//
+// Encrypted sessions also pass the eRPC header as AAD. MAC-only sessions
+// authenticate the header fields through the nonce instead, so that GMAC runs
+// over the payload alone. The destination session number is bound by the
+// per-session key.
+//
+// Credit returns and requests-for-response are sealed the same way with an
+// empty payload, so the tag covers their header. Their packet type keeps their
+// nonces apart from those of data packets.
+
+/// Fill \p nonce with the per-packet AES-GCM nonce of \p pkthdr
+static void aead_nonce(const pkthdr_t *pkthdr, uint8_t *nonce) {
+  const uint64_t nonce_lo = pkthdr->req_num |
+                            (static_cast<uint64_t>(pkthdr->pkt_num) << 44) |
+                            (static_cast<uint64_t>(pkthdr->pkt_type) << 58);
+  const uint32_t nonce_hi = static_cast<uint32_t>(pkthdr->msg_size) |
+                            (static_cast<uint32_t>(pkthdr->req_type) << 24);
+  static_assert(kReqNumBits == 44 && kPktNumBits == 14 && kMsgSizeBits == 24,
+                "");
+  memcpy(nonce, &nonce_lo, sizeof(nonce_lo));
+  memcpy(nonce + sizeof(nonce_lo), &nonce_hi, sizeof(nonce_hi));
+}
+
+/// Seal one packet with header \p pkthdr and \p len bytes of payload
+static void aead_seal_pkt(AesGcm *aead, SessionCrypto crypto, pkthdr_t *pkthdr,
+                          uint8_t *payload, size_t len) {
+  uint8_t nonce[AesGcm::kNonceSize];
+  aead_nonce(pkthdr, nonce);
+
+  if (crypto == SessionCrypto::kMac) {
+    aead->mac(payload, len, nonce, pkthdr->get_aead_tag());
+  } else {
+    aead->seal(payload, len, nonce, pkthdr->get_aead_aad(), kAeadAadSize,
+               pkthdr->get_aead_tag());
+  }
+}
+
+template <class TTr>
+void Rpc<TTr>::aead_seal_msgbuf_st(Session *session, MsgBuffer *msgbuf) {
+  assert(in_dispatch());
+
+  for (size_t i = 0; i < msgbuf->num_pkts; i++) {
+    uint8_t *payload = &msgbuf->buf[i * TTr::kMaxDataPerPkt];
+    const size_t len =
+        msgbuf->get_pkt_size<TTr::kMaxDataPerPkt>(i) - sizeof(pkthdr_t);
+    aead_seal_pkt(session->aead, session->crypto, msgbuf->get_pkthdr_n(i),
+                  payload, len);
+  }
+}
+
+template <class TTr>
+void Rpc<TTr>::aead_seal_ctrl_st(Session *session, pkthdr_t *pkthdr) {
+  assert(in_dispatch());
+  assert(pkthdr->msg_size == 0);
+  uint8_t unused_payload[1];
+  aead_seal_pkt(session->aead, session->crypto, pkthdr, unused_payload, 0);
+}
+
+template <class TTr>
+bool Rpc<TTr>::aead_open_st(Session *session, const pkthdr_t *pkthdr,
+                            size_t pkt_idx, MsgBuffer *dst_msgbuf) {
+  assert(in_dispatch());
+  const size_t offset = pkt_idx * TTr::kMaxDataPerPkt;
+  const size_t len = std::min(TTr::kMaxDataPerPkt, pkthdr->msg_size - offset);
+
+  // The payload is in the RX ring, which we own until the next RX burst. The
+  // plaintext may be written before the tag is checked, so check its bounds.
+  auto *_pkthdr = const_cast<pkthdr_t *>(pkthdr);
+  uint8_t *payload = reinterpret_cast<uint8_t *>(_pkthdr + 1);
+  uint8_t *dst = payload;
+  bool bounds_ok = offset <= pkthdr->msg_size;
+  if (dst_msgbuf != nullptr) {
+    dst = &dst_msgbuf->buf[offset];
+    bounds_ok = bounds_ok && offset + len <= dst_msgbuf->max_data_size;
+  }
+
+  uint8_t nonce[AesGcm::kNonceSize];
+  aead_nonce(pkthdr, nonce);
+
+  bool authentic = false;
+  if (likely(bounds_ok)) {
+    if (session->crypto == SessionCrypto::kMac) {
+      authentic = session->aead->verify(payload, len, nonce,
+                                        _pkthdr->get_aead_tag());
+      if (likely(authentic) && dst != payload) memcpy(dst, payload, len);
+    } else {
+      authentic = session->aead->open_to(dst, payload, len, nonce,
+                                         pkthdr->get_aead_aad(), kAeadAadSize,
+                                         _pkthdr->get_aead_tag());
+    }
+  }
+
+  if (likely(authentic)) {
+    if (dst_msgbuf != nullptr) count_enclave_copy(dst_msgbuf, len);
+    return true;
+  }
+
+  ERPC_WARN("Rpc %u, lsn %u (%s): Dropping packet %s that failed AEAD.\n",
+            rpc_id, session->local_session_num,
+            session->get_remote_hostname().c_str(),
+            pkthdr->to_string().c_str());
+  return false;
+}
+
+FORCE_COMPILE_TRANSPORTS
+
+}  // namespace erpc
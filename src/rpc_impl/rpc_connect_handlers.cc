@@ -31,9 +31,13 @@ void Rpc<TTr>::handle_connect_req_st(const SmPkt &sm_pkt) {
     } else {
       SmPkt resp_sm_pkt = sm_construct_resp(sm_pkt, SmErrType::kNoError);
       resp_sm_pkt.server = session->server;  // Re-send server endpoint info
+      if (session->crypto != SessionCrypto::kNone) {
+        resp_sm_pkt.srv_nonce = session->srv_nonce;
+        nexus->sign_connect_resp(&resp_sm_pkt);
+      }
 
       ERPC_INFO("%s: Duplicate request. Re-sending response.\n", issue_msg);
-      sm_pkt_udp_tx_st(resp_sm_pkt);
+      sm_pkt_tx_st(resp_sm_pkt);
       return;
     }
   }
@@ -44,14 +48,22 @@ void Rpc<TTr>::handle_connect_req_st(const SmPkt &sm_pkt) {
   if (sm_pkt.server.transport_type != transport->transport_type) {
     ERPC_WARN("%s: Invalid transport %s. Sending response.\n", issue_msg,
               Transport::get_name(sm_pkt.server.transport_type).c_str());
-    sm_pkt_udp_tx_st(sm_construct_resp(sm_pkt, SmErrType::kInvalidTransport));
+    sm_pkt_tx_st(sm_construct_resp(sm_pkt, SmErrType::kInvalidTransport));
+    return;
+  }
+
+  // Check that we can derive the key of a protected session
+  if (sm_pkt.client.crypto != SessionCrypto::kNone && !nexus->aead_key_set) {
+    ERPC_WARN("%s: No AEAD key for protected session. Sending response.\n",
+              issue_msg);
+    sm_pkt_tx_st(sm_construct_resp(sm_pkt, SmErrType::kAeadUnavailable));
     return;
   }
 
   // Check if we are allowed to create another session
-  if (!have_ring_entries()) {
+  if (!have_ring_entries(Session::Role::kServer)) {
     ERPC_WARN("%s: Ring buffers exhausted. Sending response.\n", issue_msg);
-    sm_pkt_udp_tx_st(sm_construct_resp(sm_pkt, SmErrType::kRingExhausted));
+    sm_pkt_tx_st(sm_construct_resp(sm_pkt, SmErrType::kRingExhausted));
     return;
   }
 
@@ -62,64 +74,79 @@ void Rpc<TTr>::handle_connect_req_st(const SmPkt &sm_pkt) {
   if (kTesting && faults.fail_resolve_rinfo) {
     resolve_success = false;
   } else {
-    resolve_success = transport->resolve_remote_routing_info(&client_rinfo);
+    resolve_success = resolve_remote_routing_info_st(&client_rinfo);
   }
 
   if (!resolve_success) {
     std::string routing_info_str = TTr::routing_info_str(&client_rinfo);
     ERPC_WARN("%s: Unable to resolve routing info %s. Sending response.\n",
               issue_msg, routing_info_str.c_str());
-    sm_pkt_udp_tx_st(
+    sm_pkt_tx_st(
         sm_construct_resp(sm_pkt, SmErrType::kRoutingResolutionFailure));
     return;
   }
 
+  // Start tracking the client's process for failure detection
+  const uint32_t hb_peer_id =
+      nexus->heartbeat_mgr.unlocked_add_remote(sm_pkt.client.uri());
+  if (hb_peer_id == HeartbeatMgr::kInvalidPeerId) {
+    ERPC_WARN("%s: Too many heartbeat peers. Sending response.\n", issue_msg);
+    sm_pkt_tx_st(sm_construct_resp(sm_pkt, SmErrType::kTooManyPeers));
+    return;
+  }
+
   // If we are here, create a new session and fill preallocated MsgBuffers
   auto *session = new Session(Session::Role::kServer, sm_pkt.uniq_token,
                               get_freq_ghz(), transport->get_bandwidth());
   session->state = SessionState::kConnected;
 
-  for (size_t i = 0; i < kSessionReqWindow; i++) {
-    MsgBuffer &msgbuf_i = session->sslot_arr[i].pre_resp_msgbuf;
-    msgbuf_i = alloc_msg_buffer(pre_resp_msgbuf_size);
-
-    if (msgbuf_i.buf == nullptr) {
-      // Cleanup everything allocated for this session
-      for (size_t j = 0; j < i; j++) {
-        MsgBuffer &msgbuf_j = session->sslot_arr[j].pre_resp_msgbuf;
-        assert(msgbuf_j.buf != nullptr);
-        free_msg_buffer(msgbuf_j);
-      }
-
-      free(session);
-      ERPC_WARN("%s: Failed to allocate prealloc MsgBuffer.\n", issue_msg);
-      sm_pkt_udp_tx_st(sm_construct_resp(sm_pkt, SmErrType::kOutOfMemory));
-      return;
-    }
+  if (!init_server_sslots_st(session)) {
+    delete session;
+    nexus->heartbeat_mgr.unlocked_remove_remote(hb_peer_id);
+    ERPC_WARN("%s: Failed to allocate prealloc MsgBuffer.\n", issue_msg);
+    sm_pkt_tx_st(sm_construct_resp(sm_pkt, SmErrType::kOutOfMemory));
+    return;
   }
 
   // Fill-in the server endpoint
   session->server = sm_pkt.server;
   session->server.session_num = session_vec.size();
   transport->fill_local_routing_info(&session->server.routing_info);
+  session->server.datapath_sm = dp_sm.enabled;
   conn_req_token_map[session->uniq_token] = session->server.session_num;
 
   // Fill-in the client endpoint
   session->client = sm_pkt.client;
   session->client.routing_info = client_rinfo;
 
+  // Both ends derive the session key from the master key, the client's token,
+  // and a fresh nonce from us, so a replayed request doesn't reuse a key
+  session->server.crypto = session->client.crypto;
+  if (session->client.crypto != SessionCrypto::kNone) {
+    session->srv_nonce = slow_rand.next_u64();
+    session->aead =
+        nexus->new_session_aead(session->uniq_token, session->srv_nonce);
+    session->crypto = session->client.crypto;
+  }
+
   session->local_session_num = session->server.session_num;
   session->remote_session_num = session->client.session_num;
 
-  alloc_ring_entries();
+  alloc_ring_entries(Session::Role::kServer);
   session_vec.push_back(session);  // Add to list of all sessions
+  session->hb_peer_id = hb_peer_id;
+  learn_dp_sm_route_st(session->client, client_rinfo);
 
   // Add server endpoint info created above to resp. No need to add client info.
   SmPkt resp_sm_pkt = sm_construct_resp(sm_pkt, SmErrType::kNoError);
   resp_sm_pkt.server = session->server;
+  if (session->crypto != SessionCrypto::kNone) {
+    resp_sm_pkt.srv_nonce = session->srv_nonce;
+    nexus->sign_connect_resp(&resp_sm_pkt);
+  }
 
   ERPC_INFO("%s: None. Sending response.\n", issue_msg);
-  sm_pkt_udp_tx_st(resp_sm_pkt);
+  sm_pkt_tx_st(resp_sm_pkt);
   return;
 }
 
@@ -169,7 +196,8 @@ void Rpc<TTr>::handle_connect_resp_st(const SmPkt &sm_pkt) {
     ERPC_WARN("%s: Error %s.\n", issue_msg,
               sm_err_type_str(sm_pkt.err_type).c_str());
 
-    free_ring_entries();  // Free before callback to allow creating new session
+    // Free before callback to allow creating new session
+    free_ring_entries(session->role);
     sm_handler(session->local_session_num, SmEventType::kConnectFailed,
                sm_pkt.err_type, context);
     bury_session_st(session);
@@ -177,7 +205,18 @@ void Rpc<TTr>::handle_connect_resp_st(const SmPkt &sm_pkt) {
     return;
   }
 
-  // If we are here, the server has created a session endpoint
+  // If we are here, the server claims to have created a session endpoint. For
+  // protected sessions, only a holder of the master key can make this claim.
+  // Error responses are not authenticated: forging one only fails the connect,
+  // which an attacker on the path can do anyway by dropping packets.
+  if (session->crypto != SessionCrypto::kNone) {
+    if (!nexus->verify_connect_resp(sm_pkt)) {
+      ERPC_WARN("%s: Response failed authentication. Ignoring.\n", issue_msg);
+      return;
+    }
+    session->aead = nexus->new_session_aead(session->uniq_token,
+                                            sm_pkt.srv_nonce);
+  }
 
   // Try to resolve the server-provided routing info
   Transport::RoutingInfo srv_routing_info = sm_pkt.server.routing_info;
@@ -185,7 +224,7 @@ void Rpc<TTr>::handle_connect_resp_st(const SmPkt &sm_pkt) {
   if (kTesting && faults.fail_resolve_rinfo) {
     resolve_success = false;  // Inject fault
   } else {
-    resolve_success = transport->resolve_remote_routing_info(&srv_routing_info);
+    resolve_success = resolve_remote_routing_info_st(&srv_routing_info);
   }
 
   if (!resolve_success) {
@@ -202,6 +241,18 @@ void Rpc<TTr>::handle_connect_resp_st(const SmPkt &sm_pkt) {
     return;
   }
 
+  // Start tracking the server's process for failure detection
+  const uint32_t hb_peer_id =
+      nexus->heartbeat_mgr.unlocked_add_remote(sm_pkt.server.uri());
+  if (hb_peer_id == HeartbeatMgr::kInvalidPeerId) {
+    // Free server resources by disconnecting, like above
+    ERPC_WARN("%s: Too many heartbeat peers. Disconnecting.\n", issue_msg);
+    session->server = sm_pkt.server;
+    session->state = SessionState::kDisconnectInProgress;
+    send_sm_req_st(session);
+    return;
+  }
+
   // Save server endpoint metadata
   session->server = sm_pkt.server;  // This fills most fields
   session->server.routing_info = srv_routing_info;
@@ -209,6 +260,8 @@ void Rpc<TTr>::handle_connect_resp_st(const SmPkt &sm_pkt) {
   session->state = SessionState::kConnected;
 
   session->client_info.cc.prev_desired_tx_tsc = rdtsc();
+  session->hb_peer_id = hb_peer_id;
+  learn_dp_sm_route_st(session->server, srv_routing_info);
 
   ERPC_INFO("%s: None. Session connected.\n", issue_msg);
   sm_handler(session->local_session_num, SmEventType::kConnected,
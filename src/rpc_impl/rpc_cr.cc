@@ -19,6 +19,9 @@ void Rpc<TTr>::enqueue_cr_st(SSlot *sslot, const pkthdr_t *req_pkthdr) {
   cr_pkthdr->pkt_num = req_pkthdr->pkt_num;
   cr_pkthdr->req_num = req_pkthdr->req_num;
   cr_pkthdr->magic = kPktHdrMagic;
+  if (kCrypto && sslot->session->aead != nullptr) {
+    aead_seal_ctrl_st(sslot->session, cr_pkthdr);
+  }
 
   enqueue_hdr_tx_burst_st(sslot, ctrl_msgbuf, nullptr);
 }
@@ -40,6 +43,12 @@ void Rpc<TTr>::process_expl_cr_st(SSlot *sslot, const pkthdr_t *pkthdr,
     return;
   }
 
+  // Authenticate before crediting the session
+  if (kCrypto && sslot->session->aead != nullptr &&
+      unlikely(!aead_open_st(sslot->session, pkthdr, 0, nullptr))) {
+    return;
+  }
+
   // Update client tracking metadata
   if (kCcRateComp) update_timely_rate(sslot, pkthdr->pkt_num, rx_tsc);
   bump_credits(sslot->session);
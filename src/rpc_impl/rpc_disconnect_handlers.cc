@@ -25,7 +25,7 @@ void Rpc<TTr>::handle_disconnect_req_st(const SmPkt &sm_pkt) {
   Session *session = session_vec.at(session_num);
   if (session == nullptr) {
     ERPC_INFO("%s: Duplicate request. Re-sending response.\n", issue_msg);
-    sm_pkt_udp_tx_st(sm_construct_resp(sm_pkt, SmErrType::kNoError));
+    sm_pkt_tx_st(sm_construct_resp(sm_pkt, SmErrType::kNoError));
     return;
   }
 
@@ -47,10 +47,10 @@ void Rpc<TTr>::handle_disconnect_req_st(const SmPkt &sm_pkt) {
     }
   }
 
-  free_ring_entries();
+  free_ring_entries(session->role);
 
   ERPC_INFO("%s. None. Sending response.\n", issue_msg);
-  sm_pkt_udp_tx_st(sm_construct_resp(sm_pkt, SmErrType::kNoError));
+  sm_pkt_tx_st(sm_construct_resp(sm_pkt, SmErrType::kNoError));
 
   bury_session_st(session);
 }
@@ -86,7 +86,8 @@ void Rpc<TTr>::handle_disconnect_resp_st(const SmPkt &sm_pkt) {
   assert(session->server == sm_pkt.server);
 
   ERPC_INFO("%s: None. Session disconnected.\n", issue_msg);
-  free_ring_entries();  // Free before callback to allow creating a new session
+  // Free before callback to allow creating a new session
+  free_ring_entries(session->role);
   sm_handler(session->local_session_num, SmEventType::kDisconnected,
              SmErrType::kNoError, context);
   bury_session_st(session);
@@ -1,3 +1,5 @@
+#include <sys/epoll.h>
+
 #include "rpc.h"
 
 namespace erpc {
@@ -8,16 +10,22 @@ void Rpc<TTr>::run_event_loop_do_one_st() {
   dpath_stat_inc(dpath_stats.ev_loop_calls, 1);
 
   // Handle any new session management packets
-  if (unlikely(nexus_hook.sm_rx_queue.size > 0)) handle_sm_rx_st();
+  if (unlikely(!nexus_hook.sm_rx_queue.empty())) handle_sm_rx_st();
 
   // The packet RX code uses ev_loop_tsc as the RX timestamp, so it must be
   // next to ev_loop_tsc stamping.
   ev_loop_tsc = dpath_rdtsc();
   process_comps_st();  // RX
+  if (unlikely(!dp_sm.rx_queue.empty())) handle_sm_rx_st();
 
   process_credit_stall_queue_st();    // TX
   if (kCcPacing) process_wheel_st();  // TX
 
+  // Requests from application threads' producer lanes
+  if (producer_lanes.doorbell.load(std::memory_order_relaxed)) {
+    process_producer_lanes_st();
+  }
+
   // Drain all packets
   if (tx_batch_i > 0) do_tx_burst_st();
 
@@ -27,11 +35,32 @@ void Rpc<TTr>::run_event_loop_do_one_st() {
     process_bg_queues_enqueue_response_st();
   }
 
+  // Retry completions that found their completion ring full
+  if (unlikely(!comp_queue_overflow.empty())) process_comp_queue_overflow_st();
+
   // Check for packet loss if we're in a new epoch. ev_loop_tsc is stale by
   // less than one event loop iteration, which is negligible compared to epoch.
   if (unlikely(ev_loop_tsc - pkt_loss_scan_tsc > rpc_pkt_loss_scan_cycles)) {
     pkt_loss_scan_tsc = ev_loop_tsc;
     pkt_loss_scan_st();
+
+    if (dp_sm.enabled &&
+        ev_loop_tsc - dp_sm.ping_tsc >
+            nexus->heartbeat_mgr.get_hb_send_delta_tsc() / 2) {
+      dp_sm.ping_tsc = ev_loop_tsc;
+      send_dp_sm_pings_st();
+    }
+
+    // Lazily release free hugepage regions above the low watermark
+    lock_cond(&huge_alloc_lock);
+    huge_alloc->reclaim();
+    unlock_cond(&huge_alloc_lock);
+
+    if (kLazyPreRespMsgbuf &&
+        ev_loop_tsc - idle_session_scan_tsc > session_idle_cycles) {
+      idle_session_scan_tsc = ev_loop_tsc;
+      release_idle_server_sslots_st();
+    }
   }
 }
 
@@ -45,7 +74,136 @@ void Rpc<TTr>::run_event_loop_timeout_st(size_t timeout_ms) {
   while (true) {
     run_event_loop_do_one_st();  // Run at least once even if timeout_ms is 0
     if (unlikely(ev_loop_tsc - start_tsc > timeout_tsc)) break;
+
+    // Low-load mode: sleep if we've been idle, but not past the timeout
+    if (rx_intr.idle_cycles > 0 &&
+        ev_loop_tsc - rx_intr.last_rx_tsc > rx_intr.idle_cycles &&
+        can_sleep_st()) {
+      const size_t remaining_tsc = timeout_tsc - (ev_loop_tsc - start_tsc);
+      const auto remaining_us =
+          static_cast<size_t>(to_usec(remaining_tsc, freq_ghz));
+      transport->ack_rx_event();  // Clear events from an earlier arming
+      if (remaining_us > 0 && transport->arm_rx_event()) {
+        // Catch packets that arrived before arming, then sleep if still idle
+        run_event_loop_do_one_st();
+        if (ev_loop_tsc != rx_intr.last_rx_tsc && can_sleep_st()) {
+          sleep_until_rx_st(remaining_us);
+        }
+      }
+    }
+  }
+}
+
+template <class TTr>
+bool Rpc<TTr>::can_sleep_st() const {
+  assert(in_dispatch());
+  if (tx_batch_i > 0 || !stallq.empty() || !comp_queue_overflow.empty()) {
+    return false;
+  }
+
+  if (!nexus_hook.sm_rx_queue.empty() ||
+      producer_lanes.doorbell.load(std::memory_order_relaxed)) {
+    return false;
+  }
+
+  if (multi_threaded && (bg_queues._enqueue_request.size > 0 ||
+                         bg_queues._enqueue_response.size > 0)) {
+    return false;
+  }
+
+  // Packets in the timing wheel must be transmitted at their scheduled time
+  if (kCcPacing) {
+    if (!wheel->ready_queue.empty()) return false;
+    for (SSlot *s = active_rpcs_root_sentinel.client_info.next;
+         s != &active_rpcs_tail_sentinel; s = s->client_info.next) {
+      if (s->client_info.wheel_count > 0) return false;
+    }
+  }
+
+  return true;
+}
+
+template <class TTr>
+void Rpc<TTr>::sleep_until_rx_st(size_t max_sleep_us) {
+  assert(in_dispatch());
+  assert(rx_intr.epoll_fd != -1);
+
+  // While requests are outstanding, wake up in time for packet loss scans
+  size_t sleep_us = std::min(max_sleep_us, kRxIntrMaxSleepUs);
+  const bool rpcs_active =
+      active_rpcs_root_sentinel.client_info.next != &active_rpcs_tail_sentinel;
+  if (rpcs_active) {
+    const auto scan_us =
+        static_cast<size_t>(to_usec(rpc_pkt_loss_scan_cycles, freq_ghz));
+    sleep_us = std::min(sleep_us, scan_us);
+  }
+
+  rx_intr.num_sleeps++;
+  struct epoll_event ev;
+  const int timeout_ms = static_cast<int>((sleep_us + 999) / 1000);
+  int ret = epoll_wait(rx_intr.epoll_fd, &ev, 1, timeout_ms);
+  if (ret < 0 && errno != EINTR) {
+    ERPC_WARN("Rpc %u: epoll_wait() failed in low-load mode. Error %s.\n",
+              rpc_id, strerror(errno));
+  }
+
+  transport->ack_rx_event();
+}
+
+template <class TTr>
+bool Rpc<TTr>::init_rx_intr_st() {
+  assert(in_dispatch());
+  if (rx_intr.epoll_fd != -1) return true;
+
+  const int rx_event_fd = transport->get_rx_event_fd();
+  if (rx_event_fd == -1) return false;
+
+  rx_intr.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  rt_assert(rx_intr.epoll_fd != -1, "Failed to create epoll fd");
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  int ret = epoll_ctl(rx_intr.epoll_fd, EPOLL_CTL_ADD, rx_event_fd, &ev);
+  rt_assert(ret == 0, "Failed to add RX event fd to epoll fd");
+  return true;
+}
+
+template <class TTr>
+int Rpc<TTr>::set_rx_intr_idle_us(size_t idle_us) {
+  assert(in_dispatch());
+  if (idle_us == 0) {
+    rx_intr.idle_cycles = 0;
+    return 0;
   }
+
+  if (!init_rx_intr_st()) {
+    ERPC_WARN("Rpc %u: Transport does not support RX events.\n", rpc_id);
+    return -ENOTSUP;
+  }
+
+  rx_intr.idle_cycles = us_to_cycles(idle_us, freq_ghz);
+  rx_intr.last_rx_tsc = ev_loop_tsc;
+  return 0;
+}
+
+template <class TTr>
+int Rpc<TTr>::get_event_fd() {
+  assert(in_dispatch());
+  return init_rx_intr_st() ? rx_intr.epoll_fd : -1;
+}
+
+template <class TTr>
+bool Rpc<TTr>::arm_event_fd() {
+  assert(in_dispatch());
+  if (!can_sleep_st() || !init_rx_intr_st()) return false;
+
+  transport->ack_rx_event();  // Clear events left over from an earlier arming
+  if (!transport->arm_rx_event()) return false;
+
+  // Catch packets that arrived before arming
+  run_event_loop_do_one_st();
+  return ev_loop_tsc != rx_intr.last_rx_tsc && can_sleep_st();
 }
 
 FORCE_COMPILE_TRANSPORTS
@@ -5,7 +5,8 @@ namespace erpc {
 template <class TTr>
 void Rpc<TTr>::kick_req_st(SSlot *sslot) {
   assert(in_dispatch());
-  auto &credits = sslot->session->client_info.credits;
+  Session *session = sslot->session;
+  const size_t credits = avail_credits(session);
   assert(credits > 0);  // Precondition
 
   auto &ci = sslot->client_info;
@@ -21,7 +22,7 @@ void Rpc<TTr>::kick_req_st(SSlot *sslot) {
     }
 
     ci.num_tx++;
-    credits--;
+    consume_credit(session);
   }
 }
 
@@ -31,7 +32,8 @@ void Rpc<TTr>::kick_req_st(SSlot *sslot) {
 template <class TTr>
 void Rpc<TTr>::kick_rfr_st(SSlot *sslot) {
   assert(in_dispatch());
-  auto &credits = sslot->session->client_info.credits;
+  Session *session = sslot->session;
+  const size_t credits = avail_credits(session);
   auto &ci = sslot->client_info;
 
   assert(credits > 0);  // Precondition
@@ -44,7 +46,7 @@ void Rpc<TTr>::kick_rfr_st(SSlot *sslot) {
   for (size_t _x = 0; _x < sending; _x++) {
     enqueue_rfr_st(sslot, ci.resp_msgbuf->get_pkthdr_0());
     ci.num_tx++;
-    credits--;
+    consume_credit(session);
   }
 }
 
@@ -60,7 +60,8 @@ void Rpc<TTr>::pkt_loss_scan_st() {
     cur = cur->client_info.next;
   }
 
-  // Management packet loss
+  // Management packet loss. Retransmit to each remote Nexus in one batch.
+  begin_sm_tx_batch_st();
   for (uint16_t session_num : sm_pending_reqs) {
     Session *session = session_vec[session_num];
     if (session == nullptr) continue;  // XXX: Can this happen?
@@ -71,12 +72,21 @@ void Rpc<TTr>::pkt_loss_scan_st() {
         // Session management packet loss detection
         const size_t ms_elapsed =
             to_msec(rdtsc() - session->client_info.sm_req_ts, freq_ghz);
-        if (ms_elapsed > kSMTimeoutMs) send_sm_req_st(session);
+        if (ms_elapsed > kSMTimeoutMs) {
+          // The remote Rpc may have restarted with new routing info, so fall
+          // back to UDP for retransmissions. Queued packets may point to the
+          // route.
+          if (tx_batch_i > 0) do_tx_burst_st();
+          dp_sm.routes.erase(std::make_pair(session->server.uri(),
+                                            session->server.rpc_id));
+          send_sm_req_st(session);
+        }
         break;
       }
       default: break;
     }
   }
+  end_sm_tx_batch_st();
 }
 
 template <class TTr>
@@ -121,6 +131,7 @@ void Rpc<TTr>::pkt_loss_retransmit_st(SSlot *sslot) {
   ERPC_REORDER("%s: Retransmitting %s.\n", issue_msg,
                ci.num_rx < req_msgbuf->num_pkts ? "requests" : "RFRs");
   credits += delta;
+  shared_credits += delta;
   ci.num_tx = ci.num_rx;
   ci.progress_tsc = ev_loop_tsc;
 
@@ -8,7 +8,7 @@ void Rpc<TTr>::process_credit_stall_queue_st() {
   size_t write_index = 0;  // Re-add incomplete sslots at this index
 
   for (SSlot *sslot : stallq) {
-    if (sslot->session->client_info.credits > 0) {
+    if (avail_credits(sslot->session) > 0) {
       // sslots in stall queue have packets to send
       req_pkts_pending(sslot) ? kick_req_st(sslot) : kick_rfr_st(sslot);
     } else {
@@ -22,7 +22,7 @@ void Rpc<TTr>::process_credit_stall_queue_st() {
 template <class TTr>
 void Rpc<TTr>::process_wheel_st() {
   assert(in_dispatch());
-  size_t cur_tsc = dpath_rdtsc();
+  size_t cur_tsc = dpath_tsc();
   wheel->reap(cur_tsc);
 
   size_t num_ready = wheel->ready_queue.size();
@@ -60,8 +60,8 @@ void Rpc<TTr>::process_bg_queues_enqueue_request_st() {
 
   for (size_t i = 0; i < cmds_to_process; i++) {
     enq_req_args_t args = queue.unlocked_pop();
-    enqueue_request(args.session_num, args.req_type, args.req_msgbuf,
-                    args.resp_msgbuf, args.cont_func, args.tag, args.cont_etid);
+    enqueue_request_st(session_vec[static_cast<size_t>(args.session_num)],
+                       args);
   }
 }
 
@@ -73,7 +73,67 @@ void Rpc<TTr>::process_bg_queues_enqueue_response_st() {
 
   for (size_t i = 0; i < cmds_to_process; i++) {
     enq_resp_args_t enq_resp_args = queue.unlocked_pop();
-    enqueue_response(enq_resp_args.req_handle, enq_resp_args.resp_msgbuf);
+    enqueue_response_st(static_cast<SSlot *>(enq_resp_args.req_handle),
+                        enq_resp_args.resp_msgbuf);
+  }
+}
+
+template <class TTr>
+void Rpc<TTr>::process_comp_queue_overflow_st() {
+  assert(in_dispatch());
+  size_t write_index = 0;  // Re-add undelivered completions at this index
+
+  for (auto &ent : comp_queue_overflow) {
+    if (!ent.first->push(ent.second)) comp_queue_overflow[write_index++] = ent;
+  }
+
+  comp_queue_overflow.resize(write_index);
+}
+
+template <class TTr>
+ProducerLane *Rpc<TTr>::create_producer_lane(size_t capacity) {
+  assert(in_dispatch());
+  const size_t num_lanes = producer_lanes.num_lanes.load();
+  if (num_lanes == kMaxProducerLanes) {
+    ERPC_WARN("Rpc %u: Producer lane limit (%zu) reached.\n", rpc_id,
+              kMaxProducerLanes);
+    return nullptr;
+  }
+
+  // Producers may allocate MsgBuffers from now on. Until this lane is handed
+  // off, only threads that already lock the allocator use it, so it's safe to
+  // start locking it here.
+  multi_threaded = true;
+
+  auto *lane = new ProducerLane(capacity, &producer_lanes.doorbell);
+  producer_lanes.lane_arr[num_lanes] = lane;
+  producer_lanes.num_lanes.store(num_lanes + 1, std::memory_order_release);
+  return lane;
+}
+
+template <class TTr>
+void Rpc<TTr>::process_producer_lanes_st() {
+  assert(in_dispatch());
+
+  // Clear the doorbell before draining, so a submission that races with the
+  // drain re-rings it and gets picked up in the next iteration
+  producer_lanes.doorbell.exchange(false, std::memory_order_acquire);
+
+  const size_t num_lanes =
+      producer_lanes.num_lanes.load(std::memory_order_acquire);
+  enq_req_args_t args_arr[TTr::kPostlist];
+
+  for (size_t i = 0; i < num_lanes; i++) {
+    ProducerLane *lane = producer_lanes.lane_arr[i];
+    while (true) {
+      const size_t num = lane->ring.pop_burst(args_arr, TTr::kPostlist);
+      for (size_t j = 0; j < num; j++) {
+        const enq_req_args_t &args = args_arr[j];
+        enqueue_request_st(session_vec[static_cast<size_t>(args.session_num)],
+                           args);
+      }
+      if (num < TTr::kPostlist) break;
+    }
   }
 }
 
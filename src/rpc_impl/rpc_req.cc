@@ -1,33 +1,65 @@
 #include <stdexcept>
+#include <vector>
 
 #include "rpc.h"
 
 namespace erpc {
 
-// The cont_etid parameter is passed only when the event loop processes the
-// background threads' queue of enqueue_request calls.
+// The cont_etid field is set only when the event loop processes the background
+// threads' queue of enqueue_request calls.
 template <class TTr>
-void Rpc<TTr>::enqueue_request(int session_num, uint8_t req_type,
-                               MsgBuffer *req_msgbuf, MsgBuffer *resp_msgbuf,
-                               erpc_cont_func_t cont_func, void *tag,
-                               size_t cont_etid) {
-  // When called from a background thread, enqueue to the foreground thread
+void Rpc<TTr>::enqueue_request_args(const enq_req_args_t &args) {
+  // When called from a background thread, enqueue to the foreground thread.
+  // Completion queues are thread-agnostic, so they need no cont_etid.
   if (unlikely(!in_dispatch())) {
-    auto req_args = enq_req_args_t(session_num, req_type, req_msgbuf,
-                                   resp_msgbuf, cont_func, tag, get_etid());
-    bg_queues._enqueue_request.unlocked_push(req_args);
+    enq_req_args_t bg_args = args;
+    if (bg_args.comp_queue == nullptr) bg_args.cont_etid = get_etid();
+    bg_queues._enqueue_request.unlocked_push(bg_args);
     return;
   }
 
   // If we're here, we're in the dispatch thread
-  Session *session = session_vec[static_cast<size_t>(session_num)];
+  enqueue_request_st(session_vec[static_cast<size_t>(args.session_num)], args);
+}
+
+template <class TTr>
+void Rpc<TTr>::enqueue_requests(const enq_req_args_t *args_arr, size_t num) {
+  // When called from a background thread, hand the burst to the foreground
+  // thread in one queue operation
+  if (unlikely(!in_dispatch())) {
+    std::vector<enq_req_args_t> bg_args(args_arr, args_arr + num);
+    const size_t etid = get_etid();
+    for (auto &args : bg_args) {
+      if (args.comp_queue == nullptr) args.cont_etid = etid;
+    }
+    bg_queues._enqueue_request.unlocked_push_burst(bg_args.data(), num);
+    return;
+  }
+
+  // Bursts usually target one or a few sessions, so look up sessions per run
+  Session *session = nullptr;
+  int cur_session_num = -1;
+  for (size_t i = 0; i < num; i++) {
+    const enq_req_args_t &args = args_arr[i];
+    if (args.session_num != cur_session_num) {
+      cur_session_num = args.session_num;
+      session = session_vec[static_cast<size_t>(cur_session_num)];
+    }
+    enqueue_request_st(session, args);
+  }
+}
+
+template <class TTr>
+void Rpc<TTr>::enqueue_request_st(Session *session,
+                                  const enq_req_args_t &args) {
+  assert(in_dispatch());
   assert(session->is_connected());  // User is notified before we disconnect
+  MsgBuffer *req_msgbuf = args.req_msgbuf;
+  assert(!req_msgbuf->buffer.trusted);  // Trusted memory is not NIC-registered
 
   // If a free sslot is unavailable, save to session backlog
   if (unlikely(session->client_info.sslot_free_vec.size() == 0)) {
-    session->client_info.enq_req_backlog.emplace(session_num, req_type,
-                                                 req_msgbuf, resp_msgbuf,
-                                                 cont_func, tag, cont_etid);
+    session->client_info.enq_req_backlog.push(args);
     return;
   }
 
@@ -39,19 +71,20 @@ void Rpc<TTr>::enqueue_request(int session_num, uint8_t req_type,
   sslot.cur_req_num += kSessionReqWindow;  // Move to next request
 
   auto &ci = sslot.client_info;
-  ci.resp_msgbuf = resp_msgbuf;
-  ci.cont_func = cont_func;
-  ci.tag = tag;
+  ci.resp_msgbuf = args.resp_msgbuf;
+  ci.cont_func = args.cont_func;
+  ci.comp_queue = args.comp_queue;
+  ci.tag = args.tag;
   ci.progress_tsc = ev_loop_tsc;
   add_to_active_rpc_list(sslot);
 
   ci.num_rx = 0;
   ci.num_tx = 0;
-  ci.cont_etid = cont_etid;
+  ci.cont_etid = args.cont_etid;
 
   // Fill in packet 0's header
   pkthdr_t *pkthdr_0 = req_msgbuf->get_pkthdr_0();
-  pkthdr_0->req_type = req_type;
+  pkthdr_0->req_type = args.req_type;
   pkthdr_0->msg_size = req_msgbuf->data_size;
   pkthdr_0->dest_session_num = session->remote_session_num;
   pkthdr_0->pkt_type = kPktTypeReq;
@@ -67,7 +100,11 @@ void Rpc<TTr>::enqueue_request(int session_num, uint8_t req_type,
     }
   }
 
-  if (likely(session->client_info.credits > 0)) {
+  if (kCrypto && session->aead != nullptr) {
+    aead_seal_msgbuf_st(session, req_msgbuf);
+  }
+
+  if (likely(avail_credits(session) > 0)) {
     kick_req_st(&sslot);
   } else {
     stallq.push_back(&sslot);
@@ -110,9 +147,23 @@ void Rpc<TTr>::process_small_req_st(SSlot *sslot, pkthdr_t *pkthdr) {
   // If we're here, this is the first (and only) packet of this new request
   assert(pkthdr->req_num == sslot->cur_req_num + kSessionReqWindow);
 
+  // Authenticate and decrypt before changing any state
+  if (kCrypto && sslot->session->aead != nullptr &&
+      unlikely(!aead_open_st(sslot->session, pkthdr, 0, nullptr))) {
+    return;
+  }
+
   auto &req_msgbuf = sslot->server_info.req_msgbuf;
   assert(req_msgbuf.is_buried());  // Buried on prev req's enqueue_response()
 
+  if (kLazyPreRespMsgbuf && unlikely(sslot->pre_resp_msgbuf.buf == nullptr)) {
+    if (unlikely(!alloc_pre_resp_msgbuf_st(sslot))) {
+      ERPC_WARN("Rpc %u: Failed to allocate prealloc MsgBuffer. Dropping.\n",
+                rpc_id);
+      return;  // The client will retransmit
+    }
+  }
+
   // Bury the previous, possibly dynamic response (sslot->tx_msgbuf). This marks
   // the response for cur_req_num as unavailable.
   bury_resp_msgbuf_server_st(sslot);
@@ -137,15 +188,17 @@ void Rpc<TTr>::process_small_req_st(SSlot *sslot, pkthdr_t *pkthdr) {
       // request msgbuf to the duration of req_func.
       req_msgbuf = MsgBuffer(pkthdr, pkthdr->msg_size);
     } else {
-      req_msgbuf = alloc_msg_buffer(pkthdr->msg_size);
+      req_msgbuf = alloc_msg_buffer(pkthdr->msg_size, req_msgbuf_placement);
       memcpy(req_msgbuf.buf, pkthdr + 1, pkthdr->msg_size);  // Omit header
+      count_enclave_copy(&req_msgbuf, pkthdr->msg_size);
     }
     req_func.req_func(static_cast<ReqHandle *>(sslot), context);
     return;
   } else {
     // Background request handlers need an RX ring--independent request copy
-    req_msgbuf = alloc_msg_buffer(pkthdr->msg_size);
+    req_msgbuf = alloc_msg_buffer(pkthdr->msg_size, req_msgbuf_placement);
     memcpy(req_msgbuf.buf, pkthdr + 1, pkthdr->msg_size);  // Omit header
+    count_enclave_copy(&req_msgbuf, pkthdr->msg_size);
     submit_bg_req_st(sslot);
     return;
   }
@@ -205,16 +258,34 @@ void Rpc<TTr>::process_large_req_one_st(SSlot *sslot, const pkthdr_t *pkthdr) {
 
   MsgBuffer &req_msgbuf = sslot->server_info.req_msgbuf;
 
+  // Authenticate and decrypt before changing any state. Packets after the
+  // first are opened straight from the RX ring into the request MsgBuffer.
+  const bool fused_open =
+      kCrypto && sslot->session->aead != nullptr && pkthdr->pkt_num > 0;
+  if (kCrypto && sslot->session->aead != nullptr &&
+      unlikely(!aead_open_st(sslot->session, pkthdr, pkthdr->pkt_num,
+                             fused_open ? &req_msgbuf : nullptr))) {
+    return;
+  }
+
   // Allocate or locate the request MsgBuffer
   if (pkthdr->pkt_num == 0) {
     // This is the first packet received for this request
     assert(req_msgbuf.is_buried());  // Buried on prev req's enqueue_response()
 
+    if (kLazyPreRespMsgbuf && unlikely(sslot->pre_resp_msgbuf.buf == nullptr)) {
+      if (unlikely(!alloc_pre_resp_msgbuf_st(sslot))) {
+        ERPC_WARN("Rpc %u: Failed to allocate prealloc MsgBuffer. Dropping.\n",
+                  rpc_id);
+        return;  // The client will retransmit
+      }
+    }
+
     // Bury the previous, possibly dynamic response. This marks the response for
     // cur_req_num as unavailable.
     bury_resp_msgbuf_server_st(sslot);
 
-    req_msgbuf = alloc_msg_buffer(pkthdr->msg_size);
+    req_msgbuf = alloc_msg_buffer(pkthdr->msg_size, req_msgbuf_placement);
     assert(req_msgbuf.buf != nullptr);
 
     // Update sslot tracking
@@ -228,7 +299,9 @@ void Rpc<TTr>::process_large_req_one_st(SSlot *sslot, const pkthdr_t *pkthdr) {
   // Send a credit return for every request packet except the last in sequence
   if (pkthdr->pkt_num != req_msgbuf.num_pkts - 1) enqueue_cr_st(sslot, pkthdr);
 
-  copy_data_to_msgbuf(&req_msgbuf, pkthdr->pkt_num, pkthdr);  // Omits header
+  if (!fused_open) {
+    copy_data_to_msgbuf(&req_msgbuf, pkthdr->pkt_num, pkthdr);  // Omits header
+  }
 
   // Invoke the request handler iff we have all the request packets
   if (sslot->server_info.num_rx != req_msgbuf.num_pkts) return;
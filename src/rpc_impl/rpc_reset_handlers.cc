@@ -31,7 +31,12 @@ bool Rpc<TTr>::handle_reset_client_st(Session *session) {
 
       MsgBuffer *resp_msgbuf = sslot.client_info.resp_msgbuf;
       resize_msg_buffer(resp_msgbuf, 0);  // 0 response size marks the error
-      sslot.client_info.cont_func(context, sslot.client_info.tag);
+      if (sslot.client_info.comp_queue != nullptr) {
+        deliver_completion_st(sslot.client_info.comp_queue,
+                              sslot.client_info.tag, resp_msgbuf);
+      } else {
+        sslot.client_info.cont_func(context, sslot.client_info.tag);
+      }
     }
   }
 
@@ -42,7 +47,8 @@ bool Rpc<TTr>::handle_reset_client_st(Session *session) {
 
   // Act similar to handling a disconnect response
   ERPC_INFO("%s: None. Session resetted.\n", issue_msg);
-  free_ring_entries();  // Free before callback to allow creating new session
+  // Free before callback to allow creating new session
+  free_ring_entries(session->role);
   sm_handler(session->local_session_num, SmEventType::kDisconnected,
              SmErrType::kSrvDisconnected, context);
   bury_session_st(session);
@@ -69,7 +75,7 @@ bool Rpc<TTr>::handle_reset_server_st(Session *session) {
   if (pending_enqueue_resps == 0) {
     // Act similar to handling a disconnect request, but don't send SM response
     ERPC_INFO("%s: None. Session resetted.\n", issue_msg);
-    free_ring_entries();
+    free_ring_entries(session->role);
     bury_session_st(session);
     return true;
   } else {
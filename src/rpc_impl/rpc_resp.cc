@@ -17,7 +17,28 @@ void Rpc<TTr>::enqueue_response(ReqHandle *req_handle, MsgBuffer *resp_msgbuf) {
   }
 
   // If we're here, we're in the dispatch thread
-  SSlot *sslot = static_cast<SSlot *>(req_handle);
+  enqueue_response_st(static_cast<SSlot *>(req_handle), resp_msgbuf);
+}
+
+template <class TTr>
+void Rpc<TTr>::enqueue_responses(const enq_resp_args_t *args_arr, size_t num) {
+  // When called from a background thread, hand the burst to the foreground
+  // thread in one queue operation
+  if (unlikely(!in_dispatch())) {
+    bg_queues._enqueue_response.unlocked_push_burst(args_arr, num);
+    return;
+  }
+
+  for (size_t i = 0; i < num; i++) {
+    enqueue_response_st(static_cast<SSlot *>(args_arr[i].req_handle),
+                        args_arr[i].resp_msgbuf);
+  }
+}
+
+template <class TTr>
+void Rpc<TTr>::enqueue_response_st(SSlot *sslot, MsgBuffer *resp_msgbuf) {
+  assert(in_dispatch());
+  assert(!resp_msgbuf->buffer.trusted);  // Trusted memory is not NIC-registered
   sslot->server_info.sav_num_req_pkts = sslot->server_info.req_msgbuf.num_pkts;
   bury_req_msgbuf_server_st(sslot);  // Bury the possibly-dynamic req MsgBuffer
 
@@ -36,9 +57,13 @@ void Rpc<TTr>::enqueue_response(ReqHandle *req_handle, MsgBuffer *resp_msgbuf) {
     return;  // During session reset, don't add packets to TX burst
   }
 
-  // Fill in packet 0's header
+  // Fill in packet 0's header. A MsgBuffer from this request type's pool
+  // already has its constant fields.
   pkthdr_t *resp_pkthdr_0 = resp_msgbuf->get_pkthdr_0();
-  resp_pkthdr_0->req_type = sslot->server_info.req_type;
+  if (!resp_msgbuf->buffer.pooled ||
+      unlikely(resp_pkthdr_0->req_type != sslot->server_info.req_type)) {
+    resp_pkthdr_0->req_type = sslot->server_info.req_type;
+  }
   resp_pkthdr_0->msg_size = resp_msgbuf->data_size;
   resp_pkthdr_0->dest_session_num = session->remote_session_num;
   resp_pkthdr_0->pkt_type = kPktTypeResp;
@@ -59,11 +84,16 @@ void Rpc<TTr>::enqueue_response(ReqHandle *req_handle, MsgBuffer *resp_msgbuf) {
   // Fill in the slot and reset queueing progress
   assert(sslot->tx_msgbuf == nullptr);  // Buried before calling request handler
   sslot->tx_msgbuf = resp_msgbuf;       // Mark response as valid
+  sslot->server_info.resp_req_type = sslot->server_info.req_type;
 
   // Mark enqueue_response() as completed
   assert(sslot->server_info.req_type != kInvalidReqType);
   sslot->server_info.req_type = kInvalidReqType;
 
+  if (kCrypto && session->aead != nullptr) {
+    aead_seal_msgbuf_st(session, resp_msgbuf);
+  }
+
   enqueue_pkt_tx_burst_st(sslot, 0, nullptr);  // 0 = packet index, not pkt_num
 }
 
@@ -87,6 +117,20 @@ void Rpc<TTr>::process_resp_one_st(SSlot *sslot, const pkthdr_t *pkthdr,
   auto &ci = sslot->client_info;
   MsgBuffer *resp_msgbuf = ci.resp_msgbuf;
 
+  // Authenticate and decrypt before changing any state. The payload is
+  // decrypted (or only copied, for MAC-only sessions) straight from the RX
+  // ring into the response MsgBuffer.
+  const bool fused_open = kCrypto && sslot->session->aead != nullptr;
+  if (fused_open) {
+    const size_t pkt_idx =
+        pkthdr->msg_size <= TTr::kMaxDataPerPkt
+            ? 0
+            : resp_ntoi(pkthdr->pkt_num, sslot->tx_msgbuf->num_pkts);
+    if (unlikely(!aead_open_st(sslot->session, pkthdr, pkt_idx, resp_msgbuf))) {
+      return;
+    }
+  }
+
   // Update client tracking metadata
   if (kCcRateComp) update_timely_rate(sslot, pkthdr->pkt_num, rx_tsc);
   bump_credits(sslot->session);
@@ -99,9 +143,11 @@ void Rpc<TTr>::process_resp_one_st(SSlot *sslot, const pkthdr_t *pkthdr,
 
     // Copy eRPC header and data (but not Transport headroom). The eRPC header
     // will be needed (e.g., to determine the request type) if the continuation
-    // runs in a background thread.
+    // runs in a background thread. Protected sessions' data was already
+    // written to resp_msgbuf.
     memcpy(resp_msgbuf->get_pkthdr_0()->ehdrptr(), pkthdr->ehdrptr(),
-           pkthdr->msg_size + sizeof(pkthdr_t) - kHeadroom);
+           (fused_open ? 0 : pkthdr->msg_size) + sizeof(pkthdr_t) - kHeadroom);
+    if (!fused_open) count_enclave_copy(resp_msgbuf, pkthdr->msg_size);
 
     // Fall through to invoke continuation
   } else {
@@ -120,7 +166,7 @@ void Rpc<TTr>::process_resp_one_st(SSlot *sslot, const pkthdr_t *pkthdr,
 
     // Hdr 0 was copied earlier, other headers are unneeded, so copy just data.
     const size_t pkt_idx = resp_ntoi(pkthdr->pkt_num, req_msgbuf->num_pkts);
-    copy_data_to_msgbuf(resp_msgbuf, pkt_idx, pkthdr);
+    if (!fused_open) copy_data_to_msgbuf(resp_msgbuf, pkt_idx, pkthdr);
 
     if (ci.num_rx != wire_pkts(req_msgbuf, resp_msgbuf)) return;
     // Else fall through to invoke continuation
@@ -135,6 +181,11 @@ void Rpc<TTr>::process_resp_one_st(SSlot *sslot, const pkthdr_t *pkthdr,
   //    corresponding packets received for packets in the wheel.
   assert(ci.wheel_count == 0);
 
+  // Sealing the request again with the same nonces restores its plaintext
+  if (kCrypto && sslot->session->crypto == SessionCrypto::kAead) {
+    aead_seal_msgbuf_st(sslot->session, sslot->tx_msgbuf);
+  }
+
   sslot->tx_msgbuf = nullptr;  // Mark response as received
   delete_from_active_rpc_list(*sslot);
 
@@ -142,6 +193,7 @@ void Rpc<TTr>::process_resp_one_st(SSlot *sslot, const pkthdr_t *pkthdr,
   // immediately if there are backlogged requests, or much later from a request
   // enqueued by a background thread.
   const erpc_cont_func_t _cont_func = ci.cont_func;
+  CompletionQueue *_comp_queue = ci.comp_queue;
   void *_tag = ci.tag;
   const size_t _cont_etid = ci.cont_etid;
 
@@ -152,13 +204,13 @@ void Rpc<TTr>::process_resp_one_st(SSlot *sslot, const pkthdr_t *pkthdr,
   if (!session->client_info.enq_req_backlog.empty()) {
     // We just got a new sslot, and we should have no more if there's backlog
     assert(session->client_info.sslot_free_vec.size() == 1);
-    enq_req_args_t &args = session->client_info.enq_req_backlog.front();
-    enqueue_request(args.session_num, args.req_type, args.req_msgbuf,
-                    args.resp_msgbuf, args.cont_func, args.tag, args.cont_etid);
+    enqueue_request_args(session->client_info.enq_req_backlog.front());
     session->client_info.enq_req_backlog.pop();
   }
 
-  if (likely(_cont_etid == kInvalidBgETid)) {
+  if (_comp_queue != nullptr) {
+    deliver_completion_st(_comp_queue, _tag, resp_msgbuf);
+  } else if (likely(_cont_etid == kInvalidBgETid)) {
     _cont_func(context, _tag);
   } else {
     submit_bg_resp_st(_cont_func, _tag, _cont_etid);
@@ -19,6 +19,9 @@ void Rpc<TTr>::enqueue_rfr_st(SSlot *sslot, const pkthdr_t *resp_pkthdr) {
   rfr_pkthdr->pkt_num = sslot->client_info.num_tx;
   rfr_pkthdr->req_num = resp_pkthdr->req_num;
   rfr_pkthdr->magic = kPktHdrMagic;
+  if (kCrypto && sslot->session->aead != nullptr) {
+    aead_seal_ctrl_st(sslot->session, rfr_pkthdr);
+  }
 
   enqueue_hdr_tx_burst_st(
       sslot, ctrl_msgbuf,
@@ -31,6 +34,12 @@ void Rpc<TTr>::process_rfr_st(SSlot *sslot, const pkthdr_t *pkthdr) {
   assert(!sslot->is_client);
   auto &si = sslot->server_info;
 
+  // Authenticate first, since even a past RFR makes us re-send a response
+  if (kCrypto && sslot->session->aead != nullptr &&
+      unlikely(!aead_open_st(sslot->session, pkthdr, 0, nullptr))) {
+    return;
+  }
+
   // Handle reordering. If request numbers match, then we have not reset num_rx.
   assert(pkthdr->req_num <= sslot->cur_req_num);
   bool in_order =
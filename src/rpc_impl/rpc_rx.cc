@@ -1,3 +1,7 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "rpc.h"
 
 namespace erpc {
@@ -5,72 +9,176 @@ namespace erpc {
 template <class TTr>
 void Rpc<TTr>::process_comps_st() {
   assert(in_dispatch());
-  size_t num_pkts = transport->rx_burst();
+  const size_t num_pkts = transport->rx_burst();
   if (num_pkts == 0) return;
+  rx_intr.last_rx_tsc = ev_loop_tsc;
 
   // Measure RX burst size
   dpath_stat_inc(dpath_stats.rx_burst_calls, 1);
   dpath_stat_inc(dpath_stats.pkts_rx, num_pkts);
 
-  // ev_loop_tsc was taken just before calling the packet RX code
-  const size_t &batch_rx_tsc = ev_loop_tsc;
+  for (size_t i = 0; i < num_pkts; i += kRxClassifyBatch) {
+    process_comps_batch_st(std::min(kRxClassifyBatch, num_pkts - i));
+  }
+
+  // Technically, these RECVs can be posted immediately after rx_burst(), or
+  // even in the rx_burst() code.
+  transport->post_recvs(num_pkts);
+}
+
+template <class TTr>
+void Rpc<TTr>::process_comps_batch_st(size_t num_pkts) {
+  assert(in_dispatch());
+  assert(num_pkts > 0 && num_pkts <= kRxClassifyBatch);
+
+  // Gather the magic and packet type bytes of all packets into SIMD lanes.
+  // Unused lanes stay zero, which never matches the non-zero magic.
+  pkthdr_t *pkthdr_arr[kRxClassifyBatch];
+  alignas(16) uint8_t magic_bytes[kRxClassifyBatch] = {};
+  alignas(16) uint8_t type_bytes[kRxClassifyBatch] = {};
 
   for (size_t i = 0; i < num_pkts; i++) {
     auto *pkthdr = reinterpret_cast<pkthdr_t *>(rx_ring[rx_ring_head]);
     rx_ring_head = (rx_ring_head + 1) % Transport::kNumRxRingEntries;
+    pkthdr_arr[i] = pkthdr;
 
-    if (unlikely(!pkthdr->check_magic())) {
-      ERPC_WARN("Rpc %u: Received packet %s with bad magic number. Dropping.\n", rpc_id, pkthdr->to_string().c_str());
-      continue;
-    }
-    assert(pkthdr->msg_size <= kMaxMsgSize);  // msg_size can be 0 here
+    const uint8_t *ehdr = pkthdr->ehdrptr();
+    magic_bytes[i] = ehdr[kEhdrMagicByte];
+    type_bytes[i] = ehdr[kEhdrPktTypeByte];
 
-    Session *session = session_vec[pkthdr->dest_session_num];
-    if (unlikely(session == nullptr)) {
-      ERPC_WARN("Rpc %u: Received %s for buried session. Dropping.\n", rpc_id,
-                pkthdr->to_string().c_str());
-      continue;
+    // The session pointer's address needs only the header. Out-of-range
+    // session numbers are caught in process_pkt_st(); prefetch cannot fault.
+    __builtin_prefetch(session_vec.data() + pkthdr->dest_session_num, 0, 3);
+  }
+
+  uint32_t type_mask[4];  // Bit i is set iff packet i is valid and of type t
+
+#ifdef __SSE2__
+  const __m128i magic_v = _mm_and_si128(
+      _mm_load_si128(reinterpret_cast<const __m128i *>(magic_bytes)),
+      _mm_set1_epi8(static_cast<char>(0xf0)));
+  const uint32_t valid_mask = static_cast<uint32_t>(_mm_movemask_epi8(
+      _mm_cmpeq_epi8(magic_v,
+                     _mm_set1_epi8(static_cast<char>(kPktHdrMagic << 4)))));
+
+  const __m128i type_v = _mm_and_si128(
+      _mm_load_si128(reinterpret_cast<const __m128i *>(type_bytes)),
+      _mm_set1_epi8(0x3));
+  for (size_t t = 0; t < 4; t++) {
+    type_mask[t] = valid_mask &
+                   static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(
+                       type_v, _mm_set1_epi8(static_cast<char>(t)))));
+  }
+#else
+  uint32_t valid_mask = 0;
+  for (size_t t = 0; t < 4; t++) type_mask[t] = 0;
+  for (size_t i = 0; i < num_pkts; i++) {
+    if ((magic_bytes[i] >> 4) != kPktHdrMagic) continue;
+    valid_mask |= (1u << i);
+    type_mask[type_bytes[i] & 0x3] |= (1u << i);
+  }
+#endif
+
+  const uint32_t all_mask = (1u << num_pkts) - 1;
+  if (unlikely(valid_mask != all_mask)) {
+    uint32_t bad_mask = all_mask & ~valid_mask;
+    while (bad_mask != 0) {
+      const size_t i = static_cast<size_t>(__builtin_ctz(bad_mask));
+      bad_mask &= bad_mask - 1;
+      ERPC_WARN("Rpc %u: Received packet %s with bad magic number. Dropping.\n",
+                rpc_id, pkthdr_arr[i]->to_string().c_str());
     }
+  }
 
-    if (unlikely(!session->is_connected())) {
-      ERPC_WARN(
-          "Rpc %u: Received %s for unconnected session (state %s). Dropping.\n",
-          rpc_id, pkthdr->to_string().c_str(),
-          session_state_str(session->state).c_str());
-      continue;
+  // Flatten the per-type groups into the dispatch order
+  static constexpr PktType kDispatchOrder[4] = {
+      kPktTypeExplCR, kPktTypeResp, kPktTypeReq, kPktTypeRFR};
+  pkthdr_t *order[kRxClassifyBatch];
+  size_t num_valid = 0;
+  for (PktType t : kDispatchOrder) {
+    uint32_t m = type_mask[t];
+    while (m != 0) {
+      order[num_valid++] = pkthdr_arr[__builtin_ctz(m)];
+      m &= m - 1;
     }
+  }
 
-    // If we are here, we have a valid packet for a connected session
-    ERPC_TRACE(
-        "Rpc %u, lsn %u (%s): RX %s.\n", rpc_id, session->local_session_num,
-        session->get_remote_hostname().c_str(), pkthdr->to_string().c_str());
-
-    size_t sslot_i = pkthdr->req_num % kSessionReqWindow;  // Bit shift
-    SSlot *sslot = &session->sslot_arr[sslot_i];
-
-    switch (pkthdr->pkt_type) {
-      case PktType::kPktTypeReq:
-        pkthdr->msg_size <= TTr::kMaxDataPerPkt
-            ? process_small_req_st(sslot, pkthdr)
-            : process_large_req_one_st(sslot, pkthdr);
-        break;
-      case PktType::kPktTypeResp: {
-        size_t rx_tsc = kCcOptBatchTsc ? batch_rx_tsc : dpath_rdtsc();
-        process_resp_one_st(sslot, pkthdr, rx_tsc);
-        break;
-      }
-      case PktType::kPktTypeRFR: process_rfr_st(sslot, pkthdr); break;
-      case PktType::kPktTypeExplCR: {
-        size_t rx_tsc = kCcOptBatchTsc ? batch_rx_tsc : dpath_rdtsc();
-        process_expl_cr_st(sslot, pkthdr, rx_tsc);
-        break;
+  for (size_t i = 0; i < num_valid; i++) {
+    if (i + kRxPrefetchDistance < num_valid) {
+      const pkthdr_t *next = order[i + kRxPrefetchDistance];
+      if (likely(next->dest_session_num < session_vec.size())) {
+        Session *session = session_vec[next->dest_session_num];
+        if (session != nullptr) {
+          __builtin_prefetch(session, 0, 3);
+          __builtin_prefetch(
+              &session->sslot_arr[next->req_num % kSessionReqWindow], 1, 3);
+        }
       }
     }
+
+    process_pkt_st(order[i]);
   }
+}
 
-  // Technically, these RECVs can be posted immediately after rx_burst(), or
-  // even in the rx_burst() code.
-  transport->post_recvs(num_pkts);
+template <class TTr>
+void Rpc<TTr>::process_pkt_st(pkthdr_t *pkthdr) {
+  assert(in_dispatch());
+  assert(pkthdr->check_magic());
+  assert(pkthdr->msg_size <= kMaxMsgSize);  // msg_size can be 0 here
+
+  if (unlikely(pkthdr->dest_session_num >= session_vec.size() ||
+               session_vec[pkthdr->dest_session_num] == nullptr)) {
+    if (pkthdr->dest_session_num == kSmSessionNum) {
+      process_sm_pkt_dp_st(pkthdr);
+      return;
+    }
+
+    ERPC_WARN("Rpc %u: Received %s for buried session. Dropping.\n", rpc_id,
+              pkthdr->to_string().c_str());
+    return;
+  }
+
+  Session *session = session_vec[pkthdr->dest_session_num];
+  if (unlikely(!session->is_connected())) {
+    ERPC_WARN(
+        "Rpc %u: Received %s for unconnected session (state %s). Dropping.\n",
+        rpc_id, pkthdr->to_string().c_str(),
+        session_state_str(session->state).c_str());
+    return;
+  }
+
+  // If we are here, we have a valid packet for a connected session
+  ERPC_TRACE("Rpc %u, lsn %u (%s): RX %s.\n", rpc_id,
+             session->local_session_num,
+             session->get_remote_hostname().c_str(),
+             pkthdr->to_string().c_str());
+
+  size_t sslot_i = pkthdr->req_num % kSessionReqWindow;  // Bit shift
+  SSlot *sslot = &session->sslot_arr[sslot_i];
+  if (kLazyPreRespMsgbuf) session->last_rx_tsc = ev_loop_tsc;
+  hb_rx_tsc[session->hb_peer_id] = ev_loop_tsc;  // Liveness evidence
+
+  // ev_loop_tsc was taken just before calling the packet RX code
+  const size_t &batch_rx_tsc = ev_loop_tsc;
+
+  switch (pkthdr->pkt_type) {
+    case PktType::kPktTypeReq:
+      pkthdr->msg_size <= TTr::kMaxDataPerPkt
+          ? process_small_req_st(sslot, pkthdr)
+          : process_large_req_one_st(sslot, pkthdr);
+      break;
+    case PktType::kPktTypeResp: {
+      size_t rx_tsc = kCcOptBatchTsc ? batch_rx_tsc : dpath_tsc();
+      process_resp_one_st(sslot, pkthdr, rx_tsc);
+      break;
+    }
+    case PktType::kPktTypeRFR: process_rfr_st(sslot, pkthdr); break;
+    case PktType::kPktTypeExplCR: {
+      size_t rx_tsc = kCcOptBatchTsc ? batch_rx_tsc : dpath_tsc();
+      process_expl_cr_st(sslot, pkthdr, rx_tsc);
+      break;
+    }
+  }
 }
 
 template <class TTr>
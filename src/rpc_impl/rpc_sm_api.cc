@@ -12,7 +12,8 @@ namespace erpc {
 // This function is not on the critical path and is exposed to the user,
 // so the args checking is always enabled.
 template <class TTr>
-int Rpc<TTr>::create_session_st(std::string remote_uri, uint8_t rem_rpc_id) {
+int Rpc<TTr>::create_session_st(std::string remote_uri, uint8_t rem_rpc_id,
+                                 SessionCrypto crypto) {
   char issue_msg[kMaxIssueMsgLen];  // The basic issue message
   sprintf(issue_msg, "Rpc %u: create_session() failed. Issue", rpc_id);
 
@@ -38,8 +39,14 @@ int Rpc<TTr>::create_session_st(std::string remote_uri, uint8_t rem_rpc_id) {
     return -EINVAL;
   }
 
+  // Protected sessions need a key to derive the session key from
+  if (crypto != SessionCrypto::kNone && !nexus->aead_key_set) {
+    ERPC_WARN("%s: No AEAD key set in the Nexus.\n", issue_msg);
+    return -ENOTSUP;
+  }
+
   // Ensure that we have ring buffers for this session
-  if (!have_ring_entries()) {
+  if (!have_ring_entries(Session::Role::kClient)) {
     ERPC_WARN("%s: Ring buffers exhausted.\n", issue_msg);
     return -ENOMEM;
   }
@@ -48,6 +55,7 @@ int Rpc<TTr>::create_session_st(std::string remote_uri, uint8_t rem_rpc_id) {
                               get_freq_ghz(), transport->get_bandwidth());
   session->state = SessionState::kConnectInProgress;
   session->local_session_num = session_vec.size();
+  session->crypto = crypto;  // The key is derived from the connect response
 
   // Fill in client and server endpoint metadata. Commented server fields will
   // be filled when the connect response is received.
@@ -58,6 +66,8 @@ int Rpc<TTr>::create_session_st(std::string remote_uri, uint8_t rem_rpc_id) {
   client_endpoint.rpc_id = rpc_id;
   client_endpoint.session_num = session->local_session_num;
   transport->fill_local_routing_info(&client_endpoint.routing_info);
+  client_endpoint.datapath_sm = dp_sm.enabled;
+  client_endpoint.crypto = crypto;
 
   SessionEndpoint &server_endpoint = session->server;
   server_endpoint.transport_type = transport->transport_type;
@@ -67,13 +77,40 @@ int Rpc<TTr>::create_session_st(std::string remote_uri, uint8_t rem_rpc_id) {
   // server_endpoint.session_num = ??
   // server_endpoint.routing_info = ??
 
-  alloc_ring_entries();
+  alloc_ring_entries(Session::Role::kClient);
   session_vec.push_back(session);  // Add to list of all sessions
 
   send_sm_req_st(session);
   return client_endpoint.session_num;
 }
 
+template <class TTr>
+int Rpc<TTr>::create_sessions(
+    const std::vector<std::pair<std::string, uint8_t>> &remotes,
+    std::vector<int> *session_nums) {
+  char issue_msg[kMaxIssueMsgLen];  // The basic issue message
+  sprintf(issue_msg, "Rpc %u: create_sessions() failed. Issue", rpc_id);
+
+  if (!in_dispatch()) {
+    ERPC_WARN("%s: Caller thread is not the creator thread.\n", issue_msg);
+    return -EPERM;
+  }
+
+  // Queue the connect requests, and send them per remote Nexus at the end
+  int num_created = 0;
+  session_nums->clear();
+  begin_sm_tx_batch_st();
+  for (const auto &remote : remotes) {
+    const int session_num = create_session_st(remote.first, remote.second,
+                                              SessionCrypto::kNone);
+    session_nums->push_back(session_num);
+    if (session_num >= 0) num_created++;
+  }
+  end_sm_tx_batch_st();
+
+  return num_created;
+}
+
 template <class TTr>
 int Rpc<TTr>::destroy_session_st(int session_num) {
   char issue_msg[kMaxIssueMsgLen];  // The basic issue message
@@ -140,6 +177,33 @@ int Rpc<TTr>::destroy_session_st(int session_num) {
   }
 }
 
+template <class TTr>
+int Rpc<TTr>::enable_shared_credits(size_t num_credits) {
+  char issue_msg[kMaxIssueMsgLen];  // The basic issue message
+  sprintf(issue_msg, "Rpc %u: enable_shared_credits() failed. Issue", rpc_id);
+
+  if (!in_dispatch()) {
+    ERPC_WARN("%s: Caller thread is not the creator thread.\n", issue_msg);
+    return -EPERM;
+  }
+
+  if (shared_credits_enabled || !session_vec.empty()) {
+    ERPC_WARN("%s: Sessions already exist.\n", issue_msg);
+    return -EPERM;
+  }
+
+  if (num_credits == 0 || num_credits > ring_entries_available) {
+    ERPC_WARN("%s: Invalid number of credits %zu.\n", issue_msg, num_credits);
+    return -EINVAL;
+  }
+
+  // Reserve ring entries for the pool once, instead of per client session
+  ring_entries_available -= num_credits;
+  shared_credits = num_credits;
+  shared_credits_enabled = true;
+  return 0;
+}
+
 template <class TTr>
 size_t Rpc<TTr>::num_active_sessions_st() {
   assert(in_dispatch());
@@ -2,6 +2,7 @@
  * @file rpc_sm_helpers.cc
  * @brief Session management helper methods
  */
+#include <algorithm>
 #include "rpc.h"
 
 namespace erpc {
@@ -9,31 +10,45 @@ namespace erpc {
 template <class TTr>
 void Rpc<TTr>::handle_sm_rx_st() {
   assert(in_dispatch());
-  MtQueue<SmWorkItem> &queue = nexus_hook.sm_rx_queue;
+  SmPkt sm_pkts[kMaxSmPktBatch];
 
-  while (queue.size > 0) {
-    const SmWorkItem wi = queue.unlocked_pop();
-    assert(!wi.is_reset());
+  // Respond to a batch of requests, or send requests caused by a batch of
+  // responses, in one datagram per remote Nexus
+  begin_sm_tx_batch_st();
+  while (true) {
+    const size_t num_pkts =
+        nexus_hook.sm_rx_queue.pop_burst(sm_pkts, kMaxSmPktBatch);
+    if (num_pkts == 0) break;
 
-    // Here, it's not a reset item, so we have a valid SM packet
-    const SmPkt sm_pkt = wi.sm_pkt;
+    for (size_t i = 0; i < num_pkts; i++) handle_sm_pkt_st(sm_pkts[i]);
+  }
 
-    // If it's an SM response, remove pending requests for this session
-    if (sm_pkt.is_resp() &&
-        sm_pending_reqs.count(sm_pkt.client.session_num) > 0) {
-      sm_pending_reqs.erase(sm_pending_reqs.find(sm_pkt.client.session_num));
-    }
+  // Handlers may queue more datapath packets, so don't iterate the queue
+  while (!dp_sm.rx_queue.empty()) {
+    std::vector<SmPkt> dp_sm_pkts;
+    dp_sm_pkts.swap(dp_sm.rx_queue);
+    for (const SmPkt &sm_pkt : dp_sm_pkts) handle_sm_pkt_st(sm_pkt);
+  }
+  end_sm_tx_batch_st();
+}
 
-    switch (wi.sm_pkt.pkt_type) {
-      case SmPktType::kConnectReq: handle_connect_req_st(sm_pkt); break;
-      case SmPktType::kDisconnectReq: handle_disconnect_req_st(sm_pkt); break;
-      case SmPktType::kConnectResp: {
-        handle_connect_resp_st(sm_pkt);
-        break;
-      }
-      case SmPktType::kDisconnectResp: handle_disconnect_resp_st(sm_pkt); break;
-      default: throw std::runtime_error("Invalid packet type");
+template <class TTr>
+void Rpc<TTr>::handle_sm_pkt_st(const SmPkt &sm_pkt) {
+  // If it's an SM response, remove pending requests for this session
+  if (sm_pkt.is_resp() &&
+      sm_pending_reqs.count(sm_pkt.client.session_num) > 0) {
+    sm_pending_reqs.erase(sm_pending_reqs.find(sm_pkt.client.session_num));
+  }
+
+  switch (sm_pkt.pkt_type) {
+    case SmPktType::kConnectReq: handle_connect_req_st(sm_pkt); break;
+    case SmPktType::kDisconnectReq: handle_disconnect_req_st(sm_pkt); break;
+    case SmPktType::kConnectResp: {
+      handle_connect_resp_st(sm_pkt);
+      break;
     }
+    case SmPktType::kDisconnectResp: handle_disconnect_resp_st(sm_pkt); break;
+    default: throw std::runtime_error("Invalid packet type");
   }
 }
 
@@ -47,15 +62,219 @@ void Rpc<TTr>::bury_session_st(Session *session) {
   // guaranteed to have been freed at this point?
 
   if (session->is_server()) {
-    for (const SSlot &sslot : session->sslot_arr) {
-      free_msg_buffer(sslot.pre_resp_msgbuf);  // Prealloc buf is always valid
-    }
+    for (SSlot &sslot : session->sslot_arr) free_pre_resp_msgbuf_st(&sslot);
+    pre_resp_stats.num_server_sslots -= kSessionReqWindow;
+  } else {
+    // Return credits of packets that will never be acknowledged to the pool
+    shared_credits += kSessionCredits - session->client_info.credits;
+  }
+
+  // Sessions get a heartbeat peer ID and a datapath SM route when they connect
+  if (session->hb_peer_id != HeartbeatMgr::kInvalidPeerId) {
+    nexus->heartbeat_mgr.unlocked_remove_remote(session->hb_peer_id);
+    forget_dp_sm_route_st(session->is_client() ? session->server
+                                               : session->client);
   }
 
   session_vec.at(session->local_session_num) = nullptr;
   delete session;  // This does nothing except free the session memory
 }
 
+template <class TTr>
+bool Rpc<TTr>::init_server_sslots_st(Session *session) {
+  assert(in_dispatch() && session->is_server());
+
+  if (!kLazyPreRespMsgbuf) {
+    for (size_t i = 0; i < kSessionReqWindow; i++) {
+      if (!alloc_pre_resp_msgbuf_st(&session->sslot_arr[i])) {
+        // Cleanup everything allocated for this session
+        for (size_t j = 0; j < i; j++) {
+          free_pre_resp_msgbuf_st(&session->sslot_arr[j]);
+        }
+        return false;
+      }
+    }
+  }
+
+  pre_resp_stats.num_server_sslots += kSessionReqWindow;
+  return true;
+}
+
+template <class TTr>
+void Rpc<TTr>::release_idle_server_sslots_st() {
+  assert(in_dispatch());
+
+  for (Session *session : session_vec) {
+    if (session == nullptr || !session->is_server()) continue;
+    if (ev_loop_tsc - session->last_rx_tsc <= session_idle_cycles) continue;
+
+    for (SSlot &sslot : session->sslot_arr) {
+      // Skip slots whose request handler hasn't enqueued a response yet
+      if (sslot.server_info.req_type != kInvalidReqType) continue;
+      if (sslot.pre_resp_msgbuf.buf == nullptr) continue;
+
+      // The response stays until the client's next request on this slot
+      // acknowledges it. A client that stalled may still retransmit the
+      // request, and a dropped retransmission would hang the RPC.
+      if (sslot.tx_msgbuf == &sslot.pre_resp_msgbuf) continue;
+
+      free_pre_resp_msgbuf_st(&sslot);
+      pre_resp_stats.num_released++;
+    }
+  }
+}
+
+template <class TTr>
+void Rpc<TTr>::sm_pkt_tx_st(const SmPkt &sm_pkt) {
+  const SessionEndpoint &remote =
+      sm_pkt.is_req() ? sm_pkt.server : sm_pkt.client;
+  auto it = dp_sm.routes.find(std::make_pair(remote.uri(), remote.rpc_id));
+  if (it == dp_sm.routes.end() || !take_dp_sm_credit_st(&it->second)) {
+    sm_pkt_udp_tx_st(sm_pkt);
+    return;
+  }
+
+  ERPC_INFO("Rpc %u: Sending packet %s over the datapath.\n", rpc_id,
+            sm_pkt.to_string().c_str());
+  sm_pkt_dp_tx_st(sm_pkt, &it->second.routing_info);
+}
+
+template <class TTr>
+bool Rpc<TTr>::take_dp_sm_credit_st(dp_sm_route_t *route) {
+  // The remote reserves kDpSmCredits RX ring entries for each of its sessions
+  // with us, and drains them well within one epoch
+  if (route->epoch_tsc != pkt_loss_scan_tsc) {
+    route->epoch_tsc = pkt_loss_scan_tsc;
+    route->credits = kDpSmCredits;
+  }
+
+  if (route->credits == 0) return false;
+  route->credits--;
+  return true;
+}
+
+template <class TTr>
+void Rpc<TTr>::sm_pkt_dp_tx_st(const SmPkt &sm_pkt,
+                               Transport::RoutingInfo *routing_info) {
+  assert(in_dispatch());
+  static_assert(sizeof(SmPkt) <= TTr::kMaxDataPerPkt, "");
+
+  // Like control packets, a buffer is reused after (2 * unsig_batch) packets
+  MsgBuffer *msgbuf = &dp_sm.msgbufs[dp_sm.msgbuf_head];
+  dp_sm.msgbuf_head++;
+  if (dp_sm.msgbuf_head == 2 * TTr::kUnsigBatch) dp_sm.msgbuf_head = 0;
+
+  memcpy(msgbuf->buf, &sm_pkt, sizeof(SmPkt));
+  msgbuf->get_pkthdr_0()->format(kInvalidReqType, sizeof(SmPkt),
+                                 kSmSessionNum, kPktTypeReq, 0, 0);
+
+  Transport::tx_burst_item_t &item = tx_burst_arr[tx_batch_i];
+  item.routing_info = routing_info;
+  item.msg_buffer = msgbuf;
+  item.pkt_idx = 0;
+  if (kCcRTT) item.tx_ts = nullptr;
+
+  if (kTesting) {
+    item.drop = roll_pkt_drop();
+    testing.pkthdr_tx_queue.push(*msgbuf->get_pkthdr_0());
+  }
+
+  tx_batch_i++;
+  if (tx_batch_i == TTr::kPostlist) do_tx_burst_st();
+}
+
+template <class TTr>
+void Rpc<TTr>::process_sm_pkt_dp_st(const pkthdr_t *pkthdr) {
+  assert(in_dispatch());
+  if (unlikely(!dp_sm.enabled || pkthdr->msg_size != sizeof(SmPkt))) {
+    ERPC_WARN("Rpc %u: Received unexpected datapath SM packet %s. Dropping.\n",
+              rpc_id, pkthdr->to_string().c_str());
+    return;
+  }
+
+  SmPkt sm_pkt;
+  memcpy(static_cast<void *>(&sm_pkt), pkthdr + 1, sizeof(SmPkt));
+  if (!sm_pkt_type_is_valid(sm_pkt.pkt_type) ||
+      !sm_err_type_is_valid(sm_pkt.err_type) ||
+      (sm_pkt.is_req() ? sm_pkt.server.rpc_id : sm_pkt.client.rpc_id) !=
+          rpc_id) {
+    ERPC_WARN("Rpc %u: Received invalid datapath SM packet. Dropping.\n",
+              rpc_id);
+    return;
+  }
+
+  switch (sm_pkt.pkt_type) {
+    case SmPktType::kPingReq: {
+      // The server endpoint in a datapath ping is the receiver's endpoint
+      const uint16_t session_num = sm_pkt.server.session_num;
+      if (session_num >= session_vec.size()) return;
+
+      const Session *session = session_vec[session_num];
+      if (session != nullptr && session->is_connected() &&
+          session->uniq_token == sm_pkt.uniq_token) {
+        hb_rx_tsc[session->hb_peer_id] = ev_loop_tsc;  // Liveness evidence
+      }
+      return;
+    }
+    case SmPktType::kPingResp: return;  // Datapath pings are not answered
+    default: dp_sm.rx_queue.push_back(sm_pkt);
+  }
+}
+
+template <class TTr>
+void Rpc<TTr>::learn_dp_sm_route_st(
+    const SessionEndpoint &remote, const Transport::RoutingInfo &routing_info) {
+  if (!dp_sm.enabled || !remote.datapath_sm) return;
+  dp_sm_route_t &route =
+      dp_sm.routes[std::make_pair(remote.uri(), remote.rpc_id)];
+  route.routing_info = routing_info;
+  route.num_sessions++;
+}
+
+template <class TTr>
+void Rpc<TTr>::forget_dp_sm_route_st(const SessionEndpoint &remote) {
+  if (!dp_sm.enabled || !remote.datapath_sm) return;
+
+  // The route may have been dropped after an SM timeout
+  auto it = dp_sm.routes.find(std::make_pair(remote.uri(), remote.rpc_id));
+  if (it == dp_sm.routes.end()) return;
+
+  assert(it->second.num_sessions > 0);
+  it->second.num_sessions--;
+  if (it->second.num_sessions > 0) return;
+
+  if (tx_batch_i > 0) do_tx_burst_st();  // Queued packets may use the route
+  dp_sm.routes.erase(it);
+}
+
+template <class TTr>
+void Rpc<TTr>::send_dp_sm_pings_st() {
+  assert(in_dispatch());
+  std::set<uint32_t> pinged_peers;
+
+  for (Session *session : session_vec) {
+    if (session == nullptr || !session->is_connected()) continue;
+
+    const SessionEndpoint &local =
+        session->is_client() ? session->client : session->server;
+    const SessionEndpoint &remote =
+        session->is_client() ? session->server : session->client;
+    if (!remote.datapath_sm) continue;
+    if (!pinged_peers.insert(session->hb_peer_id).second) continue;
+
+    // Pings are optional, so skip them if the route is out of credits
+    auto it = dp_sm.routes.find(std::make_pair(remote.uri(), remote.rpc_id));
+    if (it == dp_sm.routes.end() || !take_dp_sm_credit_st(&it->second)) {
+      continue;
+    }
+
+    // The remote matches the ping to its session using the server endpoint
+    const SmPkt ping(SmPktType::kPingReq, SmErrType::kNoError,
+                     session->uniq_token, local, remote);
+    sm_pkt_dp_tx_st(ping, &it->second.routing_info);
+  }
+}
+
 template <class TTr>
 void Rpc<TTr>::sm_pkt_udp_tx_st(const SmPkt &sm_pkt) {
   ERPC_INFO("Rpc %u: Sending packet %s.\n", rpc_id, sm_pkt.to_string().c_str());
@@ -64,9 +283,51 @@ void Rpc<TTr>::sm_pkt_udp_tx_st(const SmPkt &sm_pkt) {
   const uint16_t rem_sm_udp_port =
       sm_pkt.is_req() ? sm_pkt.server.sm_udp_port : sm_pkt.client.sm_udp_port;
 
+  if (sm_tx_batch.depth > 0) {
+    sm_tx_batch.pkts[std::make_pair(rem_hostname, rem_sm_udp_port)].push_back(
+        sm_pkt);
+    return;
+  }
+
   udp_client.send(rem_hostname, rem_sm_udp_port, sm_pkt);
 }
 
+template <class TTr>
+void Rpc<TTr>::end_sm_tx_batch_st() {
+  assert(in_dispatch() && sm_tx_batch.depth > 0);
+  sm_tx_batch.depth--;
+  if (sm_tx_batch.depth > 0) return;
+
+  for (auto &kv : sm_tx_batch.pkts) {
+    const std::vector<SmPkt> &pkts = kv.second;
+    for (size_t i = 0; i < pkts.size(); i += kMaxSmPktBatch) {
+      udp_client.send(kv.first.first, kv.first.second, &pkts[i],
+                      std::min(kMaxSmPktBatch, pkts.size() - i));
+    }
+  }
+
+  sm_tx_batch.pkts.clear();
+  sm_tx_batch.resolved_rinfo.clear();
+}
+
+template <class TTr>
+bool Rpc<TTr>::resolve_remote_routing_info_st(
+    Transport::RoutingInfo *routing_info) {
+  assert(in_dispatch());
+  const std::string key(reinterpret_cast<const char *>(routing_info->buf),
+                        sizeof(routing_info->buf));
+
+  auto it = sm_tx_batch.resolved_rinfo.find(key);
+  if (it != sm_tx_batch.resolved_rinfo.end()) {
+    *routing_info = it->second;
+    return true;
+  }
+
+  if (!transport->resolve_remote_routing_info(routing_info)) return false;
+  if (sm_tx_batch.depth > 0) sm_tx_batch.resolved_rinfo[key] = *routing_info;
+  return true;
+}
+
 template <class TTr>
 void Rpc<TTr>::send_sm_req_st(Session *session) {
   assert(in_dispatch());
@@ -83,7 +344,7 @@ void Rpc<TTr>::send_sm_req_st(Session *session) {
   sm_pkt.uniq_token = session->uniq_token;
   sm_pkt.client = session->client;
   sm_pkt.server = session->server;
-  sm_pkt_udp_tx_st(sm_pkt);
+  sm_pkt_tx_st(sm_pkt);
 }
 
 FORCE_COMPILE_TRANSPORTS
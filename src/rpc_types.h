@@ -56,6 +56,17 @@ typedef void (*erpc_cont_func_t)(void *context, void *tag);
  */
 enum class ReqFuncType : uint8_t { kForeground, kBackground };
 
+/**
+ * @relates Rpc
+ * @brief Where a MsgBuffer's memory lives. Untrusted MsgBuffers are in
+ * hugepage memory registered with the NIC, so they can be transmitted and
+ * received zero-copy. Trusted MsgBuffers are in ordinary process memory, which
+ * is enclave memory when eRPC runs in an enclave. They are not registered with
+ * the NIC, so they can only hold received requests or responses, which eRPC
+ * copies out of the untrusted RX ring.
+ */
+enum class MemPlacement : uint8_t { kUntrusted, kTrusted };
+
 /**
  * @relates Rpc
  * @brief The request handler registered by applications
@@ -2,6 +2,7 @@
 
 #if defined(SCONE)
 
+#include <sys/mman.h>
 #include <unistd.h>
 
 #define SYS_untrusted_mmap 1025
@@ -10,6 +11,11 @@ static void * scone_kernel_mmap(void * addr, size_t length, int prot, int flags,
   return (void*)syscall(SYS_untrusted_mmap, addr, length, prot, flags, fd, offset);
 }
 
+// SCONE forwards munmap of addresses outside the enclave to the host kernel
+static int scone_kernel_munmap(void * addr, size_t length) {
+  return munmap(addr, length);
+}
+
 #else
 
 #include <sys/mman.h>
@@ -19,4 +25,8 @@ static void * scone_kernel_mmap(void * addr, size_t length, int prot, int flags,
   return mmap(addr, length, prot, flags, fd, offset);
 }
 
+static int scone_kernel_munmap(void * addr, size_t length) {
+  return munmap(addr, length);
+}
+
 #endif
@@ -7,10 +7,12 @@
 #include "cc/timely.h"
 #include "cc/timing_wheel.h"
 #include "common.h"
+#include "completion_queue.h"
 #include "msg_buffer.h"
 #include "rpc_types.h"
 #include "sm_types.h"
 #include "sslot.h"
+#include "util/aes_gcm.h"
 #include "util/buffer.h"
 #include "util/fixed_vector.h"
 
@@ -25,18 +27,20 @@ struct enq_req_args_t {
   erpc_cont_func_t cont_func;
   void *tag;
   size_t cont_etid;
+  CompletionQueue *comp_queue;  ///< If non-null, used instead of cont_func
 
   enq_req_args_t() {}
   enq_req_args_t(int session_num, uint8_t req_type, MsgBuffer *req_msgbuf,
                  MsgBuffer *resp_msgbuf, erpc_cont_func_t cont_func, void *tag,
-                 size_t cont_etid)
+                 size_t cont_etid, CompletionQueue *comp_queue = nullptr)
       : session_num(session_num),
         req_type(req_type),
         req_msgbuf(req_msgbuf),
         resp_msgbuf(resp_msgbuf),
         cont_func(cont_func),
         tag(tag),
-        cont_etid(cont_etid) {}
+        cont_etid(cont_etid),
+        comp_queue(comp_queue) {}
 };
 
 /// The arguments to enqueue_response()
@@ -96,8 +100,8 @@ class Session {
     }
   }
 
-  /// All session resources are freed by the owner Rpc
-  ~Session() {}
+  /// All session resources except the AEAD context are freed by the owner Rpc
+  ~Session() { delete aead; }
 
   inline bool is_client() const { return role == Role::kClient; }
   inline bool is_server() const { return role == Role::kServer; }
@@ -133,21 +137,40 @@ class Session {
     return trim_hostname(client.hostname);
   }
 
-  const Role role;  ///< The role (server/client) of this session endpoint
-  const conn_req_uniq_token_t uniq_token;  ///< A cluster-wide unique token
-  const double freq_ghz;                   ///< TSC frequency
-  const double link_bandwidth;  ///< Link bandwidth in bytes per second
-  SessionState state;  ///< The management state of this session endpoint
-  SessionEndpoint client, server;  ///< Read-only endpoint metadata
+  // Members are ordered by access frequency. The session slots come first so
+  // that each starts on a cache line, followed by one cache line of
+  // per-packet session state. Control-path and congestion control state comes
+  // last. sslot_layout_test checks this layout.
 
   std::array<SSlot, kSessionReqWindow> sslot_arr;  ///< The session slots
 
+  /// The management state of this session endpoint
+  alignas(64) SessionState state;
+
   ///@{ Info saved for faster unconditional access
-  Transport::RoutingInfo *remote_routing_info;
   uint16_t local_session_num;
   uint16_t remote_session_num;
+  Transport::RoutingInfo *remote_routing_info;
   ///@}
 
+  /// Timestamp of the last datapath packet received for this session. Server
+  /// sessions idle for long release their preallocated response MsgBuffers.
+  size_t last_rx_tsc = 0;
+
+  /// The remote process's heartbeat peer ID. Datapath packets received on
+  /// this session are recorded at this index, which is a spare one for
+  /// sessions that are not connected.
+  uint32_t hb_peer_id = kMaxHeartbeatPeers;
+
+  /// AES-GCM context for sessions with payload protection, checked for every
+  /// data packet. This is nullptr for sessions with SessionCrypto::kNone.
+  AesGcm *aead = nullptr;
+  SessionCrypto crypto = SessionCrypto::kNone;  ///< The protection mode
+
+  /// The server's random contribution to the session key, kept by the server
+  /// to re-send its connect response
+  uint64_t srv_nonce = 0;
+
   /// Information that is required only at the client endpoint
   struct {
     size_t credits = kSessionCredits;  ///< Currently available credits
@@ -160,15 +183,20 @@ class Session {
     std::queue<enq_req_args_t> enq_req_backlog;
 
     size_t num_re_tx = 0;  ///< Number of retransmissions for this session
+    size_t sm_req_ts;  ///< Timestamp of the last session management request
 
     // Congestion control
     struct {
-      Timely timely;
       size_t prev_desired_tx_tsc;  ///< Desired TX timestamp of the last packet
+      Timely timely;
     } cc;
-
-    size_t sm_req_ts;  ///< Timestamp of the last session management request
   } client_info;
+
+  const Role role;  ///< The role (server/client) of this session endpoint
+  const conn_req_uniq_token_t uniq_token;  ///< A cluster-wide unique token
+  const double freq_ghz;                   ///< TSC frequency
+  const double link_bandwidth;  ///< Link bandwidth in bytes per second
+  SessionEndpoint client, server;  ///< Read-only endpoint metadata
 };
 
 }  // namespace erpc
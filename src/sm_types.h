@@ -20,6 +20,17 @@ static_assert(is_power_of_two(kSessionReqWindow), "");
 // Invalid metadata values for session endpoint initialization
 static constexpr uint16_t kInvalidSessionNum = UINT16_MAX;
 
+/// The destination session number of session management packets carried over
+/// the datapath. Every Rpc implicitly has this bootstrap session, so it needs
+/// no handshake. Real session numbers are bounded by RX ring entries.
+static constexpr uint16_t kSmSessionNum = kInvalidSessionNum - 1;
+
+/// Credits for session management packets carried over the datapath. An Rpc
+/// sends at most this many such packets to one remote Rpc per packet loss
+/// epoch, and falls back to UDP beyond that. In exchange, each session
+/// reserves this many RX ring entries for them.
+static constexpr size_t kDpSmCredits = 2;
+
 // A cluster-wide unique token for each session, generated on session creation
 typedef size_t conn_req_uniq_token_t;
 
@@ -48,7 +59,16 @@ enum class SmErrType : int {
   kOutOfMemory,      ///< Connect req failed because server is out of memory
   kRoutingResolutionFailure,  ///< Server failed to resolve client routing info
   kInvalidRemoteRpcId,  ///< Connect req failed because remote RPC ID was wrong
-  kInvalidTransport     ///< Connect req failed because of transport mismatch
+  kInvalidTransport,    ///< Connect req failed because of transport mismatch
+  kAeadUnavailable,  ///< Connect req for an encrypted session, but no AEAD key
+  kTooManyPeers  ///< Connect req failed because server tracks too many peers
+};
+
+/// How a session protects the payloads of its data packets
+enum class SessionCrypto : uint8_t {
+  kNone,
+  kAead,  ///< Encrypted and authenticated with AES-GCM
+  kMac    ///< Authenticated but not encrypted, with AES-GMAC
 };
 
 /// Events generated for application-level session management handler
@@ -136,7 +156,9 @@ static bool sm_err_type_is_valid(SmErrType err_type) {
     case SmErrType::kOutOfMemory:
     case SmErrType::kRoutingResolutionFailure:
     case SmErrType::kInvalidRemoteRpcId:
-    case SmErrType::kInvalidTransport: return true;
+    case SmErrType::kInvalidTransport:
+    case SmErrType::kAeadUnavailable:
+    case SmErrType::kTooManyPeers: return true;
   }
   return false;
 }
@@ -153,6 +175,8 @@ static std::string sm_err_type_str(SmErrType err_type) {
       return "[Routing resolution failure]";
     case SmErrType::kInvalidRemoteRpcId: return "[Invalid remote Rpc ID]";
     case SmErrType::kInvalidTransport: return "[Invalid transport]";
+    case SmErrType::kAeadUnavailable: return "[AEAD unavailable]";
+    case SmErrType::kTooManyPeers: return "[Too many heartbeat peers]";
   }
 
   throw std::runtime_error("Invalid session management error type");
@@ -178,12 +202,22 @@ class SessionEndpoint {
   uint16_t session_num;  ///< The session number of this endpoint in its Rpc
   Transport::RoutingInfo routing_info;  ///< Endpoint's routing info
 
+  /// True iff the endpoint's Rpc accepts session management packets over its
+  /// datapath
+  bool datapath_sm;
+
+  /// Payload protection for the session. Set by the client in connect
+  /// requests.
+  SessionCrypto crypto;
+
   SessionEndpoint() {
     memset(static_cast<void *>(hostname), 0, sizeof(hostname));
     sm_udp_port = 0;  // UDP port 0 is naturally invalid
     rpc_id = kInvalidRpcId;
     session_num = kInvalidSessionNum;
     memset(static_cast<void *>(&routing_info), 0, sizeof(routing_info));
+    datapath_sm = false;
+    crypto = SessionCrypto::kNone;
   }
 
   /// Return this endpoint's URI
@@ -224,6 +258,9 @@ class SessionEndpoint {
   }
 };
 
+/// Size of the tag in authenticated session management packets
+static constexpr size_t kSmPktTagSize = 16;
+
 /// General-purpose session management packet sent by both Rpc clients and
 /// servers. This is pretty large (~500 bytes), so use sparingly.
 class SmPkt {
@@ -233,6 +270,14 @@ class SmPkt {
   conn_req_uniq_token_t uniq_token;  ///< The token for this session
   SessionEndpoint client, server;    ///< Endpoint metadata
 
+  /// The server's random contribution to the key of a protected session. Set
+  /// in successful connect responses.
+  uint64_t srv_nonce;
+
+  /// The tag that authenticates a successful connect response of a protected
+  /// session. See Nexus::sign_connect_resp().
+  uint8_t auth_tag[kSmPktTagSize];
+
   std::string to_string() const {
     std::ostringstream ret;
     ret << sm_pkt_type_str(pkt_type) << ", " << sm_err_type_str(err_type)
@@ -248,7 +293,10 @@ class SmPkt {
         err_type(err_type),
         uniq_token(uniq_token),
         client(client),
-        server(server) {}
+        server(server),
+        srv_nonce(0) {
+    memset(auth_tag, 0, sizeof(auth_tag));
+  }
 
   // The response to a ping is the same packet but with packet type switched
   static SmPkt make_ping_resp(const SmPkt &ping_req) {
@@ -261,6 +309,14 @@ class SmPkt {
   bool is_resp() const { return !is_req(); }
 };
 
+/// Maximum number of session management packets in one UDP datagram. Rpcs
+/// batch packets to the same remote Nexus, e.g., for bulk session creation.
+static constexpr size_t kMaxSmPktBatch = 32;
+static_assert(kMaxSmPktBatch * sizeof(SmPkt) <= 65507, "Datagram too large");
+
+/// Capacity of each Rpc's session management RX ring
+static constexpr size_t kSmRxQueueSize = 256;
+
 static SmPkt sm_construct_resp(const SmPkt &req_sm_pkt, SmErrType err_type) {
   SmPkt resp_sm_pkt = req_sm_pkt;
   resp_sm_pkt.pkt_type = sm_pkt_type_req_to_resp(req_sm_pkt.pkt_type);
@@ -268,28 +324,4 @@ static SmPkt sm_construct_resp(const SmPkt &req_sm_pkt, SmErrType err_type) {
   return resp_sm_pkt;
 }
 
-/// A work item exchanged between an Rpc thread and an SM thread. This does
-/// not have any Nexus-related members, so it's outside the Nexus class.
-class SmWorkItem {
-  enum class Reset { kFalse, kTrue };
-
- public:
-  SmWorkItem(uint8_t rpc_id, SmPkt sm_pkt)
-      : reset(Reset::kFalse), rpc_id(rpc_id), sm_pkt(sm_pkt) {}
-
-  SmWorkItem(std::string reset_rem_hostname)
-      : reset(Reset::kTrue),
-        rpc_id(kInvalidRpcId),
-        reset_rem_hostname(reset_rem_hostname) {}
-
-  bool is_reset() const { return reset == Reset::kTrue; }
-
-  const Reset reset;     ///< Is this work item a reset?
-  const uint8_t rpc_id;  ///< The local Rpc ID, invalid for reset work items
-
-  SmPkt sm_pkt;  ///< The session management packet, for non-reset work items
-
-  /// The remote hostname to reset, valid for reset work items
-  std::string reset_rem_hostname;
-};
 }  // namespace erpc
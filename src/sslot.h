@@ -1,5 +1,6 @@
 #pragma once
 
+#include "completion_queue.h"
 #include "msg_buffer.h"
 #include "rpc_types.h"
 #include "sm_types.h"
@@ -13,8 +14,16 @@ class Nexus;
 template <typename T>
 class Rpc;
 
-/// Session slot metadata maintained for an RPC by both client and server
-class SSlot {
+/**
+ * @brief Session slot metadata maintained for an RPC by both client and server
+ *
+ * Members are ordered by access frequency. The first cache line holds
+ * everything that a client needs to receive a single-packet response, and
+ * everything that a server needs to receive a request packet. Members used
+ * once per RPC follow, and congestion control state and the server's response
+ * MsgBuffers come last. sslot_layout_test checks this layout.
+ */
+class alignas(64) SSlot {
   friend class Session;
   friend class Nexus;
   friend class Rpc<CTransport>;
@@ -24,24 +33,10 @@ class SSlot {
   SSlot() {}
   ~SSlot() {}
 
-  // Server-only members. Exposed to req handlers, so not kept in server struct.
-
-  /// A preallocated msgbuf for single-packet responses
-  MsgBuffer pre_resp_msgbuf;
-
-  /// A non-preallocated msgbuf for possibly multi-packet responses
-  MsgBuffer dyn_resp_msgbuf;
-
  private:
   // Members that are valid for both server and client
   Session *session;  ///< Pointer to this sslot's session
 
-  /// True iff this sslot is a client sslot. sslot class does not have complete
-  /// access to \p session, so we need this info separately.
-  bool is_client;
-
-  size_t index;  ///< Index of this sslot in the session's sslot_arr
-
   /// The request (client) or response (server) buffer. For client sslots, a
   /// non-null value indicates that the request is active/incomplete.
   MsgBuffer *tx_msgbuf;
@@ -49,11 +44,15 @@ class SSlot {
   /// Info about the current request
   size_t cur_req_num;
 
+  uint32_t index;  ///< Index of this sslot in the session's sslot_arr
+
+  /// True iff this sslot is a client sslot. sslot class does not have complete
+  /// access to \p session, so we need this info separately.
+  bool is_client;
+
   union {
     struct {
-      MsgBuffer *resp_msgbuf;      ///< User-supplied response buffer
-      erpc_cont_func_t cont_func;  ///< Continuation function for the request
-      void *tag;                   ///< Tag of the request
+      // Accessed for every response packet
 
       /// Number of packets sent. Packets up to (num_tx - 1) have been sent.
       size_t num_tx;
@@ -61,29 +60,39 @@ class SSlot {
       /// Number of pkts received. Pkts up to (num_tx - 1) have been received.
       size_t num_rx;
 
+      MsgBuffer *resp_msgbuf;  ///< User-supplied response buffer
+
       /// TSC at which we last sent or retransmitted a packet, or received an
       /// in-order packet for this request
       size_t progress_tsc;
 
+      // Accessed once per request
+
+      erpc_cont_func_t cont_func;  ///< Continuation function for the request
+      void *tag;                   ///< Tag of the request
       size_t cont_etid;  ///< eRPC thread ID to run the continuation on
 
+      /// If non-null, the completion is delivered here instead of cont_func
+      CompletionQueue *comp_queue;
+
       /// Pointers for the intrusive doubly-linked list of active RPCs
       SSlot *prev, *next;
 
       // Fields for congestion control, cold if CC is disabled.
 
+      size_t wheel_count;  ///< Number of packets in the wheel (or ready queue)
+
       /// Packet number n is in the wheel (including its ready queue) iff
       /// in_wheel[n % kSessionCredits] is true
       std::array<bool, kSessionCredits> in_wheel;
-      size_t wheel_count;  ///< Number of packets in the wheel (or ready queue)
 
       /// Per-packet TX timestamp. Indexed by pkt_num % kSessionCredits.
       std::array<size_t, kSessionCredits> tx_ts;
     } client_info;
 
     struct {
-      /// The fake or dynamic request buffer
-      MsgBuffer req_msgbuf;
+      /// Number of pkts received. Pkts up to (num_rx - 1) have been received.
+      size_t num_rx;
 
       // Request metadata saved by the server before calling the request
       // handler. These fields are needed in enqueue_response(), and the request
@@ -96,15 +105,31 @@ class SSlot {
       uint8_t req_type;
       ReqFuncType req_func_type;  ///< The req handler type (e.g., background)
 
-      /// Number of pkts received. Pkts up to (num_rx - 1) have been received.
-      size_t num_rx;
+      /// The request type of the response in tx_msgbuf, saved for returning
+      /// a pooled dynamic response to its MsgBuffer pool
+      uint8_t resp_req_type;
 
       /// The server remembers the number of packets in the request after
       /// burying the request in enqueue_response().
       size_t sav_num_req_pkts;
+
+      /// The fake or dynamic request buffer
+      MsgBuffer req_msgbuf;
     } server_info;
   };
 
+ public:
+  // Server-only members. Exposed to req handlers, so not kept in server struct.
+
+  /// A preallocated msgbuf for single-packet responses. With
+  /// kLazyPreRespMsgbuf, this is allocated when the slot receives a request,
+  /// so it is always valid in request handlers.
+  MsgBuffer pre_resp_msgbuf;
+
+  /// A non-preallocated msgbuf for possibly multi-packet responses
+  MsgBuffer dyn_resp_msgbuf;
+
+ private:
   /// Return a string representation of the progress made by this sslot.
   /// Progress fields that are zero are not included in the string.
   std::string progress_str() const {
@@ -132,6 +132,25 @@ class Transport {
    */
   void post_recvs(size_t num_recvs);
 
+  /**
+   * @brief Return a file descriptor that becomes readable when a packet
+   * arrives after arm_rx_event(), or -1 if this transport cannot generate RX
+   * events. The file descriptor is non-blocking.
+   */
+  int get_rx_event_fd() const;
+
+  /**
+   * @brief Request an RX event for the next packet arrival. Packets that
+   * arrived before arming may not generate an event, so the caller must poll
+   * with rx_burst() once more after arming and before blocking.
+   *
+   * @return True if the event is armed, false if RX events are unsupported
+   */
+  bool arm_rx_event();
+
+  /// Consume any RX events delivered on the RX event file descriptor
+  void ack_rx_event();
+
   /// Fill-in local routing information
   void fill_local_routing_info(RoutingInfo* routing_info) const;
 
@@ -131,6 +131,8 @@ void DpdkTransport::setup_phy_port() {
 #endif
   eth_conf.rxmode.offloads = 0;
 
+  eth_conf.intr_conf.rxq = kEnableRxIntr ? 1 : 0;
+
   eth_conf.txmode.mq_mode = ETH_MQ_TX_NONE;
   eth_conf.txmode.offloads = kOffloads;
 
@@ -24,6 +24,9 @@ class DpdkTransport : public Transport {
  public:
   // Transport-specific constants
   static constexpr TransportType kTransportType = TransportType::kDPDK;
+
+  /// DPDK memory registration is a no-op, so memory can be shared freely
+  static constexpr bool kSharedMemReg = true;
   static constexpr size_t kMTU = 1024;
   static constexpr size_t kMaxQueuesPerPort = 16;
 
@@ -39,6 +42,11 @@ class DpdkTransport : public Transport {
   /// Maximum number of packets received in rx_burst
   static constexpr size_t kRxBatchSize = 32;
 
+  /// Enable RX queue interrupts, used by the Rpc's interrupt-driven low-load
+  /// mode. This requires a PMD with RX interrupt support and a VFIO/UIO setup
+  /// that delivers them; port configuration fails otherwise.
+  static constexpr bool kEnableRxIntr = false;
+
   /// Number of mbufs in each mempool (one per Transport instance). The DPDK
   /// docs recommend power-of-two minus one mbufs per pool for best utilization.
   static constexpr size_t kNumMbufs = (kNumRxRingEntries * 2 - 1);
@@ -102,6 +110,12 @@ class DpdkTransport : public Transport {
   void tx_flush();
   size_t rx_burst();
   void post_recvs(size_t num_recvs);
+  int get_rx_event_fd() const {
+    return kEnableRxIntr ? rte_eth_dev_rx_intr_ctl_q_get_fd(phy_port, qp_id)
+                         : -1;
+  }
+  bool arm_rx_event();
+  void ack_rx_event();
 
  private:
   /// Do DPDK initialization for \p phy_port. \p phy_port must not have been
@@ -1,5 +1,7 @@
 #ifdef ERPC_DPDK
 
+#include <unistd.h>
+
 #include "dpdk_transport.h"
 #include "util/huge_alloc.h"
 
@@ -131,6 +133,23 @@ size_t DpdkTransport::rx_burst() {
   return nb_rx_new;
 }
 
+bool DpdkTransport::arm_rx_event() {
+  if (!kEnableRxIntr) return false;
+  int ret = rte_eth_dev_rx_intr_enable(phy_port, qp_id);
+  rt_assert(ret == 0, "Failed to enable RX interrupt: ", strerror(-1 * ret));
+  return true;
+}
+
+void DpdkTransport::ack_rx_event() {
+  if (!kEnableRxIntr) return;
+
+  // Drain the queue's eventfd, and go back to polling mode
+  uint64_t counter;
+  ssize_t ret = read(get_rx_event_fd(), &counter, sizeof(counter));
+  _unused(ret);
+  rte_eth_dev_rx_intr_disable(phy_port, qp_id);
+}
+
 void DpdkTransport::post_recvs(size_t num_recvs) {
   for (size_t i = 0; i < num_recvs; i++) {
     auto *mbuf = dpdk_dtom(rx_ring[rx_ring_tail]);
@@ -1,5 +1,6 @@
 #ifdef ERPC_INFINIBAND
 
+#include <fcntl.h>
 #include <iomanip>
 #include <stdexcept>
 
@@ -17,6 +18,9 @@ constexpr size_t IBTransport::kMaxDataPerPkt;
 //  * Mellanox's `show_gids` script lists all GIDs on all NICs
 static constexpr size_t kDefaultGIDIndex = 1;
 
+IBTransport::shared_port_t IBTransport::shared_ports[kMaxPhyPorts];
+std::mutex IBTransport::shared_ports_lock;
+
 // Initialize the protection domain, queue pair, and memory registration and
 // deregistration functions. RECVs will be initialized later when the hugepage
 // allocator is provided.
@@ -31,9 +35,7 @@ IBTransport::IBTransport(uint16_t sm_udp_port, uint8_t rpc_id, uint8_t phy_port,
     rt_assert(kHeadroom == 40, "Invalid packet header headroom for RoCE");
   }
 
-  common_resolve_phy_port(phy_port, kMTU, kTransportType, resolve);
-  ib_resolve_phy_port();
-
+  acquire_shared_port();
   init_verbs_structs();
   init_mem_reg_funcs();
 
@@ -60,15 +62,17 @@ IBTransport::~IBTransport() {
   exit_assert(ibv_destroy_qp(qp) == 0, "Failed to destroy send QP");
   exit_assert(ibv_destroy_cq(send_cq) == 0, "Failed to destroy send CQ");
   exit_assert(ibv_destroy_cq(recv_cq) == 0, "Failed to destroy recv CQ");
+  exit_assert(ibv_destroy_comp_channel(comp_channel) == 0,
+              "Failed to destroy completion channel");
 
   exit_assert(ibv_destroy_ah(self_ah) == 0, "Failed to destroy self AH");
   for (auto *_ah : ah_to_free_vec) {
     exit_assert(ibv_destroy_ah(_ah) == 0, "Failed to destroy AH");
   }
 
-  // Destroy protection domain and device context
-  exit_assert(ibv_dealloc_pd(pd) == 0, "Failed to destroy PD. Leaked MRs?");
-  exit_assert(ibv_close_device(resolve.ib_ctx) == 0, "Failed to close device");
+  // Destroy the protection domain and device context if this is the last
+  // IBTransport on the port
+  release_shared_port();
 }
 
 struct ibv_ah *IBTransport::create_ah(const ib_routing_info_t *ib_rinfo) const {
@@ -124,18 +128,56 @@ void IBTransport::ib_resolve_phy_port() {
   }
 }
 
+void IBTransport::acquire_shared_port() {
+  std::lock_guard<std::mutex> lock(shared_ports_lock);
+  shared_port_t &shared_port = shared_ports[phy_port];
+
+  if (shared_port.refcount == 0) {
+    common_resolve_phy_port(phy_port, kMTU, kTransportType, resolve);
+    ib_resolve_phy_port();
+
+    shared_port.pd = ibv_alloc_pd(resolve.ib_ctx);
+    rt_assert(shared_port.pd != nullptr, "Failed to allocate PD");
+    shared_port.resolve = resolve;
+  }
+
+  resolve = shared_port.resolve;
+  pd = shared_port.pd;
+  shared_port.refcount++;
+}
+
+void IBTransport::release_shared_port() {
+  std::lock_guard<std::mutex> lock(shared_ports_lock);
+  shared_port_t &shared_port = shared_ports[phy_port];
+  assert(shared_port.refcount > 0 && shared_port.pd == pd);
+
+  shared_port.refcount--;
+  if (shared_port.refcount > 0) return;
+
+  // Destroy protection domain and device context
+  exit_assert(ibv_dealloc_pd(pd) == 0, "Failed to destroy PD. Leaked MRs?");
+  exit_assert(ibv_close_device(resolve.ib_ctx) == 0, "Failed to close device");
+  shared_port.pd = nullptr;
+}
+
 void IBTransport::init_verbs_structs() {
   assert(resolve.ib_ctx != nullptr && resolve.device_id != -1);
+  assert(pd != nullptr);
 
-  // Create protection domain, send CQ, and recv CQ
-  pd = ibv_alloc_pd(resolve.ib_ctx);
-  rt_assert(pd != nullptr, "Failed to allocate PD");
-
+  // Create send CQ and recv CQ
   send_cq = ibv_create_cq(resolve.ib_ctx, kSQDepth, nullptr, nullptr, 0);
   rt_assert(send_cq != nullptr, "Failed to create SEND CQ. Forgot hugepages?");
 
-  recv_cq = ibv_create_cq(resolve.ib_ctx, kRQDepth, nullptr, nullptr, 0);
-  rt_assert(recv_cq != nullptr, "Failed to create SEND CQ");
+  // The RECV CQ is attached to a completion channel so that the Rpc can sleep
+  // until a packet arrives. This has no cost until the CQ is armed.
+  comp_channel = ibv_create_comp_channel(resolve.ib_ctx);
+  rt_assert(comp_channel != nullptr, "Failed to create completion channel");
+  int flags = fcntl(comp_channel->fd, F_GETFL);
+  rt_assert(fcntl(comp_channel->fd, F_SETFL, flags | O_NONBLOCK) == 0,
+            "Failed to make completion channel non-blocking");
+
+  recv_cq = ibv_create_cq(resolve.ib_ctx, kRQDepth, nullptr, comp_channel, 0);
+  rt_assert(recv_cq != nullptr, "Failed to create RECV CQ");
 
   // Initialize QP creation attributes
   struct ibv_qp_init_attr create_attr;
@@ -6,6 +6,7 @@
 
 #ifdef ERPC_INFINIBAND
 
+#include <mutex>
 #include "transport.h"
 #include "transport_impl/verbs_common.h"
 #include "util/logger.h"
@@ -31,6 +32,10 @@ class IBTransport : public Transport {
   static constexpr uint32_t kQKey = 0xffffffff;  ///< Secure key for all nodes
   static constexpr size_t kGRHBytes = 40;
 
+  /// Memory registered with one IBTransport is usable by all IBTransports on
+  /// the same physical port because they share a protection domain
+  static constexpr bool kSharedMemReg = true;
+
   static_assert(kSQDepth >= 2 * kUnsigBatch, "");  // Queue capacity check
   static_assert(kPostlist <= kUnsigBatch, "");     // Postlist check
 
@@ -96,6 +101,9 @@ class IBTransport : public Transport {
   void tx_flush();
   size_t rx_burst();
   void post_recvs(size_t num_recvs);
+  int get_rx_event_fd() const { return comp_channel->fd; }
+  bool arm_rx_event();
+  void ack_rx_event();
 
   /// Get the current SEND signaling flag, and poll the send CQ if we need to
   inline bool get_signaled_flag() {
@@ -149,8 +157,32 @@ class IBTransport : public Transport {
     union ibv_gid gid;      ///< GID, used only for RoCE
   } resolve;
 
-  struct ibv_pd *pd = nullptr;
+  /**
+   * @brief The device context and protection domain shared by all
+   * IBTransports on a physical port in this process. Sharing the PD lets
+   * memory registered once be used by all Rpcs on the port.
+   */
+  struct shared_port_t {
+    IBResolve resolve;
+    struct ibv_pd *pd = nullptr;
+    size_t refcount = 0;
+  };
+  static shared_port_t shared_ports[kMaxPhyPorts];
+  static std::mutex shared_ports_lock;
+
+  /// Resolve \p phy_port and get the port's shared PD, creating them if this
+  /// is the first IBTransport on the port
+  void acquire_shared_port();
+
+  /// Drop this IBTransport's reference to the port's shared PD
+  void release_shared_port();
+
+  struct ibv_pd *pd = nullptr;  ///< Shared by all IBTransports on the port
   struct ibv_cq *send_cq = nullptr, *recv_cq = nullptr;
+
+  /// Completion channel for RX events on the RECV CQ. Used only in the Rpc's
+  /// interrupt-driven low-load mode.
+  struct ibv_comp_channel *comp_channel = nullptr;
   struct ibv_qp *qp = nullptr;
 
   /// An address handle for this endpoint's port. Used for tx_flush().
@@ -121,6 +121,26 @@ size_t IBTransport::rx_burst() {
   return static_cast<size_t>(ret);
 }
 
+bool IBTransport::arm_rx_event() {
+  int ret = ibv_req_notify_cq(recv_cq, 0 /* all completions */);
+  rt_assert(ret == 0, "Failed to arm RECV CQ");
+  return true;
+}
+
+void IBTransport::ack_rx_event() {
+  struct ibv_cq *ev_cq;
+  void *ev_ctx;
+  unsigned int num_events = 0;
+
+  // The channel is non-blocking, so this stops when no events are left
+  while (ibv_get_cq_event(comp_channel, &ev_cq, &ev_ctx) == 0) {
+    assert(ev_cq == recv_cq);
+    num_events++;
+  }
+
+  if (num_events > 0) ibv_ack_cq_events(recv_cq, num_events);
+}
+
 void IBTransport::post_recvs(size_t num_recvs) {
   assert(!fast_recv_used);        // Not supported yet
   assert(num_recvs <= kRQDepth);  // num_recvs can be 0
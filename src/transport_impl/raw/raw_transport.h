@@ -29,6 +29,10 @@ class RawTransport : public Transport {
 
   // Transport-specific constants
   static constexpr TransportType kTransportType = TransportType::kRaw;
+
+  /// Each RawTransport has its own protection domain, so registered memory
+  /// cannot be shared with other Rpcs
+  static constexpr bool kSharedMemReg = false;
   static constexpr size_t kMTU = 1024;
 
   // Multi-packet RQ constants
@@ -133,6 +137,12 @@ class RawTransport : public Transport {
   size_t rx_burst();
   void post_recvs(size_t num_recvs);
 
+  // The dumbpipe RECV CQ is overrunning and polled by snapshotting CQEs, so it
+  // cannot generate completion events
+  int get_rx_event_fd() const { return -1; }
+  bool arm_rx_event() { return false; }
+  void ack_rx_event() {}
+
   /// Get the current SEND signaling flag, and poll the send CQ if we need to
   inline bool get_signaled_flag() {
     // If kUnsigBatch is 4, the sequence of signaling and polling looks like so:
@@ -12,6 +12,11 @@ namespace erpc {
 /// Packet loss timeout for an RPC request in microseconds
 static constexpr size_t kRpcRTOUs = 5000;
 
+/// Maximum time in microseconds that the event loop sleeps at a time in the
+/// interrupt-driven low-load mode. This bounds the latency of work that does
+/// not generate RX events, e.g., session management and background requests.
+static constexpr size_t kRxIntrMaxSleepUs = 1000;
+
 // Congestion control
 static constexpr bool kEnableCc = false;
 static constexpr bool kEnableCcOpts = true;
@@ -23,6 +28,11 @@ static constexpr bool kCcPacing = kEnableCc;    ///< Use rate limiter for pacing
 /// Sample RDTSC once per RX/TX batch for RTT measurements
 static constexpr bool kCcOptBatchTsc = kEnableCcOpts;
 
+/// Use the TSC sampled at the start of each event loop iteration for all
+/// datapath timing, i.e., RTT timestamps and the timing wheel. This coarsens
+/// kCcOptBatchTsc to one clock read per event loop iteration.
+static constexpr bool kEvLoopTsc = false;
+
 /// Bypass timing wheel if a session is uncongested
 static constexpr bool kCcOptWheelBypass = kEnableCcOpts;
 
@@ -37,5 +47,28 @@ static_assert(kCcRTT || !kCcRateComp, "");  // Rate comp => RTT measurement
 /// of the request handler.
 static constexpr bool kZeroCopyRX = true;
 
+/// Back hugepage memory with anonymous hugetlb memfds, which are freed
+/// deterministically when unmapped or when the process exits. The page size is
+/// kHugepageSize, i.e., the Hugepagesize environment variable or 1 GB. If
+/// hugepages are unavailable, HugeAlloc falls back to anonymous memory.
+static constexpr bool kHugeAllocMemfd = true;
+
+/// Allocate a server session slot's preallocated response MsgBuffer when the
+/// slot receives its first request instead of when the session connects, and
+/// release it after the session is idle for kSessionIdleMs if it doesn't hold
+/// the slot's latest response. This bounds memory for servers with many
+/// mostly-idle sessions.
+static constexpr bool kLazyPreRespMsgbuf = true;
+static constexpr size_t kSessionIdleMs = 100;
+
+// Scan for idle sessions no more often than clients retransmit
+static_assert(kSessionIdleMs * 1000 >= 10 * kRpcRTOUs, "");
+
+/// Read the TSC published in memory by a helper thread that each Nexus runs,
+/// instead of executing RDTSC, which faults inside SGX1 enclaves. rdtsc() is
+/// then one load, and time advances in steps of one helper iteration. In
+/// SCONE, only the helper exits the enclave for the clock (see TscPublisher).
+static constexpr bool kPublishedTsc = false;
+
 static constexpr bool kDatapathStats = false;
 }  // namespace erpc
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <string.h>
+#include <stdexcept>
+#include "common.h"
+
+#if ERPC_CRYPTO
+#include <isa-l_crypto/aes_gcm.h>
+#endif
+
+namespace erpc {
+
+/**
+ * @brief AES-128-GCM with an expanded key, using ISA-L's AES-NI routines.
+ *
+ * The key schedule and GHASH tables are computed once at construction, so
+ * sealing or opening a packet costs only the cipher and hash passes. An AesGcm
+ * object is not thread-safe: its ISA-L context holds per-operation state.
+ */
+class AesGcm {
+ public:
+  static constexpr size_t kKeySize = 16;    ///< AES-128
+  static constexpr size_t kTagSize = 16;    ///< Full-length GCM tag
+  static constexpr size_t kNonceSize = 12;  ///< 96-bit GCM nonce
+
+  /// Expand \p key. Throw if eRPC was compiled without crypto support.
+  explicit AesGcm(const uint8_t *key) {
+#if ERPC_CRYPTO
+    aesni_gcm128_pre(const_cast<uint8_t *>(key), &gdata);
+#else
+    _unused(key);
+    throw std::runtime_error("eRPC AesGcm: Compiled without crypto support.");
+#endif
+  }
+
+  /**
+   * @brief Encrypt \p len bytes at \p data in place and authenticate them
+   * with \p aad. The 16-byte tag is written to \p tag.
+   *
+   * @param nonce A kNonceSize-byte nonce that is never reused with this key
+   */
+  void seal(uint8_t *data, size_t len, const uint8_t *nonce,
+            const uint8_t *aad, size_t aad_len, uint8_t *tag) {
+#if ERPC_CRYPTO
+    uint8_t iv[GCM_IV_LEN];
+    make_iv(nonce, iv);
+    aesni_gcm128_enc(&gdata, data, data, len, iv, const_cast<uint8_t *>(aad),
+                     aad_len, tag, kTagSize);
+#else
+    _unused(data), _unused(len), _unused(nonce), _unused(aad);
+    _unused(aad_len), _unused(tag);
+#endif
+  }
+
+  /**
+   * @brief Decrypt \p len bytes at \p data in place, and check them and
+   * \p aad against \p tag
+   *
+   * @return True iff the tag matches. If the tag does not match, \p data
+   * holds garbage and must be dropped.
+   */
+  bool open(uint8_t *data, size_t len, const uint8_t *nonce,
+            const uint8_t *aad, size_t aad_len, const uint8_t *tag) {
+    return open_to(data, data, len, nonce, aad, aad_len, tag);
+  }
+
+  /**
+   * @brief Like open(), but decrypt from \p in to \p out in one pass. This
+   * fuses decryption with the copy out of a buffer, e.g., an RX ring.
+   *
+   * @return True iff the tag matches. If the tag does not match, \p out
+   * holds garbage.
+   */
+  bool open_to(uint8_t *out, const uint8_t *in, size_t len,
+               const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+               const uint8_t *tag) {
+#if ERPC_CRYPTO
+    uint8_t iv[GCM_IV_LEN];
+    make_iv(nonce, iv);
+    uint8_t computed_tag[kTagSize];
+    aesni_gcm128_dec(&gdata, out, const_cast<uint8_t *>(in), len, iv,
+                     const_cast<uint8_t *>(aad), aad_len, computed_tag,
+                     kTagSize);
+
+    return tags_equal(computed_tag, tag);
+#else
+    _unused(out), _unused(in), _unused(len), _unused(nonce), _unused(aad);
+    _unused(aad_len), _unused(tag);
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Compute the GMAC tag of \p len bytes at \p data into \p tag.
+   * The data is authenticated but not encrypted, which skips the AES-CTR
+   * pass of seal() and leaves only GHASH.
+   */
+  void mac(const uint8_t *data, size_t len, const uint8_t *nonce,
+           uint8_t *tag) {
+#if ERPC_CRYPTO
+    uint8_t iv[GCM_IV_LEN];
+    make_iv(nonce, iv);
+    uint8_t unused_text[1];
+    aesni_gcm128_enc(&gdata, unused_text, unused_text, 0, iv,
+                     const_cast<uint8_t *>(data), len, tag, kTagSize);
+#else
+    _unused(data), _unused(len), _unused(nonce), _unused(tag);
+#endif
+  }
+
+  /// Return true iff \p tag is the GMAC tag of \p len bytes at \p data
+  bool verify(const uint8_t *data, size_t len, const uint8_t *nonce,
+              const uint8_t *tag) {
+    uint8_t computed_tag[kTagSize];
+    mac(data, len, nonce, computed_tag);
+    return kCrypto && tags_equal(computed_tag, tag);
+  }
+
+  /**
+   * @brief Derive a key from \p master_key, \p salt, and \p label into
+   * \p out, by encrypting a zero block under \p master_key with the salt and
+   * label as the nonce. Keys derived with different labels are independent.
+   */
+  static void derive_key(const uint8_t *master_key, uint64_t salt,
+                         uint32_t label, uint8_t *out) {
+    uint8_t nonce[kNonceSize];
+    static_assert(sizeof(salt) + sizeof(label) == kNonceSize, "");
+    memcpy(nonce, &salt, sizeof(salt));
+    memcpy(nonce + sizeof(salt), &label, sizeof(label));
+
+    static_assert(kKeySize == kTagSize, "");
+    uint8_t tag[kTagSize];
+    memset(out, 0, kKeySize);
+    AesGcm master(master_key);
+    master.seal(out, kKeySize, nonce, nullptr, 0, tag);
+  }
+
+ private:
+  /// Compare two tags in constant time
+  static bool tags_equal(const uint8_t *tag_1, const uint8_t *tag_2) {
+    uint8_t diff = 0;
+    for (size_t i = 0; i < kTagSize; i++) diff |= tag_1[i] ^ tag_2[i];
+    return diff == 0;
+  }
+
+#if ERPC_CRYPTO
+  /// ISA-L's GCM IV is the 96-bit nonce followed by its required end mark
+  static void make_iv(const uint8_t *nonce, uint8_t *iv) {
+    static_assert(GCM_IV_END_START == kNonceSize, "");
+    static constexpr uint8_t kIvEnd[] = GCM_IV_END_MARK;
+    memcpy(iv, nonce, kNonceSize);
+    memcpy(&iv[GCM_IV_END_START], kIvEnd, sizeof(kIvEnd));
+  }
+
+  struct gcm_data gdata;  ///< Expanded key and GHASH state
+#endif
+};
+
+}  // namespace erpc
@@ -28,6 +28,12 @@ class Buffer {
   uint8_t *buf;
   size_t class_size;  ///< The allocator's class size
   uint32_t lkey;      ///< The memory registration lkey
+
+  /// True iff buf is in trusted (non-NIC-registered) memory
+  bool trusted = false;
+
+  /// True iff this Buffer belongs to a MsgBuffer pool
+  bool pooled = false;
 };
 
 }  // namespace erpc
@@ -5,5 +5,6 @@ namespace erpc {
 
 std::mutex dpdk_lock;
 volatile bool dpdk_initialized(false);
+std::atomic<size_t> published_tsc(0);
 
 }  // namespace erpc
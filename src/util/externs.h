@@ -8,4 +8,7 @@ namespace erpc {
 extern std::mutex dpdk_lock;
 extern volatile bool dpdk_initialized;
 
+/// The TSC published by TscPublisher, read by rdtsc() if kPublishedTsc is set
+extern std::atomic<size_t> published_tsc;
+
 }  // namespace erpc
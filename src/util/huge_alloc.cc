@@ -1,13 +1,24 @@
 #include "huge_alloc.h"
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <dirent.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <thread>
+#include "util/huge_arena.h"
 #include "util/logger.h"
 
 #include "scone.h"
 
+#ifndef MFD_HUGE_SHIFT
+#define MFD_HUGE_SHIFT 26  // From linux/memfd.h
+#endif
+
 namespace erpc {
 
 HugeAlloc::HugeAlloc(size_t initial_size, size_t numa_node,
@@ -18,21 +29,163 @@ HugeAlloc::HugeAlloc(size_t initial_size, size_t numa_node,
       dereg_mr_func(dereg_mr_func) {
   assert(numa_node <= kMaxNumaNodes);
 
-  if (initial_size < kMaxClassSize) initial_size = kMaxClassSize;
+  // Regions are carved into max-class Buffers
+  initial_size = round_up(kMaxClassSize, initial_size);
   prev_allocation_size = initial_size;
+
+  // Allow CI and hugepage-less environments to force the 4 KB page backing
+  no_hugepages = (getenv("ERPC_NO_HUGEPAGES") != nullptr);
 }
 
 HugeAlloc::~HugeAlloc() {
+  // Return cached Buffers to the shared arena
+  if (arena != nullptr) {
+    for (size_t i = 0; i < kNumClasses; i++) {
+      drain_magazine(i, magazine[i].size());
+    }
+  }
+
   // Deregister and detach the created SHM regions
-  for (shm_region_t &shm_region : shm_list) {
-    if (shm_region.registered) dereg_mr_func(shm_region.mem_reg_info);
-    int ret = shmdt(static_cast<void *>(const_cast<uint8_t *>(shm_region.buf)));
-    if (ret != 0) {
-      fprintf(stderr, "HugeAlloc: Error freeing SHM buf for key %d.\n",
-              shm_region.shm_key);
-      exit(-1);
+  for (shm_region_t &shm_region : shm_list) release_shm_region(shm_region);
+
+  if (!persist_prefix.empty()) remove_stale_persistent_files();
+}
+
+void HugeAlloc::release_shm_region(const shm_region_t &shm_region) {
+  if (shm_region.registered) dereg_mr_func(shm_region.mem_reg_info);
+  int ret = scone_kernel_munmap(
+      static_cast<void *>(const_cast<uint8_t *>(shm_region.buf)),
+      shm_region.size);
+  if (ret != 0) {
+    fprintf(stderr, "HugeAlloc: Error freeing SHM buf %p. Error = %s.\n",
+            shm_region.buf, strerror(errno));
+    exit(-1);
+  }
+}
+
+bool HugeAlloc::region_is_free(const buddy_region_t &region) const {
+  const std::vector<uint64_t> &bmp = region.free_bmp[kNumClasses - 1];
+  size_t num_free = 0;
+  for (uint64_t word : bmp) {
+    num_free += static_cast<size_t>(__builtin_popcountll(word));
+  }
+  return num_free == region.size / kMaxClassSize;
+}
+
+size_t HugeAlloc::reclaim() {
+  if (stats.shm_reserved <= low_watermark) return 0;
+  size_t released = 0;
+
+  // Iterate backwards because released regions are erased from buddy_regions
+  for (size_t i = buddy_regions.size(); i-- > 0;) {
+    buddy_region_t &region = *buddy_regions[i];
+    if (region.pinned || !region_is_free(region)) continue;
+    if (stats.shm_reserved - region.size < low_watermark) continue;
+
+    // Drop all freelist entries, including stale ones, in this region
+    const uint8_t *start = region.buf, *end = region.buf + region.size;
+    for (size_t c = 0; c < kNumClasses; c++) {
+      std::vector<Buffer> &fl = freelist[c];
+      fl.erase(std::remove_if(fl.begin(), fl.end(),
+                              [start, end](const Buffer &b) {
+                                return b.buf >= start && b.buf < end;
+                              }),
+               fl.end());
+    }
+    stats.free_blocks[kNumClasses - 1] -= region.size / kMaxClassSize;
+
+    auto shm_it = std::find_if(
+        shm_list.begin(), shm_list.end(),
+        [start](const shm_region_t &r) { return r.buf == start; });
+    assert(shm_it != shm_list.end());
+    release_shm_region(*shm_it);
+    if (!shm_it->path.empty()) unlink(shm_it->path.c_str());
+    stats.shm_reserved -= shm_it->size;
+    stats.tlb_entries -= shm_it->size / shm_it->page_size;
+    if (shm_it->page_size < kHugepageSize) {
+      stats.fallback_bytes -= shm_it->size;
+    }
+    released += shm_it->size;
+
+    // shm_region_t has const members, so erase by rebuilding the vector
+    std::vector<shm_region_t> new_shm_list;
+    for (auto it = shm_list.begin(); it != shm_list.end(); it++) {
+      if (it != shm_it) new_shm_list.push_back(*it);
     }
+    shm_list.swap(new_shm_list);
+    unmap_region(&region);
+    buddy_regions.erase(buddy_regions.begin() + static_cast<ssize_t>(i));
+
+    // Regrow from a smaller reservation next time
+    prev_allocation_size = std::max(
+        kMaxClassSize, round_up(kMaxClassSize, prev_allocation_size / 2));
+  }
+
+  if (released > 0) {
+    ERPC_INFO("eRPC HugeAlloc: Reclaimed %zu MB. Reserved = %zu MB.\n",
+              released / MB(1), stats.shm_reserved / MB(1));
+  }
+  return released;
+}
+
+bool HugeAlloc::reserve_pinned(size_t size) {
+  if (arena != nullptr) {
+    ERPC_WARN("eRPC HugeAlloc: Can't pin a budget with a shared arena.\n");
+    return false;
+  }
+
+  // Check the budget as it will be mapped, i.e., in whole region granules
+  size = round_up(region_granule(), size);
+  if (size > high_watermark || stats.shm_reserved > high_watermark - size) {
+    ERPC_WARN("eRPC HugeAlloc: Pinned budget exceeds the high watermark.\n");
+    return false;
+  }
+  if (!reserve_hugepages(size, true)) return false;
+  growth_disabled = true;
+  return true;
+}
+
+bool HugeAlloc::grow() {
+  if (growth_disabled) return false;
+
+  // Regions are mapped in whole granules, so round before checking headroom
+  const size_t granule = region_granule();
+  const size_t headroom = high_watermark > stats.shm_reserved
+                              ? high_watermark - stats.shm_reserved
+                              : 0;
+  size_t size = std::min(round_up(granule, prev_allocation_size * 2),
+                         (headroom / granule) * granule);
+
+  while (size >= granule) {
+    if (reserve_hugepages(size, false)) {
+      prev_allocation_size = size;
+      return true;
+    }
+    size = ((size / 2) / granule) * granule;
+  }
+
+  return false;
+}
+
+size_t HugeAlloc::get_stat_free_bytes() const {
+  size_t ret = 0;
+  for (size_t i = 0; i < kNumClasses; i++) {
+    ret += stats.free_blocks[i] * class_max_size(i);
+  }
+  return ret;
+}
+
+double HugeAlloc::get_stat_fragmentation() const {
+  const size_t free_bytes = get_stat_free_bytes();
+  if (free_bytes == 0) return 0.0;
+
+  for (size_t i = kNumClasses; i-- > 0;) {
+    if (stats.free_blocks[i] == 0) continue;
+    return 1.0 - (1.0 * stats.free_blocks[i] * class_max_size(i) / free_bytes);
   }
+
+  assert(false);
+  return 0.0;
 }
 
 void HugeAlloc::print_stats() {
@@ -41,176 +194,531 @@ void HugeAlloc::print_stats() {
           stats.shm_reserved, 1.0 * stats.shm_reserved / MB(1));
   fprintf(stderr, "Total memory allocated to user = %zu bytes (%.2f MB)\n",
           stats.user_alloc_tot, 1.0 * stats.user_alloc_tot / MB(1));
+  fprintf(stderr, "Total free memory = %zu bytes (%.2f MB)\n",
+          get_stat_free_bytes(), 1.0 * get_stat_free_bytes() / MB(1));
+  fprintf(stderr, "Free memory fragmentation = %.2f (best = 0.0)\n",
+          get_stat_fragmentation());
+  fprintf(stderr,
+          "Backing: %.2f MB hugepages, %.2f MB 4 KB pages. "
+          "TLB reach loss = %.1fx (best = 1.0)\n",
+          1.0 * (stats.shm_reserved - stats.fallback_bytes) / MB(1),
+          1.0 * stats.fallback_bytes / MB(1), get_stat_tlb_reach_loss());
+
+  if (!persist_prefix.empty()) {
+    fprintf(stderr, "Persistent regions %s*: %.2f MB reused\n",
+            persist_prefix.c_str(), 1.0 * stats.warm_bytes / MB(1));
+  }
 
-  fprintf(stderr, "%zu SHM regions\n", shm_list.size());
+  fprintf(stderr, "%zu SHM regions, %zu buddy regions\n", shm_list.size(),
+          buddy_regions.size());
   size_t shm_region_index = 0;
   for (shm_region_t &shm_region : shm_list) {
-    fprintf(stderr, "Region %zu, size %zu MB\n", shm_region_index,
-            shm_region.size / MB(1));
+    fprintf(stderr, "Region %zu, size %zu MB, page size %zu KB\n",
+            shm_region_index, shm_region.size / MB(1),
+            shm_region.page_size / KB(1));
     shm_region_index++;
   }
 
-  fprintf(stderr, "Size classes:\n");
+  fprintf(stderr, "Size classes (free blocks, freelist entries):\n");
   for (size_t i = 0; i < kNumClasses; i++) {
     size_t class_size = class_max_size(i);
     if (class_size < KB(1)) {
-      fprintf(stderr, "\t%zu B: %zu Buffers\n", class_size, freelist[i].size());
-    } else if (class_size < MB(1)) {
-      fprintf(stderr, "\t%zu KB: %zu Buffers\n", class_size / KB(1),
+      fprintf(stderr, "\t%zu B: %zu, %zu\n", class_size, stats.free_blocks[i],
               freelist[i].size());
+    } else if (class_size < MB(1)) {
+      fprintf(stderr, "\t%zu KB: %zu, %zu\n", class_size / KB(1),
+              stats.free_blocks[i], freelist[i].size());
     } else {
-      fprintf(stderr, "\t%zu MB: %zu Buffers\n", class_size / MB(1),
-              freelist[i].size());
+      fprintf(stderr, "\t%zu MB: %zu, %zu\n", class_size / MB(1),
+              stats.free_blocks[i], freelist[i].size());
+    }
+  }
+}
+
+HugeAlloc::buddy_region_t *HugeAlloc::get_region_map_entry(
+    size_t granule) const {
+  const size_t root_i = granule >> kRegionLeafBits;
+  if (unlikely(root_i >= region_map.size() || !region_map[root_i])) {
+    return nullptr;
+  }
+  return (*region_map[root_i])[granule & ((1ull << kRegionLeafBits) - 1)];
+}
+
+HugeAlloc::buddy_region_t *HugeAlloc::find_region(const uint8_t *buf) {
+  const size_t granule = reinterpret_cast<size_t>(buf) >> kRegionGranuleShift;
+  buddy_region_t *region = get_region_map_entry(granule);
+
+  // A region that starts mid-granule shares the granule with its predecessor
+  if (region != nullptr && unlikely(buf < region->buf) && granule > 0) {
+    region = get_region_map_entry(granule - 1);
+  }
+
+  rt_assert(region != nullptr && buf >= region->buf &&
+                buf < region->buf + region->size,
+            "HugeAlloc: Foreign Buffer");
+  return region;
+}
+
+void HugeAlloc::map_region(buddy_region_t *region) {
+  const size_t first = reinterpret_cast<size_t>(region->buf) >>
+                       kRegionGranuleShift;
+  const size_t last =
+      reinterpret_cast<size_t>(region->buf + region->size - 1) >>
+      kRegionGranuleShift;
+  rt_assert((last >> kRegionLeafBits) < region_map.size(),
+            "HugeAlloc: Region beyond the region map");
+
+  for (size_t granule = first; granule <= last; granule++) {
+    std::unique_ptr<region_leaf_t> &leaf =
+        region_map[granule >> kRegionLeafBits];
+    if (!leaf) leaf.reset(new region_leaf_t());  // Zeroed
+
+    buddy_region_t *&entry =
+        (*leaf)[granule & ((1ull << kRegionLeafBits) - 1)];
+    if (entry == nullptr || entry->buf < region->buf) entry = region;
+  }
+}
+
+void HugeAlloc::unmap_region(const buddy_region_t *region) {
+  const size_t first = reinterpret_cast<size_t>(region->buf) >>
+                       kRegionGranuleShift;
+  const size_t last =
+      reinterpret_cast<size_t>(region->buf + region->size - 1) >>
+      kRegionGranuleShift;
+
+  for (size_t granule = first; granule <= last; granule++) {
+    region_leaf_t &leaf = *region_map[granule >> kRegionLeafBits];
+    buddy_region_t *&entry = leaf[granule & ((1ull << kRegionLeafBits) - 1)];
+    if (entry != region) continue;  // A later region shares this granule
+    entry = nullptr;
+
+    // A predecessor may end in the region's first granule
+    if (granule == first && granule > 0) {
+      buddy_region_t *prev = get_region_map_entry(granule - 1);
+      const size_t granule_start = granule << kRegionGranuleShift;
+      if (prev != nullptr &&
+          reinterpret_cast<size_t>(prev->buf + prev->size) > granule_start) {
+        entry = prev;
+      }
+    }
+  }
+}
+
+void HugeAlloc::mark_free(buddy_region_t *region, size_t size_class,
+                          size_t block_i) {
+  assert(!bmp_test(region->free_bmp[size_class], block_i));
+  bmp_set(region->free_bmp[size_class], block_i);
+  stats.free_blocks[size_class]++;
+
+  if (!bmp_test(region->listed_bmp[size_class], block_i)) {
+    bmp_set(region->listed_bmp[size_class], block_i);
+    uint8_t *buf = region->buf + (block_i << (size_class + kMinClassBitShift));
+    freelist[size_class].push_back(
+        Buffer(buf, class_max_size(size_class), region->lkey));
+  }
+}
+
+void HugeAlloc::free_and_coalesce(uint8_t *buf, size_t size_class) {
+  buddy_region_t *region = find_region(buf);
+  size_t block_i = block_index(region, buf, size_class);
+
+  // Merge with the buddy while it's free. Max-class blocks have no buddy.
+  while (size_class < kNumClasses - 1) {
+    const size_t buddy_i = block_i ^ 1;
+    if (!bmp_test(region->free_bmp[size_class], buddy_i)) break;
+
+    // The buddy's freelist entry, if any, becomes stale
+    bmp_clear(region->free_bmp[size_class], buddy_i);
+    stats.free_blocks[size_class]--;
+
+    block_i >>= 1;
+    size_class++;
+  }
+
+  mark_free(region, size_class, block_i);
+}
+
+Buffer HugeAlloc::pop_free(size_t size_class) {
+  // Use the Buffers at the back to improve locality
+  while (!freelist[size_class].empty()) {
+    Buffer buffer = freelist[size_class].back();
+    freelist[size_class].pop_back();
+    assert(buffer.class_size == class_max_size(size_class));
+
+    buddy_region_t *region = find_region(buffer.buf);
+    const size_t block_i = block_index(region, buffer.buf, size_class);
+    bmp_clear(region->listed_bmp[size_class], block_i);
+
+    if (bmp_test(region->free_bmp[size_class], block_i)) {
+      bmp_clear(region->free_bmp[size_class], block_i);
+      stats.free_blocks[size_class]--;
+      return buffer;
+    }
+
+    // Else this entry is stale because the block was merged into a larger one
+  }
+
+  return Buffer(nullptr, 0, 0);
+}
+
+void *HugeAlloc::map_anonymous_thp(size_t size) {
+  int mem = open("/dev/zero", O_RDWR);
+  if (mem == -1) return MAP_FAILED;
+
+  // Transparent hugepages need 2 MB-aligned memory, so over-map and trim
+  static constexpr size_t kThpSize = MB(2);
+  void *mmap_ret = scone_kernel_mmap(
+      nullptr, size + kThpSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, mem, 0);
+  const int mmap_errno = errno;
+  close(mem);  // The mapping holds its own reference
+  if (mmap_ret == MAP_FAILED) {
+    errno = mmap_errno;
+    return MAP_FAILED;
+  }
+
+  auto *raw = static_cast<uint8_t *>(mmap_ret);
+  auto *buf = reinterpret_cast<uint8_t *>(
+      round_up(kThpSize, reinterpret_cast<size_t>(raw)));
+  const size_t head = static_cast<size_t>(buf - raw);
+  if (head > 0) scone_kernel_munmap(raw, head);
+  if (head < kThpSize) scone_kernel_munmap(buf + size, kThpSize - head);
+
+  // The hint is best-effort, e.g., THP may be disabled
+  if (madvise(buf, size, MADV_HUGEPAGE) != 0) {
+    ERPC_INFO("eRPC HugeAlloc: madvise(MADV_HUGEPAGE) failed. Error = %s.\n",
+              strerror(errno));
+  }
+
+  return buf;
+}
+
+double HugeAlloc::get_stat_tlb_reach_loss() const {
+  if (stats.shm_reserved == 0) return 1.0;
+  return 1.0 * stats.tlb_entries / (stats.shm_reserved / kHugepageSize);
+}
+
+void *HugeAlloc::map_hugetlb_memfd(size_t size) {
+  // Request the configured hugepage size, e.g., 1 GB, instead of the system's
+  // default hugepage size
+  unsigned int flags = MFD_CLOEXEC | MFD_HUGETLB;
+  flags |= static_cast<unsigned int>(__builtin_ctzll(kHugepageSize))
+           << MFD_HUGE_SHIFT;
+
+  int fd =
+      static_cast<int>(syscall(SYS_memfd_create, "erpc_huge_alloc", flags));
+  if (fd == -1) return MAP_FAILED;
+
+  // Hugetlb memfds must be sized before mapping. Pages are reserved at mmap
+  // time, so a shortage shows up as an mmap failure, not SIGBUS later.
+  if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    close(fd);
+    return MAP_FAILED;
+  }
+
+  int mmap_flags = MAP_SHARED;
+  if (size < kParallelPrefaultSize) mmap_flags |= MAP_POPULATE;
+  void *ret = scone_kernel_mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                mmap_flags, fd, 0);
+
+  // The mapping holds its own reference to the memfd, so its memory is freed
+  // by munmap or process exit. There is no named segment to leak on a crash.
+  close(fd);
+  return ret;
+}
+
+void HugeAlloc::set_persistent(const std::string &path_prefix) {
+  rt_assert(shm_list.empty(),
+            "HugeAlloc: Persistence must be set before allocation");
+  persist_prefix = path_prefix;
+}
+
+void *HugeAlloc::map_persistent_file(size_t size, std::string *path,
+                                     bool *warm) {
+  *path = persist_prefix + std::to_string(persist_seq++);
+  int fd = open(path->c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    ERPC_WARN("eRPC HugeAlloc: Failed to open %s. Error = %s.\n",
+              path->c_str(), strerror(errno));
+    return MAP_FAILED;
+  }
+
+  // A predecessor's file of the same size still holds its hugepages. Files of
+  // another size can't be reused, so they are emptied and resized.
+  struct stat file_stat;
+  *warm = fstat(fd, &file_stat) == 0 &&
+          static_cast<size_t>(file_stat.st_size) == size;
+  if (!*warm && (ftruncate(fd, 0) != 0 ||
+                 ftruncate(fd, static_cast<off_t>(size)) != 0)) {
+    close(fd);
+    unlink(path->c_str());
+    return MAP_FAILED;
+  }
+
+  // Populating a warm file only builds page tables for its resident pages
+  int mmap_flags = MAP_SHARED;
+  if (*warm || size < kParallelPrefaultSize) mmap_flags |= MAP_POPULATE;
+  void *ret = scone_kernel_mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                mmap_flags, fd, 0);
+  close(fd);
+
+  if (ret == MAP_FAILED && !*warm) unlink(path->c_str());
+  return ret;
+}
+
+void HugeAlloc::remove_stale_persistent_files() {
+  const size_t slash = persist_prefix.rfind('/');
+  const std::string dir =
+      slash == std::string::npos ? "." : persist_prefix.substr(0, slash + 1);
+  const std::string name_prefix = persist_prefix.substr(
+      slash == std::string::npos ? 0 : slash + 1);
+
+  DIR *dirp = opendir(dir.c_str());
+  if (dirp == nullptr) return;
+
+  while (struct dirent *entry = readdir(dirp)) {
+    const std::string name = entry->d_name;
+    if (name.size() <= name_prefix.size() ||
+        name.compare(0, name_prefix.size(), name_prefix) != 0) {
+      continue;
+    }
+
+    const std::string seq_str = name.substr(name_prefix.size());
+    if (seq_str.size() > 18 ||
+        seq_str.find_first_not_of("0123456789") != std::string::npos) {
+      continue;
     }
+    if (std::stoull(seq_str) < persist_seq) continue;
+
+    const std::string path = persist_prefix + seq_str;
+    ERPC_INFO("eRPC HugeAlloc: Deleting stale region file %s.\n",
+              path.c_str());
+    unlink(path.c_str());
+  }
+  closedir(dirp);
+}
+
+void HugeAlloc::prefault(uint8_t *buf, size_t size, size_t page_size) {
+  const size_t num_pages = size / page_size;
+  size_t num_threads = std::min(kPrefaultThreads, num_pages);
+  num_threads = std::min(
+      num_threads,
+      static_cast<size_t>(std::max(1u, std::thread::hardware_concurrency())));
+
+  // The memory is zero-filled, so writing zeros is harmless and faults the
+  // pages in for writing
+  auto touch_func = [buf, page_size](size_t page_start, size_t page_end) {
+    for (size_t i = page_start; i < page_end; i++) {
+      reinterpret_cast<volatile uint8_t *>(buf)[i * page_size] = 0;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  const size_t pages_per_thread = (num_pages + num_threads - 1) / num_threads;
+  for (size_t i = 1; i < num_threads; i++) {
+    threads.emplace_back(touch_func, i * pages_per_thread,
+                         std::min(num_pages, (i + 1) * pages_per_thread));
   }
+  touch_func(0, std::min(num_pages, pages_per_thread));  // This thread's share
+  for (std::thread &thread : threads) thread.join();
 }
 
 Buffer HugeAlloc::alloc_raw(size_t size, DoRegister do_register) {
   std::ostringstream xmsg;  // The exception message
   size = round_up(kHugepageSize, size);
-#if 0
-  int shm_key, shm_id;
-  std::string file;
-
-  while (true) {
-    // Choose a positive SHM key. Negative is fine but it looks scary in the
-    // error message.
-    shm_key = static_cast<int>(slow_rand.next_u64());
-    shm_key = std::abs(shm_key);
-
-    std::stringstream name;
-    name << "this_is_stupid_" << shm_key;
-    file = name.str();
-    shm_id = open(file.c_str(), O_CREAT | O_RDWR, 0666);
-    // Try to get an SHM region
-    //shm_id = shmget(shm_key, size, IPC_CREAT | IPC_EXCL | 0666 | SHM_HUGETLB);
-
-
-    if (shm_id == -1) {
-      switch (errno) {
-        case EEXIST:
-          continue;  // shm_key already exists. Try again.
-
-        case EACCES:
-          xmsg << "eRPC HugeAlloc: SHM allocation error. "
-               << "Insufficient permissions.";
-          throw std::runtime_error(xmsg.str());
-
-        case EINVAL:
-          xmsg << "eRPC HugeAlloc: SHM allocation error: SHMMAX/SHMIN "
-               << "mismatch. size = " << std::to_string(size) << " ("
-               << std::to_string(size / MB(1)) << " MB).";
-          throw std::runtime_error(xmsg.str());
-
-        case ENOMEM:
-          // Out of memory - this is OK
-          ERPC_WARN(
-              "eRPC HugeAlloc: Insufficient hugepages. Can't reserve %lu MB.\n",
-              size / MB(1));
-          return Buffer(nullptr, 0, 0);
-
-        default:
-          xmsg << "eRPC HugeAlloc: Unexpected SHM malloc error "
-               << strerror(errno);
-          throw std::runtime_error(xmsg.str());
-      }
-    } else {
-      // shm_key worked. Break out of the while loop.
-      break;
+  size_t page_size = kHugepageSize;
+
+  // Try a persistent region file or a hugetlb memfd first. If hugepages are
+  // unavailable, fall back to zero-filled anonymous memory.
+  void *mmap_ret = MAP_FAILED;
+  std::string path;
+  bool warm = false;
+  if (!no_hugepages) {
+    if (!persist_prefix.empty()) {
+      mmap_ret = map_persistent_file(size, &path, &warm);
+    } else if (kHugeAllocMemfd) {
+      mmap_ret = map_hugetlb_memfd(size);
     }
   }
 
-  uint8_t *shm_buf = static_cast<uint8_t *>(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_id, 0));
-  rt_assert(shm_buf != nullptr,
-            "eRPC HugeAlloc: shmat() failed. Key = " + std::to_string(shm_key));
-  close(shm_id);
-  remove(file.c_str());
-  // Mark the SHM region for deletion when this process exits
-  //shmctl(shm_id, IPC_RMID, nullptr);
-#endif
-  auto mem = open("/dev/zero", O_RDWR);
-  if (mem == -1) {
-    rt_assert("FUCK YOU!!");
+  if (mmap_ret == MAP_FAILED) {
+    if (stats.fallback_bytes == 0) {
+      ERPC_WARN(
+          "eRPC HugeAlloc: Hugepages unavailable. Using 4 KB pages with "
+          "transparent hugepage hints. TLB reach may be up to %zux lower.\n",
+          kHugepageSize / KB(4));
+    }
+
+    mmap_ret = map_anonymous_thp(size);
+    const int mmap_errno = errno;
+    page_size = KB(4);
+    path.clear();  // Not persistent
+
+    if (mmap_ret == MAP_FAILED) {
+      if (mmap_errno == ENOMEM) {
+        // Out of memory - this is OK
+        ERPC_WARN(
+            "eRPC HugeAlloc: Insufficient memory. Can't reserve %lu MB.\n",
+            size / MB(1));
+        return Buffer(nullptr, 0, 0);
+      }
+
+      xmsg << "eRPC HugeAlloc: Unexpected mmap error " << strerror(mmap_errno);
+      throw std::runtime_error(xmsg.str());
+    }
   }
-  auto shm_buf = static_cast<uint8_t *>(scone_kernel_mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, mem, 0));
-  // Bind the buffer to the NUMA node
+  auto *shm_buf = static_cast<uint8_t *>(mmap_ret);
+
+  // Bind the buffer to the NUMA node before pre-faulting, since the
+  // pre-faulting threads may run on other nodes. Pages that mmap already
+  // populated are moved to the node.
   const unsigned long nodemask = (1ul << static_cast<unsigned long>(numa_node));
+  if (mbind(shm_buf, size, MPOL_BIND, &nodemask, 8 * sizeof(nodemask),
+            MPOL_MF_MOVE) != 0) {
+    ERPC_WARN("eRPC HugeAlloc: mbind() to NUMA node %zu failed. Error = %s.\n",
+              numa_node, strerror(errno));
+  }
+
+  // Small regions were populated by mmap if possible. Fault large hugepage
+  // regions in on several cores so that reserving them takes milliseconds.
+  // The 4 KB fallback stays lazy: its size was rounded up to kHugepageSize,
+  // so faulting it in would commit far more memory than was requested.
+  if (warm) {
+    ERPC_INFO("eRPC HugeAlloc: Reusing %zu MB from %s.\n", size / MB(1),
+              path.c_str());
+    stats.warm_bytes += size;
+  } else if (page_size == kHugepageSize && size >= kParallelPrefaultSize) {
+    prefault(shm_buf, size, page_size);
+  }
 
   // If we are here, the allocation succeeded.  Register if needed.
   bool do_register_bool = (do_register == DoRegister::kTrue);
   Transport::MemRegInfo reg_info;
   if (do_register_bool) reg_info = reg_mr_func(shm_buf, size);
 
-  // Save the SHM region so we can free it later
-//shm_list.push_back(
-//      shm_region_t(shm_key, shm_buf, size, do_register_bool, reg_info));
- // stats.shm_reserved += size;
+  // Save the SHM region so we can free it later. There is no SHM key for
+  // mmap-backed regions.
+  shm_list.push_back(shm_region_t(-1, shm_buf, size, page_size,
+                                  do_register_bool, reg_info, path));
+  stats.shm_reserved += size;
+  stats.tlb_entries += size / page_size;
+  if (page_size < kHugepageSize) stats.fallback_bytes += size;
 
   // buffer.class_size is invalid because we didn't allocate from a class
   return Buffer(shm_buf, SIZE_MAX,
                 do_register_bool ? reg_info.lkey : UINT32_MAX);
 }
 
+void HugeAlloc::set_arena(HugeArena *arena) {
+  rt_assert(stats.user_alloc_tot == 0 && this->arena == nullptr,
+            "HugeAlloc: Arena must be set before allocation");
+  this->arena = arena;
+}
+
+Buffer HugeAlloc::alloc_from_magazine(size_t size_class) {
+  std::vector<Buffer> &mag = magazine[size_class];
+  if (unlikely(mag.empty())) {
+    const size_t batch = magazine_batch(size_class);
+    mag.resize(batch);
+    mag.resize(arena->alloc_batch(class_max_size(size_class), mag.data(),
+                                  batch));
+    if (mag.empty()) return Buffer(nullptr, 0, 0);
+  }
+
+  Buffer buffer = mag.back();
+  mag.pop_back();
+  stats.user_alloc_tot += buffer.class_size;
+  return buffer;
+}
+
+void HugeAlloc::free_to_magazine(Buffer buffer, size_t size_class) {
+  std::vector<Buffer> &mag = magazine[size_class];
+  // Drop the caller's flags (e.g., pooled) so they aren't handed out again
+  mag.push_back(Buffer(buffer.buf, buffer.class_size, buffer.lkey));
+
+  // Keep up to two batches so alternating alloc/free doesn't thrash the arena
+  const size_t batch = magazine_batch(size_class);
+  if (unlikely(mag.size() > 2 * batch)) drain_magazine(size_class, batch);
+}
+
+void HugeAlloc::drain_magazine(size_t size_class, size_t num) {
+  std::vector<Buffer> &mag = magazine[size_class];
+  assert(num <= mag.size());
+  arena->free_batch(mag.data() + (mag.size() - num), num);
+  mag.resize(mag.size() - num);
+}
+
 Buffer HugeAlloc::alloc(size_t size) {
   assert(size <= kMaxClassSize);
 
-  size_t size_class = get_class(size);
+  const size_t size_class = get_class(size);
   assert(size_class < kNumClasses);
 
-  if (!freelist[size_class].empty()) {
-    return alloc_from_class(size_class);
-  } else {
-    // There is no free Buffer in this class. Find the first larger class with
-    // free Buffers.
-    size_t next_class = size_class + 1;
-    for (; next_class < kNumClasses; next_class++) {
-      if (!freelist[next_class].empty()) break;
-    }
+  if (arena != nullptr) return alloc_from_magazine(size_class);
 
-    if (next_class == kNumClasses) {
-      // There's no larger size class with free pages, we we need to allocate
-      // more hugepages. This adds some Buffers to the largest class.
-      prev_allocation_size *= 2;
-      bool success = reserve_hugepages(prev_allocation_size);
-      while (!success) {
-        prev_allocation_size /= 2; // Restore the previous allocation
-        if (prev_allocation_size < kMaxClassSize) {
-          return Buffer(nullptr, 0, 0);
-        }
-        success = reserve_hugepages(prev_allocation_size);
-      }
-      next_class = kNumClasses - 1;
-    }
+  Buffer buffer = pop_free(size_class);
+  if (likely(buffer.buf != nullptr)) {
+    stats.user_alloc_tot += buffer.class_size;
+    return buffer;
+  }
 
-    // If we're here, \p next_class has free Buffers
-    assert(next_class < kNumClasses);
-    while (next_class != size_class) {
-      split(next_class);
-      next_class--;
-    }
+  // There is no free Buffer in this class. Find the first larger class with
+  // free Buffers.
+  size_t next_class = size_class + 1;
+  for (; next_class < kNumClasses; next_class++) {
+    buffer = pop_free(next_class);
+    if (buffer.buf != nullptr) break;
+  }
 
-    assert(!freelist[size_class].empty());
-    return alloc_from_class(size_class);
+  if (next_class == kNumClasses) {
+    // There's no larger size class with free pages, we we need to allocate
+    // more hugepages. This adds some Buffers to the largest class.
+    if (!grow()) return Buffer(nullptr, 0, 0);
+    next_class = kNumClasses - 1;
+    buffer = pop_free(next_class);
   }
 
-  assert(false);
-  exit(-1);  // We should never get here
-  return Buffer(nullptr, 0, 0);
+  // If we're here, \p buffer is a free block of \p next_class. Split it down
+  // to \p size_class, freeing the upper half at each level.
+  assert(buffer.buf != nullptr);
+  buddy_region_t *region = find_region(buffer.buf);
+  while (next_class != size_class) {
+    next_class--;
+    const size_t half = class_max_size(next_class);
+    mark_free(region, next_class,
+              block_index(region, buffer.buf + half, next_class));
+    buffer = Buffer(buffer.buf, half, buffer.lkey);
+  }
+
+  stats.user_alloc_tot += buffer.class_size;
+  return buffer;
 }
 
-bool HugeAlloc::reserve_hugepages(size_t size) {
+bool HugeAlloc::reserve_hugepages(size_t size, bool pinned) {
   assert(size >= kMaxClassSize);  // We need at least one max-sized buffer
+  size = round_up(kHugepageSize, size);  // Use all of the mapping
   Buffer buffer = alloc_raw(size, DoRegister::kTrue);
   if (buffer.buf == nullptr) return false;
 
+  // Set up buddy metadata for the region
+  auto *region = new buddy_region_t();
+  region->buf = buffer.buf;
+  region->size = (size / kMaxClassSize) * kMaxClassSize;
+  region->lkey = buffer.lkey;
+  region->pinned = pinned;
+  for (size_t i = 0; i < kNumClasses; i++) {
+    const size_t num_blocks = region->size / class_max_size(i);
+    region->free_bmp[i].resize((num_blocks + 63) / 64, 0);
+    region->listed_bmp[i].resize((num_blocks + 63) / 64, 0);
+  }
+
+  buddy_regions.emplace_back(region);
+  map_region(region);
+
   // Add Buffers to the largest class
   size_t num_buffers = size / kMaxClassSize;
   assert(num_buffers >= 1);
   for (size_t i = 0; i < num_buffers; i++) {
-    uint8_t *buf = buffer.buf + (i * kMaxClassSize);
-    uint32_t lkey = buffer.lkey;
-
-    freelist[kNumClasses - 1].push_back(Buffer(buf, kMaxClassSize, lkey));
+    mark_free(region, kNumClasses - 1, i);
   }
 
   return true;
@@ -5,13 +5,16 @@
 #include <numaif.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <algorithm>
+#include <array>
+#include <memory>
 #include <stdexcept>
+#include <string>
 #include <vector>
 
 #include "common.h"
 #include "transport.h"
 #include "util/buffer.h"
-#include "util/rand.h"
 
 namespace erpc {
 
@@ -21,17 +24,22 @@ struct shm_region_t {
   const int shm_key;      /// The key used to create the SHM region
   const uint8_t *buf;     /// The start address of the allocated SHM buffer
   const size_t size;      /// The size in bytes of the allocated SHM buffer
-  const bool registered;  /// Is this SHM region registered with the NIC?
+  const size_t page_size;  /// Backing page size, 4 KB without hugepages
+  const bool registered;   /// Is this SHM region registered with the NIC?
+  const std::string path;  /// Backing file of a persistent region, or empty
 
   /// The transport-specific memory registration info
   Transport::MemRegInfo mem_reg_info;
 
-  shm_region_t(int shm_key, uint8_t *buf, size_t size, bool registered,
-               Transport::MemRegInfo mem_reg_info)
+  shm_region_t(int shm_key, uint8_t *buf, size_t size, size_t page_size,
+               bool registered, Transport::MemRegInfo mem_reg_info,
+               std::string path = "")
       : shm_key(shm_key),
         buf(buf),
         size(size),
+        page_size(page_size),
         registered(registered),
+        path(path),
         mem_reg_info(mem_reg_info) {
     assert(size % kHugepageSize == 0);
   }
@@ -39,38 +47,80 @@ struct shm_region_t {
 
 enum class DoRegister { kTrue, kFalse };
 
+class HugeArena;  // Forward declaration: HugeArena wraps a HugeAlloc
+
 /**
- * A hugepage allocator that uses per-class freelists. The minimum class size
- * is kMinClassSize, and class size increases by a factor of 2 until
+ * A hugepage buddy allocator that uses per-class freelists. The minimum class
+ * size is kMinClassSize, and class size increases by a factor of 2 until
  * kMaxClassSize.
  *
  * When a new SHM region is added to the allocator, it is split into Buffers of
  * size kMaxClassSize and added to that class. These Buffers are later split to
- * fill up smaller classes.
+ * fill up smaller classes. When a Buffer is freed, it is merged with its buddy
+ * if the buddy is also free, repeatedly up to kMaxClassSize.
+ *
+ * Buddy metadata lives in per-region bitmaps, not inside the free blocks: the
+ * hugepage memory may be untrusted (e.g., outside an enclave), and its
+ * contents must not be able to steer the allocator. Freelist entries are
+ * invalidated lazily when their block is merged, and skipped on allocation.
  *
  * The \p size field of allocated Buffers equals the requested size, i.e., it's
  * not rounded to the class size.
  *
- * The allocator uses randomly generated positive SHM keys, and deallocates the
- * SHM regions it creates when deleted.
+ * Reserved memory can be bounded with watermarks. Growth never takes reserved
+ * memory above the high watermark, and reclaim() releases fully free regions
+ * while reserved memory stays at or above the low watermark. By default, there
+ * is no high watermark and reclaim() releases nothing. Alternatively,
+ * reserve_pinned() reserves a fixed budget up front and disables growth.
+ *
+ * If hugepages are unavailable, or if the ERPC_NO_HUGEPAGES environment
+ * variable is set, memory is backed by 4 KB pages with a transparent hugepage
+ * hint instead. This costs TLB reach, which the allocator reports.
+ *
+ * Optionally, regions can be backed by named files in a hugetlbfs mount, which
+ * keep their memory across process restarts. A successor allocator with the
+ * same file name prefix maps the existing memory instead of faulting it in.
+ *
+ * Optionally, class allocations can be served from a HugeArena shared with
+ * other allocators, through per-class magazines of cached Buffers. Raw
+ * allocations always use this allocator's own SHM regions.
+ *
+ * The allocator deallocates the SHM regions it creates when deleted, except
+ * for the memory of persistent regions.
  */
 class HugeAlloc {
  public:
   static constexpr const char *alloc_fail_help_str =
       "This could be due to insufficient huge pages or SHM limits.";
-  static const size_t kMinClassSize = 64;     /// Min allocation size
-  static const size_t kMinClassBitShift = 6;  /// For division by kMinClassSize
+  static constexpr size_t kMinClassSize = 64;  /// Min allocation size
+  static constexpr size_t kMinClassBitShift = 6;  /// Division by kMinClassSize
   static_assert((kMinClassSize >> kMinClassBitShift) == 1, "");
 
-  static const size_t kMaxClassSize = MB(8);  /// Max allocation size
-  static const size_t kNumClasses = 18;       /// 64 B (2^6), ..., 8 MB (2^23)
+  static constexpr size_t kMaxClassSize = MB(8);  /// Max allocation size
+  static constexpr size_t kNumClasses = 18;  /// 64 B (2^6), ..., 8 MB (2^23)
   static_assert(kMaxClassSize == kMinClassSize << (kNumClasses - 1), "");
 
+  /// Hugepage reservations at least this large are pre-faulted by several
+  /// threads
+  static constexpr size_t kParallelPrefaultSize = MB(64);
+  static constexpr size_t kPrefaultThreads = 8;  /// Max pre-faulting threads
+
+  /// Max Buffers moved between a magazine and the shared arena at once
+  static constexpr size_t kMagazineBatch = 32;
+  static constexpr size_t kMagazineBatchBytes = MB(2);  /// Cap per batch
+
   /// Return the maximum size of a class
   static constexpr size_t class_max_size(size_t class_i) {
     return kMinClassSize * (1ull << class_i);
   }
 
+  /// Return the granularity of class regions. Regions are mapped in whole
+  /// hugepages and carved into max-class Buffers, so reservations by alloc()
+  /// and reserve_pinned() are multiples of this size.
+  static inline size_t region_granule() {
+    return std::max(kHugepageSize, kMaxClassSize);
+  }
+
   /**
    * @brief Construct the hugepage allocator
    * @throw runtime_error if construction fails
@@ -118,15 +168,71 @@ class HugeAlloc {
    */
   Buffer alloc(size_t size);
 
-  /// Free a Buffer
+  /**
+   * @brief Bound the hugepage memory reserved by this allocator, including
+   * memory reserved by alloc_raw()
+   *
+   * @param low_watermark reclaim() never takes reserved memory below this
+   * @param high_watermark alloc() never grows reserved memory above this
+   */
+  inline void set_watermarks(size_t low_watermark, size_t high_watermark) {
+    rt_assert(low_watermark <= high_watermark, "Invalid HugeAlloc watermarks");
+    this->low_watermark = low_watermark;
+    this->high_watermark = high_watermark;
+  }
+
+  /**
+   * @brief Release fully free regions to the system while reserved memory
+   * stays at or above the low watermark. Pinned regions are never released.
+   *
+   * @return The number of bytes released
+   */
+  size_t reclaim();
+
+  /**
+   * @brief Reserve and pin \p size (rounded up to region_granule()) bytes of
+   * hugepages, and disable further growth. After this, alloc() never reserves
+   * hugepages and fails when the pinned budget is exhausted.
+   *
+   * @return True if the reservation succeeds. False if it fails, if it would
+   * exceed the high watermark, or if class allocations are served from a
+   * shared arena.
+   * @throw runtime_error if hugepage reservation failure is catastrophic
+   */
+  bool reserve_pinned(size_t size);
+
+  /**
+   * @brief Back all future regions with files named \p path_prefix followed
+   * by a sequence number, in a hugetlbfs mount. Files are kept when the
+   * allocator is deleted, and reused by a later allocator with the same prefix
+   * if their size matches, so that the hugepages needn't be faulted in and
+   * zeroed again. Files of reclaimed regions are deleted, and so are files
+   * left by a predecessor beyond the ones this allocator reused, when this
+   * allocator is deleted. Memory registrations are not persistent. This must
+   * be called before any allocation.
+   */
+  void set_persistent(const std::string &path_prefix);
+
+  /**
+   * @brief Serve all future class allocations from \p arena instead of this
+   * allocator's SHM regions. This must be called before any call to alloc().
+   * \p arena must outlive this allocator.
+   */
+  void set_arena(HugeArena *arena);
+
+  /// Free a Buffer, merging it with its free buddies
   inline void free_buf(Buffer buffer) {
     assert(buffer.buf != nullptr);
 
     size_t size_class = get_class(buffer.class_size);
     assert(class_max_size(size_class) == buffer.class_size);
 
-    freelist[size_class].push_back(buffer);
     stats.user_alloc_tot -= buffer.class_size;
+    if (arena != nullptr) {
+      free_to_magazine(buffer, size_class);
+      return;
+    }
+    free_and_coalesce(buffer.buf, size_class);
   }
 
   inline size_t get_numa_node() { return numa_node; }
@@ -137,12 +243,45 @@ class HugeAlloc {
     return stats.shm_reserved;
   }
 
+  /// Return the reserved memory that was mapped from existing persistent
+  /// region files, instead of being faulted in
+  inline size_t get_stat_warm_bytes() const { return stats.warm_bytes; }
+
+  /// Return the reserved memory backed by 4 KB pages instead of hugepages
+  inline size_t get_stat_fallback_bytes() const {
+    return stats.fallback_bytes;
+  }
+
+  /**
+   * @brief Return the TLB reach lost to 4 KB page backing, as the ratio of the
+   * TLB entries needed to map reserved memory to the entries needed with
+   * hugepages only. This is 1.0 if all memory is hugepage-backed. It is a
+   * worst case because transparent hugepages may recover some reach.
+   */
+  double get_stat_tlb_reach_loss() const;
+
   /// Return the total amoung of memory allocated to the user
   inline size_t get_stat_user_alloc_tot() const {
     assert(stats.user_alloc_tot % kMinClassSize == 0);
     return stats.user_alloc_tot;
   }
 
+  /// Return the number of free blocks of class \p class_i
+  inline size_t get_stat_free_blocks(size_t class_i) const {
+    assert(class_i < kNumClasses);
+    return stats.free_blocks[class_i];
+  }
+
+  /// Return the total free memory in the allocator's classes
+  size_t get_stat_free_bytes() const;
+
+  /**
+   * @brief Return the external fragmentation of free memory, i.e., one minus
+   * the fraction of free memory in the largest free block class. This is zero
+   * when all free memory is in the largest free blocks.
+   */
+  double get_stat_fragmentation() const;
+
   /// Print a summary of this allocator
   void print_stats();
 
@@ -171,46 +310,144 @@ class HugeAlloc {
     return size_class;
   }
 
-  /// Split one Buffers from class \p size_class into two Buffers of the
-  /// previous class, which must be an empty class.
-  inline void split(size_t size_class) {
-    assert(size_class >= 1);
-    assert(!freelist[size_class].empty());
-    assert(freelist[size_class - 1].empty());
+  /// Buddy metadata for one region of max-class Buffers
+  struct buddy_region_t {
+    uint8_t *buf;   ///< Start address of the region
+    size_t size;    ///< Size of the region, a multiple of kMaxClassSize
+    uint32_t lkey;  ///< The memory registration lkey
+    bool pinned;    ///< Pinned regions are never reclaimed
 
-    Buffer buffer = freelist[size_class].back();
-    freelist[size_class].pop_back();
-    assert(buffer.class_size == class_max_size(size_class));
+    /// Bit i of free_bmp[c] is set iff the i-th block of class c in this
+    /// region is a free block of exactly class c
+    std::vector<uint64_t> free_bmp[kNumClasses];
 
-    Buffer buffer_0 = Buffer(buffer.buf, buffer.class_size / 2, buffer.lkey);
-    Buffer buffer_1 = Buffer(buffer.buf + buffer.class_size / 2,
-                             buffer.class_size / 2, buffer.lkey);
+    /// Bit i of listed_bmp[c] is set iff the i-th block of class c has an
+    /// entry, possibly stale, in freelist[c]
+    std::vector<uint64_t> listed_bmp[kNumClasses];
+  };
 
-    freelist[size_class - 1].push_back(buffer_0);
-    freelist[size_class - 1].push_back(buffer_1);
+  static inline bool bmp_test(const std::vector<uint64_t> &bmp, size_t i) {
+    return (bmp[i / 64] >> (i % 64)) & 1;
   }
+  static inline void bmp_set(std::vector<uint64_t> &bmp, size_t i) {
+    bmp[i / 64] |= (1ull << (i % 64));
+  }
+  static inline void bmp_clear(std::vector<uint64_t> &bmp, size_t i) {
+    bmp[i / 64] &= ~(1ull << (i % 64));
+  }
+
+  /// Return the index of the block at \p buf among class \p size_class
+  /// blocks in \p region
+  static inline size_t block_index(const buddy_region_t *region,
+                                   const uint8_t *buf, size_t size_class) {
+    return static_cast<size_t>(buf - region->buf) >>
+           (size_class + kMinClassBitShift);
+  }
+
+  /**
+   * @brief Return the region containing \p buf in O(1) time, using the region
+   * map entries of \p buf's granule and, if a region starts mid-granule, of
+   * the granule before it
+   *
+   * @throw runtime_error if \p buf was not allocated by this allocator
+   */
+  buddy_region_t *find_region(const uint8_t *buf);
+
+  /// Return the region map entry of granule \p granule, or nullptr if no
+  /// region overlaps it
+  buddy_region_t *get_region_map_entry(size_t granule) const;
+
+  /// Add \p region to the region map
+  void map_region(buddy_region_t *region);
+
+  /// Remove \p region from the region map
+  void unmap_region(const buddy_region_t *region);
+
+  /// Mark block \p block_i of class \p size_class in \p region as free, and
+  /// add it to the class freelist if it doesn't already have an entry
+  void mark_free(buddy_region_t *region, size_t size_class, size_t block_i);
+
+  /// Free the block at \p buf of class \p size_class, merging free buddies
+  void free_and_coalesce(uint8_t *buf, size_t size_class);
+
+  /**
+   * @brief Pop a valid free Buffer from class \p size_class, skipping stale
+   * freelist entries
+   *
+   * @return The Buffer, or an invalid Buffer if the class has no free blocks
+   */
+  Buffer pop_free(size_t size_class);
+
+  /**
+   * @brief Map \p size bytes of hugepages backed by an anonymous hugetlb
+   * memfd. Small mappings are populated by mmap.
+   *
+   * @return The mapping, or MAP_FAILED if hugepages are unavailable
+   */
+  void *map_hugetlb_memfd(size_t size);
 
   /**
-   * @brief Allocate a Buffer from a non-empty class
-   * @param size_class Index of the non-empty size class to allocate from
+   * @brief Map \p size bytes of hugepages backed by the next persistent region
+   * file. An existing file of this size is mapped as is.
+   *
+   * @param path The file's path
+   * @param warm Set to true iff an existing file was reused
+   *
+   * @return The mapping, or MAP_FAILED if hugepages are unavailable
    */
-  inline Buffer alloc_from_class(size_t size_class) {
-    assert(size_class < kNumClasses);
+  void *map_persistent_file(size_t size, std::string *path, bool *warm);
+
+  /// Delete persistent region files with sequence numbers that this allocator
+  /// didn't reach. They were left by a predecessor with more regions.
+  void remove_stale_persistent_files();
 
-    // Use the Buffers at the back to improve locality
-    Buffer buffer = freelist[size_class].back();
-    assert(buffer.class_size = class_max_size(size_class));
-    freelist[size_class].pop_back();
+  /**
+   * @brief Map \p size bytes of zero-filled 4 KB pages, aligned and advised
+   * for transparent hugepages
+   *
+   * @return The mapping, or MAP_FAILED with errno set
+   */
+  void *map_anonymous_thp(size_t size);
 
-    stats.user_alloc_tot += buffer.class_size;
+  /// Fault in all pages of size \p page_size in \p buf, in parallel
+  static void prefault(uint8_t *buf, size_t size, size_t page_size);
+
+  /// Return true iff all memory in \p region is free
+  bool region_is_free(const buddy_region_t &region) const;
+
+  /**
+   * @brief Grow the allocator by reserving a new region within the high
+   * watermark, doubling the previous reservation size if possible. The high
+   * watermark is checked against the region's size rounded up to
+   * region_granule().
+   *
+   * @return True if the allocator grew
+   */
+  bool grow();
 
-    return buffer;
+  /// Return the number of Buffers moved between a class magazine and the
+  /// arena at once. This is smaller for large classes to bound cached memory.
+  static constexpr size_t magazine_batch(size_t size_class) {
+    const size_t num = kMagazineBatchBytes / class_max_size(size_class);
+    return num == 0 ? 1 : (num < kMagazineBatch ? num : kMagazineBatch);
   }
 
+  /// Allocate a Buffer from the magazine of class \p size_class, refilling
+  /// the magazine from the arena if it's empty
+  Buffer alloc_from_magazine(size_t size_class);
+
+  /// Return a Buffer to its class magazine, draining a batch to the arena if
+  /// the magazine is full
+  void free_to_magazine(Buffer buffer, size_t size_class);
+
+  /// Return \p num Buffers from the back of class \p size_class's magazine to
+  /// the arena
+  void drain_magazine(size_t size_class, size_t num);
+
   /**
-   * @brief Try to reserve \p size (rounded to 2MB) bytes as huge pages by
-   * adding hugepage-backed Buffers to freelists. The allocated hugepages are
-   * registered with the NIC.
+   * @brief Try to reserve \p size (a multiple of kMaxClassSize) bytes as huge
+   * pages by adding hugepage-backed Buffers to freelists. The allocated
+   * hugepages are registered with the NIC.
    *
    * @return True if the allocation succeeds. False if the allocation fails
    * because no more hugepages are available.
@@ -218,23 +455,59 @@ class HugeAlloc {
    * @throw runtime_error if allocation is \a catastrophic (i.e., it fails
    * due to reasons other than out-of-memory).
    */
-  bool reserve_hugepages(size_t size);
+  bool reserve_hugepages(size_t size, bool pinned);
+
+  /// Deregister and unmap an SHM region
+  void release_shm_region(const shm_region_t &shm_region);
 
   std::vector<shm_region_t> shm_list;  /// SHM regions by increasing alloc size
+  /// Buddy regions, boxed so that region map entries stay valid
+  std::vector<std::unique_ptr<buddy_region_t>> buddy_regions;
+
+  /**
+   * The region map finds the region of a Buffer in O(1) time. It's a two-level
+   * table indexed by the bits of the Buffer's 2 MB granule number. Regions
+   * are at least kMaxClassSize long, so a granule overlaps at most two
+   * regions, and its entry is the one that starts last. Regions are usually
+   * hugepage-aligned, so the other case occurs only with unaligned persistent
+   * files.
+   */
+  static constexpr size_t kRegionGranuleShift = 21;  /// 2 MB granules
+  static constexpr size_t kRegionLeafBits = 13;
+  static constexpr size_t kRegionRootBits =
+      47 - kRegionGranuleShift - kRegionLeafBits;  /// 47-bit user addresses
+  static_assert(kMaxClassSize >= (1ull << kRegionGranuleShift), "");
+
+  using region_leaf_t = std::array<buddy_region_t *, 1ull << kRegionLeafBits>;
+  std::array<std::unique_ptr<region_leaf_t>, 1ull << kRegionRootBits>
+      region_map;
+
   std::vector<Buffer> freelist[kNumClasses];  /// Per-class freelist
 
-  SlowRand slow_rand;      /// RNG to generate SHM keys
+  HugeArena *arena = nullptr;                 /// The shared arena, if any
+  std::vector<Buffer> magazine[kNumClasses];  /// Buffers cached from arena
+
   const size_t numa_node;  /// NUMA node on which all memory is allocated
 
   Transport::reg_mr_func_t reg_mr_func;
   Transport::dereg_mr_func_t dereg_mr_func;
 
-  size_t prev_allocation_size;  /// Size of previous hugepage reservation
+  size_t prev_allocation_size;       /// Size of previous hugepage reservation
+  size_t low_watermark = SIZE_MAX;   /// Reclaim keeps this much reserved
+  size_t high_watermark = SIZE_MAX;  /// Growth stays within this
+  bool growth_disabled = false;      /// Set by reserve_pinned()
+  bool no_hugepages;                 /// Set by ERPC_NO_HUGEPAGES
+  std::string persist_prefix;        /// Persistent region files, if non-empty
+  size_t persist_seq = 0;            /// Number of the next persistent file
 
   // Stats
   struct {
     size_t shm_reserved = 0;    /// Total hugepage memory reserved by allocator
     size_t user_alloc_tot = 0;  /// Total memory allocated to user
+    size_t free_blocks[kNumClasses] = {};  /// Valid free blocks per class
+    size_t fallback_bytes = 0;  /// Reserved memory backed by 4 KB pages
+    size_t tlb_entries = 0;     /// Pages needed to map reserved memory
+    size_t warm_bytes = 0;      /// Reserved memory mapped from existing files
   } stats;
 };
 
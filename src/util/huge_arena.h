@@ -0,0 +1,65 @@
+#pragma once
+
+#include <mutex>
+#include "util/huge_alloc.h"
+
+namespace erpc {
+
+/**
+ * @brief A hugepage allocator shared by all Rpcs of a process on one physical
+ * port. Memory in the arena is registered once with the port's device, instead
+ * of once per Rpc.
+ *
+ * Rpcs do not allocate from the arena directly. Each Rpc's HugeAlloc keeps
+ * per-class magazines of Buffers that it refills from, and drains to, the
+ * arena in batches, so the arena lock is rarely taken on the datapath.
+ */
+class HugeArena {
+ public:
+  HugeArena(size_t numa_node, Transport::reg_mr_func_t reg_mr_func,
+            Transport::dereg_mr_func_t dereg_mr_func)
+      : huge_alloc(kInitialSize, numa_node, reg_mr_func, dereg_mr_func) {}
+
+  /**
+   * @brief Allocate up to \p num Buffers of class size \p class_size into
+   * \p out. Thread-safe.
+   *
+   * @return The number of Buffers allocated. This is less than \p num only if
+   * the arena ran out of memory.
+   */
+  size_t alloc_batch(size_t class_size, Buffer *out, size_t num) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t i = 0; i < num; i++) {
+      out[i] = huge_alloc.alloc(class_size);
+      if (out[i].buf == nullptr) return i;
+    }
+    return num;
+  }
+
+  /// Free \p num Buffers allocated from this arena. Thread-safe.
+  void free_batch(const Buffer *buffers, size_t num) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t i = 0; i < num; i++) huge_alloc.free_buf(buffers[i]);
+  }
+
+  /// Return the total hugepage memory reserved by the arena. Thread-safe.
+  size_t get_stat_shm_reserved() {
+    std::lock_guard<std::mutex> guard(lock);
+    return huge_alloc.get_stat_shm_reserved();
+  }
+
+  /// Return the total arena memory held by Rpcs, including Buffers cached in
+  /// their magazines. Thread-safe.
+  size_t get_stat_user_alloc_tot() {
+    std::lock_guard<std::mutex> guard(lock);
+    return huge_alloc.get_stat_user_alloc_tot();
+  }
+
+ private:
+  static constexpr size_t kInitialSize = MB(32);
+
+  std::mutex lock;       ///< Guards huge_alloc
+  HugeAlloc huge_alloc;  ///< The shared buddy allocator
+};
+
+}  // namespace erpc
@@ -25,6 +25,16 @@ class MtQueue {
     unlock();
   }
 
+  /// Add \p num elements to the queue under one lock acquisition. Caller need
+  /// not grab the lock.
+  void unlocked_push_burst(const T *t_arr, size_t num) {
+    lock();
+    for (size_t i = 0; i < num; i++) queue.push(t_arr[i]);
+    memory_barrier();
+    size += num;
+    unlock();
+  }
+
   /// Get the first element from the queue. Caller need not grab the lock.
   T unlocked_pop() {
     lock();
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "common.h"
+
+namespace erpc {
+
+/**
+ * @brief A bounded lock-free queue for exactly one producer thread and one
+ * consumer thread. The producer and consumer may be the same thread.
+ *
+ * @tparam T The type of elements stored in the queue. This must be cheap to
+ * copy; elements are copied in and out of the ring.
+ */
+template <class T>
+class SpscQueue {
+ public:
+  /// Create a queue that holds at least \p capacity elements. The capacity is
+  /// rounded up to a power of two.
+  explicit SpscQueue(size_t capacity)
+      : mask(round_up_pow2(capacity) - 1), ring(mask + 1) {
+    rt_assert(capacity > 0, "SpscQueue capacity must be non-zero");
+  }
+
+  /// Producer: add an element. Return false iff the queue is full.
+  inline bool push(const T &t) {
+    const size_t tail = _tail.load(std::memory_order_relaxed);
+    if (unlikely(tail - head_cache > mask)) {
+      head_cache = _head.load(std::memory_order_acquire);
+      if (tail - head_cache > mask) return false;
+    }
+
+    ring[tail & mask] = t;
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Consumer: remove one element into \p t. Return false iff the queue is
+  /// empty.
+  inline bool pop(T &t) { return pop_burst(&t, 1) == 1; }
+
+  /// Consumer: remove up to \p max elements into \p out. Return the number of
+  /// elements removed.
+  inline size_t pop_burst(T *out, size_t max) {
+    const size_t head = _head.load(std::memory_order_relaxed);
+    if (tail_cache - head < max) {
+      tail_cache = _tail.load(std::memory_order_acquire);
+    }
+
+    const size_t num = std::min(max, tail_cache - head);
+    for (size_t i = 0; i < num; i++) out[i] = ring[(head + i) & mask];
+
+    if (num > 0) _head.store(head + num, std::memory_order_release);
+    return num;
+  }
+
+  /// Return the number of elements in the queue. This is exact only if the
+  /// producer and consumer are quiescent.
+  inline size_t size() const {
+    return _tail.load(std::memory_order_acquire) -
+           _head.load(std::memory_order_acquire);
+  }
+
+  inline bool empty() const { return size() == 0; }
+
+  /// Return the maximum number of elements the queue can hold
+  inline size_t capacity() const { return mask + 1; }
+
+ private:
+  static size_t round_up_pow2(size_t x) {
+    size_t ret = 1;
+    while (ret < x) ret <<= 1;
+    return ret;
+  }
+
+  const size_t mask;
+  std::vector<T> ring;
+
+  // The producer and consumer indices live on separate cache lines. Each side
+  // caches the other side's index to avoid cache line ping-pong.
+  alignas(64) std::atomic<size_t> _tail{0};  ///< Written by the producer
+  size_t head_cache = 0;                     ///< Producer's copy of _head
+  alignas(64) std::atomic<size_t> _head{0};  ///< Written by the consumer
+  size_t tail_cache = 0;                     ///< Consumer's copy of _tail
+};
+
+}  // namespace erpc
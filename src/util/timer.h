@@ -9,17 +9,25 @@
 #include <stdlib.h>
 #include <time.h>
 #include "common.h"
+#include "util/externs.h"
 
 namespace erpc {
 
-/// Return the TSC
-static inline size_t rdtsc() {
+/// Return the TSC by executing RDTSC. Only TscPublisher should use this.
+static inline size_t hw_rdtsc() {
   uint64_t rax;
   uint64_t rdx;
   asm volatile("rdtsc" : "=a"(rax), "=d"(rdx));
   return static_cast<size_t>((rdx << 32) | rax);
 }
 
+/// Return the TSC. With kPublishedTsc, this reads the TSC that TscPublisher
+/// publishes instead of executing RDTSC.
+static inline size_t rdtsc() {
+  if (kPublishedTsc) return published_tsc.load(std::memory_order_relaxed);
+  return hw_rdtsc();
+}
+
 /// An alias for rdtsc() to distinguish calls on the critical path
 static const auto &dpath_rdtsc = rdtsc;
 
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include "util/timer.h"
+
+namespace erpc {
+
+/**
+ * @brief A thread that publishes the TSC in memory for rdtsc() if
+ * kPublishedTsc is set, so that the datapath never executes RDTSC. This is
+ * for SGX1 enclaves, where RDTSC faults and forces an enclave exit.
+ *
+ * In SCONE, all of the process's threads run in the enclave, including this
+ * one. SCONE emulates the publisher's RDTSC with an enclave exit, so the
+ * publisher is the only thread that exits for the clock, and the published
+ * TSC advances once per exit instead of once per loop iteration.
+ *
+ * The thread spins on one core while the TscPublisher lives. A disabled
+ * TscPublisher does nothing.
+ */
+class TscPublisher {
+ public:
+  /// Start publishing if \p enabled. rdtsc() reads the published TSC only if
+  /// kPublishedTsc is set.
+  explicit TscPublisher(bool enabled = kPublishedTsc) : enabled(enabled) {
+    if (!enabled) return;
+
+    // Publish once before returning, so that rdtsc() never returns zero
+    published_tsc.store(hw_rdtsc(), std::memory_order_relaxed);
+    thread = std::thread([this] {
+      while (!stop.load(std::memory_order_relaxed)) {
+        published_tsc.store(hw_rdtsc(), std::memory_order_relaxed);
+        asm volatile("pause" ::: "memory");
+      }
+    });
+  }
+
+  ~TscPublisher() {
+    if (!enabled) return;
+    stop.store(true);
+    thread.join();
+  }
+
+ private:
+  const bool enabled;             ///< True iff the thread runs
+  std::atomic<bool> stop{false};  ///< Set to stop the publishing thread
+  std::thread thread;             ///< The publishing thread
+};
+
+}  // namespace erpc
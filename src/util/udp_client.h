@@ -4,6 +4,7 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <algorithm>
 #include <map>
 #include <stdexcept>
 #include <vector>
@@ -31,48 +32,108 @@ class UDPClient {
 
   ssize_t send(const std::string rem_hostname, uint16_t rem_port,
                const T &msg) {
+    return send(rem_hostname, rem_port, &msg, 1);
+  }
+
+  /// Send \p num messages in one datagram
+  ssize_t send(const std::string rem_hostname, uint16_t rem_port,
+               const T *msgs, size_t num) {
+    const struct addrinfo *rem_addrinfo = resolve(rem_hostname, rem_port);
+    ssize_t ret = sendto(sock_fd, msgs, num * sizeof(T), 0,
+                         rem_addrinfo->ai_addr, rem_addrinfo->ai_addrlen);
+    if (ret != static_cast<ssize_t>(num * sizeof(T))) {
+      throw std::runtime_error("sendto() failed. errno = " +
+                               std::string(strerror(errno)));
+    }
+
+    if (enable_recording_flag) {
+      sent_vec.insert(sent_vec.end(), msgs, msgs + num);
+      num_sent_datagrams++;
+    }
+    return ret;
+  }
+
+  /// Return the cached addrinfo for a remote, resolving it on first use. The
+  /// result is valid for the lifetime of this client.
+  const struct addrinfo *resolve(const std::string rem_hostname,
+                                 uint16_t rem_port) {
     std::string remote_uri = rem_hostname + ":" + std::to_string(rem_port);
+    auto it = addrinfo_map.find(remote_uri);
+    if (it != addrinfo_map.end()) return it->second;
+
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%u", rem_port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+
     struct addrinfo *rem_addrinfo = nullptr;
+    int r = getaddrinfo(rem_hostname.c_str(), port_str, &hints, &rem_addrinfo);
+    if (r != 0 || rem_addrinfo == nullptr) {
+      char issue_msg[1000];
+      sprintf(issue_msg, "Failed to resolve %s. getaddrinfo error = %s.",
+              remote_uri.c_str(), gai_strerror(r));
+      throw std::runtime_error(issue_msg);
+    }
 
-    if (addrinfo_map.count(remote_uri) != 0) {
-      rem_addrinfo = addrinfo_map.at(remote_uri);
-    } else {
-      char port_str[16];
-      snprintf(port_str, sizeof(port_str), "%u", rem_port);
-
-      struct addrinfo hints;
-      memset(&hints, 0, sizeof(hints));
-      hints.ai_family = AF_INET;
-      hints.ai_socktype = SOCK_DGRAM;
-      hints.ai_protocol = IPPROTO_UDP;
-
-      int r =
-          getaddrinfo(rem_hostname.c_str(), port_str, &hints, &rem_addrinfo);
-      if (r != 0 || rem_addrinfo == nullptr) {
-        char issue_msg[1000];
-        sprintf(issue_msg, "Failed to resolve %s. getaddrinfo error = %s.",
-                remote_uri.c_str(), gai_strerror(r));
-        throw std::runtime_error(issue_msg);
+    addrinfo_map[remote_uri] = rem_addrinfo;
+    return rem_addrinfo;
+  }
+
+  /**
+   * @brief Send message \p msgs[i] to \p addrs[i] for all i < \p num, with
+   * one sendmmsg() system call per kMaxMmsgBatch messages. No strings are
+   * built and no maps are searched.
+   *
+   * @param addrs Remote addresses returned by resolve()
+   */
+  void send_batch(const struct addrinfo *const *addrs, const T *msgs,
+                  size_t num) {
+    struct mmsghdr mmsg_arr[kMaxMmsgBatch];
+    struct iovec iov_arr[kMaxMmsgBatch];
+
+    for (size_t base = 0; base < num; base += kMaxMmsgBatch) {
+      const size_t batch = std::min(kMaxMmsgBatch, num - base);
+      for (size_t i = 0; i < batch; i++) {
+        iov_arr[i].iov_base = const_cast<T *>(&msgs[base + i]);
+        iov_arr[i].iov_len = sizeof(T);
+
+        struct msghdr &hdr = mmsg_arr[i].msg_hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_name = addrs[base + i]->ai_addr;
+        hdr.msg_namelen = addrs[base + i]->ai_addrlen;
+        hdr.msg_iov = &iov_arr[i];
+        hdr.msg_iovlen = 1;
       }
 
-      addrinfo_map[remote_uri] = rem_addrinfo;
+      // sendmmsg() stops at the first message that fails
+      size_t num_sent = 0;
+      while (num_sent < batch) {
+        int ret = sendmmsg(sock_fd, &mmsg_arr[num_sent],
+                           static_cast<unsigned>(batch - num_sent), 0);
+        if (ret <= 0) {
+          throw std::runtime_error("sendmmsg() failed. errno = " +
+                                   std::string(strerror(errno)));
+        }
+        num_sent += static_cast<size_t>(ret);
+      }
     }
 
-    ssize_t ret = sendto(sock_fd, &msg, sizeof(T), 0, rem_addrinfo->ai_addr,
-                         rem_addrinfo->ai_addrlen);
-    if (ret != static_cast<ssize_t>(sizeof(T))) {
-      throw std::runtime_error("sendto() failed. errno = " +
-                               std::string(strerror(errno)));
+    if (enable_recording_flag) {
+      sent_vec.insert(sent_vec.end(), msgs, msgs + num);
+      num_sent_datagrams += num;
     }
-
-    if (enable_recording_flag) sent_vec.push_back(msg);
-    return ret;
   }
 
   /// Maintain a all packets sent by this client
   void enable_recording() { enable_recording_flag = true; }
 
  private:
+  static constexpr size_t kMaxMmsgBatch = 64;  ///< Messages per sendmmsg()
+
   int sock_fd = -1;
 
   /// A cache mapping hostname:udp_port to addrinfo
@@ -80,6 +141,7 @@ class UDPClient {
 
   /// The list of all packets sent, maintained if recording is enabled
   std::vector<T> sent_vec;
+  size_t num_sent_datagrams = 0;  ///< Datagrams sent, if recording is enabled
   bool enable_recording_flag = false;  ///< Flag to enable recording for testing
 };
 
@@ -2,8 +2,10 @@
 
 #include <netdb.h>
 #include <sys/socket.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdexcept>
+#include <vector>
 
 namespace erpc {
 
@@ -62,10 +64,51 @@ class UDPServer {
     return recv(sock_fd, static_cast<void *>(&msg), sizeof(T), 0);
   }
 
+  /**
+   * @brief Receive up to \p max_datagrams datagrams that are already queued,
+   * with one recvmmsg() system call. This does not block.
+   *
+   * @param msgs Space for \p max_datagrams datagrams of \p msgs_per_datagram
+   * messages each. Datagram i is received at msgs[i * msgs_per_datagram].
+   * @param sizes Filled with the size in bytes of each datagram received
+   *
+   * @return The number of datagrams received
+   */
+  size_t recv_burst(T *msgs, size_t msgs_per_datagram, size_t max_datagrams,
+                    size_t *sizes) {
+    mmsg_arr.resize(max_datagrams);
+    iov_arr.resize(max_datagrams);
+    for (size_t i = 0; i < max_datagrams; i++) {
+      iov_arr[i].iov_base = &msgs[i * msgs_per_datagram];
+      iov_arr[i].iov_len = msgs_per_datagram * sizeof(T);
+
+      memset(&mmsg_arr[i].msg_hdr, 0, sizeof(mmsg_arr[i].msg_hdr));
+      mmsg_arr[i].msg_hdr.msg_iov = &iov_arr[i];
+      mmsg_arr[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int ret = recvmmsg(sock_fd, mmsg_arr.data(),
+                       static_cast<unsigned>(max_datagrams), MSG_DONTWAIT,
+                       nullptr);
+    if (ret <= 0) return 0;
+
+    for (size_t i = 0; i < static_cast<size_t>(ret); i++) {
+      sizes[i] = mmsg_arr[i].msg_len;
+    }
+    return static_cast<size_t>(ret);
+  }
+
+  /// Return the socket's file descriptor, e.g., for epoll
+  int get_fd() const { return sock_fd; }
+
  private:
   uint16_t port;  ///< The port to listen on
   size_t timeout_ms;
   int sock_fd = -1;
+
+  // recvmmsg() headers, reused across recv_burst() calls
+  std::vector<struct mmsghdr> mmsg_arr;
+  std::vector<struct iovec> iov_arr;
 };
 
 }  // namespace erpc
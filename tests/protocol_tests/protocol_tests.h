@@ -125,10 +125,8 @@ class RpcTest : public ::testing::Test {
     session->client = client;
     session->server = server;
 
-    for (SSlot &sslot : session->sslot_arr) {
-      sslot.pre_resp_msgbuf =
-          rpc->alloc_msg_buffer_or_die(rpc->transport->kMaxDataPerPkt);
-    }
+    rt_assert(rpc->init_server_sslots_st(session),
+              "Failed to initialize server sslots");
 
     auto &remote_rinfo = session->client.routing_info;
     rt_assert(rpc->transport->resolve_remote_routing_info(&remote_rinfo),
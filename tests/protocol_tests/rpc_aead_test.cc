@@ -0,0 +1,439 @@
+#include "protocol_tests.h"
+
+namespace erpc {
+
+static constexpr uint8_t kTestAeadKey[AesGcm::kKeySize] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+
+/// Tests for encrypted sessions. The client and server sessions live in the
+/// same Rpc and share a key, so packets sealed by one can be fed to the other.
+class RpcAeadTest : public RpcTest {
+ public:
+  /// Protect \p session's packets with the test key
+  static void protect(Session *session,
+                      SessionCrypto crypto = SessionCrypto::kAead) {
+    session->aead = new AesGcm(kTestAeadKey);
+    session->crypto = crypto;
+  }
+
+  /// Return a copy of packet \p pkt_idx of \p msgbuf as it appears on the
+  /// wire. Receivers decrypt packets in place, so each RX needs a new copy.
+  static std::vector<uint8_t> get_wire_pkt(const MsgBuffer *msgbuf,
+                                           size_t pkt_idx) {
+    const size_t data_size =
+        msgbuf->get_pkt_size<CTransport::kMaxDataPerPkt>(pkt_idx) -
+        sizeof(pkthdr_t);
+    std::vector<uint8_t> pkt(sizeof(pkthdr_t) + data_size);
+    memcpy(pkt.data(), msgbuf->get_pkthdr_n(pkt_idx), sizeof(pkthdr_t));
+    memcpy(pkt.data() + sizeof(pkthdr_t),
+           &msgbuf->buf[pkt_idx * CTransport::kMaxDataPerPkt], data_size);
+    return pkt;
+  }
+
+  static pkthdr_t *to_pkthdr(std::vector<uint8_t> &pkt) {
+    return reinterpret_cast<pkthdr_t *>(pkt.data());
+  }
+
+  /// Set the Nexus's master key. The fixture's Rpc is already registered, so
+  /// this bypasses Nexus::set_aead_key().
+  void set_master_key(const uint8_t *key) {
+    memcpy(nexus->aead_key, key, AesGcm::kKeySize);
+    nexus->aead_key_set = true;
+  }
+};
+
+TEST_F(RpcAeadTest, mac_small_round_trip) {
+  if (!kCrypto) GTEST_SKIP() << "Needs ERPC_CRYPTO";
+
+  const auto server = get_local_endpoint();
+  const auto client = get_remote_endpoint();
+  Session *srv_session = create_server_session_init(client, server);
+  Session *clt_session = create_client_session_connected(client, server);
+  protect(srv_session, SessionCrypto::kMac);
+  protect(clt_session, SessionCrypto::kMac);
+  SSlot *srv_sslot = &srv_session->sslot_arr[0];
+  SSlot *clt_sslot = &clt_session->sslot_arr[0];
+
+  MsgBuffer req = rpc->alloc_msg_buffer(kTestSmallMsgSize);
+  MsgBuffer resp = rpc->alloc_msg_buffer(kTestSmallMsgSize);
+  for (size_t i = 0; i < kTestSmallMsgSize; i++) {
+    req.buf[i] = static_cast<uint8_t>(i);
+  }
+  const std::vector<uint8_t> plaintext(req.buf, req.buf + kTestSmallMsgSize);
+
+  // Enqueue the request
+  // Expect: Its payload is sent in cleartext
+  rpc->faults.hard_wheel_bypass = true;  // Don't place request pkt in wheel
+  rpc->enqueue_request(clt_session->local_session_num, kTestReqType, &req,
+                       &resp, cont_func, kTestTag);
+  ASSERT_EQ(pkthdr_tx_queue->pop().pkt_type, PktType::kPktTypeReq);
+  ASSERT_EQ(memcmp(req.buf, plaintext.data(), kTestSmallMsgSize), 0);
+
+  // Receive the request with a tampered payload, with a tampered tag, and with
+  // a tampered message size, which the MAC covers through the nonce
+  // Expect: All are dropped
+  std::vector<uint8_t> req_pkt = get_wire_pkt(&req, 0);
+  req_pkt[sizeof(pkthdr_t)] ^= 1;
+  rpc->process_small_req_st(srv_sslot, to_pkthdr(req_pkt));
+
+  req_pkt = get_wire_pkt(&req, 0);
+  to_pkthdr(req_pkt)->get_aead_tag()[0] ^= 1;
+  rpc->process_small_req_st(srv_sslot, to_pkthdr(req_pkt));
+
+  req_pkt = get_wire_pkt(&req, 0);
+  to_pkthdr(req_pkt)->msg_size--;
+  rpc->process_small_req_st(srv_sslot, to_pkthdr(req_pkt));
+  ASSERT_EQ(num_req_handler_calls, 0);
+  ASSERT_EQ(pkthdr_tx_queue->size(), 0);
+
+  // Receive the authentic request
+  // Expect: The request handler echoes it in a cleartext response
+  req_pkt = get_wire_pkt(&req, 0);
+  rpc->process_small_req_st(srv_sslot, to_pkthdr(req_pkt));
+  ASSERT_EQ(num_req_handler_calls, 1);
+  ASSERT_EQ(pkthdr_tx_queue->pop().pkt_type, PktType::kPktTypeResp);
+
+  std::vector<uint8_t> resp_pkt = get_wire_pkt(srv_sslot->tx_msgbuf, 0);
+  ASSERT_EQ(memcmp(&resp_pkt[sizeof(pkthdr_t)], plaintext.data(),
+                   kTestSmallMsgSize),
+            0);
+
+  // Receive a tampered response
+  // Expect: It's dropped
+  resp_pkt[sizeof(pkthdr_t)] ^= 1;
+  rpc->process_resp_one_st(clt_sslot, to_pkthdr(resp_pkt), rdtsc());
+  ASSERT_EQ(num_cont_func_calls, 0);
+  ASSERT_EQ(clt_sslot->client_info.num_rx, 0);
+
+  // Receive the authentic response
+  // Expect: It's copied into the response MsgBuffer
+  resp_pkt = get_wire_pkt(srv_sslot->tx_msgbuf, 0);
+  rpc->process_resp_one_st(clt_sslot, to_pkthdr(resp_pkt), rdtsc());
+  ASSERT_EQ(num_cont_func_calls, 1);
+  ASSERT_EQ(memcmp(resp.buf, plaintext.data(), kTestSmallMsgSize), 0);
+}
+
+/// Credit returns and requests-for-response are authenticated like data
+TEST_F(RpcAeadTest, mac_ctrl_pkts) {
+  if (!kCrypto) GTEST_SKIP() << "Needs ERPC_CRYPTO";
+
+  const auto server = get_local_endpoint();
+  const auto client = get_remote_endpoint();
+  Session *srv_session = create_server_session_init(client, server);
+  Session *clt_session = create_client_session_connected(client, server);
+  protect(srv_session, SessionCrypto::kMac);
+  protect(clt_session, SessionCrypto::kMac);
+  SSlot *srv_sslot = &srv_session->sslot_arr[0];
+  SSlot *clt_sslot = &clt_session->sslot_arr[0];
+
+  // Send a large request. This uses all credits.
+  MsgBuffer req = rpc->alloc_msg_buffer(kTestLargeMsgSize);
+  MsgBuffer resp = rpc->alloc_msg_buffer(kTestLargeMsgSize);
+  rpc->faults.hard_wheel_bypass = true;  // Don't place request pkts in wheel
+  rpc->enqueue_request(clt_session->local_session_num, kTestReqType, &req,
+                       &resp, cont_func, kTestTag);
+  ASSERT_EQ(clt_sslot->client_info.num_tx, kSessionCredits);
+  pkthdr_tx_queue->clear();
+
+  // The server returns a credit for the zeroth request packet
+  rpc->enqueue_cr_st(srv_sslot, req.get_pkthdr_0());
+  const pkthdr_t cr = pkthdr_tx_queue->pop();
+  ASSERT_EQ(cr.pkt_type, PktType::kPktTypeExplCR);
+
+  // Receive the credit return with a tampered tag, and with a tampered request
+  // type
+  // Expect: Both are dropped
+  pkthdr_t bad_cr = cr;
+  bad_cr.get_aead_tag()[0] ^= 1;
+  rpc->process_expl_cr_st(clt_sslot, &bad_cr, rdtsc());
+
+  bad_cr = cr;
+  bad_cr.req_type++;
+  rpc->process_expl_cr_st(clt_sslot, &bad_cr, rdtsc());
+  ASSERT_EQ(clt_sslot->client_info.num_rx, 0);
+  ASSERT_EQ(clt_session->client_info.credits, 0);
+  ASSERT_EQ(pkthdr_tx_queue->size(), 0);
+
+  // Receive the authentic credit return
+  // Expect: Its credit is used to send another request packet
+  pkthdr_t rx_cr = cr;
+  rpc->process_expl_cr_st(clt_sslot, &rx_cr, rdtsc());
+  ASSERT_EQ(clt_sslot->client_info.num_rx, 1);
+  ASSERT_EQ(pkthdr_tx_queue->pop().pkt_type, PktType::kPktTypeReq);
+
+  // Make the server hold a large response to a request of num_tx packets, and
+  // have the client request the response's next packet
+  const size_t num_req_pkts = clt_sslot->client_info.num_tx;
+  auto &si = srv_sslot->server_info;
+  si.req_msgbuf =
+      rpc->alloc_msg_buffer(num_req_pkts * rpc->get_max_data_per_pkt());
+  si.num_rx = num_req_pkts;
+  si.req_type = kTestReqType;
+  srv_sslot->cur_req_num = req.get_pkthdr_0()->req_num;
+  srv_sslot->dyn_resp_msgbuf = rpc->alloc_msg_buffer(kTestLargeMsgSize);
+  rpc->enqueue_response(reinterpret_cast<ReqHandle *>(srv_sslot),
+                        &srv_sslot->dyn_resp_msgbuf);
+  pkthdr_tx_queue->clear();
+
+  rpc->enqueue_rfr_st(clt_sslot, req.get_pkthdr_0());
+  const pkthdr_t rfr = pkthdr_tx_queue->pop();
+  ASSERT_EQ(rfr.pkt_type, PktType::kPktTypeRFR);
+  ASSERT_EQ(rfr.pkt_num, num_req_pkts);
+
+  // Receive the RFR with a tampered tag
+  // Expect: It's dropped
+  pkthdr_t bad_rfr = rfr;
+  bad_rfr.get_aead_tag()[0] ^= 1;
+  rpc->process_rfr_st(srv_sslot, &bad_rfr);
+  ASSERT_EQ(si.num_rx, num_req_pkts);
+  ASSERT_EQ(pkthdr_tx_queue->size(), 0);
+
+  // Receive the authentic RFR
+  // Expect: Response packet #1 is sent
+  pkthdr_t rx_rfr = rfr;
+  rpc->process_rfr_st(srv_sslot, &rx_rfr);
+  ASSERT_EQ(si.num_rx, num_req_pkts + 1);
+  ASSERT_TRUE(
+      pkthdr_tx_queue->pop().matches(PktType::kPktTypeResp, num_req_pkts));
+}
+
+TEST_F(RpcAeadTest, connect_key_exchange) {
+  if (!kCrypto) GTEST_SKIP() << "Needs ERPC_CRYPTO";
+  set_master_key(kTestAeadKey);
+  rpc->udp_client.enable_recording();
+
+  auto client = get_remote_endpoint();
+  client.crypto = SessionCrypto::kAead;
+  const auto server = set_invalid_session_num(get_local_endpoint());
+  const SmPkt conn_req(SmPktType::kConnectReq, SmErrType::kNoError,
+                       kTestUniqToken, client, server);
+
+  // Process the connect request
+  // Expect: The response carries the server's nonce and is authenticated
+  rpc->handle_connect_req_st(conn_req);
+  const SmPkt conn_resp = rpc->udp_client.sent_vec.back();
+  Session *srv_session_1 = rpc->session_vec.back();
+  ASSERT_EQ(conn_resp.err_type, SmErrType::kNoError);
+  ASSERT_EQ(conn_resp.srv_nonce, srv_session_1->srv_nonce);
+  ASSERT_TRUE(nexus->verify_connect_resp(conn_resp));
+
+  // Process the request again
+  // Expect: The re-sent response is identical
+  rpc->handle_connect_req_st(conn_req);
+  const SmPkt dup_resp = rpc->udp_client.sent_vec.back();
+  ASSERT_EQ(dup_resp.srv_nonce, conn_resp.srv_nonce);
+  ASSERT_EQ(memcmp(dup_resp.auth_tag, conn_resp.auth_tag, kSmPktTagSize), 0);
+
+  // Replay the request to a server that forgot its token, e.g., a restarted
+  // one
+  // Expect: The new session's key differs, so packets sealed in the old
+  // session don't open in the new one
+  rpc->conn_req_token_map.clear();
+  rpc->handle_connect_req_st(conn_req);
+  const SmPkt replay_resp = rpc->udp_client.sent_vec.back();
+  Session *srv_session_2 = rpc->session_vec.back();
+  ASSERT_NE(srv_session_2, srv_session_1);
+  ASSERT_NE(replay_resp.srv_nonce, conn_resp.srv_nonce);
+
+  uint8_t data[kTestSmallMsgSize] = {0};
+  uint8_t nonce[AesGcm::kNonceSize] = {0};
+  uint8_t tag[AesGcm::kTagSize];
+  srv_session_1->aead->seal(data, sizeof(data), nonce, nullptr, 0, tag);
+  ASSERT_FALSE(
+      srv_session_2->aead->open(data, sizeof(data), nonce, nullptr, 0, tag));
+}
+
+TEST_F(RpcAeadTest, connect_resp_authentication) {
+  if (!kCrypto) GTEST_SKIP() << "Needs ERPC_CRYPTO";
+  set_master_key(kTestAeadKey);
+
+  const auto client = get_local_endpoint();
+  const auto server = get_remote_endpoint();
+  Session *clt_session = create_client_session_init(client, server);
+  clt_session->crypto = SessionCrypto::kAead;
+
+  SmPkt conn_resp(SmPktType::kConnectResp, SmErrType::kNoError, kTestUniqToken,
+                  client, server);
+  conn_resp.srv_nonce = 1;
+  nexus->sign_connect_resp(&conn_resp);
+
+  // Receive the response with a tampered server endpoint, and the response
+  // signed under another master key
+  // Expect: Both are ignored
+  SmPkt bad_resp = conn_resp;
+  bad_resp.server.session_num++;
+  rpc->handle_connect_resp_st(bad_resp);
+
+  bad_resp = conn_resp;
+  nexus->aead_key[0] ^= 1;
+  nexus->sign_connect_resp(&bad_resp);
+  nexus->aead_key[0] ^= 1;
+  rpc->handle_connect_resp_st(bad_resp);
+  ASSERT_EQ(clt_session->state, SessionState::kConnectInProgress);
+  ASSERT_EQ(clt_session->aead, nullptr);
+
+  // Receive the authentic response
+  // Expect: The session connects with the key that the server derived
+  rpc->handle_connect_resp_st(conn_resp);
+  ASSERT_EQ(clt_session->state, SessionState::kConnected);
+
+  AesGcm *srv_aead = nexus->new_session_aead(kTestUniqToken, 1);
+  uint8_t data[kTestSmallMsgSize] = {0};
+  uint8_t nonce[AesGcm::kNonceSize] = {0};
+  uint8_t tag[AesGcm::kTagSize];
+  clt_session->aead->seal(data, sizeof(data), nonce, nullptr, 0, tag);
+  ASSERT_TRUE(srv_aead->open(data, sizeof(data), nonce, nullptr, 0, tag));
+  delete srv_aead;
+}
+
+TEST_F(RpcAeadTest, small_round_trip) {
+  if (!kCrypto) GTEST_SKIP() << "Needs ERPC_CRYPTO";
+
+  const auto server = get_local_endpoint();
+  const auto client = get_remote_endpoint();
+  Session *srv_session = create_server_session_init(client, server);
+  Session *clt_session = create_client_session_connected(client, server);
+  protect(srv_session);
+  protect(clt_session);
+  SSlot *srv_sslot = &srv_session->sslot_arr[0];
+  SSlot *clt_sslot = &clt_session->sslot_arr[0];
+
+  MsgBuffer req = rpc->alloc_msg_buffer(kTestSmallMsgSize);
+  MsgBuffer resp = rpc->alloc_msg_buffer(kTestSmallMsgSize);
+  for (size_t i = 0; i < kTestSmallMsgSize; i++) {
+    req.buf[i] = static_cast<uint8_t>(i);
+  }
+  const std::vector<uint8_t> plaintext(req.buf, req.buf + kTestSmallMsgSize);
+
+  // Enqueue the request
+  // Expect: It's encrypted in place
+  rpc->faults.hard_wheel_bypass = true;  // Don't place request pkt in wheel
+  rpc->enqueue_request(clt_session->local_session_num, kTestReqType, &req,
+                       &resp, cont_func, kTestTag);
+  ASSERT_EQ(pkthdr_tx_queue->pop().pkt_type, PktType::kPktTypeReq);
+  ASSERT_NE(memcmp(req.buf, plaintext.data(), kTestSmallMsgSize), 0);
+
+  // Receive the request with a tampered payload, and with a tampered tag
+  // Expect: Both are dropped
+  std::vector<uint8_t> req_pkt = get_wire_pkt(&req, 0);
+  req_pkt[sizeof(pkthdr_t)] ^= 1;
+  rpc->process_small_req_st(srv_sslot, to_pkthdr(req_pkt));
+
+  req_pkt = get_wire_pkt(&req, 0);
+  to_pkthdr(req_pkt)->get_aead_tag()[0] ^= 1;
+  rpc->process_small_req_st(srv_sslot, to_pkthdr(req_pkt));
+  ASSERT_EQ(num_req_handler_calls, 0);
+  ASSERT_EQ(pkthdr_tx_queue->size(), 0);
+
+  // Receive the authentic request
+  // Expect: The request handler gets the plaintext and echoes it
+  req_pkt = get_wire_pkt(&req, 0);
+  rpc->process_small_req_st(srv_sslot, to_pkthdr(req_pkt));
+  ASSERT_EQ(num_req_handler_calls, 1);
+  ASSERT_EQ(pkthdr_tx_queue->pop().pkt_type, PktType::kPktTypeResp);
+
+  // Receive a tampered response
+  // Expect: It's dropped
+  std::vector<uint8_t> resp_pkt = get_wire_pkt(srv_sslot->tx_msgbuf, 0);
+  ASSERT_NE(memcmp(&resp_pkt[sizeof(pkthdr_t)], plaintext.data(),
+                   kTestSmallMsgSize),
+            0);
+  resp_pkt[sizeof(pkthdr_t)] ^= 1;
+  rpc->process_resp_one_st(clt_sslot, to_pkthdr(resp_pkt), rdtsc());
+  ASSERT_EQ(num_cont_func_calls, 0);
+  ASSERT_EQ(clt_sslot->client_info.num_rx, 0);
+
+  // Receive the authentic response
+  // Expect: It's decrypted into the response MsgBuffer with its header, and
+  // re-sealing the request restores its plaintext
+  resp_pkt = get_wire_pkt(srv_sslot->tx_msgbuf, 0);
+  rpc->process_resp_one_st(clt_sslot, to_pkthdr(resp_pkt), rdtsc());
+  ASSERT_EQ(num_cont_func_calls, 1);
+  ASSERT_EQ(memcmp(resp.buf, plaintext.data(), kTestSmallMsgSize), 0);
+  ASSERT_EQ(resp.get_pkthdr_0()->req_type, kTestReqType);
+  ASSERT_EQ(resp.get_pkthdr_0()->msg_size, kTestSmallMsgSize);
+  ASSERT_TRUE(resp.get_pkthdr_0()->check_magic());
+  ASSERT_EQ(memcmp(req.buf, plaintext.data(), kTestSmallMsgSize), 0);
+}
+
+TEST_F(RpcAeadTest, large_round_trip) {
+  if (!kCrypto) GTEST_SKIP() << "Needs ERPC_CRYPTO";
+
+  const auto server = get_local_endpoint();
+  const auto client = get_remote_endpoint();
+  Session *srv_session = create_server_session_init(client, server);
+  Session *clt_session = create_client_session_connected(client, server);
+  protect(srv_session);
+  protect(clt_session);
+  SSlot *srv_sslot = &srv_session->sslot_arr[0];
+  SSlot *clt_sslot = &clt_session->sslot_arr[0];
+
+  MsgBuffer req = rpc->alloc_msg_buffer(kTestLargeMsgSize);
+  MsgBuffer resp = rpc->alloc_msg_buffer(kTestLargeMsgSize);
+  for (size_t i = 0; i < kTestLargeMsgSize; i++) {
+    req.buf[i] = static_cast<uint8_t>(i % 251);
+  }
+  const std::vector<uint8_t> plaintext(req.buf, req.buf + kTestLargeMsgSize);
+  const size_t num_pkts = req.num_pkts;
+  ASSERT_GT(num_pkts, 2);
+
+  rpc->faults.hard_wheel_bypass = true;  // Don't place request pkts in wheel
+  rpc->enqueue_request(clt_session->local_session_num, kTestReqType, &req,
+                       &resp, cont_func, kTestTag);
+  pkthdr_tx_queue->clear();
+
+  // Receive the zeroth request packet, which is opened in the RX ring
+  std::vector<uint8_t> pkt = get_wire_pkt(&req, 0);
+  rpc->process_large_req_one_st(srv_sslot, to_pkthdr(pkt));
+  ASSERT_EQ(srv_sslot->server_info.num_rx, 1);
+
+  // Receive packet 1 carrying packet 2's payload and tag
+  // Expect: It's dropped, since the nonce covers the packet number
+  pkt = get_wire_pkt(&req, 1);
+  std::vector<uint8_t> pkt_2 = get_wire_pkt(&req, 2);
+  memcpy(&pkt[sizeof(pkthdr_t)], &pkt_2[sizeof(pkthdr_t)],
+         CTransport::kMaxDataPerPkt);
+  memcpy(to_pkthdr(pkt)->get_aead_tag(), to_pkthdr(pkt_2)->get_aead_tag(),
+         kAeadTagSize);
+  rpc->process_large_req_one_st(srv_sslot, to_pkthdr(pkt));
+  ASSERT_EQ(srv_sslot->server_info.num_rx, 1);
+
+  // Receive the remaining request packets, which are opened into the request
+  // MsgBuffer at their packet index
+  // Expect: The request handler gets the plaintext and echoes it
+  for (size_t i = 1; i < num_pkts; i++) {
+    pkt = get_wire_pkt(&req, i);
+    rpc->process_large_req_one_st(srv_sslot, to_pkthdr(pkt));
+  }
+  ASSERT_EQ(num_req_handler_calls, 1);
+  const MsgBuffer *srv_resp = srv_sslot->tx_msgbuf;
+  ASSERT_EQ(srv_resp->num_pkts, num_pkts);
+
+  // Pretend that the client got credit returns for all but the last request
+  // packet
+  auto &ci = clt_sslot->client_info;
+  ci.num_tx = num_pkts;
+  ci.num_rx = num_pkts - 1;
+  clt_session->client_info.credits = kSessionCredits - 1;
+
+  // Receive the response packets, whose packet numbers follow the request's
+  // Expect: Each is opened into the response MsgBuffer at its packet index
+  for (size_t i = 0; i < srv_resp->num_pkts; i++) {
+    pkt = get_wire_pkt(srv_resp, i);
+    rpc->process_resp_one_st(clt_sslot, to_pkthdr(pkt), rdtsc());
+  }
+  ASSERT_EQ(num_cont_func_calls, 1);
+  ASSERT_EQ(resp.get_data_size(), kTestLargeMsgSize);
+  ASSERT_EQ(memcmp(resp.buf, plaintext.data(), kTestLargeMsgSize), 0);
+
+  // Re-sealing the request at completion restores its plaintext
+  ASSERT_EQ(memcmp(req.buf, plaintext.data(), kTestLargeMsgSize), 0);
+}
+
+}  // namespace erpc
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,98 @@
+#include "protocol_tests.h"
+
+namespace erpc {
+
+/// An Rpc with no sessions or queued work may sleep
+TEST_F(RpcTest, can_sleep_st_idle) { ASSERT_TRUE(rpc->can_sleep_st()); }
+
+/// An active RPC keeps the Rpc awake until its packets leave the TX batch and
+/// the timing wheel
+TEST_F(RpcTest, can_sleep_st_active_rpc) {
+  const auto client = get_local_endpoint();
+  const auto server = get_remote_endpoint();
+  create_client_session_connected(client, server);
+  ASSERT_TRUE(rpc->can_sleep_st());
+
+  MsgBuffer req = rpc->alloc_msg_buffer(kTestLargeMsgSize);
+  MsgBuffer resp = rpc->alloc_msg_buffer(kTestLargeMsgSize);
+  rpc->enqueue_request(0, kTestReqType, &req, &resp, cont_func, kTestTag);
+  ASSERT_NE(rpc->active_rpcs_root_sentinel.client_info.next,
+            &rpc->active_rpcs_tail_sentinel);
+  ASSERT_FALSE(rpc->can_sleep_st());  // Packets are in the wheel or TX batch
+
+  // Move all packets out of the wheel and transmit them
+  if (kCcPacing) {
+    for (size_t i = 0; i < kWheelNumWslots; i++) rpc->wheel->reap_wslot(i);
+    ASSERT_FALSE(rpc->can_sleep_st());  // Packets in the wheel's ready queue
+    rpc->process_wheel_st();
+  }
+  if (rpc->tx_batch_i > 0) {
+    ASSERT_FALSE(rpc->can_sleep_st());
+    rpc->do_tx_burst_st();
+  }
+
+  // The RPC waits only for RX now, which wakes the Rpc. Sleep is bounded by
+  // packet loss scans while RPCs are active.
+  ASSERT_TRUE(rpc->can_sleep_st());
+
+  // A request stalled for credits keeps the Rpc awake
+  rpc->stallq.push_back(&rpc->session_vec[0]->sslot_arr[1]);
+  ASSERT_FALSE(rpc->can_sleep_st());
+  rpc->stallq.clear();
+}
+
+/// Work queued by other threads keeps the Rpc awake
+TEST_F(RpcTest, can_sleep_st_pending_work) {
+  const auto client = get_local_endpoint();
+  const auto server = get_remote_endpoint();
+  create_client_session_connected(client, server);
+
+  // Session management packets from the Nexus
+  rpc->nexus_hook.sm_rx_queue.push(SmPkt());
+  ASSERT_FALSE(rpc->can_sleep_st());
+  SmPkt sm_pkt;
+  rpc->nexus_hook.sm_rx_queue.pop(sm_pkt);
+  ASSERT_TRUE(rpc->can_sleep_st());
+
+  // Requests from background threads
+  MsgBuffer req = rpc->alloc_msg_buffer(kTestSmallMsgSize);
+  MsgBuffer resp = rpc->alloc_msg_buffer(kTestSmallMsgSize);
+  const enq_req_args_t args(0, kTestReqType, &req, &resp, cont_func, kTestTag,
+                            kInvalidBgETid);
+  rpc->multi_threaded = true;
+  rpc->bg_queues._enqueue_request.unlocked_push(args);
+  ASSERT_FALSE(rpc->can_sleep_st());
+  rpc->bg_queues._enqueue_request.unlocked_pop();
+  ASSERT_TRUE(rpc->can_sleep_st());
+
+  // Requests from producer lanes
+  ProducerLane *lane = rpc->create_producer_lane(4);
+  ASSERT_TRUE(lane->enqueue_request(0, kTestReqType, &req, &resp, cont_func,
+                                    kTestTag));
+  ASSERT_FALSE(rpc->can_sleep_st());
+}
+
+/// Datapath timestamps come from the clock, or from the event loop's sample
+/// with kEvLoopTsc, and they advance across event loop iterations
+TEST_F(RpcTest, dpath_tsc) {
+  rpc->run_event_loop_do_one_st();
+  const size_t tsc_0 = rpc->dpath_tsc();
+  if (kEvLoopTsc) {
+    ASSERT_EQ(tsc_0, rpc->ev_loop_tsc);
+  }
+
+  usleep(1000);
+  if (kEvLoopTsc) {
+    ASSERT_EQ(rpc->dpath_tsc(), tsc_0);  // Not resampled yet
+  }
+  rpc->run_event_loop_do_one_st();
+  ASSERT_GT(rpc->dpath_tsc(), tsc_0);
+  ASSERT_LE(rpc->dpath_tsc(), rdtsc());
+}
+
+}  // namespace erpc
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -97,6 +97,45 @@ TEST_F(RpcClientKickTest, kick_st_req_pkts) {
   ASSERT_DEATH(rpc->kick_req_st(sslot_0), ".*");
 }
 
+/// Client sessions that share credits stall when the shared pool is empty
+TEST_F(RpcTest, shared_credits) {
+  ASSERT_EQ(rpc->enable_shared_credits(0), -EINVAL);
+  ASSERT_EQ(rpc->enable_shared_credits(kSessionCredits + 1), 0);
+
+  const auto client = get_local_endpoint();
+  const auto server = get_remote_endpoint();
+  Session *session_arr[3];
+  for (Session *&session : session_arr) {
+    session = create_client_session_connected(client, server);
+  }
+  ASSERT_EQ(rpc->enable_shared_credits(1), -EPERM);
+
+  MsgBuffer req[3], resp[3];
+  for (size_t i = 0; i < 3; i++) {
+    req[i] = rpc->alloc_msg_buffer(kTestLargeMsgSize);
+    resp[i] = rpc->alloc_msg_buffer(kTestLargeMsgSize);
+  }
+
+  // Session 0 is limited by its own credits, session 1 by the pool
+  rpc->enqueue_request(0, kTestReqType, &req[0], &resp[0], cont_func, kTestTag);
+  ASSERT_EQ(session_arr[0]->sslot_arr[0].client_info.num_tx, kSessionCredits);
+  rpc->enqueue_request(1, kTestReqType, &req[1], &resp[1], cont_func, kTestTag);
+  ASSERT_EQ(session_arr[1]->sslot_arr[0].client_info.num_tx, 1);
+  ASSERT_EQ(rpc->shared_credits, 0);
+
+  // Session 2 has all its credits, but the pool is empty
+  rpc->enqueue_request(2, kTestReqType, &req[2], &resp[2], cont_func, kTestTag);
+  ASSERT_EQ(session_arr[2]->sslot_arr[0].client_info.num_tx, 0);
+  ASSERT_EQ(rpc->stallq.size(), 1);
+
+  // A credit returned by any session unblocks the stalled session
+  rpc->bump_credits(session_arr[0]);
+  rpc->process_credit_stall_queue_st();
+  ASSERT_EQ(session_arr[2]->sslot_arr[0].client_info.num_tx, 1);
+  ASSERT_EQ(rpc->stallq.size(), 0);
+  ASSERT_EQ(rpc->shared_credits, 0);
+}
+
 /// Kick a sslot that has received the first response packet
 TEST_F(RpcClientKickTest, kick_st_rfr_pkts) {
   rpc->enqueue_request(0, kTestReqType, &req, &resp, cont_func, kTestTag);
@@ -52,6 +52,80 @@ TEST_F(RpcTest, process_small_req_st) {
   num_req_handler_calls = 0;
 }
 
+TEST_F(RpcTest, release_idle_server_sslots_st) {
+  if (!kLazyPreRespMsgbuf) return;
+
+  const auto server = get_local_endpoint();
+  const auto client = get_remote_endpoint();
+  Session *srv_session = create_server_session_init(client, server);
+  SSlot *sslot_0 = &srv_session->sslot_arr[0];
+  const size_t all_saved = rpc->get_stat_pre_resp_bytes_saved();
+  ASSERT_EQ(sslot_0->pre_resp_msgbuf.buf, nullptr);
+
+  // Receive a request
+  // Expect: The sslot's prealloc MsgBuffer is materialized
+  uint8_t req[sizeof(pkthdr_t) + kTestSmallMsgSize];
+  auto *pkthdr_0 = reinterpret_cast<pkthdr_t *>(req);
+  pkthdr_0->format(kTestReqType, kTestSmallMsgSize, server.session_num,
+                   PktType::kPktTypeReq, 0 /* pkt_num */, kSessionReqWindow);
+  rpc->ev_loop_tsc = rdtsc();
+  srv_session->last_rx_tsc = rpc->ev_loop_tsc;
+  rpc->process_small_req_st(sslot_0, pkthdr_0);
+  ASSERT_EQ(pkthdr_tx_queue->pop().pkt_type, PktType::kPktTypeResp);
+  ASSERT_NE(sslot_0->pre_resp_msgbuf.buf, nullptr);
+  ASSERT_LT(rpc->get_stat_pre_resp_bytes_saved(), all_saved);
+
+  // Scan before the session becomes idle
+  // Expect: Nothing is released
+  rpc->release_idle_server_sslots_st();
+  ASSERT_NE(sslot_0->pre_resp_msgbuf.buf, nullptr);
+
+  // Scan after the session becomes idle
+  // Expect: The unused prealloc MsgBuffer is released, but the dynamic
+  // response is kept
+  rpc->ev_loop_tsc += rpc->session_idle_cycles + 1;
+  rpc->release_idle_server_sslots_st();
+  ASSERT_EQ(sslot_0->pre_resp_msgbuf.buf, nullptr);
+  ASSERT_EQ(sslot_0->tx_msgbuf, &sslot_0->dyn_resp_msgbuf);
+  ASSERT_EQ(rpc->get_stat_pre_resp_bytes_saved(), all_saved);
+  ASSERT_EQ(rpc->get_stat_pre_resp_released(), 1);
+
+  // Receive the request again from a client that stalled (past)
+  // Expect: Request handler is not called and the response is re-sent
+  rpc->process_small_req_st(sslot_0, pkthdr_0);
+  ASSERT_EQ(num_req_handler_calls, 1);
+  ASSERT_EQ(pkthdr_tx_queue->pop().pkt_type, PktType::kPktTypeResp);
+
+  // Receive the next request, and pretend that its handler responded in the
+  // prealloc MsgBuffer
+  pkthdr_0->req_num += kSessionReqWindow;
+  rpc->process_small_req_st(sslot_0, pkthdr_0);
+  ASSERT_EQ(pkthdr_tx_queue->pop().pkt_type, PktType::kPktTypeResp);
+  rpc->bury_resp_msgbuf_server_st(sslot_0);
+
+  MsgBuffer *pre_resp_msgbuf = &sslot_0->pre_resp_msgbuf;
+  rpc->resize_msg_buffer(pre_resp_msgbuf, kTestSmallMsgSize);
+  pre_resp_msgbuf->get_pkthdr_0()->format(
+      kTestReqType, kTestSmallMsgSize, client.session_num,
+      PktType::kPktTypeResp, 0 /* pkt_num */, pkthdr_0->req_num);
+  sslot_0->tx_msgbuf = pre_resp_msgbuf;
+
+  // Scan after the session becomes idle again
+  // Expect: The prealloc MsgBuffer holds the response, so it's kept
+  srv_session->last_rx_tsc = rpc->ev_loop_tsc;
+  rpc->ev_loop_tsc += rpc->session_idle_cycles + 1;
+  rpc->release_idle_server_sslots_st();
+  ASSERT_EQ(sslot_0->tx_msgbuf, pre_resp_msgbuf);
+  ASSERT_NE(pre_resp_msgbuf->buf, nullptr);
+  ASSERT_EQ(rpc->get_stat_pre_resp_released(), 1);
+
+  // Receive the request again (past)
+  // Expect: The response is re-sent
+  rpc->process_small_req_st(sslot_0, pkthdr_0);
+  ASSERT_EQ(num_req_handler_calls, 2);
+  ASSERT_EQ(pkthdr_tx_queue->pop().pkt_type, PktType::kPktTypeResp);
+}
+
 TEST_F(RpcTest, process_large_req_one_st) {
   const size_t num_pkts_in_req = rpc->data_size_to_num_pkts(kTestLargeMsgSize);
   ASSERT_GT(num_pkts_in_req, 10);
@@ -133,6 +207,108 @@ TEST_F(RpcTest, process_large_req_one_st) {
   ASSERT_EQ(rpc->transport->testing.tx_flush_count, 0);
 }
 
+/// With trusted request placement, a multi-packet request is reassembled in
+/// heap memory, which is freed when the request is buried
+TEST_F(RpcTest, process_large_req_one_st_trusted) {
+  const size_t num_pkts_in_req = rpc->data_size_to_num_pkts(kTestLargeMsgSize);
+  rpc->set_req_msgbuf_placement(MemPlacement::kTrusted);
+
+  const auto server = get_local_endpoint();
+  const auto client = get_remote_endpoint();
+  Session *srv_session = create_server_session_init(client, server);
+  SSlot *sslot_0 = &srv_session->sslot_arr[0];
+  const MsgBuffer &req_msgbuf = sslot_0->server_info.req_msgbuf;
+
+  uint8_t req[CTransport::kMTU];
+  auto *pkthdr_0 = reinterpret_cast<pkthdr_t *>(req);
+  pkthdr_0->format(kTestReqType, kTestLargeMsgSize, server.session_num,
+                   PktType::kPktTypeReq, 0 /* pkt_num */, kSessionReqWindow);
+
+  // Receive the zeroth request packet
+  // Expect: The request MsgBuffer is allocated from the heap
+  rpc->process_large_req_one_st(sslot_0, pkthdr_0);
+  ASSERT_TRUE(req_msgbuf.buffer.trusted);
+  ASSERT_GE(rpc->get_stat_trusted_alloc_tot(), kTestLargeMsgSize);
+  ASSERT_EQ(rpc->get_stat_enclave_rx_copy_bytes(),
+            CTransport::kMaxDataPerPkt);
+
+  // Receive the remaining request packets
+  // Expect: The request handler runs, and enqueue_response() buries the
+  // request, which frees it to the heap
+  for (size_t i = 1; i < num_pkts_in_req; i++) {
+    pkthdr_0->pkt_num = i;
+    rpc->process_large_req_one_st(sslot_0, pkthdr_0);
+  }
+  ASSERT_EQ(num_req_handler_calls, 1);
+  ASSERT_TRUE(req_msgbuf.is_buried());
+  ASSERT_EQ(rpc->get_stat_trusted_alloc_tot(), 0);
+  ASSERT_EQ(rpc->get_stat_enclave_rx_copy_bytes(), kTestLargeMsgSize);
+}
+
+/// A burst larger than the request window fills all sslots and backlogs the
+/// remainder, like the equivalent sequence of enqueue_request() calls
+TEST_F(RpcTest, enqueue_requests) {
+  const auto client = get_local_endpoint();
+  const auto server = get_remote_endpoint();
+  Session *clt_session = create_client_session_connected(client, server);
+
+  static constexpr size_t kNumReqs = kSessionReqWindow + 2;
+  MsgBuffer req[kNumReqs], resp[kNumReqs];
+  enq_req_args_t args_arr[kNumReqs];
+  for (size_t i = 0; i < kNumReqs; i++) {
+    req[i] = rpc->alloc_msg_buffer(kTestSmallMsgSize);
+    resp[i] = rpc->alloc_msg_buffer(kTestSmallMsgSize);
+    args_arr[i] = enq_req_args_t(client.session_num, kTestReqType, &req[i],
+                                 &resp[i], cont_func, kTestTag, kInvalidBgETid);
+  }
+
+  rpc->enqueue_requests(args_arr, kNumReqs);
+  ASSERT_EQ(clt_session->client_info.sslot_free_vec.size(), 0);
+  ASSERT_EQ(clt_session->client_info.enq_req_backlog.size(), 2);
+
+  // Requests occupy sslots in the order of the burst
+  for (size_t i = 0; i < kSessionReqWindow; i++) {
+    const SSlot &sslot = clt_session->sslot_arr[kSessionReqWindow - 1 - i];
+    ASSERT_EQ(sslot.tx_msgbuf, &req[i]);
+  }
+}
+
+/// Requests submitted from a non-eRPC thread through a producer lane are
+/// enqueued when the event loop drains the lanes
+TEST_F(RpcTest, process_producer_lanes_st) {
+  const auto client = get_local_endpoint();
+  const auto server = get_remote_endpoint();
+  Session *clt_session = create_client_session_connected(client, server);
+
+  MsgBuffer req = rpc->alloc_msg_buffer(kTestSmallMsgSize);
+  MsgBuffer resp = rpc->alloc_msg_buffer(kTestSmallMsgSize);
+  CompletionQueue comp_queue(kSessionReqWindow);
+
+  ProducerLane *lane = rpc->create_producer_lane(4);
+  ASSERT_NE(lane, nullptr);
+  ASSERT_TRUE(rpc->multi_threaded);  // Producers can use the allocator
+
+  std::thread producer([&] {
+    MsgBuffer scratch = rpc->alloc_msg_buffer(kTestSmallMsgSize);
+    ASSERT_NE(scratch.buf, nullptr);
+    rpc->free_msg_buffer(scratch);
+
+    ASSERT_TRUE(lane->enqueue_request(client.session_num, kTestReqType, &req,
+                                      &resp, &comp_queue, kTestTag));
+  });
+  producer.join();
+  ASSERT_TRUE(rpc->producer_lanes.doorbell.load());
+
+  rpc->process_producer_lanes_st();
+  ASSERT_FALSE(rpc->producer_lanes.doorbell.load());
+  ASSERT_EQ(clt_session->client_info.sslot_free_vec.size(),
+            kSessionReqWindow - 1);
+
+  const SSlot &sslot = clt_session->sslot_arr[kSessionReqWindow - 1];
+  ASSERT_EQ(sslot.tx_msgbuf, &req);
+  ASSERT_EQ(sslot.client_info.comp_queue, &comp_queue);
+}
+
 }  // namespace erpc
 
 int main(int argc, char **argv) {
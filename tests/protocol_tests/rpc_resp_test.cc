@@ -60,6 +60,205 @@ TEST_F(RpcTest, process_resp_one_LARGE_st) {
   // TODO
 }
 
+/// Responses to requests enqueued with a CompletionQueue are delivered to the
+/// ring, and held back by the Rpc while the ring is full
+TEST_F(RpcTest, process_resp_one_comp_queue_st) {
+  const auto client = get_local_endpoint();
+  const auto server = get_remote_endpoint();
+  Session *clt_session = create_client_session_connected(client, server);
+  CompletionQueue comp_queue(1);
+  ASSERT_EQ(comp_queue.capacity(), 1);
+
+  // Enqueue two requests, with distinct tags
+  static constexpr size_t kNumReqs = 2;
+  MsgBuffer req[kNumReqs], local_resp[kNumReqs];
+  SSlot *sslot[kNumReqs];
+  rpc->faults.hard_wheel_bypass = true;  // Don't place request pkts in wheel
+  for (size_t i = 0; i < kNumReqs; i++) {
+    req[i] = rpc->alloc_msg_buffer(kTestSmallMsgSize);
+    local_resp[i] = rpc->alloc_msg_buffer(kTestSmallMsgSize);
+    rpc->enqueue_request(0, kTestReqType, &req[i], &local_resp[i], &comp_queue,
+                         reinterpret_cast<void *>(i + 1));
+
+    sslot[i] = nullptr;
+    for (SSlot &s : clt_session->sslot_arr) {
+      if (s.tx_msgbuf == &req[i]) sslot[i] = &s;
+    }
+    ASSERT_NE(sslot[i], nullptr);
+  }
+
+  // Receive both responses
+  // Expect: The first is delivered to the ring, and the second is held back.
+  // No continuation is invoked.
+  for (size_t i = 0; i < kNumReqs; i++) {
+    uint8_t remote_resp[sizeof(pkthdr_t) + kTestSmallMsgSize];
+    auto *pkthdr_0 = reinterpret_cast<pkthdr_t *>(remote_resp);
+    pkthdr_0->format(kTestReqType, kTestSmallMsgSize, client.session_num,
+                     PktType::kPktTypeResp, 0 /* pkt_num */,
+                     sslot[i]->cur_req_num);
+    rpc->process_resp_one_st(sslot[i], pkthdr_0, rdtsc());
+    ASSERT_EQ(sslot[i]->tx_msgbuf, nullptr);  // Response received
+  }
+  ASSERT_EQ(num_cont_func_calls, 0);
+  ASSERT_EQ(comp_queue.size(), 1);
+  ASSERT_EQ(rpc->comp_queue_overflow.size(), 1);
+  ASSERT_FALSE(rpc->can_sleep_st());
+
+  // Retry while the ring is still full
+  // Expect: The held-back completion stays held back
+  rpc->process_comp_queue_overflow_st();
+  ASSERT_EQ(rpc->comp_queue_overflow.size(), 1);
+
+  completion_t comps[kNumReqs];
+  ASSERT_EQ(comp_queue.poll_completions(comps, kNumReqs), 1);
+  ASSERT_EQ(comps[0].tag, reinterpret_cast<void *>(1));
+  ASSERT_EQ(comps[0].resp_msgbuf, &local_resp[0]);
+  ASSERT_EQ(comps[0].resp_msgbuf->get_data_size(), kTestSmallMsgSize);
+
+  // Retry after the application harvests the ring
+  // Expect: The held-back completion is delivered
+  rpc->process_comp_queue_overflow_st();
+  ASSERT_TRUE(rpc->comp_queue_overflow.empty());
+  ASSERT_EQ(comp_queue.poll_completions(comps, kNumReqs), 1);
+  ASSERT_EQ(comps[0].tag, reinterpret_cast<void *>(2));
+  ASSERT_EQ(comps[0].resp_msgbuf, &local_resp[1]);
+  ASSERT_EQ(num_cont_func_calls, 0);
+
+  for (size_t i = 0; i < kNumReqs; i++) {
+    rpc->free_msg_buffer(req[i]);
+    rpc->free_msg_buffer(local_resp[i]);
+  }
+}
+
+TEST_F(RpcTest, msg_buffer_pool) {
+  static constexpr size_t kPoolSize = 2;
+  ASSERT_EQ(rpc->create_msg_buffer_pool(kTestReqType, 0, kPoolSize), -EINVAL);
+  ASSERT_EQ(
+      rpc->create_msg_buffer_pool(kTestReqType, kTestSmallMsgSize, kPoolSize),
+      0);
+  ASSERT_EQ(
+      rpc->create_msg_buffer_pool(kTestReqType, kTestSmallMsgSize, kPoolSize),
+      -EEXIST);
+
+  // Pooled MsgBuffers come with their packet headers pre-initialized
+  MsgBuffer m0 = rpc->alloc_msg_buffer_from_pool(kTestReqType);
+  MsgBuffer m1 = rpc->alloc_msg_buffer_from_pool(kTestReqType);
+  ASSERT_EQ(m0.max_data_size, kTestSmallMsgSize);
+  ASSERT_EQ(m0.get_pkthdr_0()->req_type, kTestReqType);
+  ASSERT_TRUE(m0.get_pkthdr_0()->check_magic());
+  ASSERT_TRUE(m0.buffer.pooled);
+
+  // An empty pool falls back to the hugepage allocator, with the same headers
+  const size_t user_alloc_tot = rpc->get_stat_user_alloc_tot();
+  MsgBuffer m2 = rpc->alloc_msg_buffer_from_pool(kTestReqType);
+  ASSERT_NE(m2.buf, nullptr);
+  ASSERT_TRUE(m2.buffer.pooled);
+  ASSERT_EQ(m2.get_pkthdr_0()->req_type, kTestReqType);
+  ASSERT_GT(rpc->get_stat_user_alloc_tot(), user_alloc_tot);
+
+  // Freeing beyond the pool's capacity returns memory to the allocator
+  rpc->resize_msg_buffer(&m0, 1);
+  rpc->free_msg_buffer_to_pool(kTestReqType, m0);
+  rpc->free_msg_buffer_to_pool(kTestReqType, m1);
+  rpc->free_msg_buffer_to_pool(kTestReqType, m2);
+  ASSERT_EQ(rpc->get_stat_user_alloc_tot(), user_alloc_tot);
+
+  // Buffers returned to the pool are restored to full size
+  MsgBuffer m3 = rpc->alloc_msg_buffer_from_pool(kTestReqType);
+  ASSERT_EQ(m3.get_data_size(), kTestSmallMsgSize);
+  rpc->free_msg_buffer_to_pool(kTestReqType, m3);
+
+  // A same-sized MsgBuffer that's not from a pool never enters the pool
+  MsgBuffer m4 = rpc->alloc_msg_buffer(kTestSmallMsgSize);
+  ASSERT_FALSE(m4.buffer.pooled);
+  rpc->free_msg_buffer_to_pool(kTestReqType, m4);
+  ASSERT_EQ(rpc->get_stat_user_alloc_tot(), user_alloc_tot);
+  ASSERT_EQ(rpc->msgbuf_pools[kTestReqType].free_vec.size(), kPoolSize);
+
+  // Neither does a same-sized MsgBuffer from another request type's pool,
+  // since its headers are initialized for that type
+  const uint8_t other_req_type = kTestReqType + 1;
+  ASSERT_EQ(rpc->create_msg_buffer_pool(other_req_type, kTestSmallMsgSize, 1),
+            0);
+  MsgBuffer m5 = rpc->alloc_msg_buffer_from_pool(other_req_type);
+  ASSERT_EQ(m5.get_pkthdr_0()->req_type, other_req_type);
+  rpc->free_msg_buffer_to_pool(kTestReqType, m5);
+  ASSERT_EQ(rpc->msgbuf_pools[kTestReqType].free_vec.size(), kPoolSize);
+
+  // All packet headers of a multi-packet pooled MsgBuffer are initialized
+  const uint8_t large_req_type = kTestReqType + 2;
+  ASSERT_EQ(rpc->create_msg_buffer_pool(large_req_type, kTestLargeMsgSize, 1),
+            0);
+  MsgBuffer m6 = rpc->alloc_msg_buffer_from_pool(large_req_type);
+  ASSERT_GT(m6.num_pkts, 1);
+  for (size_t i = 0; i < m6.num_pkts; i++) {
+    ASSERT_EQ(m6.get_pkthdr_n(i)->req_type, large_req_type);
+    ASSERT_TRUE(m6.get_pkthdr_n(i)->check_magic());
+  }
+  rpc->free_msg_buffer_to_pool(large_req_type, m6);
+}
+
+/// Burying a dynamic response frees it to the pool only if it came from one
+TEST_F(RpcTest, bury_pooled_resp_msgbuf) {
+  ASSERT_EQ(
+      rpc->create_msg_buffer_pool(kTestReqType, kTestSmallMsgSize, 1), 0);
+  const size_t user_alloc_tot = rpc->get_stat_user_alloc_tot();
+  auto &free_vec = rpc->msgbuf_pools[kTestReqType].free_vec;
+
+  SSlot sslot;
+  sslot.server_info.resp_req_type = kTestReqType;
+
+  // A response from plain alloc_msg_buffer(), of another size
+  sslot.dyn_resp_msgbuf = rpc->alloc_msg_buffer(kTestSmallMsgSize * 2);
+  sslot.tx_msgbuf = &sslot.dyn_resp_msgbuf;
+  rpc->bury_resp_msgbuf_server_st(&sslot);
+  ASSERT_EQ(free_vec.size(), 1);
+  ASSERT_EQ(rpc->get_stat_user_alloc_tot(), user_alloc_tot);
+
+  // A response from the pool goes back to the pool
+  sslot.dyn_resp_msgbuf = rpc->alloc_msg_buffer_from_pool(kTestReqType);
+  ASSERT_EQ(free_vec.size(), 0);
+  sslot.tx_msgbuf = &sslot.dyn_resp_msgbuf;
+  rpc->bury_resp_msgbuf_server_st(&sslot);
+  ASSERT_EQ(free_vec.size(), 1);
+  ASSERT_EQ(rpc->get_stat_user_alloc_tot(), user_alloc_tot);
+}
+
+TEST_F(RpcTest, trusted_resp_msgbuf) {
+  const auto client = get_local_endpoint();
+  const auto server = get_remote_endpoint();
+  Session *clt_session = create_client_session_connected(client, server);
+  SSlot *sslot_0 = &clt_session->sslot_arr[0];
+
+  // Trusted MsgBuffers don't use the hugepage allocator
+  const size_t user_alloc_tot = rpc->get_stat_user_alloc_tot();
+  MsgBuffer req = rpc->alloc_msg_buffer(kTestSmallMsgSize);
+  MsgBuffer local_resp =
+      rpc->alloc_msg_buffer(kTestSmallMsgSize, MemPlacement::kTrusted);
+  ASSERT_NE(local_resp.buf, nullptr);
+  ASSERT_TRUE(local_resp.get_pkthdr_0()->check_magic());
+  ASSERT_GE(rpc->get_stat_trusted_alloc_tot(), kTestSmallMsgSize);
+
+  rpc->faults.hard_wheel_bypass = true;  // Don't place request pkt in wheel
+  rpc->enqueue_request(0, kTestReqType, &req, &local_resp, cont_func, kTestTag);
+
+  uint8_t remote_resp[sizeof(pkthdr_t) + kTestSmallMsgSize];
+  auto *pkthdr_0 = reinterpret_cast<pkthdr_t *>(remote_resp);
+  pkthdr_0->format(kTestReqType, kTestSmallMsgSize, client.session_num,
+                   PktType::kPktTypeResp, 0 /* pkt_num */, kSessionReqWindow);
+
+  // Receiving the response copies its data across the enclave boundary
+  ASSERT_EQ(rpc->get_stat_enclave_rx_copy_bytes(), 0);
+  rpc->process_resp_one_st(sslot_0, pkthdr_0, rdtsc());
+  ASSERT_EQ(num_cont_func_calls, 1);
+  ASSERT_EQ(rpc->get_stat_enclave_rx_copy_bytes(), kTestSmallMsgSize);
+
+  rpc->free_msg_buffer(req);
+  rpc->free_msg_buffer(local_resp);
+  ASSERT_EQ(rpc->get_stat_trusted_alloc_tot(), 0);
+  ASSERT_EQ(rpc->get_stat_user_alloc_tot(), user_alloc_tot);
+}
+
 }  // namespace erpc
 
 int main(int argc, char **argv) {
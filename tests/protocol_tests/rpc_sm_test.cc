@@ -91,6 +91,17 @@ TEST_F(RpcSmTest, handle_connect_req_st_errors) {
                SmErrType::kRoutingResolutionFailure);
   rpc->faults.fail_resolve_rinfo = false;  // Restore
 
+  // The heartbeat manager can't track the client's process
+  HeartbeatMgr &heartbeat_mgr = rpc->nexus->heartbeat_mgr;
+  for (size_t i = 0; i < HeartbeatMgr::kMaxPeers; i++) {
+    heartbeat_mgr.unlocked_add_remote("127.0.0.1:" + std::to_string(i + 1));
+  }
+  rpc->handle_connect_req_st(conn_req);
+  common_check(0, SmPktType::kConnectResp, SmErrType::kTooManyPeers);
+  for (uint32_t i = 0; i < HeartbeatMgr::kMaxPeers; i++) {
+    heartbeat_mgr.unlocked_remove_remote(i);  // Restore
+  }
+
   // Out of hugepages
   //
   // This should be the last subtest because we use alloc_raw() to eat up
@@ -111,7 +122,15 @@ TEST_F(RpcSmTest, handle_connect_req_st_errors) {
 
   size_t initial_alloc = rpc->huge_alloc->get_stat_user_alloc_tot();
   rpc->handle_connect_req_st(conn_req);
-  common_check(0, SmPktType::kConnectResp, SmErrType::kOutOfMemory);
+  if (kLazyPreRespMsgbuf) {
+    // Server sslots are materialized on the first request, so connecting
+    // needs no hugepages, and the first request is dropped instead
+    common_check(1, SmPktType::kConnectResp, SmErrType::kNoError);
+    SSlot *sslot_0 = &rpc->session_vec[0]->sslot_arr[0];
+    ASSERT_FALSE(rpc->alloc_pre_resp_msgbuf_st(sslot_0));
+  } else {
+    common_check(0, SmPktType::kConnectResp, SmErrType::kOutOfMemory);
+  }
   ASSERT_EQ(initial_alloc, rpc->huge_alloc->get_stat_user_alloc_tot());
   // No more tests here because all hugepages are consumed
 }
@@ -189,8 +208,11 @@ TEST_F(RpcSmTest, handle_disconnect_req_st) {
   const SmPkt disc_req(SmPktType::kDisconnectReq, SmErrType::kNoError,
                        kTestUniqToken, client, server);
 
-  // Make session 0 a server session in kConnected
-  create_server_session_init(client, server);
+  // Make session 0 a server session in kConnected, with a materialized sslot
+  Session *srv_session = create_server_session_init(client, server);
+  if (kLazyPreRespMsgbuf) {
+    ASSERT_TRUE(rpc->alloc_pre_resp_msgbuf_st(&srv_session->sslot_arr[0]));
+  }
 
   // Process first disconnect request
   // Session is destroyed, resources released, & response sent.
@@ -244,6 +266,122 @@ TEST_F(RpcSmTest, create_session_st) {
   ASSERT_LT(session_num, 0);
 }
 
+/// Connect requests from one datagram are answered in one datagram, and the
+/// client's routing info is resolved once
+TEST_F(RpcSmTest, handle_sm_rx_st_batch) {
+  static constexpr size_t kNumReqs = 4;
+  auto client = get_remote_endpoint();
+  const auto server = set_invalid_session_num(get_local_endpoint());
+
+  for (size_t i = 0; i < kNumReqs; i++) {
+    client.session_num = i;
+    ASSERT_TRUE(rpc->nexus_hook.sm_rx_queue.push(
+        SmPkt(SmPktType::kConnectReq, SmErrType::kNoError,
+              kTestUniqToken + i, client, server)));
+  }
+
+  rpc->handle_sm_rx_st();
+  common_check(kNumReqs, SmPktType::kConnectResp, SmErrType::kNoError);
+  ASSERT_EQ(rpc->udp_client.sent_vec.size(), kNumReqs);
+  ASSERT_EQ(rpc->udp_client.num_sent_datagrams, 1);
+  ASSERT_TRUE(rpc->sm_tx_batch.pkts.empty());
+  ASSERT_TRUE(rpc->sm_tx_batch.resolved_rinfo.empty());
+
+  // All sessions share the resolution of the client's routing info
+  for (size_t i = 1; i < kNumReqs; i++) {
+    ASSERT_EQ(memcmp(&rpc->session_vec[i]->client.routing_info,
+                     &rpc->session_vec[0]->client.routing_info,
+                     sizeof(Transport::RoutingInfo)),
+              0);
+  }
+}
+
+//
+// create_sessions()
+//
+TEST_F(RpcSmTest, create_sessions) {
+  static constexpr size_t kNumRemoteRpcs = kMaxSmPktBatch + 2;
+
+  // Connect requests to one remote Nexus, including one invalid remote
+  std::vector<std::pair<std::string, uint8_t>> remotes;
+  for (size_t i = 1; i <= kNumRemoteRpcs; i++) {
+    remotes.emplace_back("localhost:31850", kTestRpcId + i);
+  }
+  remotes.emplace_back("localhost:31850", kTestRpcId);  // Self
+
+  std::vector<int> session_nums;
+  ASSERT_EQ(rpc->create_sessions(remotes, &session_nums), kNumRemoteRpcs);
+  ASSERT_EQ(session_nums.size(), kNumRemoteRpcs + 1);
+  for (size_t i = 0; i < kNumRemoteRpcs; i++) ASSERT_EQ(session_nums[i], i);
+  ASSERT_LT(session_nums.back(), 0);
+
+  // The requests fill as few datagrams as possible
+  common_check(kNumRemoteRpcs, SmPktType::kConnectReq, SmErrType::kNoError);
+  ASSERT_EQ(rpc->udp_client.sent_vec.size(), kNumRemoteRpcs);
+  ASSERT_EQ(rpc->udp_client.num_sent_datagrams, 2);
+  ASSERT_EQ(rpc->sm_pending_reqs.size(), kNumRemoteRpcs);
+}
+
+//
+// Session management over the datapath
+//
+TEST_F(RpcSmTest, datapath_sm) {
+  // Datapath SM must be enabled before the Rpc is created
+  delete rpc;
+  nexus->datapath_sm_enabled = true;
+  rpc = new Rpc<CTransport>(nexus, nullptr, kTestRpcId, sm_handler,
+                            kTestPhyPort);
+  rpc->udp_client.enable_recording();
+  pkthdr_tx_queue = &rpc->testing.pkthdr_tx_queue;
+
+  auto client = get_remote_endpoint();
+  client.datapath_sm = true;
+  const auto server = set_invalid_session_num(get_local_endpoint());
+
+  // The connect request arrives over UDP. The server learns the client's
+  // routing info, so the response uses the datapath.
+  rpc->handle_connect_req_st(SmPkt(SmPktType::kConnectReq, SmErrType::kNoError,
+                                   kTestUniqToken, client, server));
+  ASSERT_EQ(rpc->session_vec.size(), 1);
+  ASSERT_TRUE(rpc->udp_client.sent_vec.empty());
+  ASSERT_EQ(rpc->dp_sm.routes.size(), 1);
+  ASSERT_EQ(pkthdr_tx_queue->pop().dest_session_num, kSmSessionNum);
+  ASSERT_EQ(rpc->ring_entries_available,
+            Transport::kNumRxRingEntries - kSessionCredits - kDpSmCredits);
+  ASSERT_EQ(rpc->get_max_num_sessions(),
+            Transport::kNumRxRingEntries / (kSessionCredits + kDpSmCredits));
+
+  // Pings take datapath SM credits, and are skipped when they run out
+  for (size_t i = 1; i < kDpSmCredits; i++) rpc->send_dp_sm_pings_st();
+  ASSERT_EQ(pkthdr_tx_queue->size(), kDpSmCredits - 1);
+  pkthdr_tx_queue->clear();
+  rpc->send_dp_sm_pings_st();
+  ASSERT_EQ(pkthdr_tx_queue->size(), 0);
+  rpc->pkt_loss_scan_tsc++;  // Start a new epoch, which refills the credits
+
+  // A disconnect request received over the datapath is handled after RX
+  const Session *session = rpc->session_vec[0];
+  const SmPkt disc_req(SmPktType::kDisconnectReq, SmErrType::kNoError,
+                       kTestUniqToken, session->client, session->server);
+  std::vector<uint8_t> pkt(sizeof(pkthdr_t) + sizeof(SmPkt));
+  auto *pkthdr = reinterpret_cast<pkthdr_t *>(pkt.data());
+  pkthdr->format(kInvalidReqType, sizeof(SmPkt), kSmSessionNum, kPktTypeReq,
+                 0, 0);
+  memcpy(&pkthdr[1], &disc_req, sizeof(SmPkt));
+
+  rpc->process_pkt_st(pkthdr);
+  ASSERT_EQ(rpc->dp_sm.rx_queue.size(), 1);
+  rpc->handle_sm_rx_st();
+  ASSERT_TRUE(rpc->dp_sm.rx_queue.empty());
+  ASSERT_EQ(rpc->session_vec[0], nullptr);
+  ASSERT_TRUE(rpc->udp_client.sent_vec.empty());
+  ASSERT_EQ(pkthdr_tx_queue->pop().dest_session_num, kSmSessionNum);
+
+  // The route is forgotten with the last session to the remote Rpc
+  ASSERT_TRUE(rpc->dp_sm.routes.empty());
+  ASSERT_EQ(rpc->ring_entries_available, Transport::kNumRxRingEntries);
+}
+
 }  // namespace erpc
 
 int main(int argc, char **argv) {
@@ -0,0 +1,58 @@
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "completion_queue.h"
+#include "util/spsc_queue.h"
+
+TEST(SpscQueueTest, Basic) {
+  erpc::SpscQueue<size_t> q(3);
+  ASSERT_EQ(q.capacity(), 4);  // Rounded up to a power of two
+
+  for (size_t i = 0; i < 4; i++) ASSERT_TRUE(q.push(i));
+  ASSERT_FALSE(q.push(4));  // Full
+  ASSERT_EQ(q.size(), 4);
+
+  size_t out[8];
+  ASSERT_EQ(q.pop_burst(out, 3), 3);
+  for (size_t i = 0; i < 3; i++) ASSERT_EQ(out[i], i);
+
+  // Wrap around
+  ASSERT_TRUE(q.push(4));
+  ASSERT_TRUE(q.push(5));
+  ASSERT_EQ(q.pop_burst(out, 8), 3);
+  ASSERT_EQ(out[0], 3);
+  ASSERT_EQ(out[2], 5);
+  ASSERT_TRUE(q.empty());
+  ASSERT_EQ(q.pop_burst(out, 8), 0);
+}
+
+TEST(CompletionQueueTest, CrossThread) {
+  static constexpr size_t kNumCompletions = 100000;
+  erpc::CompletionQueue cq(64);
+
+  std::thread producer([&cq] {
+    for (size_t i = 0; i < kNumCompletions; i++) {
+      erpc::completion_t c(reinterpret_cast<void *>(i), nullptr);
+      while (!cq.push(c)) std::this_thread::yield();
+    }
+  });
+
+  size_t expected = 0;
+  erpc::completion_t out[16];
+  while (expected < kNumCompletions) {
+    size_t num = cq.poll_completions(out, 16);
+    if (num == 0) std::this_thread::yield();
+    for (size_t i = 0; i < num; i++) {
+      ASSERT_EQ(reinterpret_cast<size_t>(out[i].tag), expected);
+      expected++;
+    }
+  }
+
+  producer.join();
+  ASSERT_EQ(cq.size(), 0);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
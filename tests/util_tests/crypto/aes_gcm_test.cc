@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+#include "util/aes_gcm.h"
+
+using namespace erpc;
+
+static constexpr size_t kTestDataSize = 1024;
+static constexpr size_t kTestAadSize = 14;
+
+class AesGcmTest : public ::testing::Test {
+ public:
+  AesGcmTest() {
+    for (size_t i = 0; i < AesGcm::kKeySize; i++) key[i] = rand();
+    for (size_t i = 0; i < AesGcm::kNonceSize; i++) nonce[i] = rand();
+    for (size_t i = 0; i < kTestAadSize; i++) aad[i] = rand();
+    for (size_t i = 0; i < kTestDataSize; i++) plaintext[i] = rand();
+    memcpy(data, plaintext, kTestDataSize);
+  }
+
+  uint8_t key[AesGcm::kKeySize];
+  uint8_t nonce[AesGcm::kNonceSize];
+  uint8_t aad[kTestAadSize];
+  uint8_t plaintext[kTestDataSize];
+  uint8_t data[kTestDataSize];
+  uint8_t tag[AesGcm::kTagSize];
+};
+
+TEST_F(AesGcmTest, SealOpen) {
+  AesGcm aead(key);
+  aead.seal(data, kTestDataSize, nonce, aad, kTestAadSize, tag);
+  ASSERT_NE(memcmp(data, plaintext, kTestDataSize), 0);
+
+  ASSERT_TRUE(aead.open(data, kTestDataSize, nonce, aad, kTestAadSize, tag));
+  ASSERT_EQ(memcmp(data, plaintext, kTestDataSize), 0);
+}
+
+TEST_F(AesGcmTest, SealTwiceRestores) {
+  AesGcm aead(key);
+  aead.seal(data, kTestDataSize, nonce, aad, kTestAadSize, tag);
+  aead.seal(data, kTestDataSize, nonce, aad, kTestAadSize, tag);
+  ASSERT_EQ(memcmp(data, plaintext, kTestDataSize), 0);
+}
+
+TEST_F(AesGcmTest, OpenTo) {
+  AesGcm aead(key);
+  aead.seal(data, kTestDataSize, nonce, aad, kTestAadSize, tag);
+  uint8_t sealed[kTestDataSize];
+  memcpy(sealed, data, kTestDataSize);
+
+  // Decrypt out of place, e.g., from an RX ring into a MsgBuffer
+  uint8_t out[kTestDataSize];
+  ASSERT_TRUE(
+      aead.open_to(out, data, kTestDataSize, nonce, aad, kTestAadSize, tag));
+  ASSERT_EQ(memcmp(out, plaintext, kTestDataSize), 0);
+  ASSERT_EQ(memcmp(data, sealed, kTestDataSize), 0);
+
+  data[0] ^= 1;
+  ASSERT_FALSE(
+      aead.open_to(out, data, kTestDataSize, nonce, aad, kTestAadSize, tag));
+}
+
+TEST_F(AesGcmTest, Tampering) {
+  AesGcm aead(key);
+  aead.seal(data, kTestDataSize, nonce, aad, kTestAadSize, tag);
+  uint8_t sealed[kTestDataSize];
+  memcpy(sealed, data, kTestDataSize);
+
+  // Modified ciphertext
+  data[kTestDataSize / 2] ^= 1;
+  ASSERT_FALSE(aead.open(data, kTestDataSize, nonce, aad, kTestAadSize, tag));
+
+  // Modified AAD
+  memcpy(data, sealed, kTestDataSize);
+  aad[0] ^= 1;
+  ASSERT_FALSE(aead.open(data, kTestDataSize, nonce, aad, kTestAadSize, tag));
+  aad[0] ^= 1;
+
+  // Wrong nonce
+  memcpy(data, sealed, kTestDataSize);
+  nonce[0] ^= 1;
+  ASSERT_FALSE(aead.open(data, kTestDataSize, nonce, aad, kTestAadSize, tag));
+}
+
+TEST_F(AesGcmTest, Mac) {
+  AesGcm aead(key);
+  aead.mac(data, kTestDataSize, nonce, tag);
+  ASSERT_EQ(memcmp(data, plaintext, kTestDataSize), 0);  // Not encrypted
+  ASSERT_TRUE(aead.verify(data, kTestDataSize, nonce, tag));
+
+  data[kTestDataSize - 1] ^= 1;
+  ASSERT_FALSE(aead.verify(data, kTestDataSize, nonce, tag));
+  data[kTestDataSize - 1] ^= 1;
+
+  // A replayed packet with a different request number has a different nonce
+  nonce[0] ^= 1;
+  ASSERT_FALSE(aead.verify(data, kTestDataSize, nonce, tag));
+}
+
+/// Control packets have no payload, so their tag covers only the nonce and,
+/// when sealed, the AAD
+TEST_F(AesGcmTest, EmptyPayload) {
+  AesGcm aead(key);
+  uint8_t empty[1], tag_2[AesGcm::kTagSize];
+
+  aead.mac(empty, 0, nonce, tag);
+  ASSERT_TRUE(aead.verify(empty, 0, nonce, tag));
+  nonce[AesGcm::kNonceSize - 1] ^= 1;
+  ASSERT_FALSE(aead.verify(empty, 0, nonce, tag));
+  aead.mac(empty, 0, nonce, tag_2);
+  ASSERT_NE(memcmp(tag, tag_2, AesGcm::kTagSize), 0);
+
+  aead.seal(empty, 0, nonce, aad, kTestAadSize, tag);
+  ASSERT_TRUE(aead.open(empty, 0, nonce, aad, kTestAadSize, tag));
+  aad[0] ^= 1;
+  ASSERT_FALSE(aead.open(empty, 0, nonce, aad, kTestAadSize, tag));
+}
+
+TEST_F(AesGcmTest, DeriveKey) {
+  uint8_t key_1[AesGcm::kKeySize], key_2[AesGcm::kKeySize];
+  AesGcm::derive_key(key, 1, 0, key_1);
+  AesGcm::derive_key(key, 2, 0, key_2);
+  ASSERT_NE(memcmp(key_1, key_2, AesGcm::kKeySize), 0);
+
+  // Labels separate keys derived from the same salt
+  AesGcm::derive_key(key, 1, 1, key_2);
+  ASSERT_NE(memcmp(key_1, key_2, AesGcm::kKeySize), 0);
+
+  // Both ends of a session derive the same key
+  AesGcm::derive_key(key, 1, 0, key_2);
+  ASSERT_EQ(memcmp(key_1, key_2, AesGcm::kKeySize), 0);
+
+  AesGcm client(key_1), server(key_2);
+  client.seal(data, kTestDataSize, nonce, aad, kTestAadSize, tag);
+  ASSERT_TRUE(server.open(data, kTestDataSize, nonce, aad, kTestAadSize, tag));
+  ASSERT_EQ(memcmp(data, plaintext, kTestDataSize), 0);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,6 +1,9 @@
 #include <gtest/gtest.h>
 #include <algorithm>
 
+#include <set>
+#include "util/test_printf.h"
+
 #define private public
 #include "heartbeat_mgr.h"
 
@@ -18,22 +21,121 @@ static bool str_vec_contains(const std::vector<std::string> &vec,
   return std::find(vec.begin(), vec.end(), s) != vec.end();
 }
 
-TEST(HeartbeatMgrTest, PriorityQueueOrderTest) {
-  std::priority_queue<HeartbeatMgr::Event, std::vector<HeartbeatMgr::Event>,
-                      HeartbeatMgr::EventComparator>
-      hb_event_pqueue;
-  hb_event_pqueue.emplace(HeartbeatMgr::EventType::kSend, "hostname_1", 1);
-  hb_event_pqueue.emplace(HeartbeatMgr::EventType::kCheck, "hostname_2", 3);
-  hb_event_pqueue.emplace(HeartbeatMgr::EventType::kSend, "hostname_3", 2);
+TEST(HeartbeatMgrTest, PeerIdTest) {
+  HeartbeatMgr heartbeat_mgr(kTestLocalHostname, kTestLocalSmUdpPort,
+                             kTestFreqGhz, kTestMachineFailureTimeoutMs);
+
+  // Peer IDs are dense and stable
+  ASSERT_EQ(heartbeat_mgr.unlocked_add_remote("127.0.0.1:1"), 0);
+  ASSERT_EQ(heartbeat_mgr.unlocked_add_remote("127.0.0.1:2"), 1);
+  ASSERT_EQ(heartbeat_mgr.unlocked_add_remote("127.0.0.1:1"), 0);
+  ASSERT_EQ(heartbeat_mgr.lookup_peer("127.0.0.1", 2), 1);
+  ASSERT_EQ(heartbeat_mgr.lookup_peer("127.0.0.1", 3),
+            HeartbeatMgr::kInvalidPeerId);
+
+  // Re-adding a tracked peer doesn't schedule more events
+  size_t num_events = 0;
+  for (auto &slot : heartbeat_mgr.wheel) num_events += slot.size();
+  ASSERT_EQ(num_events, 4);
+}
+
+/// The ID of a peer whose last reference is removed is reused
+TEST(HeartbeatMgrTest, PeerIdRecyclingTest) {
+  HeartbeatMgr heartbeat_mgr(kTestLocalHostname, kTestLocalSmUdpPort,
+                             kTestFreqGhz, kTestMachineFailureTimeoutMs);
+  volatile size_t *rx_tsc_arr = heartbeat_mgr.unlocked_add_rx_source();
+
+  // Fill the peer table
+  for (size_t i = 0; i < HeartbeatMgr::kMaxPeers; i++) {
+    ASSERT_EQ(heartbeat_mgr.unlocked_add_remote("127.0.0.1:" +
+                                                std::to_string(i + 1)),
+              i);
+  }
+  ASSERT_EQ(heartbeat_mgr.unlocked_add_remote("127.0.0.1:0"),
+            HeartbeatMgr::kInvalidPeerId);
+
+  // A peer with references left keeps its ID
+  ASSERT_EQ(heartbeat_mgr.unlocked_add_remote("127.0.0.1:1"), 0);
+  heartbeat_mgr.unlocked_remove_remote(0);
+  ASSERT_EQ(heartbeat_mgr.lookup_peer("127.0.0.1", 1), 0);
+
+  // Removing the last reference frees the ID and the peer's RX timestamps
+  rx_tsc_arr[0] = rdtsc();
+  heartbeat_mgr.unlocked_remove_remote(0);
+  ASSERT_EQ(heartbeat_mgr.lookup_peer("127.0.0.1", 1),
+            HeartbeatMgr::kInvalidPeerId);
+  ASSERT_EQ(rx_tsc_arr[0], 0);
+
+  // A new peer gets the freed ID, and the table is full again
+  ASSERT_EQ(heartbeat_mgr.unlocked_add_remote("127.0.0.1:0"), 0);
+  ASSERT_EQ(heartbeat_mgr.peers[0].uri, "127.0.0.1:0");
+  ASSERT_EQ(heartbeat_mgr.unlocked_add_remote("127.0.0.1:1"),
+            HeartbeatMgr::kInvalidPeerId);
+
+  heartbeat_mgr.unlocked_remove_rx_source(rx_tsc_arr);
+}
+
+/// Heartbeat cost with many peers: each peer gets one heartbeat per send
+/// interval, sent in batches
+TEST(HeartbeatMgrTest, ManyPeersTest) {
+  static constexpr size_t kNumPeers = 2000;
+  HeartbeatMgr heartbeat_mgr(kTestLocalHostname, kTestLocalSmUdpPort,
+                             kTestFreqGhz, kTestMachineFailureTimeoutMs);
+  heartbeat_mgr.hb_udp_client.enable_recording();
+
+  for (size_t i = 0; i < kNumPeers; i++) {
+    heartbeat_mgr.unlocked_add_remote("127.0.0.1:" + std::to_string(i + 1));
+  }
+
+  std::vector<std::string> failed_uris;
+  const size_t start_tsc = rdtsc();
+  size_t num_calls = 0;
+  while (heartbeat_mgr.hb_udp_client.sent_vec.size() < kNumPeers) {
+    heartbeat_mgr.do_one(failed_uris);
+    num_calls++;
+  }
+  const size_t cycles = rdtsc() - start_tsc;
+
+  std::set<uint16_t> ports;
+  for (auto &sm_pkt : heartbeat_mgr.hb_udp_client.sent_vec) {
+    ports.insert(sm_pkt.server.sm_udp_port);
+  }
+  ASSERT_EQ(ports.size(), kNumPeers);
+  ASSERT_TRUE(failed_uris.empty());
+
+  test_printf("%zu peers: %zu do_one() calls, %.1f us per heartbeat\n",
+              kNumPeers, num_calls, to_usec(cycles, kTestFreqGhz) / kNumPeers);
+}
+
+/// Datapath packets from a peer keep it alive and suppress heartbeats to it
+TEST(HeartbeatMgrTest, DatapathLivenessTest) {
+  HeartbeatMgr heartbeat_mgr(kTestLocalHostname, kTestLocalSmUdpPort,
+                             kTestFreqGhz, kTestMachineFailureTimeoutMs);
+  heartbeat_mgr.hb_udp_client.enable_recording();
+  std::vector<SmPkt> &sent_vec = heartbeat_mgr.hb_udp_client.sent_vec;
+  volatile size_t *rx_tsc_arr = heartbeat_mgr.unlocked_add_rx_source();
+
+  const uint32_t busy_peer = heartbeat_mgr.unlocked_add_remote("127.0.0.1:1");
+  heartbeat_mgr.unlocked_add_remote("127.0.0.1:2");  // Idle
 
-  assert(hb_event_pqueue.top().tsc == 1);
-  hb_event_pqueue.pop();
+  // An Rpc receives from the busy peer throughout two failure timeouts
+  std::vector<std::string> failed_uris;
+  const size_t end_tsc =
+      rdtsc() + 2 * ms_to_cycles(kTestMachineFailureTimeoutMs, kTestFreqGhz);
+  while (rdtsc() < end_tsc) {
+    rx_tsc_arr[busy_peer] = rdtsc();
+    heartbeat_mgr.do_one(failed_uris);
+    usleep(1000);
+  }
 
-  assert(hb_event_pqueue.top().tsc == 2);
-  hb_event_pqueue.pop();
+  ASSERT_EQ(failed_uris.size(), 1);
+  ASSERT_EQ(failed_uris[0], "127.0.0.1:2");
+  ASSERT_GT(heartbeat_mgr.get_stat_hbs_suppressed(), 0);
+  for (auto &sm_pkt : sent_vec) ASSERT_EQ(sm_pkt.server.sm_udp_port, 2);
 
-  assert(hb_event_pqueue.top().tsc == 3);
-  hb_event_pqueue.pop();
+  // Liveness evidence outlives the Rpc
+  heartbeat_mgr.unlocked_remove_rx_source(rx_tsc_arr);
+  ASSERT_GT(heartbeat_mgr.peers[busy_peer].last_hb_rx, 0);
 }
 
 TEST(HeartbeatMgrTest, URISplitTest) {
@@ -1,12 +1,20 @@
 #include "util/huge_alloc.h"
+#include "util/huge_arena.h"
 #include <gtest/gtest.h>
 #include <time.h>
+#include <unistd.h>
 #include <algorithm>
+#include <random>
 #include <vector>
 #include "util/test_printf.h"
 
 static constexpr size_t kSystemHugepages = 512;
-static constexpr size_t kSystem4KPages = kSystemHugepages * 512;
+
+/// The memory that allocate-until-failure tests may reserve. Without a bound,
+/// the lazily-faulted 4 KB fallback lets them grow until the address space or
+/// allocator metadata runs out.
+static const size_t kSystemMemory =
+    erpc::round_up(erpc::HugeAlloc::region_granule(), kSystemHugepages * MB(2));
 
 #define DUMMY_MR_PTR (reinterpret_cast<void *>(0x3185))
 #define DUMMY_LKEY (3186)
@@ -34,8 +42,9 @@ typename Transport::dereg_mr_func_t dereg_mr_func =
 /// Measure performance of 4k-page allocation
 TEST(HugeAllocTest, PageAllocPerf) {
   // Reserve all memory for high perf
-  erpc::HugeAlloc *alloc = new erpc::HugeAlloc(
-      kSystemHugepages * erpc::kHugepageSize, 0, reg_mr_func, dereg_mr_func);
+  erpc::HugeAlloc *alloc =
+      new erpc::HugeAlloc(kSystemMemory, 0, reg_mr_func, dereg_mr_func);
+  alloc->set_watermarks(0, kSystemMemory);
 
   size_t num_pages_allocated = 0;
   struct timespec start, end;
@@ -58,7 +67,7 @@ TEST(HugeAllocTest, PageAllocPerf) {
       "Time per page allocation = %.2f ns. "
       "Fraction of pages allocated = %.2f (best = 1.0)\n",
       nanoseconds / num_pages_allocated,
-      1.0 * num_pages_allocated / kSystem4KPages);
+      1.0 * num_pages_allocated / (kSystemMemory / KB(4)));
 
   delete alloc;
 }
@@ -110,6 +119,7 @@ TEST(HugeAllocTest, 2MBChunksMultiRun) {
 TEST(HugeAllocTest, VarMBChunksSingleRun) {
   erpc::HugeAlloc *alloc =
       new erpc::HugeAlloc(1024, 0, reg_mr_func, dereg_mr_func);
+  alloc->set_watermarks(0, kSystemMemory);
 
   for (size_t i = 0; i < 10; i++) {
     size_t app_memory = 0;
@@ -119,7 +129,7 @@ TEST(HugeAllocTest, VarMBChunksSingleRun) {
 
     while (true) {
       size_t num_hugepages = 1ul + static_cast<unsigned>(std::rand() % 4);
-      size_t size = num_hugepages * erpc::kHugepageSize;
+      size_t size = num_hugepages * MB(2);
       erpc::Buffer buffer = alloc->alloc(size);
 
       if (buffer.buf == nullptr) {
@@ -127,7 +137,7 @@ TEST(HugeAllocTest, VarMBChunksSingleRun) {
             "Fraction of system memory reserved by alloc at "
             "failure = %.2f (best = 1.0)\n",
             1.0 * alloc->get_stat_shm_reserved() /
-                (kSystemHugepages * erpc::kHugepageSize));
+                kSystemMemory);
 
         test_printf(
             "Fraction of memory reserved allocated to user = %.2f "
@@ -137,7 +147,7 @@ TEST(HugeAllocTest, VarMBChunksSingleRun) {
         break;
       } else {
         EXPECT_EQ(buffer.lkey, DUMMY_LKEY);
-        app_memory += (num_hugepages * erpc::kHugepageSize);
+        app_memory += (num_hugepages * MB(2));
         buffer_vec.push_back(buffer);
       }
     }
@@ -158,6 +168,7 @@ TEST(HugeAllocTest, VarMBChunksSingleRun) {
 TEST(HugeAllocTest, MixedPageHugepageSingleRun) {
   erpc::HugeAlloc *alloc;
   alloc = new erpc::HugeAlloc(1024, 0, reg_mr_func, dereg_mr_func);
+  alloc->set_watermarks(0, kSystemMemory);
 
   size_t app_memory = 0;
 
@@ -168,8 +179,8 @@ TEST(HugeAllocTest, MixedPageHugepageSingleRun) {
 
     if (alloc_hugepages) {
       size_t num_hugepages = 1ul + static_cast<unsigned>(std::rand() % 4);
-      buffer = alloc->alloc(num_hugepages * erpc::kHugepageSize);
-      new_app_memory = (num_hugepages * erpc::kHugepageSize);
+      buffer = alloc->alloc(num_hugepages * MB(2));
+      new_app_memory = (num_hugepages * MB(2));
     } else {
       buffer = alloc->alloc(KB(4));
       new_app_memory = KB(4);
@@ -180,7 +191,7 @@ TEST(HugeAllocTest, MixedPageHugepageSingleRun) {
           "Fraction of system memory reserved by alloc at "
           "failure = %.2f\n",
           1.0 * alloc->get_stat_shm_reserved() /
-              (kSystemHugepages * erpc::kHugepageSize));
+              kSystemMemory);
 
       test_printf("Fraction of memory reserved allocated to user = %.2f\n",
                   (1.0 * app_memory / alloc->get_stat_shm_reserved()));
@@ -220,6 +231,303 @@ TEST(HugeAllocTest, RawAlloc) {
   ASSERT_EQ(buffer.buf, nullptr);
 }
 
+/// Free all minimum-class Buffers of a region in random order, and check that
+/// they coalesce back into the original max-class Buffers
+TEST(HugeAllocTest, BuddyCoalescing) {
+  auto *alloc = new erpc::HugeAlloc(erpc::HugeAlloc::kMaxClassSize, 0,
+                                    reg_mr_func, dereg_mr_func);
+  erpc::Buffer first = alloc->alloc(erpc::HugeAlloc::kMinClassSize);
+  ASSERT_NE(first.buf, nullptr);
+  alloc->free_buf(first);
+
+  const size_t max_class = erpc::HugeAlloc::kNumClasses - 1;
+  const size_t num_max_blocks = alloc->get_stat_free_blocks(max_class);
+  ASSERT_EQ(alloc->get_stat_free_bytes(),
+            num_max_blocks * erpc::HugeAlloc::kMaxClassSize);
+  ASSERT_EQ(alloc->get_stat_fragmentation(), 0.0);
+
+  // Allocate every free byte as minimum-class Buffers without growing
+  const size_t num_bufs = alloc->get_stat_free_bytes() /
+                          erpc::HugeAlloc::kMinClassSize;
+  std::vector<erpc::Buffer> buffers;
+  for (size_t i = 0; i < num_bufs; i++) {
+    buffers.push_back(alloc->alloc(erpc::HugeAlloc::kMinClassSize));
+    ASSERT_NE(buffers.back().buf, nullptr);
+  }
+  ASSERT_EQ(alloc->get_stat_free_bytes(), 0);
+
+  // Free half, and check that fragmentation is visible
+  std::mt19937 rng(3185);
+  std::shuffle(buffers.begin(), buffers.end(), rng);
+  for (size_t i = 0; i < num_bufs / 2; i++) alloc->free_buf(buffers[i]);
+  ASSERT_GT(alloc->get_stat_fragmentation(), 0.0);
+
+  for (size_t i = num_bufs / 2; i < num_bufs; i++) alloc->free_buf(buffers[i]);
+  ASSERT_EQ(alloc->get_stat_free_blocks(max_class), num_max_blocks);
+  ASSERT_EQ(alloc->get_stat_fragmentation(), 0.0);
+  ASSERT_EQ(alloc->get_stat_user_alloc_tot(), 0);
+
+  // A max-class allocation now succeeds from the coalesced region
+  erpc::Buffer big = alloc->alloc(erpc::HugeAlloc::kMaxClassSize);
+  ASSERT_NE(big.buf, nullptr);
+  ASSERT_EQ(alloc->get_stat_free_blocks(max_class), num_max_blocks - 1);
+
+  delete alloc;
+}
+
+/// Check that growth respects the high watermark, and that free regions above
+/// the low watermark are reclaimed
+TEST(HugeAllocTest, WatermarksAndReclaim) {
+  const size_t kMaxClassSize = erpc::HugeAlloc::kMaxClassSize;
+  const size_t granule = erpc::HugeAlloc::region_granule();
+  auto *alloc =
+      new erpc::HugeAlloc(kMaxClassSize, 0, reg_mr_func, dereg_mr_func);
+  alloc->set_watermarks(granule, granule * 3);
+
+  std::vector<erpc::Buffer> buffers;
+  while (true) {
+    erpc::Buffer buffer = alloc->alloc(kMaxClassSize);
+    if (buffer.buf == nullptr) break;
+    buffers.push_back(buffer);
+  }
+  ASSERT_EQ(alloc->get_stat_shm_reserved(), granule * 3);
+  ASSERT_EQ(buffers.size() * kMaxClassSize, alloc->get_stat_shm_reserved());
+
+  // Nothing is free, so nothing can be reclaimed
+  ASSERT_EQ(alloc->reclaim(), 0);
+
+  for (erpc::Buffer &buffer : buffers) alloc->free_buf(buffer);
+  const size_t reserved = alloc->get_stat_shm_reserved();
+  size_t released = alloc->reclaim();
+  ASSERT_GT(released, 0);
+  ASSERT_EQ(alloc->get_stat_shm_reserved(), reserved - released);
+  ASSERT_GE(alloc->get_stat_shm_reserved(), granule);
+  ASSERT_EQ(alloc->get_stat_free_bytes(), alloc->get_stat_shm_reserved());
+
+  // The allocator can grow again after reclaiming
+  erpc::Buffer buffer = alloc->alloc(erpc::HugeAlloc::kMinClassSize);
+  ASSERT_NE(buffer.buf, nullptr);
+  alloc->free_buf(buffer);
+
+  delete alloc;
+}
+
+/// Check that freeing Buffers outside the allocator's regions is caught,
+/// including Buffers of reclaimed regions
+TEST(HugeAllocTest, ForeignBuffers) {
+  const size_t kMinClassSize = erpc::HugeAlloc::kMinClassSize;
+  auto *alloc = new erpc::HugeAlloc(erpc::HugeAlloc::kMaxClassSize, 0,
+                                    reg_mr_func, dereg_mr_func);
+  alloc->set_watermarks(0, SIZE_MAX);
+
+  // Buffers from two regions
+  std::vector<erpc::Buffer> buffers;
+  while (alloc->get_stat_shm_reserved() <= erpc::HugeAlloc::region_granule()) {
+    buffers.push_back(alloc->alloc(erpc::HugeAlloc::kMaxClassSize));
+    ASSERT_NE(buffers.back().buf, nullptr);
+  }
+  for (erpc::Buffer &buffer : buffers) alloc->free_buf(buffer);
+
+  std::vector<uint8_t> heap(kMinClassSize);
+  ASSERT_THROW(
+      alloc->free_buf(erpc::Buffer(heap.data(), kMinClassSize, DUMMY_LKEY)),
+      std::runtime_error);
+
+  ASSERT_GT(alloc->reclaim(), 0);
+  ASSERT_EQ(alloc->get_stat_shm_reserved(), 0);
+  for (erpc::Buffer &buffer : buffers) {
+    ASSERT_THROW(alloc->free_buf(erpc::Buffer(buffer.buf, kMinClassSize,
+                                              DUMMY_LKEY)),
+                 std::runtime_error);
+  }
+
+  delete alloc;
+}
+
+/// Check that a pinned budget is never grown or reclaimed
+TEST(HugeAllocTest, PinnedBudget) {
+  const size_t kMaxClassSize = erpc::HugeAlloc::kMaxClassSize;
+  const size_t granule = erpc::HugeAlloc::region_granule();
+  auto *alloc =
+      new erpc::HugeAlloc(kMaxClassSize, 0, reg_mr_func, dereg_mr_func);
+
+  // A budget above the high watermark is refused
+  alloc->set_watermarks(0, granule);
+  ASSERT_FALSE(alloc->reserve_pinned(granule + 1));
+  ASSERT_EQ(alloc->get_stat_shm_reserved(), 0);
+
+  // The budget is rounded up to whole granules
+  ASSERT_TRUE(alloc->reserve_pinned(granule - 1));
+  alloc->set_watermarks(0, SIZE_MAX);
+
+  std::vector<erpc::Buffer> buffers;
+  for (size_t i = 0; i < granule / kMaxClassSize; i++) {
+    buffers.push_back(alloc->alloc(kMaxClassSize));
+    ASSERT_NE(buffers.back().buf, nullptr);
+  }
+  ASSERT_EQ(alloc->alloc(erpc::HugeAlloc::kMinClassSize).buf, nullptr);
+  ASSERT_EQ(alloc->get_stat_shm_reserved(), granule);
+
+  for (erpc::Buffer &buffer : buffers) alloc->free_buf(buffer);
+  ASSERT_EQ(alloc->reclaim(), 0);
+  ASSERT_EQ(alloc->get_stat_shm_reserved(), granule);
+
+  delete alloc;
+}
+
+/// Check that allocators sharing an arena cache Buffers in magazines, and
+/// return them to the arena in batches
+TEST(HugeAllocTest, SharedArenaMagazines) {
+  auto *arena = new erpc::HugeArena(0, reg_mr_func, dereg_mr_func);
+  auto *alloc_0 = new erpc::HugeAlloc(erpc::HugeAlloc::kMaxClassSize, 0,
+                                      reg_mr_func, dereg_mr_func);
+  auto *alloc_1 = new erpc::HugeAlloc(erpc::HugeAlloc::kMaxClassSize, 0,
+                                      reg_mr_func, dereg_mr_func);
+  alloc_0->set_arena(arena);
+  alloc_1->set_arena(arena);
+
+  // The first allocation refills a whole magazine from the arena
+  erpc::Buffer buf_0 = alloc_0->alloc(KB(1));
+  erpc::Buffer buf_1 = alloc_1->alloc(KB(1));
+  ASSERT_NE(buf_0.buf, nullptr);
+  ASSERT_NE(buf_1.buf, nullptr);
+  ASSERT_EQ(buf_0.lkey, DUMMY_LKEY);
+  ASSERT_EQ(alloc_0->get_stat_user_alloc_tot(), KB(1));
+  ASSERT_EQ(arena->get_stat_user_alloc_tot(),
+            2 * erpc::HugeAlloc::kMagazineBatch * KB(1));
+
+  // Allocators don't reserve hugepages for class allocations
+  ASSERT_EQ(alloc_0->get_stat_shm_reserved(), 0);
+  ASSERT_EQ(alloc_1->get_stat_shm_reserved(), 0);
+
+  // Frees are cached in the magazine, not returned to the arena
+  alloc_0->free_buf(buf_0);
+  alloc_1->free_buf(buf_1);
+  ASSERT_EQ(alloc_1->get_stat_user_alloc_tot(), 0);
+  ASSERT_EQ(arena->get_stat_user_alloc_tot(),
+            2 * erpc::HugeAlloc::kMagazineBatch * KB(1));
+
+  // Overflowing a magazine drains a batch to the arena
+  std::vector<erpc::Buffer> buffers;
+  for (size_t i = 0; i < 4 * erpc::HugeAlloc::kMagazineBatch; i++) {
+    buffers.push_back(alloc_0->alloc(KB(1)));
+  }
+  for (erpc::Buffer &buffer : buffers) alloc_0->free_buf(buffer);
+  ASSERT_LE(arena->get_stat_user_alloc_tot(),
+            3 * erpc::HugeAlloc::kMagazineBatch * KB(1));
+
+  // Deleting the allocators returns all cached Buffers to the arena
+  delete alloc_0;
+  delete alloc_1;
+  ASSERT_EQ(arena->get_stat_user_alloc_tot(), 0);
+  delete arena;
+}
+
+/// Reserve a region large enough to be pre-faulted in parallel
+TEST(HugeAllocTest, ParallelPrefault) {
+  const size_t size = erpc::HugeAlloc::kParallelPrefaultSize * 2;
+  auto *alloc = new erpc::HugeAlloc(1024, 0, nullptr, nullptr);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_REALTIME, &start);
+  Buffer buffer = alloc->alloc_raw(size, DoRegister::kFalse);
+  clock_gettime(CLOCK_REALTIME, &end);
+  ASSERT_NE(buffer.buf, nullptr);
+  ASSERT_EQ(alloc->get_stat_shm_reserved(),
+            erpc::round_up(erpc::kHugepageSize, size));
+  test_printf("Reserved %zu MB in %.2f ms\n", size / MB(1),
+              (end.tv_sec - start.tv_sec) * 1000.0 +
+                  (end.tv_nsec - start.tv_nsec) / 1000000.0);
+
+  // The region is bound to the allocator's NUMA node before pre-faulting
+  int mode;
+  unsigned long nodemask = 0;
+  ASSERT_EQ(get_mempolicy(&mode, &nodemask, 8 * sizeof(nodemask), buffer.buf,
+                          MPOL_F_ADDR),
+            0);
+  ASSERT_EQ(mode, MPOL_BIND);
+  ASSERT_EQ(nodemask, 1ul << alloc->get_numa_node());
+
+  // Pre-faulting must preserve the zero-filled contents
+  for (size_t i = 0; i < size; i += MB(1)) ASSERT_EQ(buffer.buf[i], 0);
+  delete alloc;
+}
+
+/// Force the 4 KB page backing and check that it's reported
+TEST(HugeAllocTest, NoHugepagesFallback) {
+  setenv("ERPC_NO_HUGEPAGES", "1", 1);
+  auto *alloc = new erpc::HugeAlloc(erpc::HugeAlloc::kMaxClassSize, 0,
+                                    reg_mr_func, dereg_mr_func);
+  unsetenv("ERPC_NO_HUGEPAGES");
+
+  erpc::Buffer buffer = alloc->alloc(KB(4));
+  ASSERT_NE(buffer.buf, nullptr);
+  ASSERT_EQ(buffer.lkey, DUMMY_LKEY);  // Fallback memory is registered too
+  ASSERT_EQ(reinterpret_cast<size_t>(buffer.buf) % MB(2), 0);  // THP-aligned
+
+  ASSERT_EQ(alloc->get_stat_fallback_bytes(), alloc->get_stat_shm_reserved());
+  ASSERT_DOUBLE_EQ(alloc->get_stat_tlb_reach_loss(),
+                   1.0 * erpc::kHugepageSize / KB(4));
+  delete alloc;
+}
+
+TEST(HugeAllocTest, PersistentRegions) {
+  // HugeAlloc handles persistent region files the same way on any filesystem.
+  // The Nexus requires hugetlbfs, but tmpfs is enough to test warm reuse.
+  // Regions are whole hugepages and are faulted in, so keep them small.
+  if (erpc::kHugepageSize != MB(2)) {
+    GTEST_SKIP() << "Needs Hugepagesize=2097152";
+  }
+  const std::string prefix =
+      "/dev/shm/erpc_huge_alloc_test_" + std::to_string(getpid()) + "_";
+  const size_t size = erpc::kHugepageSize * 4;
+
+  auto *alloc = new erpc::HugeAlloc(1024, 0, nullptr, nullptr);
+  alloc->set_persistent(prefix);
+  erpc::Buffer buffer = alloc->alloc_raw(size, erpc::DoRegister::kFalse);
+  ASSERT_NE(buffer.buf, nullptr);
+  ASSERT_EQ(alloc->get_stat_warm_bytes(), 0);  // Cold: the file was new
+  for (size_t i = 0; i < size; i += KB(4)) buffer.buf[i] = i / KB(4) % 251;
+  delete alloc;  // Keeps the file
+
+  // A successor with the same prefix maps the same memory
+  alloc = new erpc::HugeAlloc(1024, 0, nullptr, nullptr);
+  alloc->set_persistent(prefix);
+  buffer = alloc->alloc_raw(size, erpc::DoRegister::kFalse);
+  ASSERT_NE(buffer.buf, nullptr);
+  ASSERT_EQ(alloc->get_stat_warm_bytes(), size);
+  for (size_t i = 0; i < size; i += KB(4)) {
+    ASSERT_EQ(buffer.buf[i], i / KB(4) % 251);
+  }
+
+  // Files beyond those a successor reused are deleted with the successor
+  erpc::Buffer extra = alloc->alloc_raw(size, erpc::DoRegister::kFalse);
+  ASSERT_NE(extra.buf, nullptr);
+  delete alloc;
+  ASSERT_EQ(access((prefix + "1").c_str(), F_OK), 0);
+
+  alloc = new erpc::HugeAlloc(1024, 0, nullptr, nullptr);
+  alloc->set_persistent(prefix);
+  buffer = alloc->alloc_raw(size, erpc::DoRegister::kFalse);
+  ASSERT_EQ(alloc->get_stat_warm_bytes(), size);
+  delete alloc;
+  ASSERT_EQ(access((prefix + "0").c_str(), F_OK), 0);
+  ASSERT_NE(access((prefix + "1").c_str(), F_OK), 0);
+  unlink((prefix + "0").c_str());
+
+  // Reclaiming a region deletes its file
+  alloc = new erpc::HugeAlloc(1024, 0, reg_mr_func, dereg_mr_func);
+  alloc->set_persistent(prefix);
+  alloc->set_watermarks(0, SIZE_MAX);
+  buffer = alloc->alloc(erpc::HugeAlloc::kMaxClassSize);
+  ASSERT_NE(buffer.buf, nullptr);
+  ASSERT_EQ(access((prefix + "0").c_str(), F_OK), 0);
+  alloc->free_buf(buffer);
+  ASSERT_GT(alloc->reclaim(), 0);
+  ASSERT_NE(access((prefix + "0").c_str(), F_OK), 0);
+  delete alloc;
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include <limits.h>
+#include "pkthdr.h"
 #include "util/math_utils.h"
 
 // Misc tests
@@ -15,6 +16,22 @@ TEST(StdDevTest, All) {
   // ASSERT_DOUBLE_EQ(erpc::stddev(vec), 0.47140452079103);
 }
 
+// The batched RX path reads these header bytes directly
+TEST(PktHdrTest, EhdrByteOffsets) {
+  uint8_t buf[sizeof(erpc::pkthdr_t)];
+  memset(buf, 0, sizeof(buf));
+  auto *pkthdr = reinterpret_cast<erpc::pkthdr_t *>(buf);
+  const uint8_t *ehdr = pkthdr->ehdrptr();
+
+  pkthdr->magic = erpc::kPktHdrMagic;
+  ASSERT_EQ(ehdr[erpc::kEhdrMagicByte] >> 4, erpc::kPktHdrMagic);
+
+  for (uint64_t t = 0; t < 4; t++) {
+    pkthdr->pkt_type = t;
+    ASSERT_EQ(ehdr[erpc::kEhdrPktTypeByte] & 0x3, t);
+  }
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
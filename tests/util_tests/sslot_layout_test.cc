@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "util/test_printf.h"
+
+#define private public
+#include "session.h"
+
+using namespace erpc;
+
+// Layout checks. offsetof() is conditionally-supported for these classes, but
+// GCC and Clang support it.
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+
+/// Return the index of the cache line containing a member at \p offset
+static constexpr size_t line(size_t offset) { return offset / 64; }
+
+// Each sslot starts on a cache line
+static_assert(alignof(SSlot) == 64, "");
+static_assert(sizeof(SSlot) % 64 == 0, "");
+static_assert(offsetof(Session, sslot_arr) % 64 == 0, "");
+
+// Fields that a client accesses for every response packet share line 0
+static_assert(line(offsetof(SSlot, session)) == 0, "");
+static_assert(line(offsetof(SSlot, tx_msgbuf)) == 0, "");
+static_assert(line(offsetof(SSlot, cur_req_num)) == 0, "");
+static_assert(line(offsetof(SSlot, index)) == 0, "");
+static_assert(line(offsetof(SSlot, client_info.num_tx)) == 0, "");
+static_assert(line(offsetof(SSlot, client_info.num_rx)) == 0, "");
+static_assert(line(offsetof(SSlot, client_info.resp_msgbuf)) == 0, "");
+static_assert(line(offsetof(SSlot, client_info.progress_tsc) +
+                   sizeof(size_t) - 1) == 0,
+              "");
+
+// Fields that a client accesses once per request share line 1
+static_assert(line(offsetof(SSlot, client_info.cont_func)) == 1, "");
+static_assert(line(offsetof(SSlot, client_info.tag)) == 1, "");
+static_assert(line(offsetof(SSlot, client_info.cont_etid)) == 1, "");
+static_assert(line(offsetof(SSlot, client_info.comp_queue)) == 1, "");
+static_assert(line(offsetof(SSlot, client_info.prev)) == 1, "");
+static_assert(line(offsetof(SSlot, client_info.next) + sizeof(SSlot *) - 1) ==
+                  1,
+              "");
+
+// Fields that a server accesses for every request packet share line 0
+static_assert(line(offsetof(SSlot, server_info.num_rx)) == 0, "");
+static_assert(line(offsetof(SSlot, server_info.req_type)) == 0, "");
+static_assert(line(offsetof(SSlot, server_info.sav_num_req_pkts)) == 0, "");
+
+// Server-only response buffers and CC state are after the hot lines
+static_assert(offsetof(SSlot, client_info.in_wheel) >= 64, "");
+static_assert(offsetof(SSlot, pre_resp_msgbuf) >= 128, "");
+
+// Per-packet session state shares the line after the sslots
+static constexpr size_t kSessionHotLine =
+    line(offsetof(Session, sslot_arr) + sizeof(Session::sslot_arr));
+static_assert(line(offsetof(Session, state)) == kSessionHotLine, "");
+static_assert(line(offsetof(Session, remote_routing_info)) == kSessionHotLine,
+              "");
+static_assert(line(offsetof(Session, client_info.credits)) == kSessionHotLine,
+              "");
+static_assert(line(offsetof(Session, client_info.sslot_free_vec)) ==
+                  kSessionHotLine,
+              "");
+static_assert(offsetof(Session, client_info.cc) >
+                  offsetof(Session, client_info.enq_req_backlog),
+              "");
+static_assert(offsetof(Session, client) > offsetof(Session, client_info), "");
+
+/// Cache lines that a client touches to receive a single-packet response:
+/// sslot lines 0 and 1, the session's hot line, and the request backlog. The
+/// CC state adds sslot line 2 for RTT timestamps.
+static constexpr size_t kRxCacheLines = 4 + (kCcRTT ? 1 : 0);
+
+/// Touch the session and sslot fields that a client accesses to receive a
+/// single-packet response, like the RX path and process_resp_one_st(). Return
+/// the cache-line-aligned addresses touched.
+static std::set<uintptr_t> rx_one_resp(Session *session, SSlot *sslot,
+                                       size_t pkt_num, size_t rx_tsc) {
+  std::set<uintptr_t> lines;
+  auto touch = [&lines](const volatile void *p) {
+    lines.insert(reinterpret_cast<uintptr_t>(p) / 64);
+  };
+
+  // RX path
+  touch(&session->state);
+  touch(&sslot->cur_req_num);
+
+  // in_order_client()
+  auto &ci = sslot->client_info;
+  touch(&ci.num_rx);
+  touch(&ci.num_tx);
+  if (kCcPacing) touch(&ci.in_wheel[pkt_num % kSessionCredits]);
+  if (kCcRTT) touch(&ci.tx_ts[pkt_num % kSessionCredits]);
+
+  // Bump credits and update progress
+  session->client_info.credits++;
+  touch(&session->client_info.credits);
+  ci.num_rx++;
+  ci.progress_tsc = rx_tsc;
+  touch(&ci.progress_tsc);
+  touch(&ci.resp_msgbuf);
+
+  // Complete the request
+  sslot->tx_msgbuf = nullptr;
+  touch(&sslot->tx_msgbuf);
+  touch(&ci.prev);
+  touch(&ci.next);
+  touch(&ci.cont_func);
+  touch(&ci.comp_queue);
+  touch(&ci.tag);
+  touch(&ci.cont_etid);
+  touch(&sslot->session);
+  touch(&sslot->index);
+  touch(&session->client_info.sslot_free_vec);
+  touch(&session->client_info.enq_req_backlog);
+  return lines;
+}
+
+/// Count the cache lines touched per received response packet, from the
+/// field addresses alone
+TEST(SSlotLayoutTest, RxCacheLines) {
+  auto *session = new Session(Session::Role::kClient, 0, 3.0, 1.0);
+
+  for (size_t i = 0; i < kSessionReqWindow; i++) {
+    for (size_t pkt_num = 0; pkt_num < kSessionCredits; pkt_num++) {
+      std::set<uintptr_t> lines =
+          rx_one_resp(session, &session->sslot_arr[i], pkt_num, 0);
+      ASSERT_LE(lines.size(), kRxCacheLines);
+    }
+  }
+
+  test_printf("sizeof(SSlot) = %zu, sizeof(Session) = %zu\n", sizeof(SSlot),
+              sizeof(Session));
+  delete session;
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
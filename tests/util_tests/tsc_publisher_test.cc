@@ -0,0 +1,37 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include "util/tsc_publisher.h"
+
+using namespace erpc;
+
+/// The published TSC never goes backwards, and advances over time
+TEST(TscPublisherTest, Monotonic) {
+  TscPublisher tsc_publisher(true);
+  const size_t start_tsc = published_tsc.load();
+  ASSERT_GT(start_tsc, 0);  // Published before the constructor returns
+
+  size_t prev_tsc = start_tsc;
+  for (size_t i = 0; i < 1000000; i++) {
+    const size_t cur_tsc = published_tsc.load(std::memory_order_relaxed);
+    ASSERT_GE(cur_tsc, prev_tsc);
+    prev_tsc = cur_tsc;
+  }
+
+  usleep(1000);
+  ASSERT_GT(published_tsc.load(), start_tsc);
+}
+
+/// A stopped or disabled publisher leaves the published TSC alone
+TEST(TscPublisherTest, Stop) {
+  { TscPublisher tsc_publisher(true); }
+  const size_t stopped_tsc = published_tsc.load();
+
+  TscPublisher disabled_publisher(false);
+  usleep(1000);
+  ASSERT_EQ(published_tsc.load(), stopped_tsc);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}